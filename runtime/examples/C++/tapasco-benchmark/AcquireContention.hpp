@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file       AcquireContention.hpp
+ *  @brief      Measures PE acquisition under contention: many host threads
+ *              launch jobs on few Counter PEs. Reports the time spent in
+ *              acquire_pe, the host CPU time burned while waiting and how
+ *              evenly the jobs were distributed across the threads.
+ *              Run once with TAPASCO_SCHEDULER__BLOCKING=false to compare the
+ *              spinning and the blocking scheduler.
+ **/
+#ifndef ACQUIRE_CONTENTION_HPP__
+#define ACQUIRE_CONTENTION_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <tapasco.hpp>
+#include <vector>
+#include "LatencyHistogram.hpp"
+extern "C" {
+#include <sys/resource.h>
+}
+
+using namespace std;
+using namespace std::chrono;
+using namespace tapasco;
+
+class AcquireContention {
+public:
+  static tapasco_kernel_id_t const COUNTER_ID = 14;
+
+  struct result_t {
+    double jobs_per_sec;
+    double avg_wait_us;
+    double p50_wait_us;
+    double p99_wait_us;
+    double p999_wait_us;
+    double max_wait_us;
+    double cpu_cores;
+    double fairness;
+  };
+
+  AcquireContention(Tapasco &tapasco, bool fast)
+      : tapasco(tapasco), fast(fast) {
+    if (tapasco.kernel_pe_count(COUNTER_ID) < 1)
+      throw "need at least one instance of 'Counter' (14) in bitstream";
+  }
+  virtual ~AcquireContention() {}
+
+  result_t operator()(size_t const num_threads,
+                      uint32_t const clock_cycles = 1000) {
+    vector<LatencyHistogram> waits(num_threads);
+    vector<future<void>> threads;
+    stop = false;
+
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    auto const t_start = high_resolution_clock::now();
+    for (size_t t = 0; t < num_threads; ++t)
+      threads.push_back(async(launch::async, [&, t]() {
+        run(waits[t], clock_cycles);
+      }));
+    usleep(fast ? 1000000 : 5000000);
+    stop = true;
+    for (auto &f : threads)
+      f.wait();
+    auto const t_end = high_resolution_clock::now();
+    getrusage(RUSAGE_SELF, &ru_end);
+
+    double const wall = duration<double>(t_end - t_start).count();
+    double const cpu = tv(ru_end.ru_utime) - tv(ru_start.ru_utime) +
+                       tv(ru_end.ru_stime) - tv(ru_start.ru_stime);
+
+    LatencyHistogram all;
+    size_t min_jobs = SIZE_MAX, max_jobs = 0;
+    for (auto const &w : waits) {
+      all.merge(w);
+      min_jobs = std::min(min_jobs, w.size());
+      max_jobs = std::max(max_jobs, w.size());
+    }
+
+    result_t r{0, 0, 0, 0, 0, 0, 0, 0};
+    if (all.size()) {
+      LatencyHistogram::summary_t const s = all.summary();
+      r.jobs_per_sec = s.count / wall;
+      r.avg_wait_us = s.avg;
+      r.p50_wait_us = s.p50;
+      r.p99_wait_us = s.p99;
+      r.p999_wait_us = s.p999;
+      r.max_wait_us = s.max;
+      r.fairness = static_cast<double>(min_jobs) / max_jobs;
+    }
+    r.cpu_cores = cpu / wall;
+
+    std::ios_base::fmtflags coutf(cout.flags());
+    std::cout << "Num threads: " << std::dec << std::setw(4) << num_threads
+              << ", Jobs/Second: " << std::fixed << std::setw(9)
+              << std::setprecision(2) << r.jobs_per_sec
+              << ", Wait avg/p50/p99/p99.9/max (us): " << r.avg_wait_us
+              << "/" << r.p50_wait_us << "/" << r.p99_wait_us << "/"
+              << r.p999_wait_us << "/" << r.max_wait_us
+              << ", CPU cores: " << r.cpu_cores
+              << ", Fairness (min/max jobs): " << r.fairness << std::endl;
+    cout.flags(coutf);
+
+    return r;
+  }
+
+private:
+  static double tv(struct timeval const &t) {
+    return t.tv_sec + t.tv_usec / 1000000.0;
+  }
+
+  void run(LatencyHistogram &waits, uint32_t const clock_cycles) {
+    TapascoDevice &device = tapasco.device();
+    while (!stop) {
+      // only the acquisition is timed, argument setup and the start are not
+      auto const t_start = high_resolution_clock::now();
+      Job *j = device.acquire_pe(COUNTER_ID);
+      auto const t_acquired = high_resolution_clock::now();
+      waits.add(duration<double, std::micro>(t_acquired - t_start).count());
+
+      JobArgumentList a(device.get_device());
+      a.single32(clock_cycles);
+      if (tapasco_job_start(j, a.list()) < 0 ||
+          tapasco_job_release(j, 0, true) < 0)
+        handle_error();
+    }
+  }
+
+  Tapasco &tapasco;
+  atomic<bool> stop{false};
+  bool fast;
+};
+
+#endif /* ACQUIRE_CONTENTION_HPP__ */
+/* vim: set foldmarker=@{,@} foldlevel=0 foldmethod=marker : */
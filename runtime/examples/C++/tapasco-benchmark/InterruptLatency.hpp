@@ -39,6 +39,7 @@
 #include <thread>
 #include <unistd.h>
 #include <vector>
+#include "LatencyHistogram.hpp"
 
 using namespace std;
 using namespace std::chrono;
@@ -110,6 +111,32 @@ public:
     return cavg();
   }
 
+  /**
+   * Runs a fixed number of jobs of clock_cycles one after the other.
+   * @return Software overhead of each job in us.
+   **/
+  LatencyHistogram histogram(uint32_t const clock_cycles, size_t const runs) {
+    LatencyHistogram h;
+    tapasco.launch(COUNTER_ID, clock_cycles)(); // warm up
+    for (size_t i = 0; i < runs; ++i) {
+      auto const tstart = high_resolution_clock::now();
+      tapasco.launch(COUNTER_ID, clock_cycles)();
+      duration<double, std::micro> const d =
+          high_resolution_clock::now() - tstart;
+      h.add(d.count() - static_cast<double>(clock_cycles) / design_clk);
+    }
+
+    LatencyHistogram::summary_t const s = h.summary();
+    std::ios_base::fmtflags coutf(cout.flags());
+    std::cout << "Runtime: " << std::dec << std::setw(10) << clock_cycles
+              << " cc, Latency p50/p99/p99.9/max (us): " << std::fixed
+              << std::setprecision(2) << s.p50 << "/" << s.p99 << "/"
+              << s.p999 << "/" << s.max << ", Samples: " << s.count
+              << std::endl;
+    cout.flags(coutf);
+    return h;
+  }
+
 private:
   void trigger(volatile atomic<bool> &stop, uint32_t const clock_cycles,
                CumulativeAverage<double> &cavg) {
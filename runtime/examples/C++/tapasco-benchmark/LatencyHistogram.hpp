@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file       LatencyHistogram.hpp
+ *  @brief      Collects latency samples (in us) and reports percentiles and
+ *              a histogram with one bucket per power of two. Each thread
+ *              should record into its own instance; merge them afterwards.
+ **/
+#ifndef LATENCY_HISTOGRAM_HPP__
+#define LATENCY_HISTOGRAM_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+class LatencyHistogram {
+public:
+  struct summary_t {
+    size_t count;
+    double min;
+    double avg;
+    double p50;
+    double p99;
+    double p999;
+    double max;
+  };
+
+  void add(double const us) {
+    samples.push_back(us);
+    sorted = false;
+  }
+
+  void merge(LatencyHistogram const &o) {
+    samples.insert(samples.end(), o.samples.begin(), o.samples.end());
+    sorted = false;
+  }
+
+  size_t size() const { return samples.size(); }
+
+  /** @return Sample at percentile p (0 - 100), nearest-rank method. **/
+  double percentile(double const p) const {
+    if (samples.empty())
+      return 0.0;
+    sort();
+    size_t const rank = static_cast<size_t>(ceil(p / 100.0 * samples.size()));
+    return samples[rank > 0 ? rank - 1 : 0];
+  }
+
+  summary_t summary() const {
+    summary_t s{samples.size(), 0, 0, 0, 0, 0, 0};
+    if (samples.empty())
+      return s;
+    double sum = 0.0;
+    for (auto const v : samples)
+      sum += v;
+    sort();
+    s.min = samples.front();
+    s.avg = sum / samples.size();
+    s.p50 = percentile(50.0);
+    s.p99 = percentile(99.0);
+    s.p999 = percentile(99.9);
+    s.max = samples.back();
+    return s;
+  }
+
+  /**
+   * @return Pairs of (upper bound in us, count) for the non-empty buckets;
+   *         bucket i counts the samples in [2^(i-1), 2^i) us, bucket 0 all
+   *         samples below 1 us.
+   **/
+  std::vector<std::pair<double, size_t>> buckets() const {
+    std::vector<size_t> n;
+    for (auto const v : samples) {
+      size_t const b = v < 1.0 ? 0 : static_cast<size_t>(log2(v)) + 1;
+      if (b >= n.size())
+        n.resize(b + 1, 0);
+      ++n[b];
+    }
+    std::vector<std::pair<double, size_t>> r;
+    for (size_t b = 0; b < n.size(); ++b)
+      if (n[b])
+        r.push_back(std::make_pair(ldexp(1.0, static_cast<int>(b)), n[b]));
+    return r;
+  }
+
+private:
+  void sort() const {
+    if (!sorted)
+      std::sort(samples.begin(), samples.end());
+    sorted = true;
+  }
+
+  // sorted lazily by the const queries
+  mutable std::vector<double> samples;
+  mutable bool sorted{true};
+};
+
+#endif /* LATENCY_HISTOGRAM_HPP__ */
+/* vim: set foldmarker=@{,@} foldlevel=0 foldmethod=marker : */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file       MixedWorkload.hpp
+ *  @brief      Measures job latency under a mix of kernel runtimes and
+ *              transfer sizes. Requires counter cores (e.g.,
+ *              precision_counter); several host threads launch jobs whose
+ *              runtime and buffer argument are drawn at random from fixed
+ *              sets. The random generators are seeded per thread, so every
+ *              run issues the same sequence of jobs.
+ **/
+#ifndef MIXED_WORKLOAD_HPP__
+#define MIXED_WORKLOAD_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <tapasco.hpp>
+#include <unistd.h>
+#include <vector>
+#include "LatencyHistogram.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace tapasco;
+
+class MixedWorkload {
+public:
+  static tapasco_kernel_id_t const COUNTER_ID = 14;
+
+  struct class_t {
+    uint32_t clock_cycles;
+    size_t buffer_sz; // 0: job without buffer argument
+    LatencyHistogram latency;
+  };
+
+  struct result_t {
+    double jobs_per_sec;
+    LatencyHistogram latency; // all jobs
+    vector<class_t> classes;
+  };
+
+  MixedWorkload(Tapasco &tapasco, bool fast) : tapasco(tapasco), fast(fast) {
+    if (tapasco.kernel_pe_count(COUNTER_ID) < 1)
+      throw "need at least one instance of 'Counter' (14) in bitstream";
+  }
+  virtual ~MixedWorkload() {}
+
+  result_t operator()(size_t const num_threads) {
+    vector<vector<class_t>> per_thread(num_threads, classes());
+    vector<future<void>> threads;
+    stop = false;
+
+    auto const t_start = high_resolution_clock::now();
+    for (size_t t = 0; t < num_threads; ++t)
+      threads.push_back(
+          async(launch::async, [&, t]() { run(per_thread[t], t); }));
+    usleep(fast ? 2000000 : 10000000);
+    stop = true;
+    for (auto &f : threads)
+      f.wait();
+    double const wall =
+        duration<double>(high_resolution_clock::now() - t_start).count();
+
+    result_t r{0, LatencyHistogram(), classes()};
+    for (auto const &c : per_thread) {
+      for (size_t i = 0; i < c.size(); ++i) {
+        r.classes[i].latency.merge(c[i].latency);
+        r.latency.merge(c[i].latency);
+      }
+    }
+    r.jobs_per_sec = r.latency.size() / wall;
+
+    std::ios_base::fmtflags coutf(cout.flags());
+    for (auto &c : r.classes) {
+      LatencyHistogram::summary_t const s = c.latency.summary();
+      std::cout << "Runtime: " << std::dec << std::setw(8) << c.clock_cycles
+                << " cc, Buffer: " << std::setw(6) << c.buffer_sz / 1024
+                << " KiB, Jobs: " << std::setw(7) << s.count
+                << ", Latency p50/p99/p99.9/max (us): " << std::fixed
+                << std::setprecision(2) << s.p50 << "/" << s.p99 << "/"
+                << s.p999 << "/" << s.max << std::endl;
+      cout.flags(coutf);
+    }
+    std::cout << "Threads: " << std::dec << num_threads
+              << ", Jobs/Second: " << std::fixed << std::setprecision(2)
+              << r.jobs_per_sec << std::endl;
+    cout.flags(coutf);
+    return r;
+  }
+
+private:
+  static vector<class_t> classes() {
+    vector<class_t> c;
+    for (uint32_t const cc : {100U, 10000U, 1000000U})
+      for (size_t const sz : {0UL, 4UL << 10, 256UL << 10, 4UL << 20})
+        c.push_back(class_t{cc, sz, LatencyHistogram()});
+    return c;
+  }
+
+  void run(vector<class_t> &c, size_t const seed) {
+    mt19937 rng(static_cast<mt19937::result_type>(seed));
+    uniform_int_distribution<size_t> pick(0, c.size() - 1);
+    vector<uint8_t> b(4UL << 20);
+    while (!stop) {
+      class_t &j = c[pick(rng)];
+      auto const t_start = high_resolution_clock::now();
+      if (j.buffer_sz)
+        tapasco.launch(COUNTER_ID, j.clock_cycles,
+                       makeWrappedPointer(b.data(), j.buffer_sz))();
+      else
+        tapasco.launch(COUNTER_ID, j.clock_cycles)();
+      j.latency.add(
+          duration<double, std::micro>(high_resolution_clock::now() - t_start)
+              .count());
+    }
+  }
+
+  Tapasco &tapasco;
+  atomic<bool> stop{false};
+  bool fast;
+};
+
+#endif /* MIXED_WORKLOAD_HPP__ */
+/* vim: set foldmarker=@{,@} foldlevel=0 foldmethod=marker : */
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file       MultiBufferTransfer.hpp
+ *  @brief      Measures the transfer speed of jobs with several buffer
+ *              arguments. Requires counter cores (e.g., precision_counter);
+ *              each job passes 1 - 4 buffers to a Counter PE, which are
+ *              copied to the device before and back after the job. The PE
+ *              itself finishes after 1cc, so the job time is dominated by
+ *              the transfers of the job.
+ *              Each size is measured once with all buffers in the default
+ *              memory, transferred one after the other, and once with every
+ *              other buffer in the PE-local memory, which the runtime
+ *              transfers concurrently with the default memory once a memory
+ *              moves at least 256 KiB for the job. The latter is skipped if
+ *              the Counter PEs have no local memory or the buffers do not fit
+ *              into it.
+ **/
+#ifndef MULTI_BUFFER_TRANSFER_HPP__
+#define MULTI_BUFFER_TRANSFER_HPP__
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <tapasco.hpp>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace tapasco;
+
+class MultiBufferTransfer {
+public:
+  static tapasco_kernel_id_t const COUNTER_ID = 14;
+  static size_t const MAX_BUFFERS = 4;
+
+  struct result_t {
+    /** MiB/s with all buffers in the default memory. **/
+    double sequential;
+    /** MiB/s with every other buffer in PE-local memory, 0 if skipped. **/
+    double concurrent;
+  };
+
+  MultiBufferTransfer(Tapasco &tapasco, bool fast)
+      : tapasco(tapasco), fast(fast) {
+    if (tapasco.kernel_pe_count(COUNTER_ID) < 1)
+      throw "need at least one instance of 'Counter' (14) in bitstream";
+    local = has_local_memory();
+    if (!local)
+      cout << "Counter PEs have no local memory, skipping concurrent "
+              "multi-buffer transfers"
+           << endl;
+  }
+  virtual ~MultiBufferTransfer() {}
+
+  /**
+   * Launches jobs with num_buffers buffers of chunk_sz bytes each.
+   * @return Speed in MiB/s of the data moved by the jobs in both directions.
+   **/
+  result_t operator()(size_t const num_buffers, size_t const chunk_sz) {
+    vector<vector<uint8_t>> b(MAX_BUFFERS, vector<uint8_t>(chunk_sz));
+    result_t r{measure(num_buffers, chunk_sz, b, false), 0};
+    if (local && num_buffers > 1) {
+      try {
+        r.concurrent = measure(num_buffers, chunk_sz, b, true);
+      } catch (tapasco_error const &e) {
+        cout << "Buffers do not fit into local memory, skipping concurrent "
+                "transfers: "
+             << e.what() << endl;
+      }
+    }
+
+    std::ios_base::fmtflags coutf(cout.flags());
+    std::cout << "Buffers: " << std::dec << num_buffers
+              << ", Chunk size: " << std::fixed << std::setw(10)
+              << std::setprecision(0) << chunk_sz / 1024.0
+              << " KiB, Speed sequential/concurrent: " << std::setw(9)
+              << std::setprecision(3) << r.sequential << "/" << std::setw(9)
+              << r.concurrent << " MiB/s" << std::endl;
+    cout.flags(coutf);
+    return r;
+  }
+
+private:
+  bool has_local_memory() {
+    // the PE is returned to the scheduler on destruction
+    unique_ptr<TapascoPE> pe(tapasco.acquire_pe_without_job(COUNTER_ID));
+    try {
+      pe->get_local_memory();
+    } catch (tapasco_error const &) {
+      return false;
+    }
+    return true;
+  }
+
+  double measure(size_t const num_buffers, size_t const chunk_sz,
+                 vector<vector<uint8_t>> &b, bool const concurrent) {
+    size_t const runs = fast ? 5 : 20;
+
+    // warm up the allocator and the DMA buffers
+    launch(num_buffers, chunk_sz, b, concurrent);
+
+    auto const t_start = high_resolution_clock::now();
+    for (size_t i = 0; i < runs; ++i) {
+      launch(num_buffers, chunk_sz, b, concurrent);
+    }
+    duration<double> const d = high_resolution_clock::now() - t_start;
+    double const mib = 2.0 * runs * num_buffers * chunk_sz / (1024.0 * 1024.0);
+    return mib / d.count();
+  }
+
+  void launch(size_t const num_buffers, size_t const sz,
+              vector<vector<uint8_t>> &b, bool const concurrent) {
+    TapascoDevice &device = tapasco.device();
+    JobArgumentList a(device.get_device());
+    a.single32(1);
+    for (size_t i = 0; i < num_buffers; ++i) {
+      if (concurrent && i % 2)
+        a.set_local();
+      a.memop(b[i].data(), sz);
+    }
+    Job *j = device.acquire_pe_for(COUNTER_ID, a);
+    if (tapasco_job_start(j, a.list()) < 0 ||
+        tapasco_job_release(j, 0, true) < 0)
+      handle_error();
+  }
+
+  Tapasco &tapasco;
+  bool fast;
+  bool local;
+};
+
+#endif /* MULTI_BUFFER_TRANSFER_HPP__ */
+/* vim: set foldmarker=@{,@} foldlevel=0 foldmethod=marker : */
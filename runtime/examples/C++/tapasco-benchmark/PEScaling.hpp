@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file       PEScaling.hpp
+ *  @brief      Measures how job throughput and latency scale with the number
+ *              of PEs in use. Requires counter cores (e.g., precision_counter);
+ *              runs one host thread per PE, each launching jobs of a fixed
+ *              runtime one after the other, so at most that many Counter PEs
+ *              are busy at a time.
+ **/
+#ifndef PE_SCALING_HPP__
+#define PE_SCALING_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <tapasco.hpp>
+#include <unistd.h>
+#include <vector>
+#include "LatencyHistogram.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace tapasco;
+
+class PEScaling {
+public:
+  static tapasco_kernel_id_t const COUNTER_ID = 14;
+
+  struct result_t {
+    double jobs_per_sec;
+    double efficiency; // fraction of the time the PEs in use were busy
+    LatencyHistogram latency;
+  };
+
+  PEScaling(Tapasco &tapasco, bool fast) : tapasco(tapasco), fast(fast) {
+    if (tapasco.kernel_pe_count(COUNTER_ID) < 1)
+      throw "need at least one instance of 'Counter' (14) in bitstream";
+    design_clk = tapasco.design_frequency();
+  }
+  virtual ~PEScaling() {}
+
+  size_t max_pes() const { return tapasco.kernel_pe_count(COUNTER_ID); }
+
+  result_t operator()(size_t const num_pes,
+                      uint32_t const clock_cycles = 10000) {
+    vector<LatencyHistogram> latencies(num_pes);
+    vector<future<void>> threads;
+    stop = false;
+
+    auto const t_start = high_resolution_clock::now();
+    for (size_t t = 0; t < num_pes; ++t)
+      threads.push_back(async(launch::async, [&, t]() {
+        run(latencies[t], clock_cycles);
+      }));
+    usleep(fast ? 1000000 : 5000000);
+    stop = true;
+    for (auto &f : threads)
+      f.wait();
+    double const wall =
+        duration<double>(high_resolution_clock::now() - t_start).count();
+
+    result_t r{0, 0, LatencyHistogram()};
+    for (auto const &l : latencies)
+      r.latency.merge(l);
+    r.jobs_per_sec = r.latency.size() / wall;
+    r.efficiency =
+        r.jobs_per_sec * clock_cycles / (design_clk * 1000000.0 * num_pes);
+
+    LatencyHistogram::summary_t const s = r.latency.summary();
+    std::ios_base::fmtflags coutf(cout.flags());
+    std::cout << "PEs: " << std::dec << std::setw(3) << num_pes
+              << ", Jobs/Second: " << std::fixed << std::setw(9)
+              << std::setprecision(2) << r.jobs_per_sec
+              << ", Efficiency: " << r.efficiency
+              << ", Latency p50/p99/p99.9/max (us): " << s.p50 << "/" << s.p99
+              << "/" << s.p999 << "/" << s.max << std::endl;
+    cout.flags(coutf);
+    return r;
+  }
+
+private:
+  void run(LatencyHistogram &latency, uint32_t const clock_cycles) {
+    while (!stop) {
+      auto const t_start = high_resolution_clock::now();
+      tapasco.launch(COUNTER_ID, clock_cycles)();
+      latency.add(
+          duration<double, std::micro>(high_resolution_clock::now() - t_start)
+              .count());
+    }
+  }
+
+  Tapasco &tapasco;
+  atomic<bool> stop{false};
+  double design_clk;
+  bool fast;
+};
+
+#endif /* PE_SCALING_HPP__ */
+/* vim: set foldmarker=@{,@} foldlevel=0 foldmethod=marker : */
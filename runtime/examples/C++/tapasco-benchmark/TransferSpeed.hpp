@@ -33,6 +33,7 @@
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <tapasco.hpp>
 #include <thread>
 #include <unistd.h>
@@ -129,6 +130,43 @@ public:
     return cavg();
   }
 
+  struct fill_threads_t {
+    size_t chunk_sz;
+    size_t fill_threads;
+    double speed_w;
+  };
+
+  /**
+   * Measures the host to device speed for chunk sizes 2^min_log to
+   * 2^(max_log - 1) with the bounce buffers of a transfer filled by each of
+   * the given numbers of threads (dma.fill_threads). The setting is read when
+   * the device is opened, so every thread count opens its own device. The
+   * caller must not hold another instance.
+   **/
+  static vector<fill_threads_t> fill_threads_sweep(size_t min_log,
+                                                   size_t max_log,
+                                                   vector<size_t> const &counts,
+                                                   bool fast) {
+    char const *prev_env = getenv("TAPASCO_DMA__FILL_THREADS");
+    string const prev{prev_env ? prev_env : ""};
+    vector<fill_threads_t> r;
+    for (size_t t : counts) {
+      setenv("TAPASCO_DMA__FILL_THREADS", to_string(t).c_str(), 1);
+      std::cout << "Fill threads: " << t << std::endl;
+      Tapasco tapasco;
+      TransferSpeed tp{tapasco, fast};
+      for (size_t i = min_log; i < max_log; ++i) {
+        r.push_back({1UL << i, t, tp(1UL << i, OP_COPYTO)});
+      }
+    }
+    if (prev_env) {
+      setenv("TAPASCO_DMA__FILL_THREADS", prev.c_str(), 1);
+    } else {
+      unsetenv("TAPASCO_DMA__FILL_THREADS");
+    }
+    return r;
+  }
+
 private:
   tapasco_res_t do_read(volatile atomic<bool> &stop, size_t const chunk_sz,
                         long opmask, uint8_t *data) {
@@ -17,6 +17,7 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <fstream>
@@ -29,9 +30,14 @@
 #include <unistd.h>
 #include <vector>
 
+#include "AcquireContention.hpp"
 #include "CumulativeAverage.hpp"
 #include "InterruptLatency.hpp"
 #include "JobThroughput.hpp"
+#include "LatencyHistogram.hpp"
+#include "MixedWorkload.hpp"
+#include "MultiBufferTransfer.hpp"
+#include "PEScaling.hpp"
 #include "TransferSpeed.hpp"
 #include "json11.hpp"
 
@@ -42,9 +48,31 @@ using namespace json11;
 typedef enum {
   MEASURE_TRANSFER_SPEED = (1 << 0),
   MEASURE_INTERRUPT_LATENCY = (1 << 1),
-  MEASURE_JOB_THROUGHPUT = (1 << 2)
+  MEASURE_JOB_THROUGHPUT = (1 << 2),
+  MEASURE_ACQUIRE_CONTENTION = (1 << 3),
+  MEASURE_FILL_THREADS = (1 << 4),
+  MEASURE_MULTI_BUFFER = (1 << 5),
+  MEASURE_LATENCY_PERCENTILES = (1 << 6),
+  MEASURE_PE_SCALING = (1 << 7),
+  MEASURE_MIXED_WORKLOAD = (1 << 8)
 } measure_t;
 
+static Json latency_json(LatencyHistogram const &h) {
+  LatencyHistogram::summary_t const s = h.summary();
+  vector<Json> buckets;
+  for (auto const &b : h.buckets())
+    buckets.push_back(Json::object{{"Upper Bound", b.first},
+                                   {"Count", static_cast<double>(b.second)}});
+  return Json::object{{"Samples", static_cast<double>(s.count)},
+                      {"Min", s.min},
+                      {"Avg", s.avg},
+                      {"P50", s.p50},
+                      {"P99", s.p99},
+                      {"P99.9", s.p999},
+                      {"Max", s.max},
+                      {"Histogram", buckets}};
+}
+
 struct transfer_speed_t {
   size_t chunk_sz;
   double speed_r;
@@ -58,6 +86,17 @@ struct transfer_speed_t {
   }
 };
 
+struct fill_threads_t {
+  TransferSpeed::fill_threads_t r;
+  double gain;
+  Json to_json() const {
+    return Json::object{{"Chunk Size", static_cast<int>(r.chunk_sz)},
+                        {"Fill Threads", static_cast<int>(r.fill_threads)},
+                        {"Write", r.speed_w},
+                        {"Gain", gain}};
+  }
+};
+
 struct interrupt_latency_t {
   size_t cycle_count;
   double latency_us;
@@ -80,40 +119,162 @@ struct job_throughput_t {
   }
 };
 
+struct acquire_contention_t {
+  size_t num_threads;
+  AcquireContention::result_t r;
+  Json to_json() const {
+    return Json::object{{"Number of threads", static_cast<double>(num_threads)},
+                        {"Jobs per second", r.jobs_per_sec},
+                        {"Avg Wait", r.avg_wait_us},
+                        {"P50 Wait", r.p50_wait_us},
+                        {"P99 Wait", r.p99_wait_us},
+                        {"P99.9 Wait", r.p999_wait_us},
+                        {"Max Wait", r.max_wait_us},
+                        {"CPU Cores", r.cpu_cores},
+                        {"Fairness", r.fairness}};
+  }
+};
+
+struct multi_buffer_t {
+  size_t num_buffers;
+  size_t chunk_sz;
+  MultiBufferTransfer::result_t r;
+  Json to_json() const {
+    return Json::object{{"Number of buffers", static_cast<int>(num_buffers)},
+                        {"Chunk Size", static_cast<int>(chunk_sz)},
+                        {"Sequential Speed", r.sequential},
+                        {"Concurrent Speed", r.concurrent}};
+  }
+};
+
+struct latency_percentiles_t {
+  size_t cycle_count;
+  LatencyHistogram latency;
+  Json to_json() const {
+    return Json::object{{"Cycle Count", static_cast<double>(cycle_count)},
+                        {"Latency", latency_json(latency)}};
+  }
+};
+
+struct pe_scaling_t {
+  size_t num_pes;
+  PEScaling::result_t r;
+  Json to_json() const {
+    return Json::object{{"Number of PEs", static_cast<double>(num_pes)},
+                        {"Jobs per second", r.jobs_per_sec},
+                        {"Efficiency", r.efficiency},
+                        {"Latency", latency_json(r.latency)}};
+  }
+};
+
+struct mixed_workload_t {
+  size_t num_threads;
+  MixedWorkload::result_t r;
+  Json to_json() const {
+    vector<Json> classes;
+    for (auto const &c : r.classes)
+      classes.push_back(
+          Json::object{{"Cycle Count", static_cast<double>(c.clock_cycles)},
+                       {"Buffer Size", static_cast<double>(c.buffer_sz)},
+                       {"Latency", latency_json(c.latency)}});
+    return Json::object{{"Number of threads", static_cast<double>(num_threads)},
+                        {"Jobs per second", r.jobs_per_sec},
+                        {"Latency", latency_json(r.latency)},
+                        {"Classes", classes}};
+  }
+};
+
 int main(int argc, const char *argv[]) {
-  measure_t mode = static_cast<measure_t>(MEASURE_TRANSFER_SPEED |
-                                          MEASURE_INTERRUPT_LATENCY |
-                                          MEASURE_JOB_THROUGHPUT);
+  unsigned const all = MEASURE_TRANSFER_SPEED | MEASURE_INTERRUPT_LATENCY |
+                       MEASURE_JOB_THROUGHPUT | MEASURE_ACQUIRE_CONTENTION;
+  unsigned mode = 0;
   bool fast = false;
-  if (argc > 1 && string(argv[0]).size()) {
-    switch (argv[1][0]) {
+  // modes can be combined, e.g., "fls" for fast latency and scaling runs
+  for (char const *c = argc > 1 ? argv[1] : ""; *c; ++c) {
+    switch (*c) {
     case 'm':
-      mode = MEASURE_TRANSFER_SPEED;
+      mode |= MEASURE_TRANSFER_SPEED;
       break;
     case 'i':
-      mode = MEASURE_INTERRUPT_LATENCY;
+      mode |= MEASURE_INTERRUPT_LATENCY;
       break;
     case 'j':
-      mode = MEASURE_JOB_THROUGHPUT;
+      mode |= MEASURE_JOB_THROUGHPUT;
+      break;
+    case 'c':
+      mode |= MEASURE_ACQUIRE_CONTENTION;
+      break;
+    case 'p':
+      mode |= MEASURE_FILL_THREADS;
+      break;
+    case 'b':
+      mode |= MEASURE_MULTI_BUFFER;
+      break;
+    case 'l':
+      mode |= MEASURE_LATENCY_PERCENTILES;
+      break;
+    case 's':
+      mode |= MEASURE_PE_SCALING;
+      break;
+    case 'x':
+      mode |= MEASURE_MIXED_WORKLOAD;
       break;
     case 'f':
       fast = true;
+      break;
     case 'a':
+      mode |= all;
       break;
     default:
-      cerr << "Unknown mode: " << argv[0][0]
-           << ". Choose one of a(ll), i(nterrupt latency), j(ob throughput), "
-              "m(emory transfer speed)."
+      cerr << "Unknown mode: " << *c
+           << ". Choose one or more of a(ll), i(nterrupt latency), j(ob "
+              "throughput), m(emory transfer speed), c(ontention of PE "
+              "acquisition), p(arallel bounce buffer filling), b(uffer "
+              "arguments of jobs), l(atency percentiles), s(caling with the "
+              "number of PEs), x (mixed workload); add f for fast runs."
            << endl;
       exit(1);
     }
   }
+  if (!mode)
+    mode = all;
 
   try {
+    // compare single threaded with parallel bounce buffer filling for
+    // transfers of 64 KiB - 512 MiB; needs its own device instances, so
+    // this runs before the device is opened for the other measurements
+    vector<Json> fill;
+    if (mode & MEASURE_FILL_THREADS) {
+      size_t const max_threads =
+          std::max<size_t>(2, std::min<long>(8, sysconf(_SC_NPROCESSORS_ONLN)));
+      auto r = TransferSpeed::fill_threads_sweep(16, fast ? 24 : 30,
+                                                 {1, max_threads}, fast);
+      size_t const n = r.size() / 2;
+      std::cout << "Chunk size [KiB]   1 thread [MiB/s]   " << max_threads
+                << " threads [MiB/s]   Gain" << std::endl;
+      for (size_t i = 0; i < r.size(); ++i) {
+        double base = r[i % n].speed_w;
+        fill_threads_t ft{r[i], base > 0 ? r[i].speed_w / base : 0.0};
+        fill.push_back(ft.to_json());
+        if (i >= n) {
+          std::ios_base::fmtflags coutf(cout.flags());
+          std::cout << std::fixed << std::setprecision(2) << std::setw(16)
+                    << r[i].chunk_sz / 1024.0 << std::setw(19) << base
+                    << std::setw(20) << r[i].speed_w << std::setw(9)
+                    << ft.gain << std::endl;
+          cout.flags(coutf);
+        }
+      }
+    }
+
     Tapasco tapasco;
     TransferSpeed tp{tapasco, fast};
     InterruptLatency il{tapasco, fast};
     JobThroughput jt{tapasco, fast};
+    AcquireContention ac{tapasco, fast};
+    MultiBufferTransfer mb{tapasco, fast};
+    PEScaling ps{tapasco, fast};
+    MixedWorkload mx{tapasco, fast};
     struct utsname uts;
     uname(&uts);
     vector<Json> speed;
@@ -122,6 +283,13 @@ int main(int argc, const char *argv[]) {
     struct interrupt_latency_t ls;
     vector<Json> jobs;
     struct job_throughput_t js;
+    vector<Json> contention;
+    struct acquire_contention_t cs;
+    vector<Json> buffers;
+    struct multi_buffer_t bs;
+    vector<Json> percentiles;
+    vector<Json> scaling;
+    vector<Json> mixed;
 
     string platform = "vc709";
     if (getenv("TAPASCO_PLATFORM") == NULL) {
@@ -185,6 +353,48 @@ int main(int argc, const char *argv[]) {
       } while (i <= 128 && (i <= min_threads || js.jobs_per_sec > prev));
     }
 
+    // hammer the Counter PEs with up to 64 threads
+    for (size_t i = 1; mode & MEASURE_ACQUIRE_CONTENTION && i <= 64; i *= 2) {
+      cs.num_threads = i;
+      cs.r = ac(i);
+      contention.push_back(cs.to_json());
+    }
+    // jobs with 1 - 4 in/out buffers of 64 KiB - 64 MiB each, all in the
+    // default memory vs. every other one in PE-local memory
+    for (size_t i = 16; mode & MEASURE_MULTI_BUFFER && i <= (fast ? 20 : 26);
+         i += 2) {
+      for (size_t n = 1; n <= MultiBufferTransfer::MAX_BUFFERS; ++n) {
+        bs.num_buffers = n;
+        bs.chunk_sz = 1UL << i;
+        bs.r = mb(n, bs.chunk_sz);
+        buffers.push_back(bs.to_json());
+      }
+    }
+
+    // tail latency of single jobs of 1cc - 100000cc (1 ms at 100 MHz)
+    for (size_t cc = 1; mode & MEASURE_LATENCY_PERCENTILES && cc <= 100000;
+         cc *= 10) {
+      latency_percentiles_t lp{cc, il.histogram(cc, fast ? 1000 : 10000)};
+      percentiles.push_back(lp.to_json());
+    }
+
+    // jobs of 100 us on 1 - N Counter PEs at the same time
+    for (size_t n = 1; mode & MEASURE_PE_SCALING && n <= ps.max_pes(); ++n) {
+      pe_scaling_t pe{n, ps(n)};
+      scaling.push_back(pe.to_json());
+    }
+
+    // runtimes of 1 us - 10 ms with buffers of 0 - 4 MiB, two threads per PE
+    if (mode & MEASURE_MIXED_WORKLOAD) {
+      size_t const n = 2 * ps.max_pes();
+      mixed_workload_t mw{n, mx(n)};
+      mixed.push_back(mw.to_json());
+    }
+
+    char const *blocking = getenv("TAPASCO_SCHEDULER__BLOCKING");
+    string const scheduler =
+        blocking && string(blocking) == "false" ? "spinning" : "blocking";
+
     // record current time
     time_t tt = chrono::system_clock::to_time_t(chrono::system_clock::now());
     tm tm = *localtime(&tt);
@@ -194,6 +404,7 @@ int main(int argc, const char *argv[]) {
     // build JSON object
     Json benchmark = Json::object{
         {"Timestamp", str.str()},
+        {"Fast", fast},
         {"Host", Json::object{{"Operating System", uts.sysname},
                               {"Node", uts.nodename},
                               {"Release", uts.release},
@@ -202,6 +413,13 @@ int main(int argc, const char *argv[]) {
         {"Transfer Speed", speed},
         {"Interrupt Latency", latency},
         {"Job Throughput", jobs},
+        {"Acquire Contention",
+         Json::object{{"Scheduler", scheduler}, {"Results", contention}}},
+        {"Bounce Buffer Filling", fill},
+        {"Multi Buffer Transfers", buffers},
+        {"Latency Percentiles", percentiles},
+        {"PE Scaling", scaling},
+        {"Mixed Workload", mixed},
         {"Library Versions", Json::object{{"Tapasco API", tapasco.version()}}}};
 
     // dump it
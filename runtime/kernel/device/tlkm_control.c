@@ -94,7 +94,7 @@ int tlkm_control_release(struct inode *inode, struct file *file)
 	}
 
 	if (dev->cls->miscdev_close) {
-		dev->cls->miscdev_close(dev);
+		dev->cls->miscdev_close(dev, file);
 	}
 
 	return 0;
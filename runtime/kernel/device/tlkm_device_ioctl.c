@@ -26,6 +26,7 @@
 #include "tlkm_device_ioctl_cmds.h"
 #include "tlkm_bus.h"
 #include "tlkm_control.h"
+#include "tlkm_trace.h"
 
 long tlkm_device_ioctl_info(struct file *fp, unsigned int ioctl, struct tlkm_device_info __user *info);
 long tlkm_device_ioctl_size(struct file *fp, unsigned int ioctl, struct tlkm_size_cmd __user *size);
@@ -168,20 +169,25 @@ long tlkm_device_reg_int(struct file *fp, unsigned int ioctl,
 
 long tlkm_device_ioctl(struct file *fp, unsigned int ioctl, unsigned long data)
 {
-	tlkm_perfc_control_ioctls_inc(device_from_file(fp)->dev_id);
+	long ret;
+	struct tlkm_device *dev = device_from_file(fp);
+	tlkm_perfc_control_ioctls_inc(dev->dev_id);
+	trace_tlkm_ioctl_enter(dev->dev_id, ioctl);
 	if (ioctl == TLKM_DEV_IOCTL_INFO) {
-		return tlkm_device_ioctl_info(
+		ret = tlkm_device_ioctl_info(
 			fp, ioctl, (struct tlkm_device_info __user *)data);
 	} else if (ioctl == TLKM_DEV_IOCTL_SIZE) {
-		return tlkm_device_ioctl_size(
+		ret = tlkm_device_ioctl_size(
 			fp, ioctl, (struct tlkm_size_cmd __user *)data);
 	} else if (ioctl == TLKM_DEV_IOCTL_REGISTER_INTERRUPT) {
-		return tlkm_device_reg_int(
+		ret = tlkm_device_reg_int(
 			fp, ioctl,
 			(struct tlkm_register_interrupt __user *)data);
 	} else {
-		tlkm_device_ioctl_f ioctl_f = device_from_file(fp)->cls->ioctl;
+		tlkm_device_ioctl_f ioctl_f = dev->cls->ioctl;
 		BUG_ON(!ioctl_f);
-		return ioctl_f(device_from_file(fp), ioctl, data);
+		ret = ioctl_f(dev, fp, ioctl, data);
 	}
+	trace_tlkm_ioctl_exit(dev->dev_id, ioctl, ret);
+	return ret;
 }
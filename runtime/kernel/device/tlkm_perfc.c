@@ -24,39 +24,186 @@
 //! @authors	J. Korinth, TU Darmstadt (jk@esa.cs.tu-darmstadt.de)
 //!
 #include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/cache.h>
+#include <linux/cpumask.h>
+#include <linux/local64.h>
+#include <linux/mm.h>
+#include <linux/smp.h>
+#include <linux/vmalloc.h>
 #include "tlkm_ioctl_cmds.h"
 #include "tlkm_perfc.h"
+#include "tlkm_perfc_layout.h"
 
 #ifndef NPERFC
 
-static struct tlkm_perfc_t {
-#define _PC(NAME) atomic_t pc_##NAME[TLKM_DEVS_SZ];
+enum {
+#define _PC(name) TLKM_PERFC_IDX_##name,
 	TLKM_PERFC_COUNTERS
-} tlkm_perfc;
+#undef _PC
+	TLKM_PERFC_NUM_COUNTERS
+};
+
+enum {
+#define _PH(name) TLKM_PERFC_HIST_##name,
+	TLKM_PERFC_HISTOGRAMS
+#undef _PH
+	TLKM_PERFC_NUM_HISTOGRAMS
+};
+
+#define TLKM_PERFC_CPU_STRIDE                                                  \
+	ALIGN((TLKM_PERFC_NUM_COUNTERS +                                       \
+	       TLKM_PERFC_NUM_HISTOGRAMS * TLKM_PERFC_HIST_BUCKETS) *          \
+		      sizeof(u64),                                             \
+	      SMP_CACHE_BYTES)
 
+#define _PC(name) #name "\0"
+#define _PH(name) #name "\0"
+static const char tlkm_perfc_names[] = TLKM_PERFC_COUNTERS TLKM_PERFC_HISTOGRAMS;
+#undef _PH
 #undef _PC
+
+/* one region per device, mapped by userspace via the perfc miscdev */
+static void *tlkm_perfc[TLKM_DEVS_SZ];
+
+inline static local64_t *tlkm_perfc_cpu_slot(void *base, int cpu,
+					     unsigned int idx)
+{
+	return (local64_t *)(base + PAGE_SIZE + cpu * TLKM_PERFC_CPU_STRIDE) +
+	       idx;
+}
+
+inline static void tlkm_perfc_local_add(dev_id_t dev_id, unsigned int idx,
+					u64 const v)
+{
+	void *base = READ_ONCE(tlkm_perfc[dev_id]);
+	if (unlikely(!base))
+		return;
+	local64_add(v, tlkm_perfc_cpu_slot(base, get_cpu(), idx));
+	put_cpu();
+}
+
+static u64 tlkm_perfc_sum(dev_id_t dev_id, unsigned int idx)
+{
+	void *base = READ_ONCE(tlkm_perfc[dev_id]);
+	u64 sum = 0;
+	int cpu;
+	if (!base)
+		return 0;
+	for_each_possible_cpu (cpu)
+		sum += local64_read(tlkm_perfc_cpu_slot(base, cpu, idx));
+	return sum;
+}
+
+static void tlkm_perfc_assign(dev_id_t dev_id, unsigned int idx, u64 const v)
+{
+	void *base = READ_ONCE(tlkm_perfc[dev_id]);
+	int const first = cpumask_first(cpu_possible_mask);
+	int cpu;
+	if (!base)
+		return;
+	for_each_possible_cpu (cpu)
+		local64_set(tlkm_perfc_cpu_slot(base, cpu, idx),
+			    cpu == first ? v : 0);
+}
+
+inline static unsigned int tlkm_perfc_bucket(u64 const ns)
+{
+	unsigned int const b = fls64(ns);
+	return b < TLKM_PERFC_HIST_BUCKETS ? b : TLKM_PERFC_HIST_BUCKETS - 1;
+}
+
+int tlkm_perfc_init(dev_id_t dev_id)
+{
+	struct tlkm_perfc_header *hdr;
+	size_t const size =
+		PAGE_ALIGN(PAGE_SIZE + nr_cpu_ids * TLKM_PERFC_CPU_STRIDE);
+	void *base;
+
+	BUILD_BUG_ON(sizeof(local64_t) != sizeof(u64));
+	BUILD_BUG_ON(sizeof(*hdr) + sizeof(tlkm_perfc_names) > PAGE_SIZE);
+
+	base = vmalloc_user(size);
+	if (!base)
+		return -ENOMEM;
+
+	hdr = (struct tlkm_perfc_header *)base;
+	hdr->magic = TLKM_PERFC_MAGIC;
+	hdr->version = TLKM_PERFC_LAYOUT_VERSION;
+	hdr->num_cpus = nr_cpu_ids;
+	hdr->num_counters = TLKM_PERFC_NUM_COUNTERS;
+	hdr->num_histograms = TLKM_PERFC_NUM_HISTOGRAMS;
+	hdr->hist_buckets = TLKM_PERFC_HIST_BUCKETS;
+	hdr->names_offset = sizeof(*hdr);
+	hdr->blocks_offset = PAGE_SIZE;
+	hdr->cpu_stride = TLKM_PERFC_CPU_STRIDE;
+	memcpy(base + hdr->names_offset, tlkm_perfc_names,
+	       sizeof(tlkm_perfc_names));
+
+	WRITE_ONCE(tlkm_perfc[dev_id], base);
+	return 0;
+}
+
+void tlkm_perfc_exit(dev_id_t dev_id)
+{
+	void *base = tlkm_perfc[dev_id];
+	WRITE_ONCE(tlkm_perfc[dev_id], NULL);
+	vfree(base);
+}
+
+int tlkm_perfc_mmap(dev_id_t dev_id, struct vm_area_struct *vma)
+{
+	void *base = tlkm_perfc[dev_id];
+	if (!base)
+		return -ENODEV;
+	return remap_vmalloc_range(vma, base, vma->vm_pgoff);
+}
+
 #define _PC(name)                                                              \
 	void tlkm_perfc_##name##_inc(dev_id_t dev_id)                          \
 	{                                                                      \
-		atomic_inc(&tlkm_perfc.pc_##name[dev_id]);                     \
+		tlkm_perfc_local_add(dev_id, TLKM_PERFC_IDX_##name, 1);        \
 	}                                                                      \
                                                                                \
-	void tlkm_perfc_##name##_add(dev_id_t dev_id, int const v)             \
+	void tlkm_perfc_##name##_add(dev_id_t dev_id, u64 const v)             \
 	{                                                                      \
-		atomic_add(v, &tlkm_perfc.pc_##name[dev_id]);                  \
+		tlkm_perfc_local_add(dev_id, TLKM_PERFC_IDX_##name, v);        \
 	}                                                                      \
                                                                                \
-	int tlkm_perfc_##name##_get(dev_id_t dev_id)                           \
+	u64 tlkm_perfc_##name##_get(dev_id_t dev_id)                           \
 	{                                                                      \
-		return atomic_read(&tlkm_perfc.pc_##name[dev_id]);             \
+		return tlkm_perfc_sum(dev_id, TLKM_PERFC_IDX_##name);          \
 	}                                                                      \
                                                                                \
-	void tlkm_perfc_##name##_set(dev_id_t dev_id, int const v)             \
+	void tlkm_perfc_##name##_set(dev_id_t dev_id, u64 const v)             \
 	{                                                                      \
-		atomic_set(&tlkm_perfc.pc_##name[dev_id], v);                  \
+		tlkm_perfc_assign(dev_id, TLKM_PERFC_IDX_##name, v);           \
 	}
 
 TLKM_PERFC_COUNTERS
 #undef _PC
 
+#define _PH(name)                                                              \
+	void tlkm_perfc_##name##_record(dev_id_t dev_id, u64 const ns)         \
+	{                                                                      \
+		tlkm_perfc_local_add(dev_id,                                   \
+				     TLKM_PERFC_NUM_COUNTERS +                 \
+					     TLKM_PERFC_HIST_##name *          \
+						     TLKM_PERFC_HIST_BUCKETS + \
+					     tlkm_perfc_bucket(ns),            \
+				     1);                                       \
+	}                                                                      \
+                                                                               \
+	u64 tlkm_perfc_##name##_bucket(dev_id_t dev_id, unsigned int bucket)   \
+	{                                                                      \
+		return tlkm_perfc_sum(dev_id,                                  \
+				      TLKM_PERFC_NUM_COUNTERS +                \
+					      TLKM_PERFC_HIST_##name *         \
+						      TLKM_PERFC_HIST_BUCKETS + \
+					      bucket);                         \
+	}
+
+TLKM_PERFC_HISTOGRAMS
+#undef _PH
+
 #endif
@@ -31,6 +31,9 @@
 #ifdef _PC
 #undef _PC
 #endif
+#ifdef _PH
+#undef _PH
+#endif
 
 #define TLKM_PERFC_COUNTERS                                                    \
 	_PC(signals_read)                                                      \
@@ -56,36 +59,72 @@
 	_PC(irq_error_already_pending)                                         \
 	_PC(total_irqs)
 
+/* dma_chunk_ns is recorded by the in-kernel DMA engines (blue_dma) only. The
+ * default PCIe runtime transfers via UserSpaceDMA without the driver, so the
+ * histogram stays empty there. */
+#define TLKM_PERFC_HISTOGRAMS                                                  \
+	_PH(dma_chunk_ns)                                                      \
+	_PH(irq_eventfd_ns)
+
 #ifndef NPERFC
 #include <linux/types.h>
+#include <linux/mm_types.h>
+
+int tlkm_perfc_init(dev_id_t dev_id);
+void tlkm_perfc_exit(dev_id_t dev_id);
+int tlkm_perfc_mmap(dev_id_t dev_id, struct vm_area_struct *vma);
 
 #define _PC(name)                                                              \
 	void tlkm_perfc_##name##_inc(dev_id_t dev_id);                         \
-	void tlkm_perfc_##name##_add(dev_id_t dev_id, int const v);            \
-	int tlkm_perfc_##name##_get(dev_id_t dev_id);                          \
-	void tlkm_perfc_##name##_set(dev_id_t dev_id, int const v);
+	void tlkm_perfc_##name##_add(dev_id_t dev_id, u64 const v);            \
+	u64 tlkm_perfc_##name##_get(dev_id_t dev_id);                          \
+	void tlkm_perfc_##name##_set(dev_id_t dev_id, u64 const v);
 
 TLKM_PERFC_COUNTERS
 #undef _PC
+
+#define _PH(name)                                                              \
+	void tlkm_perfc_##name##_record(dev_id_t dev_id, u64 const ns);        \
+	u64 tlkm_perfc_##name##_bucket(dev_id_t dev_id, unsigned int bucket);
+
+TLKM_PERFC_HISTOGRAMS
+#undef _PH
 #else /* NPERFC */
+#define tlkm_perfc_init(...) (0)
+#define tlkm_perfc_exit(...)
+
 #define _PC(name)                                                              \
 	inline static void tlkm_perfc_##name##_inc(dev_id_t dev_id)            \
 	{                                                                      \
 	}                                                                      \
 	inline static void tlkm_perfc_##name##_add(dev_id_t dev_id,            \
-						   int const v)                \
+						   u64 const v)                \
 	{                                                                      \
 	}                                                                      \
-	inline static int tlkm_perfc_##name##_get(dev_id_t dev_id)             \
+	inline static u64 tlkm_perfc_##name##_get(dev_id_t dev_id)             \
 	{                                                                      \
 		return 0;                                                      \
 	}                                                                      \
 	inline static void tlkm_perfc_##name##_set(dev_id_t dev_id,            \
-						   int const v)                \
+						   u64 const v)                \
 	{                                                                      \
 	}
 
 TLKM_PERFC_COUNTERS
 #undef _PC
+
+#define _PH(name)                                                              \
+	inline static void tlkm_perfc_##name##_record(dev_id_t dev_id,         \
+						      u64 const ns)            \
+	{                                                                      \
+	}                                                                      \
+	inline static u64 tlkm_perfc_##name##_bucket(dev_id_t dev_id,          \
+						     unsigned int bucket)      \
+	{                                                                      \
+		return 0;                                                      \
+	}
+
+TLKM_PERFC_HISTOGRAMS
+#undef _PH
 #endif /* NPERFC */
 #endif /* TLKM_PERFC_H__ */
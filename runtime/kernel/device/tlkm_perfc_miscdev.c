@@ -25,14 +25,17 @@
 #include <linux/uaccess.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/version.h>
 #include "tlkm_module.h"
 #include "tlkm_perfc.h"
+#include "tlkm_perfc_layout.h"
 #include "tlkm_perfc_miscdev.h"
 #include "tlkm_logging.h"
 #include "tlkm_device_ioctl_cmds.h"
 
 #ifndef NPERFC
-#define TLKM_PERFC_MISCDEV_BUFSZ 768
+#define TLKM_PERFC_MISCDEV_BUFSZ 8192
 
 inline static dev_id_t get_dev_id_from_file(struct file *file)
 {
@@ -45,27 +48,53 @@ inline static dev_id_t get_dev_id_from_file(struct file *file)
 static ssize_t tlkm_perfc_miscdev_read(struct file *file, char __user *usr,
 				       size_t sz, loff_t *loff)
 {
-	ssize_t sl;
+	ssize_t ret;
+	size_t l = 0;
+	unsigned int b;
+	u64 v;
 	dev_id_t dev_id = get_dev_id_from_file(file);
-#define _PC(name) STR(name) ":\t%8lu\n"
-	const char *const fmt = TLKM_PERFC_COUNTERS "TLKM version:\t%s\n";
+	char *tmp = kmalloc(TLKM_PERFC_MISCDEV_BUFSZ, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+#define _PC(name)                                                              \
+	l += scnprintf(tmp + l, TLKM_PERFC_MISCDEV_BUFSZ - l,                  \
+		       STR(name) ":\t%8llu\n",                                 \
+		       (unsigned long long)tlkm_perfc_##name##_get(dev_id));
+	TLKM_PERFC_COUNTERS
 #undef _PC
-	char tmp[TLKM_PERFC_MISCDEV_BUFSZ];
-#define _PC(name) (unsigned long int)tlkm_perfc_##name##_get(dev_id),
-	snprintf(tmp, TLKM_PERFC_MISCDEV_BUFSZ, fmt,
-		 TLKM_PERFC_COUNTERS TLKM_VERSION);
-	sl = strlen(tmp) + 1;
-	if (sl - *loff > 0) {
-		ssize_t rl = strlen(&tmp[*loff]) + 1;
-		*loff += rl - copy_to_user(usr, tmp, strlen(&tmp[*loff]) + 1);
-		return rl;
+#define _PH(name)                                                              \
+	for (b = 0; b < TLKM_PERFC_HIST_BUCKETS; ++b) {                        \
+		if ((v = tlkm_perfc_##name##_bucket(dev_id, b)))               \
+			l += scnprintf(tmp + l, TLKM_PERFC_MISCDEV_BUFSZ - l,  \
+				       STR(name) "[<2^%u]:\t%8llu\n", b,       \
+				       (unsigned long long)v);                 \
 	}
-	return 0;
+	TLKM_PERFC_HISTOGRAMS
+#undef _PH
+	l += scnprintf(tmp + l, TLKM_PERFC_MISCDEV_BUFSZ - l,
+		       "TLKM version:\t%s\n", TLKM_VERSION);
+	ret = simple_read_from_buffer(usr, sz, loff, tmp, l);
+	kfree(tmp);
+	return ret;
+}
+
+static int tlkm_perfc_miscdev_mmap(struct file *file,
+				   struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+	return tlkm_perfc_mmap(get_dev_id_from_file(file), vma);
 }
 
 static const struct file_operations tlkm_perfc_miscdev_fops = {
 	.owner = THIS_MODULE,
 	.read = tlkm_perfc_miscdev_read,
+	.mmap = tlkm_perfc_miscdev_mmap,
 };
 
 int tlkm_perfc_miscdev_init(struct tlkm_device *dev)
@@ -73,6 +102,11 @@ int tlkm_perfc_miscdev_init(struct tlkm_device *dev)
 	int ret = 0;
 	char fn[256];
 	snprintf(fn, 256, TLKM_DEV_PERFC_FN, dev->dev_id);
+	if ((ret = tlkm_perfc_init(dev->dev_id))) {
+		DEVERR(dev->dev_id, "could not allocate performance counters: %d",
+		       ret);
+		return ret;
+	}
 	DEVLOG(dev->dev_id, TLKM_LF_PERFC,
 	       "setting up performance counter file %s ...", fn);
 	dev->perfc_dev.minor = MISC_DYNAMIC_MINOR;
@@ -80,6 +114,8 @@ int tlkm_perfc_miscdev_init(struct tlkm_device *dev)
 	dev->perfc_dev.fops = &tlkm_perfc_miscdev_fops;
 	if ((ret = misc_register(&dev->perfc_dev))) {
 		DEVERR(dev->dev_id, "could not setup %s: %d", fn, ret);
+		kfree(dev->perfc_dev.name);
+		tlkm_perfc_exit(dev->dev_id);
 		return ret;
 	}
 	DEVLOG(dev->dev_id, TLKM_LF_PERFC, "%s is set up", fn);
@@ -91,6 +127,7 @@ void tlkm_perfc_miscdev_exit(struct tlkm_device *dev)
 	kfree(dev->perfc_dev.name);
 	misc_deregister(&dev->perfc_dev);
 	memset(&dev->perfc_dev, 0, sizeof(dev->perfc_dev));
+	tlkm_perfc_exit(dev->dev_id);
 	DEVLOG(dev->dev_id, TLKM_LF_PERFC,
 	       "removed performance counter miscdev");
 }
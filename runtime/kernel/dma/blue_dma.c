@@ -19,9 +19,11 @@
  */
 
 #include <linux/sched.h>
+#include <linux/timekeeping.h>
 #include "tlkm_dma.h"
 #include "tlkm_logging.h"
 #include "tlkm_perfc.h"
+#include "tlkm_trace.h"
 #include "blue_dma.h"
 
 /* Register Map and commands */
@@ -42,7 +44,12 @@
 irqreturn_t blue_dma_intr_handler_read(int irq, void *dev_id)
 {
 	struct dma_engine *dma = (struct dma_engine *)dev_id;
-	atomic64_inc(&dma->rq_processed);
+	u64 const n = atomic64_inc_return(&dma->rq_processed) - 1;
+	u32 const slot = n % TLKM_DMA_CHUNKS;
+	tlkm_perfc_dma_chunk_ns_record(dma->dev_id,
+				       ktime_get_ns() - dma->rq_start[slot]);
+	trace_tlkm_dma_chunk_complete(dma->dev_id, false, n, slot,
+				      dma->rq_len[slot]);
 	wake_up_interruptible(&dma->rq);
 	dma->ack_register[0] = 0;
 	return IRQ_HANDLED;
@@ -51,7 +58,12 @@ irqreturn_t blue_dma_intr_handler_read(int irq, void *dev_id)
 irqreturn_t blue_dma_intr_handler_write(int irq, void *dev_id)
 {
 	struct dma_engine *dma = (struct dma_engine *)dev_id;
-	atomic64_inc(&dma->wq_processed);
+	u64 const n = atomic64_inc_return(&dma->wq_processed) - 1;
+	u32 const slot = n % TLKM_DMA_CHUNKS;
+	tlkm_perfc_dma_chunk_ns_record(dma->dev_id,
+				       ktime_get_ns() - dma->wq_start[slot]);
+	trace_tlkm_dma_chunk_complete(dma->dev_id, true, n, slot,
+				      dma->wq_len[slot]);
 	wake_up_interruptible(&dma->wq);
 	dma->ack_register[0] = 1;
 	return IRQ_HANDLED;
@@ -85,6 +97,7 @@ int blue_dma_init(struct dma_engine *dma)
 ssize_t blue_dma_copy_from(struct dma_engine *dma, dma_addr_t dma_handle,
 			   dev_addr_t dev_addr, size_t len)
 {
+	u32 slot;
 	DEVLOG(dma->dev_id, TLKM_LF_DMA,
 	       "dev_addr = 0x%p, dma_handle = 0x%p, len: %zu bytes",
 	       (void *)dev_addr, (void *)dma_handle, len);
@@ -96,6 +109,9 @@ ssize_t blue_dma_copy_from(struct dma_engine *dma, dma_addr_t dma_handle,
 	*(u64 *)(dma->regs + REG_FPGA_ADDR) = dev_addr;
 	*(u64 *)(dma->regs + REG_HOST_ADDR) = (u64)(dma_handle);
 	*(u64 *)(dma->regs + REG_BTT) = len;
+	slot = atomic64_read(&dma->rq_enqueued) % TLKM_DMA_CHUNKS;
+	dma->rq_len[slot] = len;
+	dma->rq_start[slot] = ktime_get_ns();
 	wmb();
 	*(u64 *)(dma->regs + REG_CMD) = CMD_READ;
 	mutex_unlock(&dma->regs_mutex);
@@ -105,6 +121,7 @@ ssize_t blue_dma_copy_from(struct dma_engine *dma, dma_addr_t dma_handle,
 ssize_t blue_dma_copy_to(struct dma_engine *dma, dev_addr_t dev_addr,
 			 dma_addr_t dma_handle, size_t len)
 {
+	u32 slot;
 	DEVLOG(dma->dev_id, TLKM_LF_DMA,
 	       "dev_addr = 0x%px, dma_handle = 0x%p, len: %zu bytes",
 	       (void *)dev_addr, (void *)dma_handle, len);
@@ -116,6 +133,9 @@ ssize_t blue_dma_copy_to(struct dma_engine *dma, dev_addr_t dev_addr,
 	*(u64 *)(dma->regs + REG_FPGA_ADDR) = dev_addr;
 	*(u64 *)(dma->regs + REG_HOST_ADDR) = (u64)(dma_handle);
 	*(u64 *)(dma->regs + REG_BTT) = len;
+	slot = atomic64_read(&dma->wq_enqueued) % TLKM_DMA_CHUNKS;
+	dma->wq_len[slot] = len;
+	dma->wq_start[slot] = ktime_get_ns();
 	wmb();
 	*(u64 *)(dma->regs + REG_CMD) = CMD_WRITE;
 	mutex_unlock(&dma->regs_mutex);
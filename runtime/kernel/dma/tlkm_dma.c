@@ -24,6 +24,7 @@
 #include "tlkm_dma.h"
 #include "tlkm_logging.h"
 #include "tlkm_perfc.h"
+#include "tlkm_trace.h"
 #include "blue_dma.h"
 #include "pcie/pcie_device.h"
 
@@ -192,6 +193,7 @@ ssize_t tlkm_dma_copy_to(struct dma_engine *dma, dev_addr_t dev_addr,
 			 const void __user *usr_addr, size_t len)
 {
 	struct tlkm_device *dev = dma->dev;
+	size_t const total = len;
 	size_t cpy_sz = len;
 	int err;
 	uint64_t last_chunk = 0;
@@ -267,6 +269,9 @@ ssize_t tlkm_dma_copy_to(struct dma_engine *dma, dev_addr_t dev_addr,
 				dma, dev_addr,
 				dma->dma_buf_write_dev[last_chunk_slot],
 				cpy_sz);
+			trace_tlkm_dma_chunk_enqueue(dma->dev_id, true,
+						     last_chunk,
+						     last_chunk_slot, cpy_sz);
 
 			wake_up_interruptible(&dma->wq_enque);
 
@@ -284,7 +289,7 @@ ssize_t tlkm_dma_copy_to(struct dma_engine *dma, dev_addr_t dev_addr,
 		goto finish_err;
 	}
 
-	tlkm_perfc_dma_writes_add(dma->dev_id, len);
+	tlkm_perfc_dma_writes_add(dma->dev_id, total);
 	return len;
 
 copy_err:
@@ -304,6 +309,7 @@ ssize_t tlkm_dma_copy_from(struct dma_engine *dma, void __user *usr_addr,
 			   dev_addr_t dev_addr, size_t len)
 {
 	struct tlkm_device *dev = dma->dev;
+	size_t const total = len;
 	size_t cpy_sz = len;
 	int i, err;
 	int current_buffer = 0;
@@ -366,6 +372,9 @@ ssize_t tlkm_dma_copy_from(struct dma_engine *dma, void __user *usr_addr,
 		chunks[current_buffer].t_id = dma->ops.copy_from(
 			dma, dma->dma_buf_read_dev[current_buffer], dev_addr,
 			cpy_sz);
+		trace_tlkm_dma_chunk_enqueue(dma->dev_id, false,
+					     chunks[current_buffer].t_id - 1,
+					     current_buffer, cpy_sz);
 
 		chunks[current_buffer].usr_addr = usr_addr;
 		chunks[current_buffer].cpy_sz = cpy_sz;
@@ -403,7 +412,7 @@ ssize_t tlkm_dma_copy_from(struct dma_engine *dma, void __user *usr_addr,
 		}
 	}
 
-	tlkm_perfc_dma_reads_add(dma->dev_id, len);
+	tlkm_perfc_dma_reads_add(dma->dev_id, total);
 	mutex_unlock(&dma->rq_mutex);
 	return len;
 
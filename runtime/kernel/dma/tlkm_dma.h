@@ -90,6 +90,11 @@ struct dma_engine {
 	dma_addr_t dma_buf_read_dev[TLKM_DMA_CHUNKS];
 	void *dma_buf_write[TLKM_DMA_CHUNKS];
 	dma_addr_t dma_buf_write_dev[TLKM_DMA_CHUNKS];
+	/* issue time and length of in-flight chunks, for perfc and tracing */
+	u64 rq_start[TLKM_DMA_CHUNKS];
+	u64 wq_start[TLKM_DMA_CHUNKS];
+	size_t rq_len[TLKM_DMA_CHUNKS];
+	size_t wq_len[TLKM_DMA_CHUNKS];
 	struct tlkm_device *dev;
 	int alignment;
 	volatile uint32_t *ack_register;
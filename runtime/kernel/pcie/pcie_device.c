@@ -23,6 +23,14 @@
 #include <linux/slab.h>
 #include <linux/gfp.h>
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/capability.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#else
+#include <linux/sched.h>
+#endif
 #include "pcie.h"
 #include "pcie_device.h"
 #include "pcie_irq.h"
@@ -66,6 +74,9 @@ static int claim_device(struct tlkm_pcie_device *pdev)
 	}
 
 	INIT_LIST_HEAD(&pdev->gp_buffer);
+	INIT_LIST_HEAD(&pdev->pinned_buffer);
+	mutex_init(&pdev->pinned_lock);
+	pdev->pinned_next_id = 1;
 	dev_set_drvdata(&dev->dev, pdev);
 
 	/* read out pci bar 0 settings */
@@ -474,13 +485,14 @@ void pcie_device_exit_subsystems(struct tlkm_device *dev)
 	DEVLOG(dev->dev_id, TLKM_LF_DEVICE, "exited subsystems");
 }
 
-void pcie_device_miscdev_close(struct tlkm_device *dev)
+void pcie_device_miscdev_close(struct tlkm_device *dev, struct file *fp)
 {
 	struct tlkm_pcie_device *pdev =
 		(struct tlkm_pcie_device *)dev->private_data;
 
 	int i;
 	struct gp_buf *buf, *tmp;
+	struct pinned_buf *pin, *pin_tmp;
 
 #if defined(EN_SVM) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
 	dev_addr_t mmu_base;
@@ -504,6 +516,16 @@ void pcie_device_miscdev_close(struct tlkm_device *dev)
 		list_del(&buf->list);
 		devm_kfree(&pdev->pdev->dev, buf);
 	}
+	/* pins belong to the file which created them, other files may still
+	 * use theirs for DMA */
+	mutex_lock(&pdev->pinned_lock);
+	list_for_each_entry_safe(pin, pin_tmp, &pdev->pinned_buffer, list) {
+		if (pin->owner != fp)
+			continue;
+		list_del(&pin->list);
+		pcie_device_dma_pinned_put(pin);
+	}
+	mutex_unlock(&pdev->pinned_lock);
 
 #if defined(EN_SVM) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
 	mmu_base =
@@ -592,6 +614,188 @@ pcie_device_dma_sync_buffer_dev(dev_id_t dev_id, struct tlkm_device *dev,
 	return 0;
 }
 
+/* Buffers that need no cache maintenance can skip the sync ioctls. */
+bool pcie_device_dma_buffer_coherent(struct tlkm_device *dev,
+				     dma_addr_t dev_handle)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)dev->private_data;
+	return !dma_need_sync(&pdev->pdev->dev, dev_handle);
+#else
+	return false;
+#endif
+}
+
+static void pcie_device_unpin_pages(struct page **pages, unsigned long n)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+	unpin_user_pages_dirty_lock(pages, n, true);
+#else
+	unsigned long i;
+	for (i = 0; i < n; ++i) {
+		set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+#endif
+}
+
+/* Charge n pinned pages to mm. Like long-term pins of RDMA they count against
+ * RLIMIT_MEMLOCK, unless the process may lock memory without limit. */
+static int pcie_device_charge_pinned(struct mm_struct *mm, unsigned long n)
+{
+	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	bool unlimited = capable(CAP_IPC_LOCK);
+	int err = 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+	if ((u64)atomic64_add_return(n, &mm->pinned_vm) > limit && !unlimited) {
+		atomic64_sub(n, &mm->pinned_vm);
+		err = -ENOMEM;
+	}
+#else
+	down_write(&mm->mmap_sem);
+	if (mm->pinned_vm + n > limit && !unlimited)
+		err = -ENOMEM;
+	else
+		mm->pinned_vm += n;
+	up_write(&mm->mmap_sem);
+#endif
+	return err;
+}
+
+static void pcie_device_uncharge_pinned(struct mm_struct *mm, unsigned long n)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+	atomic64_sub(n, &mm->pinned_vm);
+#else
+	down_write(&mm->mmap_sem);
+	mm->pinned_vm -= n;
+	up_write(&mm->mmap_sem);
+#endif
+}
+
+/* Keep mm itself allocated until the pinned pages are uncharged, which may
+ * happen after the process exited when the last user closes the file. */
+static void pcie_device_grab_mm(struct mm_struct *mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+	mmgrab(mm);
+#else
+	atomic_inc(&mm->mm_count);
+#endif
+}
+
+/* Pin the user pages backing [user_addr, user_addr + len) and map them for
+ * DMA in both directions. The pages stay pinned until the buffer is unpinned.
+ * Fails with -ENOMEM if the pages exceed the RLIMIT_MEMLOCK of the caller. */
+int pcie_device_dma_pin_buffer(struct tlkm_device *dev, struct pinned_buf *buf,
+			       unsigned long user_addr, size_t len)
+{
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)dev->private_data;
+	unsigned long first = user_addr >> PAGE_SHIFT;
+	unsigned long last = (user_addr + len - 1) >> PAGE_SHIFT;
+	long pinned;
+	int err;
+
+	buf->num_pages = last - first + 1;
+	buf->mm = current->mm;
+	err = pcie_device_charge_pinned(buf->mm, buf->num_pages);
+	if (err) {
+		DEVWRN(dev->dev_id,
+		       "pinning %lu pages exceeds RLIMIT_MEMLOCK of the process",
+		       buf->num_pages);
+		return err;
+	}
+	pcie_device_grab_mm(buf->mm);
+
+	buf->pages = kvmalloc_array(buf->num_pages, sizeof(*buf->pages),
+				    GFP_KERNEL);
+	if (!buf->pages) {
+		err = -ENOMEM;
+		goto err_alloc;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+	pinned = pin_user_pages_fast(first << PAGE_SHIFT, buf->num_pages,
+				     FOLL_WRITE | FOLL_LONGTERM, buf->pages);
+#else
+	pinned = get_user_pages_fast(first << PAGE_SHIFT, buf->num_pages,
+				     FOLL_WRITE, buf->pages);
+#endif
+	if (pinned != buf->num_pages) {
+		DEVERR(dev->dev_id, "could only pin %ld of %lu pages", pinned,
+		       buf->num_pages);
+		err = pinned < 0 ? pinned : -EFAULT;
+		if (pinned > 0)
+			pcie_device_unpin_pages(buf->pages, pinned);
+		goto err_pin;
+	}
+
+	err = sg_alloc_table_from_pages(&buf->sgt, buf->pages, buf->num_pages,
+					user_addr & ~PAGE_MASK, len, GFP_KERNEL);
+	if (err) {
+		DEVERR(dev->dev_id, "failed to allocate scatter-gather table");
+		goto err_sg;
+	}
+
+	buf->nents = dma_map_sg(&pdev->pdev->dev, buf->sgt.sgl,
+				buf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+	if (!buf->nents) {
+		DEVERR(dev->dev_id, "failed to map pinned pages for DMA");
+		err = -ENOMEM;
+		goto err_map;
+	}
+
+	DEVLOG(dev->dev_id, TLKM_LF_DEVICE,
+	       "pinned %lu pages at 0x%lx in %d DMA segments", buf->num_pages,
+	       user_addr, buf->nents);
+	return 0;
+
+err_map:
+	sg_free_table(&buf->sgt);
+err_sg:
+	pcie_device_unpin_pages(buf->pages, buf->num_pages);
+err_pin:
+	kvfree(buf->pages);
+	buf->pages = NULL;
+err_alloc:
+	pcie_device_uncharge_pinned(buf->mm, buf->num_pages);
+	mmdrop(buf->mm);
+	buf->mm = NULL;
+	return err;
+}
+
+/* Undo pcie_device_dma_pin_buffer and free the buffer. */
+void pcie_device_dma_unpin_buffer(struct tlkm_device *dev,
+				  struct pinned_buf *buf)
+{
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)dev->private_data;
+
+	dma_unmap_sg(&pdev->pdev->dev, buf->sgt.sgl, buf->sgt.orig_nents,
+		     DMA_BIDIRECTIONAL);
+	sg_free_table(&buf->sgt);
+	pcie_device_unpin_pages(buf->pages, buf->num_pages);
+	pcie_device_uncharge_pinned(buf->mm, buf->num_pages);
+	mmdrop(buf->mm);
+	kvfree(buf->pages);
+	kfree(buf);
+}
+
+static void pcie_device_dma_pinned_release(struct kref *ref)
+{
+	struct pinned_buf *buf = container_of(ref, struct pinned_buf, ref);
+	pcie_device_dma_unpin_buffer(buf->dev, buf);
+}
+
+/* Drop a reference to a pinned buffer, unpins it when it was the last. */
+void pcie_device_dma_pinned_put(struct pinned_buf *buf)
+{
+	kref_put(&buf->ref, pcie_device_dma_pinned_release);
+}
+
 inline void *pcie_device_addr2map_off(struct tlkm_device *dev,
 				      dev_addr_t const addr)
 {
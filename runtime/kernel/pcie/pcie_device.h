@@ -22,6 +22,9 @@
 #define PCIE_DEVICE_H__
 
 #include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/scatterlist.h>
 #include <linux/version.h>
 #include "tlkm_types.h"
 #include "dma/tlkm_dma.h"
@@ -54,8 +57,18 @@ int pcie_device_dma_sync_buffer_cpu(dev_id_t dev_id, struct tlkm_device *dev,
 int pcie_device_dma_sync_buffer_dev(dev_id_t dev_id, struct tlkm_device *dev,
 				    void **buffer, dma_addr_t *dev_handle,
 				    dma_direction_t direction, size_t size);
+bool pcie_device_dma_buffer_coherent(struct tlkm_device *dev,
+				     dma_addr_t dev_handle);
 
-void pcie_device_miscdev_close(struct tlkm_device *dev);
+
+struct pinned_buf;
+int pcie_device_dma_pin_buffer(struct tlkm_device *dev, struct pinned_buf *buf,
+			       unsigned long user_addr, size_t len);
+void pcie_device_dma_unpin_buffer(struct tlkm_device *dev,
+				  struct pinned_buf *buf);
+void pcie_device_dma_pinned_put(struct pinned_buf *buf);
+
+void pcie_device_miscdev_close(struct tlkm_device *dev, struct file *fp);
 
 inline void *pcie_device_addr2map_off(struct tlkm_device *dev,
 				      dev_addr_t const addr);
@@ -75,6 +88,22 @@ struct gp_buf {
 	size_t buffer_id;
 };
 
+/* user pages pinned and mapped for direct DMA; owned by the device file
+ * which pinned them, freed when the last reference is put */
+struct pinned_buf {
+	struct list_head list;
+	struct kref ref;
+	struct tlkm_device *dev;
+	struct file *owner;
+	/* mm charged with the pinned pages */
+	struct mm_struct *mm;
+	struct page **pages;
+	unsigned long num_pages;
+	struct sg_table sgt;
+	int nents;
+	size_t buffer_id;
+};
+
 /* struct to hold data related to the pcie device */
 struct tlkm_pcie_device {
 	struct tlkm_device *parent;
@@ -86,6 +115,9 @@ struct tlkm_pcie_device {
 	int link_speed;
 	struct dma_buf dma_buffer[TLKM_PCIE_NUM_DMA_BUFFERS];
 	struct list_head gp_buffer;
+	struct list_head pinned_buffer;
+	struct mutex pinned_lock;
+	size_t pinned_next_id;
 	volatile uint32_t *ack_register;
 	volatile uint32_t *ack_register_aws;
 	struct list_head *interrupts;
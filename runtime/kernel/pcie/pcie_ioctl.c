@@ -18,6 +18,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <linux/uaccess.h>
+#include <linux/slab.h>
 #include "tlkm_logging.h"
 #include "tlkm_device.h"
 #include "dma/tlkm_dma.h"
@@ -34,6 +35,10 @@ long pcie_ioctl_kernel_buffer_allocate(struct tlkm_device *inst, struct tlkm_gp_
 long pcie_ioctl_kernel_buffer_free(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
 long pcie_ioctl_kernel_buffer_map(struct tlkm_device *inst, struct tlkm_gp_buffer_map_cmd *cmd);
 long pcie_ioctl_kernel_buffer_unmap(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long pcie_ioctl_pin(struct tlkm_device *inst, struct file *fp, struct tlkm_dma_pin_cmd *cmd);
+long pcie_ioctl_unpin(struct tlkm_device *inst, struct file *fp, struct tlkm_dma_buffer_op *cmd);
+long pcie_ioctl_pinned_to_dev(struct tlkm_device *inst, struct file *fp, struct tlkm_dma_buffer_op *cmd);
+long pcie_ioctl_pinned_from_dev(struct tlkm_device *inst, struct file *fp, struct tlkm_dma_buffer_op *cmd);
 
 static inline long pcie_ioctl_info(struct tlkm_device *inst,
 				   struct tlkm_device_info *info)
@@ -56,6 +61,34 @@ static inline long pcie_ioctl_reg_int(struct tlkm_device *inst,
 	return -EFAULT;
 }
 
+static inline long pcie_ioctl_dma_buffer_pin(struct tlkm_device *inst,
+					     struct tlkm_dma_pin_cmd *cmd)
+{
+	DEVERR(inst->dev_id, "should never be called");
+	return -EFAULT;
+}
+
+static inline long pcie_ioctl_dma_buffer_unpin(struct tlkm_device *inst,
+					       struct tlkm_dma_buffer_op *cmd)
+{
+	DEVERR(inst->dev_id, "should never be called");
+	return -EFAULT;
+}
+
+static inline long pcie_ioctl_dma_pinned_to_dev(struct tlkm_device *inst,
+						struct tlkm_dma_buffer_op *cmd)
+{
+	DEVERR(inst->dev_id, "should never be called");
+	return -EFAULT;
+}
+
+static inline long pcie_ioctl_dma_pinned_from_dev(struct tlkm_device *inst,
+						  struct tlkm_dma_buffer_op *cmd)
+{
+	DEVERR(inst->dev_id, "should never be called");
+	return -EFAULT;
+}
+
 static inline long pcie_ioctl_alloc(struct tlkm_device *inst,
 				    struct tlkm_mm_cmd *cmd)
 {
@@ -130,6 +163,8 @@ long pcie_ioctl_dma_buffer_allocate(
 
 			param->buffer_id = i;
 			param->addr = pdev->dma_buffer[i].ptr_dev;
+			param->coherent = pcie_device_dma_buffer_coherent(
+				inst, pdev->dma_buffer[i].ptr_dev);
 
 			return 0;
 		}
@@ -284,6 +319,155 @@ long pcie_ioctl_kernel_buffer_unmap(struct tlkm_device *inst,
 	return -ENOENT;
 }
 
+static int pcie_pinned_put_segment(struct tlkm_dma_pin_cmd *cmd, size_t idx,
+				   struct tlkm_dma_segment *seg)
+{
+	struct tlkm_dma_segment __user *segs =
+		(struct tlkm_dma_segment __user *)(uintptr_t)cmd->segments;
+	if (idx >= cmd->max_segments)
+		return -ENOSPC;
+	if (copy_to_user(&segs[idx], seg, sizeof(*seg)))
+		return -EFAULT;
+	return 0;
+}
+
+static struct pinned_buf *pcie_pinned_find(struct tlkm_pcie_device *pdev,
+					   struct file *fp, size_t buffer_id)
+{
+	struct pinned_buf *buf;
+	list_for_each_entry(buf, &pdev->pinned_buffer, list) {
+		if (buf->buffer_id == buffer_id && buf->owner == fp)
+			return buf;
+	}
+	return NULL;
+}
+
+/* Look up a pinned buffer of fp and take a reference to it. */
+static struct pinned_buf *pcie_pinned_get(struct tlkm_pcie_device *pdev,
+					  struct file *fp, size_t buffer_id)
+{
+	struct pinned_buf *buf;
+	mutex_lock(&pdev->pinned_lock);
+	buf = pcie_pinned_find(pdev, fp, buffer_id);
+	if (buf)
+		kref_get(&buf->ref);
+	mutex_unlock(&pdev->pinned_lock);
+	return buf;
+}
+
+long pcie_ioctl_pin(struct tlkm_device *inst, struct file *fp,
+		    struct tlkm_dma_pin_cmd *cmd)
+{
+	struct pinned_buf *buf;
+	struct scatterlist *sg;
+	struct tlkm_dma_segment seg = { 0 };
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)inst->private_data;
+	size_t n = 0;
+	long ret;
+	int i;
+
+	if (cmd->len == 0 || cmd->user_addr + cmd->len < cmd->user_addr)
+		return -EINVAL;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		ERR("Failed to allocate list entry");
+		return -ENOMEM;
+	}
+
+	ret = pcie_device_dma_pin_buffer(inst, buf, cmd->user_addr, cmd->len);
+	if (ret) {
+		kfree(buf);
+		return ret;
+	}
+
+	/* report the DMA segments, adjacent ones are merged */
+	for_each_sg (buf->sgt.sgl, sg, buf->nents, i) {
+		if (n && seg.addr + seg.len == sg_dma_address(sg)) {
+			seg.len += sg_dma_len(sg);
+			continue;
+		}
+		if (n && (ret = pcie_pinned_put_segment(cmd, n - 1, &seg)))
+			goto err_segments;
+		seg.addr = sg_dma_address(sg);
+		seg.len = sg_dma_len(sg);
+		++n;
+	}
+	ret = pcie_pinned_put_segment(cmd, n - 1, &seg);
+	if (ret)
+		goto err_segments;
+
+	cmd->num_segments = n;
+	cmd->coherent = pcie_device_dma_buffer_coherent(
+		inst, sg_dma_address(buf->sgt.sgl));
+
+	kref_init(&buf->ref);
+	buf->dev = inst;
+	buf->owner = fp;
+	mutex_lock(&pdev->pinned_lock);
+	buf->buffer_id = pdev->pinned_next_id++;
+	list_add_tail(&buf->list, &pdev->pinned_buffer);
+	mutex_unlock(&pdev->pinned_lock);
+	cmd->buffer_id = buf->buffer_id;
+	return 0;
+
+err_segments:
+	/* tell user space how many segments are needed at most */
+	cmd->num_segments = buf->nents;
+	pcie_device_dma_unpin_buffer(inst, buf);
+	return ret;
+}
+
+long pcie_ioctl_unpin(struct tlkm_device *inst, struct file *fp,
+		      struct tlkm_dma_buffer_op *cmd)
+{
+	struct pinned_buf *buf;
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)inst->private_data;
+
+	mutex_lock(&pdev->pinned_lock);
+	buf = pcie_pinned_find(pdev, fp, cmd->buffer_id);
+	if (buf)
+		list_del(&buf->list);
+	mutex_unlock(&pdev->pinned_lock);
+	if (!buf)
+		return -ENOENT;
+	/* running syncs keep the pages mapped until they are done */
+	pcie_device_dma_pinned_put(buf);
+	return 0;
+}
+
+long pcie_ioctl_pinned_to_dev(struct tlkm_device *inst, struct file *fp,
+			      struct tlkm_dma_buffer_op *cmd)
+{
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)inst->private_data;
+	struct pinned_buf *buf = pcie_pinned_get(pdev, fp, cmd->buffer_id);
+
+	if (!buf)
+		return -ENOENT;
+	dma_sync_sg_for_device(&pdev->pdev->dev, buf->sgt.sgl,
+			       buf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+	pcie_device_dma_pinned_put(buf);
+	return 0;
+}
+
+long pcie_ioctl_pinned_from_dev(struct tlkm_device *inst, struct file *fp,
+				struct tlkm_dma_buffer_op *cmd)
+{
+	struct tlkm_pcie_device *pdev =
+		(struct tlkm_pcie_device *)inst->private_data;
+	struct pinned_buf *buf = pcie_pinned_get(pdev, fp, cmd->buffer_id);
+
+	if (!buf)
+		return -ENOENT;
+	dma_sync_sg_for_cpu(&pdev->pdev->dev, buf->sgt.sgl,
+			    buf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+	pcie_device_dma_pinned_put(buf);
+	return 0;
+}
+
 static inline long pcie_ioctl_bar_addr(struct tlkm_device *inst,
 				       struct tlkm_bar_addr_cmd *cmd)
 {
@@ -374,11 +558,11 @@ pcie_ioctl_svm_migrate_to_ram(struct tlkm_device *inst,
 #endif /* EN_SVM */
 }
 
-long pcie_ioctl(struct tlkm_device *inst, unsigned int ioctl,
+long pcie_ioctl(struct tlkm_device *inst, struct file *fp, unsigned int ioctl,
 		unsigned long data)
 {
 	int ret = -ENXIO;
-#define _TLKM_DEV_IOCTL(NAME, name, id, dt)                                    \
+#define _PCIE_IOCTL(NAME, dt, call)                                            \
 	if (ioctl == TLKM_DEV_IOCTL_##NAME) {                                  \
 		dt d;                                                          \
 		if (copy_from_user(&d, (void __user *)data, sizeof(dt))) {     \
@@ -386,7 +570,7 @@ long pcie_ioctl(struct tlkm_device *inst, unsigned int ioctl,
 			       "could not copy ioctl data from user space");   \
 			return -EFAULT;                                        \
 		}                                                              \
-		ret = pcie_ioctl_##name(inst, &d);                             \
+		ret = call;                                                    \
 		if (copy_to_user((void __user *)data, &d, sizeof(dt))) {       \
 			DEVERR(inst->dev_id,                                   \
 			       "could not copy ioctl data to user space");     \
@@ -394,8 +578,20 @@ long pcie_ioctl(struct tlkm_device *inst, unsigned int ioctl,
 		}                                                              \
 		return ret;                                                    \
 	}
+	/* pinned buffers belong to the file which pinned them */
+	_PCIE_IOCTL(DMA_BUFFER_PIN, struct tlkm_dma_pin_cmd,
+		    pcie_ioctl_pin(inst, fp, &d))
+	_PCIE_IOCTL(DMA_BUFFER_UNPIN, struct tlkm_dma_buffer_op,
+		    pcie_ioctl_unpin(inst, fp, &d))
+	_PCIE_IOCTL(DMA_PINNED_TO_DEV, struct tlkm_dma_buffer_op,
+		    pcie_ioctl_pinned_to_dev(inst, fp, &d))
+	_PCIE_IOCTL(DMA_PINNED_FROM_DEV, struct tlkm_dma_buffer_op,
+		    pcie_ioctl_pinned_from_dev(inst, fp, &d))
+#define _TLKM_DEV_IOCTL(NAME, name, id, dt)                                    \
+	_PCIE_IOCTL(NAME, dt, pcie_ioctl_##name(inst, &d))
 	TLKM_DEV_IOCTL_CMDS
 #undef _TLKM_DEV_IOCTL
+#undef _PCIE_IOCTL
 	DEVERR(inst->dev_id, "received invalid ioctl: 0x%08x", ioctl);
 	return ret;
 }
@@ -22,7 +22,7 @@
 
 #include "tlkm_device.h"
 
-long pcie_ioctl(struct tlkm_device *inst, unsigned int ioctl,
+long pcie_ioctl(struct tlkm_device *inst, struct file *fp, unsigned int ioctl,
 		unsigned long data);
 
 #endif /* PCIE_IOCTL_H__ */
@@ -23,8 +23,11 @@
 #include <linux/version.h>
 #include <linux/atomic.h>
 #include <linux/eventfd.h>
+#include <linux/timekeeping.h>
 #include "tlkm_logging.h"
 #include "tlkm_control.h"
+#include "tlkm_perfc.h"
+#include "tlkm_trace.h"
 #include "pcie/pcie.h"
 #include "pcie/pcie_irq.h"
 #include "pcie/pcie_device.h"
@@ -64,6 +67,9 @@ irqreturn_t intr_handler_platform(int irq, void *data)
 {
 	struct tlkm_irq_mapping *mapping = (struct tlkm_irq_mapping *)data;
 	struct tlkm_pcie_device *dev = mapping->dev->private_data;
+	u64 const start = ktime_get_ns();
+	tlkm_perfc_total_irqs_inc(mapping->dev->dev_id);
+	trace_tlkm_irq_received(mapping->dev->dev_id, mapping->irq_no);
 	if (mapping->eventfd != 0) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
 		eventfd_signal(mapping->eventfd, 1);
@@ -71,6 +77,10 @@ irqreturn_t intr_handler_platform(int irq, void *data)
 		// Linux commit 3652117 removes argument from eventfd_signal
 		eventfd_signal(mapping->eventfd);
 #endif
+		tlkm_perfc_irq_eventfd_ns_record(mapping->dev->dev_id,
+						 ktime_get_ns() - start);
+		trace_tlkm_irq_eventfd_signal(mapping->dev->dev_id,
+					      mapping->irq_no);
 	}
 	dev->ack_register[0] = mapping->irq_no;
 	return IRQ_HANDLED;
@@ -39,6 +39,10 @@ long sim_ioctl_kernel_buffer_allocate(struct tlkm_device *inst, struct tlkm_gp_b
 long sim_ioctl_kernel_buffer_free(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
 long sim_ioctl_kernel_buffer_map(struct tlkm_device *inst, struct tlkm_gp_buffer_map_cmd *cmd);
 long sim_ioctl_kernel_buffer_unmap(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long sim_ioctl_dma_buffer_pin(struct tlkm_device *inst, struct tlkm_dma_pin_cmd *cmd);
+long sim_ioctl_dma_buffer_unpin(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long sim_ioctl_dma_pinned_to_dev(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long sim_ioctl_dma_pinned_from_dev(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
 
 
 static inline long sim_ioctl_info(struct tlkm_device *inst,
@@ -118,6 +122,30 @@ long sim_ioctl_kernel_buffer_unmap(struct tlkm_device *inst,
 	return -EFAULT;
 }
 
+long sim_ioctl_dma_buffer_pin(struct tlkm_device *inst,
+			      struct tlkm_dma_pin_cmd *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long sim_ioctl_dma_buffer_unpin(struct tlkm_device *inst,
+				struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long sim_ioctl_dma_pinned_to_dev(struct tlkm_device *inst,
+				 struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long sim_ioctl_dma_pinned_from_dev(struct tlkm_device *inst,
+				   struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
 static inline long sim_ioctl_bar_addr(struct tlkm_device *inst,
 				    struct tlkm_bar_addr_cmd *cmd)
 {
@@ -196,8 +224,8 @@ sim_ioctl_svm_migrate_to_ram(struct tlkm_device *inst,
 	return -EFAULT;
 }
 
-long sim_ioctl(struct tlkm_device *inst, unsigned int ioctl,
-		unsigned long data)
+long sim_ioctl(struct tlkm_device *inst, struct file *fp, unsigned int ioctl,
+	       unsigned long data)
 {
 	int ret = -ENXIO;
 #define _TLKM_DEV_IOCTL(NAME, name, id, dt)                                    \
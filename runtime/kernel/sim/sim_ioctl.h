@@ -24,6 +24,7 @@
 #define SIM_IOCTL_H__
 #include "tlkm_device.h"
 
-long sim_ioctl(struct tlkm_device *inst, unsigned int ioctl, unsigned long data);
+long sim_ioctl(struct tlkm_device *inst, struct file *fp, unsigned int ioctl,
+	       unsigned long data);
 
 #endif /* SIM_IOCTL_H__ */
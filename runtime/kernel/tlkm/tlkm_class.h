@@ -29,6 +29,7 @@
 
 struct tlkm_device;
 struct tlkm_class;
+struct file;
 
 typedef int (*tlkm_class_create_f)(struct tlkm_device *, void *data);
 typedef void (*tlkm_class_destroy_f)(struct tlkm_device *);
@@ -38,10 +39,11 @@ typedef int (*tlkm_class_probe_f)(struct tlkm_class *);
 typedef void (*tlkm_class_remove_f)(struct tlkm_class *);
 
 typedef int (*tlkm_class_miscdev_open_f)(struct tlkm_device *);
-typedef void (*tlkm_class_miscdev_close_f)(struct tlkm_device *);
+typedef void (*tlkm_class_miscdev_close_f)(struct tlkm_device *,
+					   struct file *);
 
-typedef long (*tlkm_device_ioctl_f)(struct tlkm_device *, unsigned int ioctl,
-				    unsigned long data);
+typedef long (*tlkm_device_ioctl_f)(struct tlkm_device *, struct file *fp,
+				    unsigned int ioctl, unsigned long data);
 typedef int (*tlkm_device_init_irq_f)(struct tlkm_device *,
 				      struct list_head *interrupts);
 typedef void (*tlkm_device_exit_irq_f)(struct tlkm_device *);
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2014-2020 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo 
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+//! @file	tlkm_trace.h
+//! @brief	Tracepoints of the unified TaPaSCo loadable kernel module (TLKM)
+//!		for the DMA, interrupt and ioctl paths. Enable them at run time
+//!		with perf or trace-cmd (system tlkm); disabled tracepoints
+//!		cost a single static branch.
+//!
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tlkm
+
+#if !defined(TLKM_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define TLKM_TRACE_H__
+
+#include <linux/ioctl.h>
+#include <linux/tracepoint.h>
+#include "tlkm_types.h"
+
+DECLARE_EVENT_CLASS(tlkm_dma_chunk,
+	TP_PROTO(dev_id_t dev_id, bool to_dev, u64 chunk, u32 slot, size_t sz),
+	TP_ARGS(dev_id, to_dev, chunk, slot, sz),
+	TP_STRUCT__entry(
+		__field(dev_id_t, dev_id)
+		__field(bool, to_dev)
+		__field(u64, chunk)
+		__field(u32, slot)
+		__field(size_t, sz)
+	),
+	TP_fast_assign(
+		__entry->dev_id = dev_id;
+		__entry->to_dev = to_dev;
+		__entry->chunk = chunk;
+		__entry->slot = slot;
+		__entry->sz = sz;
+	),
+	TP_printk("dev=%u dir=%s chunk=%llu slot=%u size=%zu",
+		  __entry->dev_id, __entry->to_dev ? "to_dev" : "from_dev",
+		  (unsigned long long)__entry->chunk, __entry->slot,
+		  __entry->sz)
+);
+
+//! DMA chunk has been handed to the DMA engine.
+DEFINE_EVENT(tlkm_dma_chunk, tlkm_dma_chunk_enqueue,
+	TP_PROTO(dev_id_t dev_id, bool to_dev, u64 chunk, u32 slot, size_t sz),
+	TP_ARGS(dev_id, to_dev, chunk, slot, sz)
+);
+
+//! DMA engine reported completion of a chunk; its slot may be reused.
+DEFINE_EVENT(tlkm_dma_chunk, tlkm_dma_chunk_complete,
+	TP_PROTO(dev_id_t dev_id, bool to_dev, u64 chunk, u32 slot, size_t sz),
+	TP_ARGS(dev_id, to_dev, chunk, slot, sz)
+);
+
+DECLARE_EVENT_CLASS(tlkm_irq,
+	TP_PROTO(dev_id_t dev_id, int irq_no),
+	TP_ARGS(dev_id, irq_no),
+	TP_STRUCT__entry(
+		__field(dev_id_t, dev_id)
+		__field(int, irq_no)
+	),
+	TP_fast_assign(
+		__entry->dev_id = dev_id;
+		__entry->irq_no = irq_no;
+	),
+	TP_printk("dev=%u irq_no=%d", __entry->dev_id, __entry->irq_no)
+);
+
+//! Interrupt of a PE has been received by the handler.
+DEFINE_EVENT(tlkm_irq, tlkm_irq_received,
+	TP_PROTO(dev_id_t dev_id, int irq_no),
+	TP_ARGS(dev_id, irq_no)
+);
+
+//! Eventfd registered for the interrupt has been signalled.
+DEFINE_EVENT(tlkm_irq, tlkm_irq_eventfd_signal,
+	TP_PROTO(dev_id_t dev_id, int irq_no),
+	TP_ARGS(dev_id, irq_no)
+);
+
+TRACE_EVENT(tlkm_ioctl_enter,
+	TP_PROTO(dev_id_t dev_id, unsigned int cmd),
+	TP_ARGS(dev_id, cmd),
+	TP_STRUCT__entry(
+		__field(dev_id_t, dev_id)
+		__field(unsigned int, cmd)
+	),
+	TP_fast_assign(
+		__entry->dev_id = dev_id;
+		__entry->cmd = cmd;
+	),
+	TP_printk("dev=%u cmd=0x%x nr=%u", __entry->dev_id, __entry->cmd,
+		  _IOC_NR(__entry->cmd))
+);
+
+TRACE_EVENT(tlkm_ioctl_exit,
+	TP_PROTO(dev_id_t dev_id, unsigned int cmd, long ret),
+	TP_ARGS(dev_id, cmd, ret),
+	TP_STRUCT__entry(
+		__field(dev_id_t, dev_id)
+		__field(unsigned int, cmd)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->dev_id = dev_id;
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+	TP_printk("dev=%u cmd=0x%x nr=%u ret=%ld", __entry->dev_id,
+		  __entry->cmd, _IOC_NR(__entry->cmd), __entry->ret)
+);
+
+#endif /* TLKM_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tlkm_trace
+#include <trace/define_trace.h>
@@ -65,12 +65,31 @@ struct tlkm_dma_buffer_allocate {
 	bool from_device;
 	size_t buffer_id;
 	int64_t addr;
+	/* set by the driver if the buffer needs no explicit cache syncs */
+	bool coherent;
 };
 
 struct tlkm_dma_buffer_op {
 	size_t buffer_id;
 };
 
+struct tlkm_dma_segment {
+	uint64_t addr;
+	uint64_t len;
+};
+
+struct tlkm_dma_pin_cmd {
+	uint64_t user_addr;
+	uint64_t len;
+	/* user space array of struct tlkm_dma_segment filled by the driver */
+	uint64_t segments;
+	size_t max_segments;
+	size_t num_segments;
+	size_t buffer_id;
+	/* set by the driver if the pages need no explicit cache syncs */
+	bool coherent;
+};
+
 struct tlkm_gp_buffer_allocate_cmd {
 	size_t size;
 	size_t buffer_id;
@@ -133,6 +152,14 @@ struct tlkm_svm_migrate_cmd {
 			struct tlkm_gp_buffer_map_cmd)                         \
 	_TLKM_DEV_IOCTL(KERNEL_BUFFER_UNMAP, kernel_buffer_unmap, 0x47,        \
 			struct tlkm_dma_buffer_op)                             \
+	_TLKM_DEV_IOCTL(DMA_BUFFER_PIN, dma_buffer_pin, 0x48,                  \
+			struct tlkm_dma_pin_cmd)                               \
+	_TLKM_DEV_IOCTL(DMA_BUFFER_UNPIN, dma_buffer_unpin, 0x49,              \
+			struct tlkm_dma_buffer_op)                             \
+	_TLKM_DEV_IOCTL(DMA_PINNED_TO_DEV, dma_pinned_to_dev, 0x4A,            \
+			struct tlkm_dma_buffer_op)                             \
+	_TLKM_DEV_IOCTL(DMA_PINNED_FROM_DEV, dma_pinned_from_dev, 0x4B,        \
+			struct tlkm_dma_buffer_op)                             \
 	_TLKM_DEV_IOCTL(PCIE_BAR_ADDR, bar_addr, 0x4F,                         \
 			struct tlkm_bar_addr_cmd)                              \
 	_TLKM_DEV_IOCTL(SVM_LAUNCH, svm_launch, 0x50,                          \
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2014-2020 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo 
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+//! @file	tlkm_perfc_layout.h
+//! @brief	Binary layout of the performance counter files, which can be
+//!             mapped read-only by userspace (see TLKM_DEV_PERFC_FN).
+//!
+//!             The mapping starts with a struct tlkm_perfc_header, followed
+//!             by the names of all counters and then of all histograms as
+//!             consecutive NUL-terminated strings at names_offset.
+//!             At blocks_offset there is one block per possible CPU, each
+//!             cpu_stride bytes apart. A block holds num_counters u64
+//!             counters, followed by num_histograms histograms of
+//!             hist_buckets u64 buckets each. The value of a counter is the
+//!             sum over all CPU blocks.
+//!
+//!             Histograms count latencies in ns: bucket 0 counts values of
+//!             0, bucket b > 0 counts values in [2^(b-1), 2^b); the last
+//!             bucket also counts all larger values.
+//!
+//!             The counters are updated without any synchronization with the
+//!             readers of the mapping. On 32-bit hosts (e.g. Zynq) a u64 is
+//!             written as two words, so a read can tear when the lower word
+//!             wraps and yield a value off by 2^32. Readers there should treat
+//!             a value that went backwards or jumped by about 2^32 as torn
+//!             and read it again.
+//!
+#ifndef TLKM_PERFC_LAYOUT_H__
+#define TLKM_PERFC_LAYOUT_H__
+
+#include "tlkm_types.h"
+
+#define TLKM_PERFC_MAGIC 0x50455246 /* "PERF" */
+#define TLKM_PERFC_LAYOUT_VERSION 1
+#define TLKM_PERFC_HIST_BUCKETS 64
+
+struct tlkm_perfc_header {
+	u32 magic;
+	u32 version;
+	u32 num_cpus;
+	u32 num_counters;
+	u32 num_histograms;
+	u32 hist_buckets;
+	u64 names_offset;
+	u64 blocks_offset;
+	u64 cpu_stride;
+};
+
+inline static const volatile u64 *
+tlkm_perfc_cpu_block(const struct tlkm_perfc_header *hdr, u32 cpu)
+{
+	return (const volatile u64 *)((const char *)hdr + hdr->blocks_offset +
+				      cpu * hdr->cpu_stride);
+}
+
+inline static const volatile u64 *
+tlkm_perfc_cpu_hist(const struct tlkm_perfc_header *hdr, u32 cpu, u32 hist)
+{
+	return tlkm_perfc_cpu_block(hdr, cpu) + hdr->num_counters +
+	       hist * hdr->hist_buckets;
+}
+
+#endif /* TLKM_PERFC_LAYOUT_H__ */
@@ -37,6 +37,10 @@ long zynq_ioctl_kernel_buffer_allocate(struct tlkm_device *inst, struct tlkm_gp_
 long zynq_ioctl_kernel_buffer_free(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
 long zynq_ioctl_kernel_buffer_map(struct tlkm_device *inst, struct tlkm_gp_buffer_map_cmd *cmd);
 long zynq_ioctl_kernel_buffer_unmap(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long zynq_ioctl_dma_buffer_pin(struct tlkm_device *inst, struct tlkm_dma_pin_cmd *cmd);
+long zynq_ioctl_dma_buffer_unpin(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long zynq_ioctl_dma_pinned_to_dev(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
+long zynq_ioctl_dma_pinned_from_dev(struct tlkm_device *inst, struct tlkm_dma_buffer_op *cmd);
 
 static inline long zynq_ioctl_info(struct tlkm_device *inst,
 				   struct tlkm_device_info *info)
@@ -115,6 +119,30 @@ long zynq_ioctl_kernel_buffer_unmap(struct tlkm_device *inst,
 	return -EFAULT;
 }
 
+long zynq_ioctl_dma_buffer_pin(struct tlkm_device *inst,
+			       struct tlkm_dma_pin_cmd *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long zynq_ioctl_dma_buffer_unpin(struct tlkm_device *inst,
+				 struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long zynq_ioctl_dma_pinned_to_dev(struct tlkm_device *inst,
+				  struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
+long zynq_ioctl_dma_pinned_from_dev(struct tlkm_device *inst,
+				    struct tlkm_dma_buffer_op *cmd)
+{
+	return -EOPNOTSUPP;
+}
+
 static inline long zynq_ioctl_bar_addr(struct tlkm_device *inst,
 				    struct tlkm_bar_addr_cmd *cmd)
 {
@@ -303,7 +331,7 @@ zynq_ioctl_svm_migrate_to_ram(struct tlkm_device *inst,
 	return -EFAULT;
 }
 
-long zynq_ioctl(struct tlkm_device *inst, unsigned int ioctl,
+long zynq_ioctl(struct tlkm_device *inst, struct file *fp, unsigned int ioctl,
 		unsigned long data)
 {
 	int ret = -ENXIO;
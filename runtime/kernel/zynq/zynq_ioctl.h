@@ -22,6 +22,7 @@
 
 #include "tlkm_device.h"
 
-long zynq_ioctl(struct tlkm_device *inst, unsigned ioctl, unsigned long data);
+long zynq_ioctl(struct tlkm_device *inst, struct file *fp, unsigned ioctl,
+		unsigned long data);
 
 #endif /* ZYNQ_IOCTL_H__ */
@@ -25,7 +25,10 @@
 #include <linux/of.h>
 #include <linux/of_irq.h>
 #include <linux/eventfd.h>
+#include <linux/timekeeping.h>
 #include "tlkm_logging.h"
+#include "tlkm_perfc.h"
+#include "tlkm_trace.h"
 #include "tlkm_slots.h"
 #include "zynq_irq.h"
 
@@ -36,6 +39,7 @@ static irqreturn_t zynq_irq_handler(int irq, void *data)
 	struct zynq_irq_mapping *mapping = (struct zynq_irq_mapping *)data;
 	struct tlkm_irq_mapping *m_start = mapping->mapping;
 
+	u64 const start = ktime_get_ns();
 	u32 status;
 	u32 s_off = mapping->start;
 
@@ -63,12 +67,20 @@ static irqreturn_t zynq_irq_handler(int irq, void *data)
 				}
 			}
 			if (m_start->irq_no == slot) {
+				trace_tlkm_irq_received(m_start->dev->dev_id,
+							m_start->irq_no);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
 				eventfd_signal(m_start->eventfd, 1);
 #else
 				// Linux commit 3652117 removes argument from eventfd_signal
 				eventfd_signal(m_start->eventfd);
 #endif
+				tlkm_perfc_total_irqs_inc(m_start->dev->dev_id);
+				tlkm_perfc_irq_eventfd_ns_record(
+					m_start->dev->dev_id,
+					ktime_get_ns() - start);
+				trace_tlkm_irq_eventfd_signal(
+					m_start->dev->dev_id, m_start->irq_no);
 			} else {
 				// Got interrupt for unregistered interrupt
 				LOG(TLKM_LF_IRQ,
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014-2023 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//! Micro benchmarks comparing the tree based `GenericAllocator` with the list based
+//! `FirstFitAllocator`. Run with `cargo bench --bench allocator`.
+
+use std::time::Instant;
+use tapasco::allocator::{Allocator, FirstFitAllocator, GenericAllocator};
+
+const MEMORY_SIZE: u64 = 4 * 1024 * 1024 * 1024;
+const ALIGNMENT: u64 = 64;
+const ROUNDS: usize = 100_000;
+
+/// Simple deterministic generator so both allocators see the same request stream.
+struct Lcg(u64);
+
+impl Lcg {
+    fn next(&mut self) -> u64 {
+        self.0 = self
+            .0
+            .wrapping_mul(6364136223846793005)
+            .wrapping_add(1442695040888963407);
+        self.0 >> 33
+    }
+}
+
+/// Keep `live` buffers allocated and replace a random one in every round.
+fn churn(a: &mut dyn Allocator, live: usize) -> f64 {
+    let mut rng = Lcg(42);
+    let mut buffers: Vec<u64> = (0..live)
+        .map(|_| a.allocate(4096 + rng.next() % (1 << 20), None).unwrap())
+        .collect();
+
+    let start = Instant::now();
+    for _ in 0..ROUNDS {
+        let i = rng.next() as usize % buffers.len();
+        a.free(buffers[i]).unwrap();
+        buffers[i] = a.allocate(4096 + rng.next() % (1 << 20), None).unwrap();
+    }
+    let ns = start.elapsed().as_nanos() as f64 / ROUNDS as f64;
+
+    for b in buffers {
+        a.free(b).unwrap();
+    }
+    ns
+}
+
+fn main() {
+    println!("Live buffers,FirstFitAllocator [ns/op],GenericAllocator [ns/op]");
+    for live in [16, 256, 1024, 4096] {
+        let mut first_fit = FirstFitAllocator::new(0, MEMORY_SIZE, ALIGNMENT).unwrap();
+        let mut generic = GenericAllocator::new(0, MEMORY_SIZE, ALIGNMENT).unwrap();
+        let f = churn(&mut first_fit, live);
+        let g = churn(&mut generic, live);
+        println!("{},{:.1},{:.1}", live, f, g);
+    }
+}
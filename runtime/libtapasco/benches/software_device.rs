@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//! Host overhead of jobs measured on an in-process software device, so no hardware is
+//! needed. The PEs return immediately, the times are spent in the runtime.
+//! Run with `cargo bench --bench software_device`.
+
+use std::collections::HashMap;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tapasco::device::{DataTransferAlloc, Device, PEParameter};
+use tapasco::software_device::{PEContext, SoftwareDeviceConfig};
+use tapasco::tlkm::tlkm_access;
+
+const PE_ID: usize = 14;
+const ROUNDS: usize = 10_000;
+
+fn device() -> Device {
+    let mut config = SoftwareDeviceConfig::default();
+    config.add_pe(
+        PE_ID,
+        "counter",
+        4,
+        Duration::ZERO,
+        Arc::new(|ctx: &PEContext| ctx.arg(0) + 1),
+    );
+    let mut device = Device::new_software(0, config, &HashMap::new()).unwrap();
+    device
+        .change_access(tlkm_access::TlkmAccessExclusive)
+        .unwrap();
+    device
+}
+
+/// Mean time of acquire, start and release of a job in ns.
+fn round_trip(device: &Device, args: impl Fn() -> Vec<PEParameter>) -> f64 {
+    let start = Instant::now();
+    for _ in 0..ROUNDS {
+        let mut job = device.acquire_pe(PE_ID).unwrap();
+        job.start(args()).unwrap();
+        job.release(true, true).unwrap();
+    }
+    start.elapsed().as_nanos() as f64 / ROUNDS as f64
+}
+
+fn main() {
+    let device = device();
+    let memory = device.default_memory().unwrap();
+
+    println!("Arguments,Round trip [ns/job]");
+    let scalar = round_trip(&device, || vec![PEParameter::Single64(42)]);
+    println!("1 scalar,{:.1}", scalar);
+    for len in [4096, 65536, 1 << 20] {
+        let t = round_trip(&device, || {
+            vec![PEParameter::DataTransferAlloc(DataTransferAlloc {
+                data: vec![0u8; len].into_boxed_slice(),
+                from_device: true,
+                to_device: true,
+                free: true,
+                memory: memory.clone(),
+                fixed: None,
+            })]
+        });
+        println!("{} B in/out,{:.1}", len, t);
+    }
+}
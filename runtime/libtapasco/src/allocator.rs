@@ -26,6 +26,7 @@ use crate::tlkm::tlkm_mm_cmd;
 use crate::vfio::*;
 use core::fmt::Debug;
 use snafu::ResultExt;
+use std::collections::{BTreeMap, BTreeSet, HashMap};
 use std::fs::File;
 use std::os::unix::prelude::*;
 use std::sync::Arc;
@@ -53,9 +54,25 @@ pub enum Error {
     VfioError {func: String},
     #[snafu(display("VFIO allocator requires va argument, none given"))]
     VfioNoVa {},
+    #[snafu(display("Could not acquire allocator lock."))]
+    MutexError {},
+    #[snafu(display("Buffer pool error: {}", source))]
+    BufferPoolError { source: crate::buffer_pool::Error },
 }
 type Result<T, E = Error> = std::result::Result<T, E>;
 
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
+}
+
+impl From<crate::buffer_pool::Error> for Error {
+    fn from(source: crate::buffer_pool::Error) -> Self {
+        Self::BufferPoolError { source }
+    }
+}
+
 /// Basic trait that allows memory allocations
 ///
 /// Allocate returns a valid allocation of the given size in device address space.
@@ -68,24 +85,162 @@ pub trait Allocator: Debug {
     fn free(&mut self, ptr: DeviceAddress) -> Result<()>;
 }
 
+/// Allocator for host handled device memory
+///
+/// Free segments are kept in two ordered trees: one sorted by address to find neighbours
+/// for coalescing and segments for fixed allocations, one sorted by size to find the
+/// smallest segment that fits (lowest address on ties). Allocated segments are kept in
+/// a hash map. Allocation and free are O(log n) in the number of free segments.
+/// Supports memory alignment on byte granularity.
+#[derive(Debug, Getters)]
+pub struct GenericAllocator {
+    free_by_addr: BTreeMap<DeviceAddress, DeviceSize>,
+    free_by_size: BTreeSet<(DeviceSize, DeviceAddress)>,
+    memory_used: HashMap<DeviceAddress, DeviceSize>,
+    alignment: DeviceSize,
+}
+
+impl GenericAllocator {
+    /// Generate a new allocator with the given size and alignment
+    ///
+    /// The address parameter can be used to offset all returned addresses.
+    pub fn new(
+        address: DeviceAddress,
+        size: DeviceSize,
+        alignment: DeviceSize,
+    ) -> Result<Self> {
+        if size == 0 {
+            return Err(Error::InvalidSize { size });
+        }
+        if alignment == 0 {
+            return Err(Error::InvalidAlignment {
+                alignment
+            });
+        }
+        let mut a = Self {
+            free_by_addr: BTreeMap::new(),
+            free_by_size: BTreeSet::new(),
+            memory_used: HashMap::new(),
+            alignment,
+        };
+        a.insert_free(address, size);
+        Ok(a)
+    }
+
+    const fn fix_alignment(&self, size: DeviceSize) -> DeviceSize {
+        // Works for 64 bit values, prone to overflow on 32 bit
+        (size + (self.alignment - 1)) & !(self.alignment - 1)
+    }
+
+    fn insert_free(&mut self, base: DeviceAddress, size: DeviceSize) {
+        if size > 0 {
+            self.free_by_addr.insert(base, size);
+            self.free_by_size.insert((size, base));
+        }
+    }
+
+    fn remove_free(&mut self, base: DeviceAddress, size: DeviceSize) {
+        self.free_by_addr.remove(&base);
+        self.free_by_size.remove(&(size, base));
+    }
+}
+
+impl Allocator for GenericAllocator {
+    fn allocate(&mut self, size: DeviceSize, _va: Option<u64>) -> Result<DeviceAddress> {
+        if size == 0 {
+            return Err(Error::InvalidSize { size });
+        }
+        trace!("Looking for free memory.");
+        let size_aligned = self.fix_alignment(size);
+        match self.free_by_size.range((size_aligned, 0)..).next().copied() {
+            Some((s, base)) => {
+                trace!("Found free space in segment 0x{:x} ({}B).", base, s);
+                self.remove_free(base, s);
+                self.insert_free(base + size_aligned, s - size_aligned);
+                self.memory_used.insert(base, size_aligned);
+                Ok(base)
+            }
+            None => Err(Error::OutOfMemory { size: size_aligned }),
+        }
+    }
+
+    fn allocate_fixed(&mut self, size: DeviceSize, offset: DeviceAddress) -> Result<DeviceAddress> {
+        if size == 0 {
+            return Err(Error::InvalidSize { size });
+        }
+        trace!("Looking for free memory at offset 0x{:x}.", offset);
+        let size_aligned = self.fix_alignment(size);
+        match self.free_by_addr.range(..=offset).next_back().map(|(&b, &s)| (b, s)) {
+            Some((base, s)) if base + s >= offset && base + s - offset >= size_aligned => {
+                trace!("Found fixed free space in segment 0x{:x} ({}B).", base, s);
+                self.remove_free(base, s);
+                self.insert_free(base, offset - base);
+                self.insert_free(offset + size_aligned, base + s - (offset + size_aligned));
+                self.memory_used.insert(offset, size_aligned);
+                Ok(offset)
+            }
+            _ => {
+                trace!(
+                    "Could not find free memory {}B @ {:x}: {:?}.",
+                    size_aligned,
+                    offset,
+                    self
+                );
+                Err(Error::FixedNotAvailable {
+                    size: size_aligned,
+                    offset,
+                })
+            }
+        }
+    }
+
+    fn free(&mut self, ptr: DeviceAddress) -> Result<()> {
+        let size = match self.memory_used.remove(&ptr) {
+            Some(s) => s,
+            None => return Err(Error::UnknownMemory { ptr }),
+        };
+        trace!("Freeing memory segment 0x{:x} ({}B).", ptr, size);
+        let mut base = ptr;
+        let mut merged = size;
+        if let Some((lb, ls)) = self.free_by_addr.range(..ptr).next_back().map(|(&b, &s)| (b, s)) {
+            if lb + ls == ptr {
+                trace!("Merging with left neighbour 0x{:x}.", lb);
+                self.remove_free(lb, ls);
+                base = lb;
+                merged += ls;
+            }
+        }
+        if let Some(rs) = self.free_by_addr.get(&(ptr + size)).copied() {
+            trace!("Merging with right neighbour 0x{:x}.", ptr + size);
+            self.remove_free(ptr + size, rs);
+            merged += rs;
+        }
+        self.insert_free(base, merged);
+        Ok(())
+    }
+}
+
 #[derive(Debug, Getters, Copy, Clone)]
 struct MemoryFree {
     base: DeviceAddress,
     size: DeviceSize,
 }
-/// Simple allocator for host handled device memory
+/// List based first fit allocator for host handled device memory
 ///
 /// Simply finds the first free memory on the device and returns it.
 /// Keeps track of allocated and free memory through lists.
 /// Supports memory alignment on byte granularity.
+///
+/// Allocation and free are linear in the number of segments. This was the original
+/// implementation of [`GenericAllocator`] and is kept as a reference for benchmarks.
 #[derive(Debug, Getters)]
-pub struct GenericAllocator {
+pub struct FirstFitAllocator {
     memory_free: Vec<MemoryFree>,
     memory_used: Vec<MemoryFree>,
     alignment: DeviceSize,
 }
 
-impl GenericAllocator {
+impl FirstFitAllocator {
     /// Generate a new allocator with the given size and alignment
     ///
     /// The address parameter can be used to offset all returned addresses.
@@ -140,7 +295,7 @@ impl GenericAllocator {
     }
 }
 
-impl Allocator for GenericAllocator {
+impl Allocator for FirstFitAllocator {
     fn allocate(&mut self, size: DeviceSize, _va: Option<u64>) -> Result<DeviceAddress> {
         if size == 0 {
             return Err(Error::InvalidSize { size });
@@ -477,6 +632,70 @@ mod allocator_tests {
         Ok(())
     }
 
+    #[test]
+    fn free_merges_both_neighbours() -> Result<()> {
+        init();
+        let mut a = GenericAllocator::new(0, 1024, 64)?;
+        let m0 = a.allocate(256, None)?;
+        let m1 = a.allocate(256, None)?;
+        let m2 = a.allocate(256, None)?;
+        assert_eq!(a.free(m0), Ok(()));
+        assert_eq!(a.free(m2), Ok(()));
+        assert_eq!(a.allocate(768, None), Err(Error::OutOfMemory { size: 768 }));
+        assert_eq!(a.free(m1), Ok(()));
+        let m3 = a.allocate(1024, None)?;
+        assert_eq!(m3, 0);
+        Ok(())
+    }
+
+    #[test]
+    fn allocate_best_fit() -> Result<()> {
+        init();
+        let mut a = GenericAllocator::new(0, 4096, 64)?;
+        let m0 = a.allocate(512, None)?;
+        let _m1 = a.allocate(64, None)?;
+        let m2 = a.allocate(128, None)?;
+        let _m3 = a.allocate(64, None)?;
+        assert_eq!(a.free(m0), Ok(()));
+        assert_eq!(a.free(m2), Ok(()));
+        // Smallest fitting segment is used instead of the first one
+        assert_eq!(a.allocate(128, None)?, m2);
+        assert_eq!(a.allocate(512, None)?, m0);
+        Ok(())
+    }
+
+    #[test]
+    fn random_allocate_free() -> Result<()> {
+        init();
+        let size = 1 << 20;
+        let mut a = GenericAllocator::new(0x1000, size, 64)?;
+        let mut live: Vec<(u64, u64)> = Vec::new();
+        let mut seed: u64 = 42;
+        for _ in 0..10000 {
+            seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+            let r = seed >> 33;
+            if r % 3 != 0 || live.is_empty() {
+                let len = 1 + r % 4096;
+                if let Ok(m) = a.allocate(len, None) {
+                    let len = (len + 63) & !63;
+                    for (b, l) in &live {
+                        assert!(m + len <= *b || b + l <= m);
+                    }
+                    assert!(m >= 0x1000 && m + len <= 0x1000 + size);
+                    live.push((m, len));
+                }
+            } else {
+                let (m, _) = live.swap_remove((r as usize / 3) % live.len());
+                assert_eq!(a.free(m), Ok(()));
+            }
+        }
+        for (m, _) in live {
+            assert_eq!(a.free(m), Ok(()));
+        }
+        assert_eq!(a.allocate(size, None)?, 0x1000);
+        Ok(())
+    }
+
     #[test]
     fn vfio_alloc() -> Result<()> {
         init();
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+use crate::device::DeviceAddress;
+use crate::device::DeviceSize;
+use std::collections::HashSet;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+
+#[derive(Debug, Snafu, PartialEq)]
+pub enum Error {
+    #[snafu(display("Could not acquire buffer pool lock."))]
+    MutexError {},
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
+}
+
+/// Size of the smallest size class. Smaller requests are rounded up to this size.
+const MIN_CLASS_SIZE: DeviceSize = 4096;
+/// Size classes per power of two. Limits the rounding overhead to 25%.
+const CLASSES_PER_POW2: u32 = 4;
+
+/// Returns the index and size of the size class a request of `size` bytes falls into.
+fn size_class(size: DeviceSize) -> (usize, DeviceSize) {
+    if size <= MIN_CLASS_SIZE {
+        return (0, MIN_CLASS_SIZE);
+    }
+    let s = size - 1;
+    let p = 63 - s.leading_zeros();
+    let shift = p - CLASSES_PER_POW2.trailing_zeros();
+    let sub = (s >> shift) - CLASSES_PER_POW2 as u64;
+    let first_p = 63 - MIN_CLASS_SIZE.leading_zeros();
+    let index = 1 + ((p - first_p) * CLASSES_PER_POW2) as usize + sub as usize;
+    (index, (CLASSES_PER_POW2 as u64 + sub + 1) << shift)
+}
+
+/// Usage statistics of a [`BufferPool`].
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct BufferPoolStats {
+    /// Bytes currently held in the pool.
+    pub cached_bytes: DeviceSize,
+    /// Number of buffers currently held in the pool.
+    pub cached_buffers: u64,
+    /// Allocations served from the pool.
+    pub hits: u64,
+    /// Poolable allocations that had to go to the allocator.
+    pub misses: u64,
+}
+
+/// Buffers of one size class.
+#[derive(Debug, Default)]
+struct SizeClass {
+    /// Freed buffers kept for reuse.
+    cached: Vec<DeviceAddress>,
+    /// Buffers of this class currently in use.
+    live: HashSet<DeviceAddress>,
+}
+
+/// Cache of recently freed device buffers in front of an [`Allocator`].
+///
+/// Poolable requests are rounded up to a size class. On free the buffer is kept in a
+/// per class free list instead of being returned to the allocator, so that recurring
+/// transfer sizes are served without taking the allocator lock. Every class has its own
+/// lock which also protects the set of its buffers in use, there is no lock shared by all
+/// classes. The amount of cached memory is bounded by a high-water mark in bytes and a
+/// maximum number of buffers per class. Buffers above the high-water mark go back to the
+/// allocator on free.
+///
+/// The pool only does the bookkeeping, [`OffchipMemory`] moves buffers between the pool
+/// and the allocator.
+///
+/// [`Allocator`]: ../allocator/trait.Allocator.html
+/// [`OffchipMemory`]: ../device/struct.OffchipMemory.html
+#[derive(Debug)]
+pub struct BufferPool {
+    classes: Vec<Mutex<SizeClass>>,
+    cached_bytes: AtomicU64,
+    max_cached_bytes: AtomicU64,
+    max_buffers_per_class: usize,
+    max_buffer_size: DeviceSize,
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+impl BufferPool {
+    /// Create a pool for buffers of up to `max_buffer_size` bytes.
+    ///
+    /// # Arguments
+    ///  * `max_cached_bytes`: High-water mark of memory kept in the pool. 0 disables caching.
+    ///  * `max_buffers_per_class`: Maximum number of buffers kept per size class.
+    ///  * `max_buffer_size`: Larger requests bypass the pool.
+    pub fn new(
+        max_cached_bytes: DeviceSize,
+        max_buffers_per_class: usize,
+        max_buffer_size: DeviceSize,
+    ) -> BufferPool {
+        let num_classes = size_class(max_buffer_size.max(1)).0 + 1;
+        BufferPool {
+            classes: (0..num_classes)
+                .map(|_| Mutex::new(SizeClass::default()))
+                .collect(),
+            cached_bytes: AtomicU64::new(0),
+            max_cached_bytes: AtomicU64::new(max_cached_bytes),
+            max_buffers_per_class,
+            max_buffer_size,
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns the size class for a request of `size` bytes or `None` if the request
+    /// bypasses the pool.
+    pub fn class_of(&self, size: DeviceSize) -> Option<(usize, DeviceSize)> {
+        if self.max_cached_bytes.load(Ordering::Relaxed) == 0 {
+            return None;
+        }
+        self.tracked_class_of(size)
+    }
+
+    /// Size class a buffer of `size` bytes has been tracked in if it was allocated while
+    /// caching was enabled.
+    fn tracked_class_of(&self, size: DeviceSize) -> Option<(usize, DeviceSize)> {
+        if size == 0 || size > self.max_buffer_size {
+            return None;
+        }
+        Some(size_class(size))
+    }
+
+    /// Take a cached buffer of the given class. The buffer is tracked as in use.
+    pub fn take(&self, class: (usize, DeviceSize)) -> Result<Option<DeviceAddress>> {
+        let mut c = self.classes[class.0].lock()?;
+        match c.cached.pop() {
+            Some(a) => {
+                c.live.insert(a);
+                self.cached_bytes.fetch_sub(class.1, Ordering::Relaxed);
+                self.hits.fetch_add(1, Ordering::Relaxed);
+                Ok(Some(a))
+            }
+            None => {
+                self.misses.fetch_add(1, Ordering::Relaxed);
+                Ok(None)
+            }
+        }
+    }
+
+    /// Track a buffer of the given class freshly allocated from the allocator.
+    pub fn track(&self, addr: DeviceAddress, class: usize) -> Result<()> {
+        self.classes[class].lock()?.live.insert(addr);
+        Ok(())
+    }
+
+    /// Try to keep a freed buffer in the pool.
+    ///
+    /// `size` is the size the buffer was requested with, if known. Only the class of that
+    /// size is locked then. Otherwise, or if the buffer is not found in that class, all
+    /// classes are searched.
+    ///
+    /// Returns false if the buffer was not allocated through the pool or the pool is full.
+    /// The caller has to return the buffer to the allocator in that case.
+    pub fn put(&self, addr: DeviceAddress, size: Option<DeviceSize>) -> Result<bool> {
+        let hint = size.and_then(|s| self.tracked_class_of(s)).map(|c| c.0);
+        if let Some(class) = hint {
+            if let Some(r) = self.put_tracked(addr, class)? {
+                return Ok(r);
+            }
+        }
+        for class in (0..self.classes.len()).filter(|c| Some(*c) != hint) {
+            if let Some(r) = self.put_tracked(addr, class)? {
+                return Ok(r);
+            }
+        }
+        Ok(false)
+    }
+
+    /// Put `addr` into the cache of `class` if it is in use in this class.
+    ///
+    /// Returns None if the buffer is not tracked in this class, otherwise whether it is
+    /// kept in the pool.
+    fn put_tracked(&self, addr: DeviceAddress, class: usize) -> Result<Option<bool>> {
+        let mut c = self.classes[class].lock()?;
+        if !c.live.remove(&addr) {
+            return Ok(None);
+        }
+        if c.cached.len() >= self.max_buffers_per_class {
+            return Ok(Some(false));
+        }
+        let class_size = Self::class_size(class);
+        let max = self.max_cached_bytes.load(Ordering::Relaxed);
+        if self.cached_bytes.fetch_add(class_size, Ordering::Relaxed) + class_size > max {
+            self.cached_bytes.fetch_sub(class_size, Ordering::Relaxed);
+            return Ok(Some(false));
+        }
+        c.cached.push(addr);
+        Ok(Some(true))
+    }
+
+    /// Remove cached buffers until at most `keep_bytes` remain in the pool, starting with
+    /// the largest class. Returns the removed buffers which have to be returned to the
+    /// allocator by the caller.
+    pub fn drain(&self, keep_bytes: DeviceSize) -> Result<Vec<DeviceAddress>> {
+        let mut r = Vec::new();
+        for (class, c) in self.classes.iter().enumerate().rev() {
+            let class_size = Self::class_size(class);
+            let mut c = c.lock()?;
+            while self.cached_bytes.load(Ordering::Relaxed) > keep_bytes {
+                match c.cached.pop() {
+                    Some(a) => {
+                        self.cached_bytes.fetch_sub(class_size, Ordering::Relaxed);
+                        r.push(a);
+                    }
+                    None => break,
+                }
+            }
+        }
+        Ok(r)
+    }
+
+    /// Change the high-water mark. Buffers above the new mark are not removed, use
+    /// [`drain`] for that.
+    ///
+    /// [`drain`]: #method.drain
+    pub fn set_max_cached_bytes(&self, max_cached_bytes: DeviceSize) {
+        self.max_cached_bytes
+            .store(max_cached_bytes, Ordering::Relaxed);
+    }
+
+    pub fn max_cached_bytes(&self) -> DeviceSize {
+        self.max_cached_bytes.load(Ordering::Relaxed)
+    }
+
+    pub fn stats(&self) -> Result<BufferPoolStats> {
+        let mut cached_buffers = 0;
+        for c in self.classes.iter() {
+            cached_buffers += c.lock()?.cached.len() as u64;
+        }
+        Ok(BufferPoolStats {
+            cached_bytes: self.cached_bytes.load(Ordering::Relaxed),
+            cached_buffers,
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+        })
+    }
+
+    fn class_size(class: usize) -> DeviceSize {
+        if class == 0 {
+            return MIN_CLASS_SIZE;
+        }
+        let first_p = 63 - MIN_CLASS_SIZE.leading_zeros();
+        let p = first_p + (class as u32 - 1) / CLASSES_PER_POW2;
+        let sub = ((class - 1) as u32 % CLASSES_PER_POW2) as u64;
+        (CLASSES_PER_POW2 as u64 + sub + 1) << (p - CLASSES_PER_POW2.trailing_zeros())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn size_classes() {
+        assert_eq!(size_class(1), (0, 4096));
+        assert_eq!(size_class(4096), (0, 4096));
+        assert_eq!(size_class(4097), (1, 5120));
+        assert_eq!(size_class(8192), (4, 8192));
+        assert_eq!(size_class(8193), (5, 10240));
+        for size in (1..(1 << 24)).step_by(977) {
+            let (class, class_size) = size_class(size);
+            assert!(class_size >= size);
+            assert!(class_size <= (size + size / 4).max(MIN_CLASS_SIZE));
+            assert_eq!(BufferPool::class_size(class), class_size);
+        }
+    }
+
+    #[test]
+    fn reuse_and_high_water() -> Result<()> {
+        let p = BufferPool::new(3 * 8192, 8, 1 << 20);
+        let c = p.class_of(8000).unwrap();
+        assert_eq!(p.take(c)?, None);
+        for a in 0..4 {
+            p.track(a * 8192, c.0)?;
+        }
+        assert!(p.put(0, Some(8000))?);
+        assert!(p.put(8192, None)?);
+        assert!(p.put(2 * 8192, Some(8000))?);
+        assert!(!p.put(3 * 8192, Some(8000))?);
+        assert!(!p.put(12345, None)?);
+        assert_eq!(p.take(c)?, Some(2 * 8192));
+        assert_eq!(p.stats()?.cached_bytes, 2 * 8192);
+        assert_eq!(p.drain(0)?.len(), 2);
+        assert_eq!(p.stats()?.cached_buffers, 0);
+        assert!(p.put(2 * 8192, Some(8000))?);
+        assert_eq!(p.class_of(2 << 20), None);
+        Ok(())
+    }
+
+    #[test]
+    fn wrong_size_hint_finds_the_class() -> Result<()> {
+        let p = BufferPool::new(1 << 20, 8, 1 << 20);
+        let c = p.class_of(20000).unwrap();
+        p.track(4096, c.0)?;
+        // A mismatched size hint still returns the buffer to the class it was tracked in
+        assert!(p.put(4096, Some(100))?);
+        assert_eq!(p.take(c)?, Some(4096));
+        // With caching disabled the buffer is untracked and goes back to the allocator,
+        // so a later free does not find it in any class
+        p.set_max_cached_bytes(0);
+        assert!(!p.put(4096, Some(20000))?);
+        p.set_max_cached_bytes(1 << 20);
+        assert!(!p.put(4096, None)?);
+        Ok(())
+    }
+}
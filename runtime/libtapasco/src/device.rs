@@ -20,13 +20,18 @@
 use std::any::type_name;
 use std::borrow::Borrow;
 use crate::allocator::{Allocator, DriverAllocator, DummyAllocator, GenericAllocator, VfioAllocator};
+use crate::buffer_pool::BufferPool;
+use crate::device_buffer::{DeviceBuffer, LocalBuffer};
 use crate::debug::{DebugGenerator, NonDebugGenerator};
-use crate::dma::{DMAControl, DirectDMA, DriverDMA, VfioDMA, SVMDMA, SimDMA};
+use crate::dma::{DMAControl, DirectDMA, DriverDMA, VfioDMA, SVMDMA, SimDMA, SoftwareDMA};
 use crate::dma_user_space::UserSpaceDMA;
-use crate::job::Job;
+use crate::interrupt::CompletionDispatcher;
+use crate::job::{Job, JobBatch};
+use crate::latency;
+use crate::trace::TracedDMA;
 use crate::pe::PEId;
 use crate::pe::PE;
-use crate::scheduler::{Scheduler,SinglePEHandler};
+use crate::scheduler::{PELoad, Scheduler, SinglePEHandler};
 use crate::tlkm::{tlkm_access, tlkm_ioctl_svm_launch, tlkm_svm_init_cmd};
 use crate::tlkm::tlkm_ioctl_create;
 use crate::tlkm::tlkm_ioctl_destroy;
@@ -43,8 +48,10 @@ use std::fs::OpenOptions;
 use std::os::unix::io::AsRawFd;
 use std::sync::Arc;
 use std::sync::Mutex;
+use std::time::Duration;
 use crate::mmap_mut::MemoryType;
 use crate::sim_client::SimClient;
+use crate::software_device::{SoftwareDevice, SoftwareDeviceConfig};
 use crate::protos::status;
 use prost::Message;
 use crate::device::Error::PluginNotFound;
@@ -97,6 +104,9 @@ pub enum Error {
     #[snafu(display("Mutex has been poisoned"))]
     MutexError {},
 
+    #[snafu(display("Interrupt Error: {}", source))]
+    InterruptError { source: crate::interrupt::Error },
+
     #[snafu(display("Unknown device type {}.", name))]
     DeviceType { name: String },
 
@@ -121,6 +131,9 @@ pub enum Error {
     #[snafu(display("PE Error: {}", source))]
     PEError { source: crate::pe::Error },
 
+    #[snafu(display("Job Error: {}", source))]
+    JobError { source: crate::job::Error },
+
     #[snafu(display("Debug Error: {}", source))]
     DebugError { source: crate::debug::Error },
 
@@ -134,7 +147,13 @@ pub enum Error {
     PluginNotFound { name : String },
 
     #[snafu(display("Error during plugin initialization: {}", source))]
-    PluginInitError { source: crate::plugins::plugin::Error }
+    PluginInitError { source: crate::plugins::plugin::Error },
+
+    #[snafu(display("Could not create software device: {}", source))]
+    SoftwareDeviceError { source: crate::software_device::Error },
+
+    #[snafu(display("Device buffer error: {}", source))]
+    DeviceBufferError { source: crate::device_buffer::Error },
 }
 
 type Result<T, E = Error> = std::result::Result<T, E>;
@@ -154,12 +173,175 @@ pub type DeviceSize = u64;
 ///
 /// Access to the memory is provided through the allocator to manage memory allocations
 /// and the DMA which can be used to transfer data to and from the memory.
+///
+/// Memories managed by the host may have a buffer pool in front of the allocator. Use
+/// [`allocate`] and [`free`] instead of the allocator directly to make use of it.
+///
+/// [`allocate`]: #method.allocate
+/// [`free`]: #method.free
 #[derive(Debug, Getters)]
 pub struct OffchipMemory {
     #[get = "pub"]
     allocator: Mutex<Box<dyn Allocator + Sync + Send>>,
     #[get = "pub"]
     dma: Box<dyn DMAControl + Sync + Send>,
+    #[get = "pub"]
+    pool: Option<BufferPool>,
+}
+
+impl OffchipMemory {
+    /// Allocate `size` bytes of device memory.
+    ///
+    /// Served from the buffer pool without locking the allocator if a buffer of the
+    /// matching size class is cached.
+    pub fn allocate(
+        &self,
+        size: DeviceSize,
+        va: Option<u64>,
+    ) -> std::result::Result<DeviceAddress, crate::allocator::Error> {
+        match self.allocate_cached(size)? {
+            Some(a) => Ok(a),
+            None => self.allocate_with(&mut **self.allocator.lock()?, size, va),
+        }
+    }
+
+    /// Allocate `size` bytes at device address `offset`. Bypasses the buffer pool.
+    pub fn allocate_fixed(
+        &self,
+        size: DeviceSize,
+        offset: DeviceAddress,
+    ) -> std::result::Result<DeviceAddress, crate::allocator::Error> {
+        self.allocate_fixed_with(&mut **self.allocator.lock()?, size, offset)
+    }
+
+    /// Take a buffer of at least `size` bytes from the buffer pool if one is cached.
+    pub fn allocate_cached(
+        &self,
+        size: DeviceSize,
+    ) -> std::result::Result<Option<DeviceAddress>, crate::allocator::Error> {
+        let pool = match &self.pool {
+            Some(pool) => pool,
+            None => return Ok(None),
+        };
+        match pool.class_of(size) {
+            Some(class) => Ok(pool.take(class)?),
+            None => Ok(None),
+        }
+    }
+
+    /// Allocate through the already locked `allocator` of this memory.
+    ///
+    /// Poolable sizes are rounded up to their size class so the buffer can be cached on
+    /// free. If the allocator runs out of memory the pool is emptied and the allocation
+    /// is retried.
+    pub fn allocate_with(
+        &self,
+        allocator: &mut (dyn Allocator + Sync + Send),
+        size: DeviceSize,
+        va: Option<u64>,
+    ) -> std::result::Result<DeviceAddress, crate::allocator::Error> {
+        let class = self.pool.as_ref().and_then(|p| p.class_of(size));
+        let alloc_size = class.map_or(size, |c| c.1);
+        let a = match allocator.allocate(alloc_size, va) {
+            Err(crate::allocator::Error::OutOfMemory { .. }) if self.drain_pool_into(allocator, 0)? > 0 => {
+                allocator.allocate(alloc_size, va)?
+            }
+            r => r?,
+        };
+        if let (Some(pool), Some(c)) = (&self.pool, class) {
+            if let Err(e) = pool.track(a, c.0) {
+                allocator.free(a)?;
+                return Err(e.into());
+            }
+        }
+        Ok(a)
+    }
+
+    /// Fixed allocation through the already locked `allocator` of this memory. Cached
+    /// buffers blocking the requested range are returned to the allocator first.
+    pub fn allocate_fixed_with(
+        &self,
+        allocator: &mut (dyn Allocator + Sync + Send),
+        size: DeviceSize,
+        offset: DeviceAddress,
+    ) -> std::result::Result<DeviceAddress, crate::allocator::Error> {
+        match allocator.allocate_fixed(size, offset) {
+            Err(crate::allocator::Error::FixedNotAvailable { .. })
+                if self.drain_pool_into(allocator, 0)? > 0 =>
+            {
+                allocator.allocate_fixed(size, offset)
+            }
+            r => r,
+        }
+    }
+
+    /// Free an allocation. Pooled buffers are kept in the buffer pool as long as it is
+    /// below its high-water mark.
+    ///
+    /// Use [`free_sized`] if the size of the allocation is known.
+    ///
+    /// [`free_sized`]: #method.free_sized
+    pub fn free(&self, addr: DeviceAddress) -> std::result::Result<(), crate::allocator::Error> {
+        self.free_pooled(addr, None)
+    }
+
+    /// Free an allocation of `size` bytes, the size it was requested with. Only the size
+    /// class of the buffer in the buffer pool has to be locked.
+    pub fn free_sized(
+        &self,
+        addr: DeviceAddress,
+        size: DeviceSize,
+    ) -> std::result::Result<(), crate::allocator::Error> {
+        self.free_pooled(addr, Some(size))
+    }
+
+    fn free_pooled(
+        &self,
+        addr: DeviceAddress,
+        size: Option<DeviceSize>,
+    ) -> std::result::Result<(), crate::allocator::Error> {
+        if let Some(pool) = &self.pool {
+            if pool.put(addr, size)? {
+                return Ok(());
+            }
+        }
+        self.allocator.lock()?.free(addr)
+    }
+
+    /// Return cached buffers to the allocator until at most `keep_bytes` remain in the
+    /// buffer pool. Returns the number of buffers released.
+    pub fn trim_pool(&self, keep_bytes: DeviceSize) -> std::result::Result<usize, crate::allocator::Error> {
+        match &self.pool {
+            Some(_) => self.drain_pool_into(&mut **self.allocator.lock()?, keep_bytes),
+            None => Ok(0),
+        }
+    }
+
+    /// Set the high-water mark of the buffer pool and trim it accordingly. 0 disables
+    /// caching.
+    pub fn set_pool_limit(&self, max_bytes: DeviceSize) -> std::result::Result<(), crate::allocator::Error> {
+        if let Some(pool) = &self.pool {
+            pool.set_max_cached_bytes(max_bytes);
+            self.trim_pool(max_bytes)?;
+        }
+        Ok(())
+    }
+
+    fn drain_pool_into(
+        &self,
+        allocator: &mut (dyn Allocator + Sync + Send),
+        keep_bytes: DeviceSize,
+    ) -> std::result::Result<usize, crate::allocator::Error> {
+        let buffers = match &self.pool {
+            Some(pool) => pool.drain(keep_bytes)?,
+            None => return Ok(0),
+        };
+        trace!("Returning {} pooled buffers to the allocator.", buffers.len());
+        for a in &buffers {
+            allocator.free(*a)?;
+        }
+        Ok(buffers.len())
+    }
 }
 
 // Types to describe PE parameters.
@@ -214,6 +396,16 @@ pub struct DataTransferPrealloc {
     pub memory: Arc<OffchipMemory>,
 }
 
+/// Persistent device buffer used as a job argument. Only host side modifications are
+/// transferred before the job starts.
+#[derive(Debug)]
+pub struct DataTransferBuffer {
+    /// Buffer to pass to the PE.
+    pub buffer: Arc<DeviceBuffer>,
+    /// Does the PE write to the buffer? The device copy is considered newer afterwards.
+    pub from_device: bool,
+}
+
 #[derive(Debug)]
 pub struct DataTransferStream {
     pub data: Box<[u8]>,
@@ -238,6 +430,10 @@ pub enum PEParameter {
     DataTransferPrealloc(DataTransferPrealloc),
     /// Transfer using QDMA Streams.
     DataTransferStream(DataTransferStream),
+    /// Persistent buffer which keeps its device allocation across jobs.
+    DeviceBuffer(DataTransferBuffer),
+    /// Input kept in the local memory of the PE across jobs.
+    LocalBuffer(Arc<LocalBuffer>),
     /// Virtual address parameter used for SVM.
     VirtualAddress(*const u8),
 }
@@ -266,9 +462,40 @@ pub struct Device {
     scheduler: Arc<Scheduler>,
     platform: Arc<MemoryType>,
     offchip_memory: Vec<Arc<OffchipMemory>>,
-    tlkm_file: Arc<File>,
-    tlkm_device_file: Arc<File>,
+    /// None for software devices, which do not use the driver.
+    tlkm_file: Option<Arc<File>>,
+    tlkm_device_file: Option<Arc<File>>,
     plugins: Vec<Box<dyn Plugin>>,
+    completion: Option<CompletionDispatcher>,
+}
+
+/// Create the buffer pool for a host managed memory as configured in the `pool` section.
+fn buffer_pool(settings: &Config) -> Result<Option<BufferPool>> {
+    let max_cached_bytes = settings
+        .get::<u64>("pool.max_cached_bytes")
+        .context(ConfigSnafu)?;
+    if max_cached_bytes == 0 {
+        return Ok(None);
+    }
+    Ok(Some(BufferPool::new(
+        max_cached_bytes,
+        settings
+            .get::<usize>("pool.max_buffers_per_class")
+            .context(ConfigSnafu)?,
+        settings
+            .get::<u64>("pool.max_buffer_size")
+            .context(ConfigSnafu)?,
+    )))
+}
+
+/// Start the trace configured by `trace.file` if no trace is written yet. A trace file
+/// that cannot be created does not keep the device from being used.
+fn start_trace(settings: &Config) -> Result<()> {
+    let file = settings.get_string("trace.file").context(ConfigSnafu)?;
+    if let Err(e) = crate::trace::start_configured(&file) {
+        warn!("Tracing disabled: {}", e);
+    }
+    Ok(())
 }
 
 impl Device {
@@ -288,6 +515,8 @@ impl Device {
         settings: Arc<Config>,
         debug_impls: &HashMap<String, Box<dyn DebugGenerator + Sync + Send>>,
     ) -> Result<Self> {
+        start_trace(&settings)?;
+
         trace!("Open driver device file.");
 
         let tlkm_dma_file = Arc::new(
@@ -305,10 +534,28 @@ impl Device {
         );
 
 
+        // The simulation delivers interrupts through gRPC instead of eventfds
+        let completion = if name != "sim"
+            && settings
+                .get::<bool>("interrupt.dispatcher")
+                .context(ConfigSnafu)?
+        {
+            trace!("Starting completion dispatcher.");
+            Some(CompletionDispatcher::new().context(InterruptSnafu)?)
+        } else {
+            None
+        };
+
+        // A single client and its connections are shared by everything on a simulated device
+        let sim_client = if name == "sim" {
+            Some(Arc::new(SimClient::new().context(SimClientSnafu)?))
+        } else {
+            None
+        };
+
         trace!("Mapping status core.");
         let s = {
-            if name == "sim" {
-                let client = SimClient::new().context(SimClientSnafu)?;
+            if let Some(client) = &sim_client {
                 client.get_status().context(SimClientSnafu)?
             } else {
                 let mmap = unsafe {
@@ -421,7 +668,7 @@ impl Device {
                     allocator: Mutex::new(Box::new(
                         GenericAllocator::new(0, 4 * 1024 * 1024 * 1024, 64).context(AllocatorSnafu)?,
                     )),
-                    dma: Box::new(
+                    dma: TracedDMA::new(id, Box::new(
                         UserSpaceDMA::new(
                             &tlkm_dma_file,
                             dma_offset as usize,
@@ -442,9 +689,20 @@ impl Device {
                             settings
                                 .get::<usize>("dma.write_buffers")
                                 .context(ConfigSnafu)?,
+                            settings
+                                .get::<usize>("dma.fill_threads")
+                                .context(ConfigSnafu)?,
+                            settings
+                                .get::<usize>("dma.parallel_fill_threshold")
+                                .context(ConfigSnafu)?,
+                            settings
+                                .get::<usize>("dma.zero_copy_threshold")
+                                .context(ConfigSnafu)?,
+                            completion.as_ref(),
                         )
                             .context(DMASnafu)?,
-                    ),
+                    )),
+                    pool: buffer_pool(&settings)?,
                 }));
             } else {
                 trace!("Using SVM...");
@@ -459,7 +717,8 @@ impl Device {
                 }
                 allocator.push(Arc::new(OffchipMemory {
                     allocator: Mutex::new(Box::new(DummyAllocator::new())),
-                    dma: Box::new(SVMDMA::new(&tlkm_dma_file)),
+                    dma: TracedDMA::new(id, Box::new(SVMDMA::new(&tlkm_dma_file))),
+                    pool: None,
                 }));
             }
         } else if name == "zynq" || (name == "zynqmp" && !zynqmp_vfio_mode) {
@@ -468,7 +727,8 @@ impl Device {
                 allocator: Mutex::new(Box::new(
                     DriverAllocator::new(&tlkm_dma_file).context(AllocatorSnafu)?,
                 )),
-                dma: Box::new(DriverDMA::new(&tlkm_dma_file)),
+                dma: TracedDMA::new(id, Box::new(DriverDMA::new(&tlkm_dma_file))),
+                pool: buffer_pool(&settings)?,
             }));
         } else if name == "zynqmp" {
             info!("Using VFIO mode for ZynqMP based platform.");
@@ -479,17 +739,18 @@ impl Device {
                 allocator: Mutex::new(Box::new(
                     VfioAllocator::new(&vfio_dev).context(AllocatorSnafu)?,
                 )),
-                dma: Box::new(VfioDMA::new()),
+                dma: TracedDMA::new(id, Box::new(VfioDMA::new())),
+                pool: None,
             }));
-        } else if name == "sim" {
+        } else if let Some(client) = &sim_client {
             info!("SIM DEVICE FOUND!");
             allocator.push(Arc::new(OffchipMemory{
                 allocator: Mutex::new(Box::new(
                     GenericAllocator::new(0, 2_u64.pow(30), 8).context(AllocatorSnafu)?,
                 )),
-                dma: Box::new(SimDMA::new(0, 2_u64.pow(30), false).context(DMASnafu)?),
+                dma: TracedDMA::new(id, Box::new(SimDMA::new(client.clone(), 0, 2_u64.pow(30), false).context(DMASnafu)?)),
+                pool: buffer_pool(&settings)?,
             }));
-            let client = Arc::new(SimClient::new().context(SimClientSnafu)?);
             platform = MemoryType::Sim(client.clone());
             arch = Arc::new(MemoryType::Sim(client.clone()));
         } else {
@@ -506,11 +767,15 @@ impl Device {
                             allocator: Mutex::new(Box::new(
                                 GenericAllocator::new(0, l.size, 1).context(AllocatorSnafu)?,
                             )),
-                            dma: if name == "sim" {
-                                Box::new(SimDMA::new(l.base, l.size, true).context(DMASnafu)?)
-                            } else {
-                                Box::new(DirectDMA::new(l.base, l.size, arch_mmap.clone(), name.clone()))
-                            },
+                            dma: TracedDMA::new(
+                                id,
+                                if let Some(client) = &sim_client {
+                                    Box::new(SimDMA::new(client.clone(), l.base, l.size, true).context(DMASnafu)?)
+                                } else {
+                                    Box::new(DirectDMA::new(l.base, l.size, arch_mmap.clone(), name.clone()))
+                                },
+                            ),
+                            pool: None,
                         }));
                     },
                     None => (),
@@ -520,16 +785,33 @@ impl Device {
             warn!("PE local memories not compatible with SVM currently");
         }
 
+        // Only switch recording on, it may have been enabled through the API already
+        if settings.get::<bool>("latency.enabled").context(ConfigSnafu)? {
+            latency::set_enabled(true);
+        }
+
         trace!("Initialize PE scheduler.");
         let scheduler = Arc::new(
             Scheduler::new(
                 &s.pe,
                 &arch,
                 pe_local_memories,
-                &tlkm_dma_file,
+                Some(&*tlkm_dma_file),
                 debug_impls,
                 is_pcie,
                 svm_in_use,
+                completion.as_ref(),
+                settings
+                    .get::<bool>("scheduler.blocking")
+                    .context(ConfigSnafu)?,
+                Duration::from_micros(
+                    settings
+                        .get::<u64>("scheduler.affinity_wait_us")
+                        .context(ConfigSnafu)?,
+                ),
+                &settings
+                    .get::<Vec<PEId>>("pe.retained_args")
+                    .context(ConfigSnafu)?,
             )
                 .context(SchedulerSnafu)?,
         );
@@ -545,9 +827,10 @@ impl Device {
             scheduler,
             platform: Arc::new(platform),
             offchip_memory: allocator,
-            tlkm_file,
-            tlkm_device_file: tlkm_dma_file.clone(),
+            tlkm_file: Some(tlkm_file),
+            tlkm_device_file: Some(tlkm_dma_file.clone()),
             plugins: Vec::new(),
+            completion,
         };
 
         trace!("Initialize plugins");
@@ -564,6 +847,86 @@ impl Device {
         Ok(device)
     }
 
+    /// Set up a device backed by an in-process [`SoftwareDevice`] instead of hardware.
+    ///
+    /// The status core, the PEs and the DMA link are modelled as described by `config`.
+    /// The driver is not used, so access modes are only tracked by the runtime and
+    /// plugins are not loaded. Everything else, from scheduling to memory management and
+    /// transfers, uses the same code paths as for hardware devices.
+    ///
+    /// [`SoftwareDevice`]: ../software_device/struct.SoftwareDevice.html
+    pub fn new_software(
+        id: DeviceId,
+        config: SoftwareDeviceConfig,
+        debug_impls: &HashMap<String, Box<dyn DebugGenerator + Sync + Send>>,
+    ) -> Result<Self> {
+        let settings = crate::tlkm::load_settings().context(ConfigSnafu)?;
+        start_trace(&settings)?;
+        let model = Arc::new(SoftwareDevice::new(config).context(SoftwareDeviceSnafu)?);
+        let s = model.status().clone();
+        let arch = Arc::new(MemoryType::Software(model.clone()));
+
+        let allocator = vec![Arc::new(OffchipMemory {
+            allocator: Mutex::new(Box::new(
+                GenericAllocator::new(0, model.memory().size(), 64).context(AllocatorSnafu)?,
+            )),
+            dma: TracedDMA::new(id, Box::new(SoftwareDMA::new(model.clone()))),
+            pool: buffer_pool(&settings)?,
+        })];
+
+        // Only switch recording on, it may have been enabled through the API already
+        if settings.get::<bool>("latency.enabled").context(ConfigSnafu)? {
+            latency::set_enabled(true);
+        }
+
+        trace!("Initialize PE scheduler.");
+        let scheduler = Arc::new(
+            Scheduler::new(
+                &s.pe,
+                &arch,
+                VecDeque::new(),
+                None,
+                debug_impls,
+                false,
+                false,
+                None,
+                settings
+                    .get::<bool>("scheduler.blocking")
+                    .context(ConfigSnafu)?,
+                Duration::from_micros(
+                    settings
+                        .get::<u64>("scheduler.affinity_wait_us")
+                        .context(ConfigSnafu)?,
+                ),
+                &settings
+                    .get::<Vec<PEId>>("pe.retained_args")
+                    .context(ConfigSnafu)?,
+            )
+                .context(SchedulerSnafu)?,
+        );
+
+        trace!("Software device creation completed.");
+        let mut device = Self {
+            id,
+            vendor: 0,
+            product: 0,
+            access: tlkm_access::TlkmAccessTypes,
+            name: "software".to_string(),
+            status: s,
+            scheduler,
+            platform: arch,
+            offchip_memory: allocator,
+            tlkm_file: None,
+            tlkm_device_file: None,
+            plugins: Vec::new(),
+            completion: None,
+        };
+
+        device.change_access(tlkm_access::TlkmAccessMonitor)?;
+
+        Ok(device)
+    }
+
     /// Request a PE from the device.
     ///
     /// # Arguments
@@ -575,9 +938,10 @@ impl Device {
     pub fn acquire_pe(&self, id: PEId) -> Result<Job> {
         self.check_exclusive_access()?;
         trace!("Trying to acquire PE of type {}.", id);
+        let since = latency::timestamp();
         let pe = self.scheduler.acquire_pe(id).context(SchedulerSnafu)?;
         trace!("Successfully acquired PE of type {}.", id);
-        Ok(Job::new(pe, &self.scheduler))
+        Ok(Job::new(pe, &self.scheduler).acquired_since(self.id, since))
     }
 
     /// Acquires a PE from the device for use with the [`SinglePEHandler`].
@@ -612,12 +976,150 @@ impl Device {
         match pe {
             Some(p) => {
                 trace!("Successfully acquired PE of type {}.", id);
-                Ok(Some(Job::new(p, &self.scheduler)))
+                Ok(Some(Job::new(p, &self.scheduler).acquired_since(self.id, None)))
             },
             None => Ok(None)
         }
     }
 
+    /// Request a PE from the device, waiting at most `timeout` for one to become available.
+    ///
+    /// # Arguments
+    ///   * id: The ID of the desired PE.
+    ///   * timeout: Maximum time to wait for an idle PE.
+    ///
+    /// Returns a [`Job`] with the given PE, or an empty option if no PE became available in time.
+    ///
+    /// [`Job`]: ../job/struct.Job.html
+    pub fn acquire_pe_timeout(&self, id: PEId, timeout: Duration) -> Result<Option<Job>> {
+        self.check_exclusive_access()?;
+        trace!("Trying to acquire PE of type {} within {:?}.", id, timeout);
+        let since = latency::timestamp();
+        let pe = self
+            .scheduler
+            .acquire_pe_timeout(id, timeout)
+            .context(SchedulerSnafu)?;
+        match pe {
+            Some(p) => {
+                trace!("Successfully acquired PE of type {}.", id);
+                Ok(Some(Job::new(p, &self.scheduler).acquired_since(self.id, since)))
+            },
+            None => Ok(None)
+        }
+    }
+
+    /// Request a PE for a job with the given parameters.
+    ///
+    /// Prefers PEs whose local memory already holds the [`LocalBuffer`] parameters, so
+    /// their data does not have to be transferred again. If no such PE becomes available
+    /// within the `scheduler.affinity_wait_us` setting, any PE is used. Behaves like
+    /// [`acquire_pe`] if none of the buffers is resident anywhere.
+    ///
+    /// # Arguments
+    ///   * id: The ID of the desired PE.
+    ///   * args: Parameters the job will be started with.
+    ///
+    /// [`LocalBuffer`]: ../device_buffer/struct.LocalBuffer.html
+    /// [`acquire_pe`]: #method.acquire_pe
+    pub fn acquire_pe_for(&self, id: PEId, args: &[PEParameter]) -> Result<Job> {
+        self.check_exclusive_access()?;
+        // Rank the memories by the number of resident bytes
+        let mut resident: Vec<(Arc<OffchipMemory>, usize)> = Vec::new();
+        for arg in args {
+            if let PEParameter::LocalBuffer(b) = arg {
+                for m in b.resident_memories().context(DeviceBufferSnafu)? {
+                    match resident.iter_mut().find(|(x, _)| Arc::ptr_eq(x, &m)) {
+                        Some((_, n)) => *n += *b.len(),
+                        None => resident.push((m, *b.len())),
+                    }
+                }
+            }
+        }
+        resident.sort_by(|a, b| b.1.cmp(&a.1));
+        let memories: Vec<Arc<OffchipMemory>> = resident.into_iter().map(|(m, _)| m).collect();
+        trace!(
+            "Trying to acquire PE of type {} near {} memories.",
+            id,
+            memories.len()
+        );
+        let since = latency::timestamp();
+        let pe = self
+            .scheduler
+            .acquire_pe_preferring(id, &memories)
+            .context(SchedulerSnafu)?;
+        trace!("Successfully acquired PE of type {}.", id);
+        Ok(Job::new(pe, &self.scheduler).acquired_since(self.id, since))
+    }
+
+    /// Launch one job per parameter list on PEs of the given type.
+    ///
+    /// Acquires as many idle PEs as needed with a single scheduler lock and starts them
+    /// with one lock of each allocator per round. If there are more parameter lists than
+    /// PEs, the oldest running job of the batch is waited for and its PE is reused.
+    ///
+    /// If a job cannot be started, the jobs already started are waited for and all
+    /// allocations and PEs of the batch are released before the error is returned.
+    ///
+    /// # Arguments
+    ///   * id: The ID of the desired PE.
+    ///   * args: One list of PE parameters per job.
+    ///
+    /// Returns the [`JobBatch`] used to wait for the jobs and, for each job, the memories
+    /// not marked for copy back as returned by [`Job::start`].
+    ///
+    /// [`JobBatch`]: ../job/struct.JobBatch.html
+    /// [`Job::start`]: ../job/struct.Job.html#method.start
+    pub fn launch_batch(
+        &self,
+        id: PEId,
+        args: Vec<Vec<PEParameter>>,
+    ) -> Result<(JobBatch, Vec<Vec<Box<[u8]>>>)> {
+        self.check_exclusive_access()?;
+        trace!("Launching batch of {} jobs on PE type {}.", args.len(), id);
+        let mut batch = JobBatch::new(args.len());
+        let mut unused_mem = Vec::with_capacity(args.len());
+        match self.launch_batch_waves(id, args, &mut batch, &mut unused_mem) {
+            Ok(()) => Ok((batch, unused_mem)),
+            Err(e) => {
+                // Jobs of earlier waves still hold PEs and device memory
+                batch.discard();
+                Err(e)
+            }
+        }
+    }
+
+    /// Start the jobs of `batch` in waves of as many PEs as are idle.
+    fn launch_batch_waves(
+        &self,
+        id: PEId,
+        args: Vec<Vec<PEParameter>>,
+        batch: &mut JobBatch,
+        unused_mem: &mut Vec<Vec<Box<[u8]>>>,
+    ) -> Result<()> {
+        let mut remaining = args.len();
+        let mut args = args.into_iter();
+        while remaining > 0 {
+            let since = latency::timestamp();
+            let pes = self
+                .scheduler
+                .acquire_pes(id, remaining, !batch.has_running())
+                .context(SchedulerSnafu)?;
+            if pes.is_empty() {
+                trace!("No idle PE left, waiting for the oldest job of the batch.");
+                batch.release_oldest().context(JobSnafu)?;
+                continue;
+            }
+            remaining -= pes.len();
+            let wave: Vec<Vec<PEParameter>> = args.by_ref().take(pes.len()).collect();
+            let jobs = pes
+                .into_iter()
+                .map(|pe| Job::new(pe, &self.scheduler).acquired_since(self.id, since))
+                .collect();
+            unused_mem.extend(batch.start(jobs, wave).context(JobSnafu)?);
+        }
+        Ok(())
+    }
+
     /// Request a PE from the device but don't create a Job for it. Usually [`acquire_pe`] is used
     /// if you don't want to do things manually.
     ///
@@ -667,12 +1169,14 @@ impl Device {
 
         trace!("Device {}: Trying to change mode to {:?}", self.id, access,);
 
-        unsafe {
-            tlkm_ioctl_create(self.tlkm_file.as_raw_fd(), &mut request).context(IOCTLCreateSnafu {
-                access,
-                id: self.id,
-            })?;
-        };
+        if let Some(tlkm_file) = &self.tlkm_file {
+            unsafe {
+                tlkm_ioctl_create(tlkm_file.as_raw_fd(), &mut request).context(IOCTLCreateSnafu {
+                    access,
+                    id: self.id,
+                })?;
+            };
+        }
 
         self.access = access;
 
@@ -693,9 +1197,11 @@ impl Device {
                 dev_id: self.id,
                 access: self.access,
             };
-            unsafe {
-                tlkm_ioctl_destroy(self.tlkm_file.as_raw_fd(), &mut request)
-                    .context(IOCTLDestroySnafu { id: self.id })?;
+            if let Some(tlkm_file) = &self.tlkm_file {
+                unsafe {
+                    tlkm_ioctl_destroy(tlkm_file.as_raw_fd(), &mut request)
+                        .context(IOCTLDestroySnafu { id: self.id })?;
+                }
             }
             self.access = tlkm_access::TlkmAccessTypes;
         }
@@ -760,6 +1266,22 @@ impl Device {
         self.scheduler.num_pes(pe)
     }
 
+    /// Can jobs of this device be awaited without polling their PEs? True if the
+    /// completion dispatcher is running (`interrupt.dispatcher`).
+    pub fn has_completion_dispatcher(&self) -> bool {
+        self.completion.is_some()
+    }
+
+    /// Current utilization of the PEs of the given type.
+    pub fn pe_load(&self, id: PEId) -> Result<PELoad> {
+        self.scheduler.load(id).context(SchedulerSnafu)
+    }
+
+    /// Is `memory` one of the memories of this device that are shared by all PEs?
+    pub fn owns_memory(&self, memory: &Arc<OffchipMemory>) -> bool {
+        self.offchip_memory.iter().any(|m| Arc::ptr_eq(m, memory))
+    }
+
     /// Return the PEId of the PE with the given name
     pub fn get_pe_id(&self, name: &str) -> Result<PEId> {
         self.scheduler.get_pe_id(name).context(SchedulerSnafu)
@@ -834,10 +1356,11 @@ impl Device {
                         42,
                         p.offset,
                         self.platform.clone(),
-                        &self.tlkm_device_file,
+                        self.tlkm_device_file.as_deref(),
                         p.interrupts[0].mapping as usize,
                         debug,
                         false,  // TODO: Is this correct?
+                        self.completion.as_ref(),
                     )
                     .context(PESnafu);
                 } else {
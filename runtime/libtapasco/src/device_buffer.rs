@@ -0,0 +1,538 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+use crate::device::{DeviceAddress, OffchipMemory};
+use snafu::ResultExt;
+use std::sync::{Arc, Mutex, MutexGuard};
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Allocator Error: {}", source))]
+    AllocatorError { source: crate::allocator::Error },
+
+    #[snafu(display("DMA Error: {}", source))]
+    DMAError { source: crate::dma::Error },
+
+    #[snafu(display("Mutex has been poisoned"))]
+    MutexError {},
+
+    #[snafu(display(
+        "Access of {} bytes at offset {} exceeds buffer of {} bytes.",
+        len,
+        offset,
+        size
+    ))]
+    OutOfBounds {
+        offset: usize,
+        len: usize,
+        size: usize,
+    },
+
+    #[snafu(display(
+        "The device copy has been modified since the host copy was fetched. Fetch it again before modifying it in place."
+    ))]
+    HostCopyOutdated {},
+}
+
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+/// Which copy of a [`DeviceBuffer`] holds the newest data.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Coherence {
+    /// Host and device copy are identical or the buffer has never been written.
+    Clean,
+    /// The host copy has been modified in the given byte range.
+    HostDirty { start: usize, end: usize },
+    /// A PE may have written the device copy.
+    DeviceDirty,
+}
+
+#[derive(Debug)]
+struct HostCopy {
+    data: Option<Box<[u8]>>,
+    state: Coherence,
+}
+
+/// Device allocation that persists across jobs, together with a host copy.
+///
+/// The buffer tracks which side has been modified. Passed to a job as
+/// [`PEParameter::DeviceBuffer`], only the dirty range of the host copy is transferred
+/// before the PE starts and nothing is transferred back after the job. Reading the
+/// buffer or calling [`sync_to_host`] fetches the device copy if a PE may have written it.
+///
+/// The host copy is allocated on first use, so buffers that are only used by PEs do not
+/// occupy host memory. The device allocation is freed when the buffer is dropped. Jobs
+/// hold a reference to the buffer until they are released.
+///
+/// [`PEParameter::DeviceBuffer`]: ../device/enum.PEParameter.html#variant.DeviceBuffer
+/// [`sync_to_host`]: #method.sync_to_host
+#[derive(Debug, Getters)]
+pub struct DeviceBuffer {
+    #[get = "pub"]
+    memory: Arc<OffchipMemory>,
+    #[get = "pub"]
+    device_address: DeviceAddress,
+    #[get = "pub"]
+    len: usize,
+    host: Mutex<HostCopy>,
+}
+
+impl DeviceBuffer {
+    /// Allocate a buffer of `len` bytes on `memory`. The content is undefined.
+    pub fn new(memory: Arc<OffchipMemory>, len: usize) -> Result<DeviceBuffer> {
+        let device_address = memory.allocate(len as u64, None).context(AllocatorSnafu)?;
+        Ok(DeviceBuffer {
+            memory,
+            device_address,
+            len,
+            host: Mutex::new(HostCopy {
+                data: None,
+                state: Coherence::Clean,
+            }),
+        })
+    }
+
+    /// Allocate a buffer on `memory` that takes `data` as its host copy. The data is
+    /// transferred on first use by a job or on [`sync_to_device`].
+    ///
+    /// [`sync_to_device`]: #method.sync_to_device
+    pub fn from_data(memory: Arc<OffchipMemory>, data: Box<[u8]>) -> Result<DeviceBuffer> {
+        let b = DeviceBuffer::new(memory, data.len())?;
+        {
+            let mut h = b.host.lock()?;
+            h.state = Coherence::HostDirty {
+                start: 0,
+                end: data.len(),
+            };
+            h.data = Some(data);
+        }
+        Ok(b)
+    }
+
+    /// Copy `src` into the host copy at `offset` and mark the range as modified.
+    pub fn write(&self, offset: usize, src: &[u8]) -> Result<()> {
+        self.check_bounds(offset, src.len())?;
+        let mut h = self.host.lock()?;
+        if src.len() == self.len {
+            // Complete overwrite, no need to fetch the device copy first
+            if h.data.is_none() {
+                h.data = Some(vec![0; self.len].into_boxed_slice());
+            }
+            h.state = Coherence::Clean;
+        } else {
+            self.fetch(&mut h)?;
+        }
+        h.data.as_mut().unwrap()[offset..offset + src.len()].copy_from_slice(src);
+        Self::mark_dirty(&mut h, offset, src.len());
+        Ok(())
+    }
+
+    /// Copy the buffer content at `offset` into `dst`. Fetches the device copy first if
+    /// a PE may have modified it.
+    pub fn read(&self, offset: usize, dst: &mut [u8]) -> Result<()> {
+        self.check_bounds(offset, dst.len())?;
+        let mut h = self.host.lock()?;
+        self.fetch(&mut h)?;
+        dst.copy_from_slice(&h.data.as_ref().unwrap()[offset..offset + dst.len()]);
+        Ok(())
+    }
+
+    /// Access the host copy in place. The device copy is fetched first if necessary and the
+    /// whole buffer is considered modified afterwards.
+    pub fn with_host<R>(&self, f: impl FnOnce(&mut [u8]) -> R) -> Result<R> {
+        let mut h = self.host.lock()?;
+        self.fetch(&mut h)?;
+        let r = f(&mut h.data.as_mut().unwrap()[..]);
+        Self::mark_dirty(&mut h, 0, self.len);
+        Ok(r)
+    }
+
+    /// Pointer to the host copy which stays valid for the lifetime of the buffer. The
+    /// device copy is fetched first if necessary. Modifications through the pointer have to
+    /// be announced with [`mark_host_dirty`].
+    ///
+    /// [`mark_host_dirty`]: #method.mark_host_dirty
+    pub fn host_ptr(&self) -> Result<*mut u8> {
+        let mut h = self.host.lock()?;
+        self.fetch(&mut h)?;
+        Ok(h.data.as_mut().unwrap().as_mut_ptr())
+    }
+
+    /// Mark `len` bytes at `offset` of the host copy as modified.
+    ///
+    /// Fails if a PE may have modified the device copy since the host copy was fetched.
+    /// The rest of the host copy would be outdated, while fetching it now would overwrite
+    /// the modifications. Call [`sync_to_host`] or [`host_ptr`] before modifying the
+    /// host copy in that case.
+    ///
+    /// [`sync_to_host`]: #method.sync_to_host
+    /// [`host_ptr`]: #method.host_ptr
+    pub fn mark_host_dirty(&self, offset: usize, len: usize) -> Result<()> {
+        self.check_bounds(offset, len)?;
+        let mut h = self.host.lock()?;
+        ensure!(h.state != Coherence::DeviceDirty, HostCopyOutdatedSnafu);
+        if h.data.is_none() {
+            self.fetch(&mut h)?;
+        }
+        Self::mark_dirty(&mut h, offset, len);
+        Ok(())
+    }
+
+    /// Mark the device copy as modified, e.g. after a PE wrote to the buffer through its
+    /// device address.
+    pub fn mark_device_dirty(&self) -> Result<()> {
+        self.host.lock()?.state = Coherence::DeviceDirty;
+        Ok(())
+    }
+
+    /// Transfer the modified range of the host copy to the device.
+    ///
+    /// # Returns
+    ///  * Number of bytes transferred.
+    pub fn sync_to_device(&self) -> Result<usize> {
+        let mut h = self.host.lock()?;
+        self.push(&mut h)
+    }
+
+    /// Transfer the device copy to the host if a PE may have modified it.
+    ///
+    /// # Returns
+    ///  * Number of bytes transferred.
+    pub fn sync_to_host(&self) -> Result<usize> {
+        let mut h = self.host.lock()?;
+        self.fetch(&mut h)
+    }
+
+    pub fn is_host_dirty(&self) -> Result<bool> {
+        Ok(matches!(self.host.lock()?.state, Coherence::HostDirty { .. }))
+    }
+
+    pub fn is_device_dirty(&self) -> Result<bool> {
+        Ok(self.host.lock()?.state == Coherence::DeviceDirty)
+    }
+
+    /// Prepare the buffer for use as a job argument. Transfers pending host modifications
+    /// and marks the device copy as modified if the PE writes to the buffer.
+    pub fn prepare_launch(&self, from_device: bool) -> Result<DeviceAddress> {
+        let mut h = self.host.lock()?;
+        self.push(&mut h)?;
+        if from_device {
+            h.state = Coherence::DeviceDirty;
+        }
+        Ok(self.device_address)
+    }
+
+    fn push(&self, h: &mut MutexGuard<HostCopy>) -> Result<usize> {
+        if let Coherence::HostDirty { start, end } = h.state {
+            trace!(
+                "Transferring bytes {}..{} of buffer at 0x{:x} to the device.",
+                start,
+                end,
+                self.device_address
+            );
+            self.memory
+                .dma()
+                .copy_to(
+                    &h.data.as_ref().unwrap()[start..end],
+                    self.device_address + start as u64,
+                )
+                .context(DMASnafu)?;
+            h.state = Coherence::Clean;
+            return Ok(end - start);
+        }
+        Ok(0)
+    }
+
+    fn fetch(&self, h: &mut MutexGuard<HostCopy>) -> Result<usize> {
+        let fresh = h.data.is_none();
+        if fresh {
+            h.data = Some(vec![0; self.len].into_boxed_slice());
+        }
+        if h.state == Coherence::DeviceDirty || (fresh && h.state == Coherence::Clean) {
+            trace!(
+                "Transferring buffer at 0x{:x} to the host.",
+                self.device_address
+            );
+            self.memory
+                .dma()
+                .copy_from(self.device_address, &mut h.data.as_mut().unwrap()[..])
+                .context(DMASnafu)?;
+            h.state = Coherence::Clean;
+            return Ok(self.len);
+        }
+        Ok(0)
+    }
+
+    fn mark_dirty(h: &mut MutexGuard<HostCopy>, offset: usize, len: usize) {
+        if len == 0 {
+            return;
+        }
+        h.state = match h.state {
+            Coherence::HostDirty { start, end } => Coherence::HostDirty {
+                start: start.min(offset),
+                end: end.max(offset + len),
+            },
+            _ => Coherence::HostDirty {
+                start: offset,
+                end: offset + len,
+            },
+        };
+    }
+
+    fn check_bounds(&self, offset: usize, len: usize) -> Result<()> {
+        check_bounds(offset, len, self.len)
+    }
+}
+
+impl Drop for DeviceBuffer {
+    fn drop(&mut self) {
+        if let Err(e) = self.memory.free_sized(self.device_address, self.len as u64) {
+            warn!(
+                "Failed to free device buffer at 0x{:x}: {}",
+                self.device_address, e
+            );
+        }
+    }
+}
+
+#[derive(Debug)]
+struct LocalCopy {
+    memory: Arc<OffchipMemory>,
+    device_address: DeviceAddress,
+    version: u64,
+}
+
+#[derive(Debug)]
+struct LocalState {
+    data: Box<[u8]>,
+    version: u64,
+    copies: Vec<LocalCopy>,
+}
+
+/// Job input that stays in the local memories of the PEs it has been passed to.
+///
+/// Passed to a job as [`PEParameter::LocalBuffer`], the data is transferred into the
+/// local memory of the PE unless that memory already holds the current content. The
+/// copies stay allocated until the buffer is dropped, so repeated jobs only transfer the
+/// data once per PE and again after the host modified it. [`Device::acquire_pe_for`]
+/// prefers PEs whose memory already holds the buffer. PEs must not write to the buffer.
+///
+/// [`PEParameter::LocalBuffer`]: ../device/enum.PEParameter.html#variant.LocalBuffer
+/// [`Device::acquire_pe_for`]: ../device/struct.Device.html#method.acquire_pe_for
+#[derive(Debug, Getters)]
+pub struct LocalBuffer {
+    #[get = "pub"]
+    len: usize,
+    state: Mutex<LocalState>,
+}
+
+impl LocalBuffer {
+    pub fn new(data: Box<[u8]>) -> LocalBuffer {
+        LocalBuffer {
+            len: data.len(),
+            state: Mutex::new(LocalState {
+                data,
+                version: 1,
+                copies: Vec::new(),
+            }),
+        }
+    }
+
+    /// Copy `src` into the buffer at `offset`. The copies in local memories are updated
+    /// when the buffer is passed to a job on their PE the next time.
+    pub fn write(&self, offset: usize, src: &[u8]) -> Result<()> {
+        check_bounds(offset, src.len(), self.len)?;
+        let mut s = self.state.lock()?;
+        s.data[offset..offset + src.len()].copy_from_slice(src);
+        s.version += 1;
+        Ok(())
+    }
+
+    pub fn read(&self, offset: usize, dst: &mut [u8]) -> Result<()> {
+        check_bounds(offset, dst.len(), self.len)?;
+        let s = self.state.lock()?;
+        dst.copy_from_slice(&s.data[offset..offset + dst.len()]);
+        Ok(())
+    }
+
+    /// Memories holding the current content of the buffer.
+    pub fn resident_memories(&self) -> Result<Vec<Arc<OffchipMemory>>> {
+        let s = self.state.lock()?;
+        Ok(s.copies
+            .iter()
+            .filter(|c| c.version == s.version)
+            .map(|c| c.memory.clone())
+            .collect())
+    }
+
+    pub fn is_resident(&self, memory: &Arc<OffchipMemory>) -> Result<bool> {
+        let s = self.state.lock()?;
+        Ok(s.copies
+            .iter()
+            .any(|c| Arc::ptr_eq(&c.memory, memory) && c.version == s.version))
+    }
+
+    /// Prepare the buffer for a job on a PE with the local memory `memory`. Allocates
+    /// space on first use of the memory and transfers the data if the copy is outdated.
+    pub fn prepare_launch(&self, memory: &Arc<OffchipMemory>) -> Result<DeviceAddress> {
+        let mut s = self.state.lock()?;
+        let i = match s.copies.iter().position(|c| Arc::ptr_eq(&c.memory, memory)) {
+            Some(i) => i,
+            None => {
+                let device_address = memory
+                    .allocate(self.len as u64, None)
+                    .context(AllocatorSnafu)?;
+                s.copies.push(LocalCopy {
+                    memory: memory.clone(),
+                    device_address,
+                    version: 0,
+                });
+                s.copies.len() - 1
+            }
+        };
+        let device_address = s.copies[i].device_address;
+        let version = s.version;
+        if s.copies[i].version != version {
+            trace!(
+                "Transferring local buffer of {} bytes to 0x{:x}.",
+                self.len,
+                device_address
+            );
+            memory
+                .dma()
+                .copy_to(&s.data[..], device_address)
+                .context(DMASnafu)?;
+            s.copies[i].version = version;
+        } else {
+            trace!("Local buffer already resident at 0x{:x}.", device_address);
+        }
+        Ok(device_address)
+    }
+}
+
+impl Drop for LocalBuffer {
+    fn drop(&mut self) {
+        let s = match self.state.get_mut() {
+            Ok(s) => s,
+            Err(e) => e.into_inner(),
+        };
+        for c in s.copies.drain(..) {
+            if let Err(e) = c.memory.free(c.device_address) {
+                warn!(
+                    "Failed to free local buffer copy at 0x{:x}: {}",
+                    c.device_address, e
+                );
+            }
+        }
+    }
+}
+
+fn check_bounds(offset: usize, len: usize, size: usize) -> Result<()> {
+    if offset.checked_add(len).map_or(true, |e| e > size) {
+        return Err(Error::OutOfBounds { offset, len, size });
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::Device;
+    use crate::software_device::SoftwareDeviceConfig;
+    use std::collections::HashMap;
+
+    fn memory() -> (Device, Arc<OffchipMemory>) {
+        let config = SoftwareDeviceConfig {
+            memory_size: 1024 * 1024,
+            ..Default::default()
+        };
+        let d = Device::new_software(0, config, &HashMap::new()).unwrap();
+        let m = d.default_memory().unwrap();
+        (d, m)
+    }
+
+    fn device_copy(b: &DeviceBuffer, offset: usize, len: usize) -> Vec<u8> {
+        let mut data = vec![0; len];
+        b.memory()
+            .dma()
+            .copy_from(b.device_address() + offset as u64, &mut data)
+            .unwrap();
+        data
+    }
+
+    #[test]
+    fn only_the_dirty_range_is_pushed() {
+        let (_d, m) = memory();
+        let b = DeviceBuffer::new(m, 256).unwrap();
+        b.write(0, &[0; 256]).unwrap();
+        assert_eq!(b.sync_to_device().unwrap(), 256);
+        assert_eq!(b.sync_to_device().unwrap(), 0);
+
+        b.write(16, &[1; 8]).unwrap();
+        b.write(64, &[2; 8]).unwrap();
+        assert!(b.is_host_dirty().unwrap());
+        assert_eq!(b.prepare_launch(false).unwrap(), *b.device_address());
+        assert!(!b.is_host_dirty().unwrap());
+        assert_eq!(device_copy(&b, 16, 8), vec![1; 8]);
+        assert_eq!(device_copy(&b, 64, 8), vec![2; 8]);
+        assert_eq!(device_copy(&b, 24, 40), vec![0; 40]);
+    }
+
+    #[test]
+    fn device_writes_are_fetched_on_read() {
+        let (_d, m) = memory();
+        let b = DeviceBuffer::from_data(m, vec![1; 64].into_boxed_slice()).unwrap();
+        b.prepare_launch(true).unwrap();
+        assert!(b.is_device_dirty().unwrap());
+        // What a PE writing the buffer would do
+        b.memory()
+            .dma()
+            .copy_to(&[7; 64], *b.device_address())
+            .unwrap();
+
+        let mut dst = [0; 64];
+        b.read(0, &mut dst).unwrap();
+        assert_eq!(dst, [7; 64]);
+        assert_eq!(b.sync_to_host().unwrap(), 0);
+    }
+
+    #[test]
+    fn mark_host_dirty_needs_current_host_copy() {
+        let (_d, m) = memory();
+        let b = DeviceBuffer::from_data(m, vec![1; 64].into_boxed_slice()).unwrap();
+        b.prepare_launch(true).unwrap();
+        assert!(matches!(
+            b.mark_host_dirty(0, 4),
+            Err(Error::HostCopyOutdated {})
+        ));
+        assert!(b.is_device_dirty().unwrap());
+
+        assert_eq!(b.sync_to_host().unwrap(), 64);
+        b.mark_host_dirty(0, 4).unwrap();
+        assert!(b.is_host_dirty().unwrap());
+        assert_eq!(b.sync_to_device().unwrap(), 4);
+    }
+}
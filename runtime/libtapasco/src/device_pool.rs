@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+use crate::debug::DebugGenerator;
+use crate::device::{Device, OffchipMemory, PEParameter};
+use crate::job::Job;
+use crate::pe::PEId;
+use crate::tlkm::{tlkm_access, TLKM};
+use snafu::ResultExt;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Device Error: {}", source))]
+    DeviceError { source: crate::device::Error },
+
+    #[snafu(display("TLKM Error: {}", source))]
+    TLKMError { source: crate::tlkm::Error },
+
+    #[snafu(display("Job Error: {}", source))]
+    JobError { source: crate::job::Error },
+
+    #[snafu(display("A device pool needs at least one device."))]
+    NoDevices {},
+
+    #[snafu(display("No device of the pool provides PE Type {}.", id))]
+    NoSuchPE { id: PEId },
+
+    #[snafu(display("Device {} is not part of the pool of {} devices.", device, len))]
+    NoSuchDevice { device: usize, len: usize },
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+/// Job acquired from a [`DevicePool`] together with the device it runs on.
+#[derive(Debug)]
+pub struct PoolJob {
+    /// Index of the device in the pool.
+    pub device: usize,
+    pub job: Job,
+}
+
+/// Several devices whose PEs are used as one inventory.
+///
+/// The PEs of all devices are merged by type. Each job is placed on the device with the
+/// lowest demand for the requested type relative to its number of PEs of that type,
+/// counting acquired PEs and threads waiting for one. Devices with the same demand take
+/// turns. If all PEs are busy, the job waits on the chosen device only.
+///
+/// Memories belong to a single device. [`launch`] moves `DataTransferAlloc` and
+/// `DataTransferStream` parameters that target a memory of another device of the pool
+/// to the default memory of the chosen device, so argument lists can be built with the
+/// memory of any device. Parameters bound to a device address, like preallocated
+/// transfers or device buffers, are passed unchanged and have to be created for the
+/// device of the job, e.g. after [`acquire_pe`].
+///
+/// [`launch`]: #method.launch
+/// [`acquire_pe`]: #method.acquire_pe
+#[derive(Debug)]
+pub struct DevicePool {
+    devices: Vec<Device>,
+    next: AtomicUsize,
+}
+
+impl DevicePool {
+    /// Create a pool of the given devices. Jobs can only be acquired on devices with
+    /// exclusive access.
+    pub fn new(devices: Vec<Device>) -> Result<DevicePool> {
+        ensure!(!devices.is_empty(), NoDevicesSnafu);
+        Ok(DevicePool {
+            devices,
+            next: AtomicUsize::new(0),
+        })
+    }
+
+    /// Allocate all devices known to the driver and request `access` to them.
+    pub fn open(
+        tlkm: &TLKM,
+        access: tlkm_access,
+        debug_impls: &HashMap<String, Box<dyn DebugGenerator + Sync + Send>>,
+    ) -> Result<DevicePool> {
+        let mut devices = tlkm.device_enum(debug_impls).context(TLKMSnafu)?;
+        for d in devices.iter_mut() {
+            d.change_access(access).context(DeviceSnafu)?;
+        }
+        trace!("Opened device pool of {} devices.", devices.len());
+        DevicePool::new(devices)
+    }
+
+    pub fn len(&self) -> usize {
+        self.devices.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.devices.is_empty()
+    }
+
+    pub fn device(&self, device: usize) -> Result<&Device> {
+        self.devices.get(device).ok_or(Error::NoSuchDevice {
+            device,
+            len: self.devices.len(),
+        })
+    }
+
+    pub fn devices(&self) -> &[Device] {
+        &self.devices
+    }
+
+    /// Number of PEs of the given type on all devices.
+    pub fn num_pes(&self, id: PEId) -> usize {
+        self.devices.iter().map(|d| d.num_pes(id)).sum()
+    }
+
+    /// Return the PEId of the PE with the given name on any of the devices.
+    pub fn get_pe_id(&self, name: &str) -> Result<PEId> {
+        let mut err = None;
+        for d in &self.devices {
+            match d.get_pe_id(name) {
+                Ok(id) => return Ok(id),
+                Err(e) => err = Some(e),
+            }
+        }
+        Err(err.unwrap()).context(DeviceSnafu)
+    }
+
+    /// Index of the device with the lowest relative demand for PEs of type `id`.
+    fn choose(&self, id: PEId) -> Result<usize> {
+        let n = self.devices.len();
+        let start = self.next.fetch_add(1, Ordering::Relaxed) % n;
+        let mut best: Option<(usize, usize, usize)> = None;
+        for i in (0..n).map(|i| (start + i) % n) {
+            let d = &self.devices[i];
+            if d.num_pes(id) == 0 {
+                continue;
+            }
+            let load = d.pe_load(id).context(DeviceSnafu)?;
+            let lower = match best {
+                // demand / total < best demand / best total
+                Some((_, demand, total)) => load.demand() * total < demand * load.total,
+                None => true,
+            };
+            if lower {
+                best = Some((i, load.demand(), load.total));
+            }
+        }
+        match best {
+            Some((i, _, _)) => Ok(i),
+            None => Err(Error::NoSuchPE { id }),
+        }
+    }
+
+    /// Request a PE of the given type from the least loaded device.
+    pub fn acquire_pe(&self, id: PEId) -> Result<PoolJob> {
+        let device = self.choose(id)?;
+        trace!("Acquiring PE of type {} on device {}.", id, device);
+        let job = self.devices[device].acquire_pe(id).context(DeviceSnafu)?;
+        Ok(PoolJob { device, job })
+    }
+
+    /// Acquire a PE of the given type on the least loaded device and start it.
+    ///
+    /// Returns the running job and the memories not marked for copy back as returned
+    /// by [`Job::start`].
+    ///
+    /// [`Job::start`]: ../job/struct.Job.html#method.start
+    pub fn launch(
+        &self,
+        id: PEId,
+        mut args: Vec<PEParameter>,
+    ) -> Result<(PoolJob, Vec<Box<[u8]>>)> {
+        let mut pj = self.acquire_pe(id)?;
+        self.relocate(pj.device, &mut args)?;
+        let unused_mem = pj.job.start(args).context(JobSnafu)?;
+        Ok((pj, unused_mem))
+    }
+
+    /// Move transfers targeting memories of other devices to the default memory of `device`.
+    fn relocate(&self, device: usize, args: &mut [PEParameter]) -> Result<()> {
+        let d = &self.devices[device];
+        let mut default: Option<Arc<OffchipMemory>> = None;
+        for arg in args.iter_mut() {
+            let memory = match arg {
+                PEParameter::DataTransferAlloc(x) => &mut x.memory,
+                PEParameter::DataTransferStream(x) => &mut x.memory,
+                _ => continue,
+            };
+            if d.owns_memory(memory) || !self.devices.iter().any(|o| o.owns_memory(memory)) {
+                continue;
+            }
+            if default.is_none() {
+                default = Some(d.default_memory().context(DeviceSnafu)?);
+            }
+            *memory = default.clone().unwrap();
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::DataTransferAlloc;
+    use crate::software_device::{sum_config, SUM};
+    use std::time::Duration;
+
+    fn device(id: u32) -> Device {
+        let config = sum_config(2, Duration::ZERO);
+        let mut d = Device::new_software(id, config, &HashMap::new()).unwrap();
+        d.change_access(tlkm_access::TlkmAccessExclusive).unwrap();
+        d
+    }
+
+    #[test]
+    fn inventory_is_merged() {
+        let pool = DevicePool::new(vec![device(0), device(1)]).unwrap();
+        assert_eq!(pool.num_pes(SUM), 4);
+        assert_eq!(pool.get_pe_id("sum").unwrap(), SUM);
+        assert!(pool.acquire_pe(SUM + 1).is_err());
+        assert!(DevicePool::new(Vec::new()).is_err());
+    }
+
+    #[test]
+    fn jobs_are_spread_across_devices() {
+        let pool = DevicePool::new(vec![device(0), device(1)]).unwrap();
+        let jobs: Vec<PoolJob> = (0..4).map(|_| pool.acquire_pe(SUM).unwrap()).collect();
+        for d in 0..2 {
+            assert_eq!(jobs.iter().filter(|j| j.device == d).count(), 2);
+        }
+    }
+
+    #[test]
+    fn transfers_follow_the_device() {
+        let pool = DevicePool::new(vec![device(0), device(1)]).unwrap();
+        let memory = pool.device(0).unwrap().default_memory().unwrap();
+        // Keep the PEs of one device busy so the other one is used as well
+        let mut busy = Vec::new();
+        for _ in 0..4 {
+            let args = vec![
+                PEParameter::DataTransferAlloc(DataTransferAlloc {
+                    data: vec![1u8, 2, 3, 4].into_boxed_slice(),
+                    from_device: false,
+                    to_device: true,
+                    free: true,
+                    memory: memory.clone(),
+                    fixed: None,
+                }),
+                PEParameter::Single64(4),
+            ];
+            busy.push(pool.launch(SUM, args).unwrap().0);
+        }
+        assert!(busy.iter().any(|j| j.device == 1));
+        for mut j in busy {
+            assert_eq!(j.job.release(true, true).unwrap().0, 10);
+        }
+    }
+}
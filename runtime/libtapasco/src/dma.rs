@@ -30,16 +30,16 @@ use memmap::MmapMut;
 use snafu::ResultExt;
 use std::fs::File;
 use std::os::unix::prelude::*;
-use std::sync::Arc;
+use std::collections::HashSet;
+use std::sync::{Arc, Mutex};
 use crate::sim_client::SimClient;
 use crate::protos::simcalls::{
     write_platform::Data,
     Data32,
     WritePlatform,
-    WriteMemory,
-    ReadMemory,
 };
 use crate::sim_client;
+use crate::software_device::SoftwareDevice;
 
 #[derive(Debug, Snafu)]
 #[snafu(visibility(pub))]
@@ -90,6 +90,15 @@ pub enum Error {
 
     #[snafu(display("Streams not supported on this platform"))]
     StreamsNotSupported {},
+
+    #[snafu(display("Could not pin host memory for DMA {}", source))]
+    DMAPin { source: nix::Error },
+
+    #[snafu(display("Host memory at {:x} is not registered.", ptr))]
+    NotRegistered { ptr: usize },
+
+    #[snafu(display("Error during software device transfer: {}", source))]
+    SoftwareDeviceError { source: crate::software_device::Error },
 }
 pub(crate) type Result<T, E = Error> = std::result::Result<T, E>;
 
@@ -101,6 +110,22 @@ pub trait DMAControl: Debug {
     fn copy_from(&self, ptr: DeviceAddress, data: &mut [u8]) -> Result<()>;
     fn h2c_stream(&self, data: &[u8]) -> Result<()>;
     fn c2h_stream(&self, data: &mut [u8]) -> Result<()>;
+
+    /// Prepare `len` bytes of host memory at `ptr` for repeated transfers. The memory has
+    /// to stay valid until it is unregistered.
+    ///
+    /// Engines that access host memory directly keep the memory pinned, transfers from and
+    /// to it skip the bounce buffers. The default implementation does nothing.
+    fn register_host_memory(&self, _ptr: *const u8, _len: usize) -> Result<()> {
+        Ok(())
+    }
+
+    /// Release memory registered with [`register_host_memory`] at `ptr`.
+    ///
+    /// [`register_host_memory`]: #method.register_host_memory
+    fn unregister_host_memory(&self, _ptr: *const u8) -> Result<()> {
+        Ok(())
+    }
 }
 
 #[derive(Debug, Getters)]
@@ -405,7 +430,7 @@ impl DMAControl for SVMDMA {
 
 #[derive(Debug, Getters)]
 pub struct SimDMA {
-    client: SimClient,
+    client: Arc<SimClient>,
     offset: DeviceAddress,
     size: DeviceSize,
     is_platform: bool,
@@ -413,12 +438,13 @@ pub struct SimDMA {
 
 impl SimDMA {
     pub fn new(
+        client: Arc<SimClient>,
         offset: DeviceAddress,
         size: DeviceSize,
         is_platform: bool
     ) -> Result<Self> {
         Ok(Self {
-            client: SimClient::new().context(SimClientSnafu)?,
+            client,
             offset,
             size,
             is_platform,
@@ -444,10 +470,7 @@ impl DMAControl for SimDMA {
                 data: Some(Data::U32(Data32 {value: ints.to_vec()})),
             }).context(SimClientSnafu)?;
         } else {
-            self.client.write_memory(WriteMemory {
-                addr: self.offset + ptr as u64,
-                data: data.iter().map(|b| *b as u32).collect(),
-            }).context(SimClientSnafu)?;
+            self.client.write_memory(self.offset + ptr as u64, data).context(SimClientSnafu)?;
         }
         Ok(())
     }
@@ -470,12 +493,7 @@ impl DMAControl for SimDMA {
             let read_platform_response = self.client.read_platform(request).context(SimClientSnafu)?;
             data.copy_from_slice(read_platform_response.iter().map(|val| *val as u8).collect::<Vec<u8>>().as_mut_slice());
         } else {
-            let request = ReadMemory {
-                addr: self.offset + ptr as u64,
-                length: data.len() as u64,
-            };
-            let read_memory_response = self.client.read_memory(request).context(SimClientSnafu)?;
-            data.copy_from_slice(read_memory_response.iter().map(|val| *val as u8).collect::<Vec<u8>>().as_mut_slice());
+            self.client.read_memory(self.offset + ptr as u64, data).context(SimClientSnafu)?;
         }
 
         Ok(())
@@ -489,3 +507,57 @@ impl DMAControl for SimDMA {
         Err(Error::StreamsNotSupported {})
     }
 }
+
+/// Transfers to the memory of a [`SoftwareDevice`]
+///
+/// Takes as long as the modelled host-device link needs for the transfer. Registered host
+/// memory is only bookkept, so unbalanced registrations fail as on hardware engines.
+///
+/// [`SoftwareDevice`]: ../software_device/struct.SoftwareDevice.html
+#[derive(Debug)]
+pub struct SoftwareDMA {
+    device: Arc<SoftwareDevice>,
+    registered: Mutex<HashSet<usize>>,
+}
+
+impl SoftwareDMA {
+    pub fn new(device: Arc<SoftwareDevice>) -> Self {
+        Self {
+            device,
+            registered: Mutex::new(HashSet::new()),
+        }
+    }
+}
+
+impl DMAControl for SoftwareDMA {
+    fn copy_to(&self, data: &[u8], ptr: DeviceAddress) -> Result<()> {
+        self.device.copy_to(data, ptr).context(SoftwareDeviceSnafu)
+    }
+
+    fn copy_from(&self, ptr: DeviceAddress, data: &mut [u8]) -> Result<()> {
+        self.device.copy_from(ptr, data).context(SoftwareDeviceSnafu)
+    }
+
+    fn h2c_stream(&self, _data: &[u8]) -> Result<()> {
+        Err(Error::StreamsNotSupported {})
+    }
+
+    fn c2h_stream(&self, _data: &mut [u8]) -> Result<()> {
+        Err(Error::StreamsNotSupported {})
+    }
+
+    fn register_host_memory(&self, ptr: *const u8, len: usize) -> Result<()> {
+        trace!("Register Host({:?}) ({} Bytes)", ptr, len);
+        self.registered.lock()?.insert(ptr as usize);
+        Ok(())
+    }
+
+    fn unregister_host_memory(&self, ptr: *const u8) -> Result<()> {
+        trace!("Unregister Host({:?})", ptr);
+        if self.registered.lock()?.remove(&(ptr as usize)) {
+            Ok(())
+        } else {
+            Err(Error::NotRegistered { ptr: ptr as usize })
+        }
+    }
+}
@@ -22,22 +22,30 @@ use crate::device::DeviceAddress;
 use crate::device::DeviceSize;
 use crate::dma::DMABufferAllocateSnafu;
 use crate::dma::DMAControl;
+use crate::dma::DMAPinSnafu;
 use crate::dma::Error;
 use crate::dma::ErrorInterruptSnafu;
 use crate::dma::FailedMMapDMASnafu;
-use crate::interrupt::{Interrupt, TapascoInterrupt};
+use crate::interrupt::{CompletionDispatcher, Interrupt, TapascoInterrupt};
 use crate::tlkm::tlkm_dma_buffer_allocate;
 use crate::tlkm::tlkm_dma_buffer_op;
+use crate::tlkm::tlkm_dma_pin_cmd;
+use crate::tlkm::tlkm_dma_segment;
 use crate::tlkm::tlkm_ioctl_dma_buffer_allocate;
 use crate::tlkm::tlkm_ioctl_dma_buffer_from_dev;
+use crate::tlkm::tlkm_ioctl_dma_buffer_pin;
 use crate::tlkm::tlkm_ioctl_dma_buffer_to_dev;
+use crate::tlkm::tlkm_ioctl_dma_buffer_unpin;
+use crate::tlkm::tlkm_ioctl_dma_pinned_from_dev;
+use crate::tlkm::tlkm_ioctl_dma_pinned_to_dev;
 use core::fmt::Debug;
-use core::sync::atomic::AtomicU64;
+use core::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize};
 use crossbeam::deque::{Injector, Steal};
 use lockfree::queue::Queue;
 use memmap::MmapMut;
 use memmap::MmapOptions;
 use snafu::ResultExt;
+use std::collections::BTreeMap;
 use std::fs::File;
 use std::os::unix::prelude::*;
 use std::sync::atomic::Ordering;
@@ -45,6 +53,7 @@ use std::sync::Arc;
 use std::sync::Mutex;
 use std::sync::MutexGuard;
 use std::thread;
+use std::time::Duration;
 use std::ptr::write_volatile;
 use crate::dma::Error::StreamsNotSupported;
 
@@ -56,12 +65,141 @@ impl<T> From<std::sync::PoisonError<T>> for Error {
 
 type Result<T, E = Error> = std::result::Result<T, E>;
 
+/// Maximum time to sleep on a DMA interrupt before re-checking the buffer state.
+/// Other threads may consume the interrupt we are waiting for, so the wait is bounded.
+const DMA_INTERRUPT_WAIT: Duration = Duration::from_micros(100);
+
+/// Direct transfers are only used for host addresses aligned to the data width of the engine.
+const DIRECT_ALIGNMENT: usize = 64;
+
+const PAGE_SIZE: usize = 4096;
+
 #[derive(Debug)]
 struct DMABuffer {
     id: usize,
     size: usize,
     addr: u64,
     mapped: MmapMut,
+    /// Reported by TLKM if the buffer needs no cache maintenance, the sync ioctls are skipped then.
+    coherent: bool,
+}
+
+/// Host memory pinned by TLKM for direct transfers. The pages are unpinned on drop.
+#[derive(Debug)]
+struct PinnedRegion {
+    tlkm_file: Arc<File>,
+    id: usize,
+    start: usize,
+    len: usize,
+    coherent: bool,
+    /// Bus addresses of the region in order, adjacent pages are merged by TLKM.
+    segments: Vec<tlkm_dma_segment>,
+}
+
+impl PinnedRegion {
+    fn pin(tlkm_file: &Arc<File>, start: usize, len: usize) -> Result<PinnedRegion> {
+        // At most one segment per page
+        let pages = (start + len - 1) / PAGE_SIZE - start / PAGE_SIZE + 1;
+        let mut segments = vec![tlkm_dma_segment::default(); pages];
+        let mut cmd = tlkm_dma_pin_cmd {
+            user_addr: start as u64,
+            len: len as u64,
+            segments: segments.as_mut_ptr() as u64,
+            max_segments: segments.len(),
+            num_segments: 0,
+            buffer_id: 0,
+            coherent: false,
+        };
+        unsafe {
+            tlkm_ioctl_dma_buffer_pin(tlkm_file.as_raw_fd(), &mut cmd).context(DMAPinSnafu)?;
+        };
+        segments.truncate(cmd.num_segments);
+
+        trace!(
+            "Pinned {} bytes at 0x{:x} as buffer {} in {} segments.",
+            len,
+            start,
+            cmd.buffer_id,
+            segments.len()
+        );
+
+        Ok(PinnedRegion {
+            tlkm_file: tlkm_file.clone(),
+            id: cmd.buffer_id,
+            start,
+            len,
+            coherent: cmd.coherent,
+            segments,
+        })
+    }
+
+    fn contains(&self, start: usize, len: usize) -> bool {
+        start >= self.start && start + len <= self.start + self.len
+    }
+
+    /// Hand the region over to the engine (`to_device`) or back to the CPU.
+    fn sync(&self, to_device: bool) -> Result<()> {
+        if self.coherent {
+            return Ok(());
+        }
+        let mut op = tlkm_dma_buffer_op { buffer_id: self.id };
+        unsafe {
+            if to_device {
+                tlkm_ioctl_dma_pinned_to_dev(self.tlkm_file.as_raw_fd(), &mut op)
+            } else {
+                tlkm_ioctl_dma_pinned_from_dev(self.tlkm_file.as_raw_fd(), &mut op)
+            }
+            .context(DMAPinSnafu)?;
+        };
+        Ok(())
+    }
+}
+
+impl Drop for PinnedRegion {
+    fn drop(&mut self) {
+        let r = unsafe {
+            tlkm_ioctl_dma_buffer_unpin(
+                self.tlkm_file.as_raw_fd(),
+                &mut tlkm_dma_buffer_op { buffer_id: self.id },
+            )
+        };
+        if let Err(e) = r {
+            warn!("Failed to unpin host memory at 0x{:x}: {}", self.start, e);
+        }
+    }
+}
+
+/// Split `len` bytes starting at byte `offset` of the memory described by `segments` into
+/// pieces of at most `max` bytes. Returns the bus address and length of each piece.
+fn split_segments(
+    segments: &[tlkm_dma_segment],
+    offset: usize,
+    len: usize,
+    max: usize,
+) -> Vec<(u64, usize)> {
+    let mut r = Vec::new();
+    let mut skip = offset as u64;
+    let mut left = len as u64;
+    for s in segments {
+        if left == 0 {
+            break;
+        }
+        if skip >= s.len {
+            skip -= s.len;
+            continue;
+        }
+        let mut addr = s.addr + skip;
+        let mut avail = (s.len - skip).min(left);
+        skip = 0;
+        left -= avail;
+        while avail > 0 {
+            let n = avail.min(max as u64);
+            r.push((addr, n as usize));
+            addr += n;
+            avail -= n;
+        }
+    }
+    r
 }
 
 /// Provides a DMA implementation using on device DMA engines controlled by user space
@@ -72,8 +210,21 @@ struct DMABuffer {
 /// * dma.read_buffer_size: Size of each read buffer
 /// * dma.write_buffers: Number of write bounce buffers used
 /// * dma.write_buffer_size: Size of each write buffer
+/// * dma.fill_threads: Number of threads filling write buffers of a single large transfer
+/// * dma.parallel_fill_threshold: Minimum transfer size in bytes to use more than one fill thread
+/// * dma.zero_copy_threshold: Minimum transfer size in bytes to pin unregistered host memory
+///   for a direct transfer, 0 disables pinning on demand
 ///
 /// The implementation uses TLKM to allocate the required bounce buffers and retrieve interrupts.
+/// Write buffers are filled while previously filled buffers are transferred by the engine.
+///
+/// Host memory registered through [`register_host_memory`] stays pinned and the engine
+/// transfers directly from and to its pages using the scatter-gather list provided by TLKM.
+/// The bounce buffers then only serve as transfer slots bounding the number of outstanding
+/// transfers. Pinned pages count against the RLIMIT_MEMLOCK of the process, memory
+/// exceeding it is transferred through the bounce buffers.
+///
+/// [`register_host_memory`]: ../dma/trait.DMAControl.html#method.register_host_memory
 #[derive(Debug, Getters)]
 pub struct UserSpaceDMA {
     tlkm_file: Arc<File>,
@@ -96,6 +247,13 @@ pub struct UserSpaceDMA {
     c2h_cntr: AtomicU64,
     c2h_int_cntr: AtomicU64,
     dev_offset: u64,
+    write_buf_size: usize,
+    fill_threads: usize,
+    parallel_fill_threshold: usize,
+    read_buf_size: usize,
+    zero_copy_threshold: usize,
+    pin_supported: AtomicBool,
+    pinned: Mutex<BTreeMap<usize, Arc<PinnedRegion>>>,
 }
 
 impl UserSpaceDMA {
@@ -111,6 +269,10 @@ impl UserSpaceDMA {
         read_num_buf: usize,
         write_buf_size: usize,
         write_num_buf: usize,
+        fill_threads: usize,
+        parallel_fill_threshold: usize,
+        zero_copy_threshold: usize,
+        dispatcher: Option<&CompletionDispatcher>,
     ) -> Result<Self> {
         trace!(
             "Using setting: Read {} x {}B, Write {} x {}B",
@@ -129,6 +291,7 @@ impl UserSpaceDMA {
                 from_device: false,
                 buffer_id: 42,
                 addr: 42,
+                coherent: false,
             };
             unsafe {
                 tlkm_ioctl_dma_buffer_allocate(tlkm_file.as_raw_fd(), &mut to_dev_buf)
@@ -141,6 +304,7 @@ impl UserSpaceDMA {
                 id: to_dev_buf.buffer_id,
                 addr: to_dev_buf.addr,
                 size: write_buf_size,
+                coherent: to_dev_buf.coherent,
                 mapped: unsafe {
                     MmapOptions::new()
                         .len(write_buf_size)
@@ -157,6 +321,7 @@ impl UserSpaceDMA {
                 from_device: true,
                 buffer_id: 42,
                 addr: 42,
+                coherent: false,
             };
             unsafe {
                 tlkm_ioctl_dma_buffer_allocate(tlkm_file.as_raw_fd(), &mut from_dev_buf)
@@ -169,6 +334,7 @@ impl UserSpaceDMA {
                 id: from_dev_buf.buffer_id,
                 addr: from_dev_buf.addr,
                 size: read_buf_size,
+                coherent: from_dev_buf.coherent,
                 mapped: unsafe {
                     MmapOptions::new()
                         .len(read_buf_size)
@@ -192,8 +358,8 @@ impl UserSpaceDMA {
                 engine_offset: offset,
                 to_dev_buffer: write_map,
                 from_dev_buffer: read_map,
-                read_int: Interrupt::new(tlkm_file, read_interrupt, false).context(ErrorInterruptSnafu)?,
-                write_int: Interrupt::new(tlkm_file, write_interrupt, false).context(ErrorInterruptSnafu)?,
+                read_int: Interrupt::new(tlkm_file, read_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?,
+                write_int: Interrupt::new(tlkm_file, write_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?,
                 c2h_st_int: None,
                 h2c_st_int: None,
                 write_out: Queue::new(),
@@ -207,6 +373,13 @@ impl UserSpaceDMA {
                 h2c_cntr: AtomicU64::new(0),
                 h2c_int_cntr: AtomicU64::new(0),
                 dev_offset: 0,
+                write_buf_size,
+                fill_threads,
+                parallel_fill_threshold,
+                read_buf_size,
+                zero_copy_threshold,
+                pin_supported: AtomicBool::new(true),
+                pinned: Mutex::new(BTreeMap::new()),
             })
         } else {
             Ok(Self {
@@ -215,10 +388,10 @@ impl UserSpaceDMA {
                 engine_offset: offset,
                 to_dev_buffer: write_map,
                 from_dev_buffer: read_map,
-                read_int: Interrupt::new(tlkm_file, read_interrupt, false).context(ErrorInterruptSnafu)?,
-                write_int: Interrupt::new(tlkm_file, write_interrupt, false).context(ErrorInterruptSnafu)?,
-                c2h_st_int: Some(Interrupt::new(tlkm_file, c2h_interrupt, false).context(ErrorInterruptSnafu)?),
-                h2c_st_int: Some(Interrupt::new(tlkm_file, h2c_interrupt, false).context(ErrorInterruptSnafu)?),
+                read_int: Interrupt::new(tlkm_file, read_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?,
+                write_int: Interrupt::new(tlkm_file, write_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?,
+                c2h_st_int: Some(Interrupt::new(tlkm_file, c2h_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?),
+                h2c_st_int: Some(Interrupt::new(tlkm_file, h2c_interrupt, false, dispatcher).context(ErrorInterruptSnafu)?),
                 write_out: Queue::new(),
                 write_cntr: AtomicU64::new(0),
                 write_int_cntr: AtomicU64::new(0),
@@ -230,6 +403,13 @@ impl UserSpaceDMA {
                 h2c_cntr: AtomicU64::new(0),
                 h2c_int_cntr: AtomicU64::new(0),
                 dev_offset: 0x0100_0000_0000, // address region DDR_LOW3 (3 TB):
+                write_buf_size,
+                fill_threads,
+                parallel_fill_threshold,
+                read_buf_size,
+                zero_copy_threshold,
+                pin_supported: AtomicBool::new(true),
+                pinned: Mutex::new(BTreeMap::new()),
             })
         }
     }
@@ -299,7 +479,7 @@ impl UserSpaceDMA {
                 || (!next && int_cntr.load(Ordering::Relaxed) <= cntr)
             {
                 let n = intr
-                    .check_for_interrupt()
+                    .wait_for_interrupt_timeout(DMA_INTERRUPT_WAIT)
                     .context(ErrorInterruptSnafu)?;
                 for _ in 0..n {
                     int_cntr.fetch_add(1, Ordering::Relaxed);
@@ -308,7 +488,9 @@ impl UserSpaceDMA {
                         None => return Err(Error::TooManyInterrupts {}),
                     }
                 }
-                thread::yield_now();
+                if n == 0 {
+                    thread::yield_now();
+                }
             }
         }
 
@@ -317,8 +499,9 @@ impl UserSpaceDMA {
 
     /// Update the read completion counter
     ///
-    /// Uses the eventfd interrupt mechanism
-    fn update_interrupts(&self, stream: bool) -> Result<()> {
+    /// Uses the eventfd interrupt mechanism. Waits at most `timeout` for an interrupt
+    /// and returns the number of interrupts that have occured.
+    fn update_interrupts(&self, stream: bool, timeout: Duration) -> Result<u64> {
         let (intr, int_cntr) = if stream {
             (
                 match &self.c2h_st_int {
@@ -330,12 +513,15 @@ impl UserSpaceDMA {
         } else {
             (&self.read_int, &self.read_int_cntr)
         };
-        let n = intr
-            .check_for_interrupt()
-            .context(ErrorInterruptSnafu)?;
+        let n = if timeout.is_zero() {
+            intr.check_for_interrupt()
+        } else {
+            intr.wait_for_interrupt_timeout(timeout)
+        }
+        .context(ErrorInterruptSnafu)?;
         int_cntr.fetch_add(n, Ordering::Relaxed);
 
-        Ok(())
+        Ok(n)
     }
 
     /// Copy the read buffers that have been filled by the DMA engine to user space memory
@@ -346,13 +532,15 @@ impl UserSpaceDMA {
         offset: usize,
         btt: usize,
     ) -> Result<()> {
-        unsafe {
-            tlkm_ioctl_dma_buffer_from_dev(
-                self.tlkm_file.as_raw_fd(),
-                &mut tlkm_dma_buffer_op { buffer_id: buf.id },
-            )
-            .context(DMABufferAllocateSnafu)?;
-        };
+        if !buf.coherent {
+            unsafe {
+                tlkm_ioctl_dma_buffer_from_dev(
+                    self.tlkm_file.as_raw_fd(),
+                    &mut tlkm_dma_buffer_op { buffer_id: buf.id },
+                )
+                .context(DMABufferAllocateSnafu)?;
+            };
+        }
 
         data[offset..offset + btt].copy_from_slice(&buf.mapped[0..btt]);
 
@@ -361,7 +549,7 @@ impl UserSpaceDMA {
 
     fn release_buffer(
         &self,
-        used_buffers: &mut Vec<(u64, Option<DMABuffer>, usize, usize)>,
+        used_buffers: &mut Vec<(u64, Option<DMABuffer>, usize, usize, bool)>,
         data: &mut [u8],
         stream: bool,
     ) -> Result<()> {
@@ -371,11 +559,13 @@ impl UserSpaceDMA {
         } else {
             self.read_int_cntr.load(Ordering::Relaxed)
         };
-        for (cntr, buf, offset, len) in used_buffers.iter_mut() {
+        for (cntr, buf, offset, len, copy) in used_buffers.iter_mut() {
             if *cntr < int_cntr_used {
                 let buf_taken = buf.take();
                 if let Some(b) = buf_taken {
-                    self.copyback_buffer(data, &b, *offset, *len)?;
+                    if *copy {
+                        self.copyback_buffer(data, &b, *offset, *len)?;
+                    }
                     self.from_dev_buffer.push(b);
                 };
             } else {
@@ -383,134 +573,327 @@ impl UserSpaceDMA {
             }
         }
 
-        used_buffers.retain(|(x, _y, _z, _a)| *x >= int_cntr_used);
+        used_buffers.retain(|(x, _y, _z, _a, _b)| *x >= int_cntr_used);
         Ok(())
     }
 
+    /// Returns the pinned region to transfer `len` bytes at `ptr` directly and the offset of
+    /// `ptr` in the region.
+    ///
+    /// Registered memory is always transferred directly. Other memory is pinned for the
+    /// duration of the transfer if it is at least `dma.zero_copy_threshold` bytes long.
+    /// Pinning is disabled for good only if the driver does not support it, other
+    /// failures fall back to the bounce buffers for this transfer only.
+    fn direct_region(
+        &self,
+        ptr: *const u8,
+        len: usize,
+    ) -> Result<Option<(Arc<PinnedRegion>, usize)>> {
+        let start = ptr as usize;
+        if len == 0 || start % DIRECT_ALIGNMENT != 0 {
+            return Ok(None);
+        }
+
+        let registered = self
+            .pinned
+            .lock()?
+            .range(..=start)
+            .next_back()
+            .filter(|(_, r)| r.contains(start, len))
+            .map(|(_, r)| r.clone());
+        if let Some(r) = registered {
+            let offset = start - r.start;
+            return Ok(Some((r, offset)));
+        }
+
+        if self.zero_copy_threshold == 0
+            || len < self.zero_copy_threshold
+            || !self.pin_supported.load(Ordering::Relaxed)
+        {
+            return Ok(None);
+        }
+        match PinnedRegion::pin(&self.tlkm_file, start, len) {
+            Ok(r) => Ok(Some((Arc::new(r), 0))),
+            Err(Error::DMAPin {
+                source: e @ (nix::errno::Errno::ENOTTY | nix::errno::Errno::EOPNOTSUPP),
+            }) => {
+                warn!(
+                    "Driver cannot pin host memory, using bounce buffers from now on: {}",
+                    e
+                );
+                self.pin_supported.store(false, Ordering::Relaxed);
+                Ok(None)
+            }
+            Err(e) => {
+                // E.g. memory the driver cannot pin, later transfers may still succeed
+                trace!("Pinning host memory failed, using bounce buffers: {}", e);
+                Ok(None)
+            }
+        }
+    }
+
+    fn take_write_buffer(&self, stream: bool) -> Result<DMABuffer> {
+        loop {
+            match self.to_dev_buffer.steal() {
+                Steal::Success(buffer) => return Ok(buffer),
+                Steal::Empty => self.wait_for_write(true, 0, stream)?,
+                Steal::Retry => (),
+            }
+        }
+    }
+
+    /// Start a transfer from `addr_host` to the device. `buffer` returns to the pool once
+    /// the engine signals completion. Returns the transfer counter.
+    fn schedule_write(
+        &self,
+        buffer: DMABuffer,
+        addr_host: u64,
+        ptr_device: DeviceAddress,
+        len: usize,
+        stream: bool,
+    ) -> Result<u64> {
+        let dma_engine_memory = self.memory.lock()?;
+        if stream {
+            self.h2c_out.push(buffer);
+        } else {
+            self.write_out.push(buffer);
+        }
+        self.schedule_dma_transfer(
+            &dma_engine_memory,
+            addr_host,
+            ptr_device,
+            len as u64,
+            false,
+            stream,
+        );
+        Ok(if stream {
+            self.h2c_cntr.fetch_add(1, Ordering::Relaxed)
+        } else {
+            self.write_cntr.fetch_add(1, Ordering::Relaxed)
+        })
+    }
+
+    /// Copy `data` to the device through the write bounce buffers.
+    ///
+    /// The buffers are filled while the engine transfers previously filled ones. Large
+    /// transfers are split among `dma.fill_threads` threads which claim chunks of the size
+    /// of a bounce buffer. The chunks are independent and may be scheduled in any order,
+    /// only streams are always transferred in order by the calling thread.
     fn do_copy_to(&self, data: &[u8], ptr: DeviceAddress, stream: bool) -> Result<()> {
-        let mut ptr_buffer = 0;
-        let mut ptr_device = ptr;
-        let mut btt = data.len();
+        if let Some((region, offset)) = self.direct_region(data.as_ptr(), data.len())? {
+            return self.direct_copy_to(&region, offset, data.len(), ptr, stream);
+        }
 
-        let mut highest_used = 0;
+        let next_chunk = AtomicUsize::new(0);
+        let chunks = (data.len() + self.write_buf_size - 1) / self.write_buf_size;
+        let threads = if stream || data.len() < self.parallel_fill_threshold {
+            1
+        } else {
+            self.fill_threads.min(chunks)
+        };
 
-        while btt > 0 {
-            let mut buffer = loop {
-                match self.to_dev_buffer.steal() {
-                    Steal::Success(buffer) => break buffer,
-                    Steal::Empty => self.wait_for_write(true, 0, stream)?,
-                    Steal::Retry => (),
+        let highest_used = if threads <= 1 {
+            self.fill_and_schedule(data, ptr, stream, &next_chunk)?
+        } else {
+            thread::scope(|s| {
+                let workers: Vec<_> = (1..threads)
+                    .map(|_| s.spawn(|| self.fill_and_schedule(data, ptr, stream, &next_chunk)))
+                    .collect();
+                let mut highest = self.fill_and_schedule(data, ptr, stream, &next_chunk);
+                for w in workers {
+                    let r = w.join().unwrap();
+                    highest = match (highest, r) {
+                        (Ok(a), Ok(b)) => Ok(a.max(b)),
+                        (Err(e), _) | (_, Err(e)) => Err(e),
+                    };
                 }
-            };
+                highest
+            })?
+        };
 
-            let btt_this = if btt < buffer.size { btt } else { buffer.size };
+        match highest_used {
+            Some(h) => self.wait_for_write(false, h, stream),
+            None => Ok(()),
+        }
+    }
 
-            unsafe {
-                tlkm_ioctl_dma_buffer_from_dev(
-                    self.tlkm_file.as_raw_fd(),
-                    &mut tlkm_dma_buffer_op {
-                        buffer_id: buffer.id,
-                    },
-                )
-                    .context(DMABufferAllocateSnafu)?;
-            };
+    /// Fill write buffers with the chunks of `data` claimed through `next_chunk` and schedule
+    /// their transfer. Returns the highest transfer counter used.
+    fn fill_and_schedule(
+        &self,
+        data: &[u8],
+        ptr: DeviceAddress,
+        stream: bool,
+        next_chunk: &AtomicUsize,
+    ) -> Result<Option<u64>> {
+        let mut highest_used = None;
 
-            buffer.mapped[0..btt_this].copy_from_slice(&data[ptr_buffer..ptr_buffer + btt_this]);
+        loop {
+            let ptr_buffer = next_chunk.fetch_add(1, Ordering::Relaxed) * self.write_buf_size;
+            if ptr_buffer >= data.len() {
+                break;
+            }
+            let btt_this = (data.len() - ptr_buffer).min(self.write_buf_size);
+            let ptr_device = if stream { 0 } else { ptr + ptr_buffer as u64 };
 
-            unsafe {
-                tlkm_ioctl_dma_buffer_to_dev(
-                    self.tlkm_file.as_raw_fd(),
-                    &mut tlkm_dma_buffer_op {
-                        buffer_id: buffer.id,
-                    },
-                )
-                    .context(DMABufferAllocateSnafu)?;
-            };
+            let mut buffer = self.take_write_buffer(stream)?;
 
-            {
-                let dma_engine_memory = self.memory.lock()?;
-                let addr = buffer.addr;
-                if stream {
-                    self.h2c_out.push(buffer);
-                } else {
-                    self.write_out.push(buffer);
-                }
-                self.schedule_dma_transfer(
-                    &dma_engine_memory,
-                    addr,
-                    ptr_device,
-                    btt_this as u64,
-                    false,
-                    stream
-                );
-                highest_used = if stream {
-                    self.h2c_cntr.fetch_add(1, Ordering::Relaxed)
-                } else {
-                    self.write_cntr.fetch_add(1, Ordering::Relaxed)
-                }
+            if !buffer.coherent {
+                unsafe {
+                    tlkm_ioctl_dma_buffer_from_dev(
+                        self.tlkm_file.as_raw_fd(),
+                        &mut tlkm_dma_buffer_op {
+                            buffer_id: buffer.id,
+                        },
+                    )
+                        .context(DMABufferAllocateSnafu)?;
+                };
             }
 
-            btt -= btt_this;
-            ptr_buffer += btt_this;
+            buffer.mapped[0..btt_this].copy_from_slice(&data[ptr_buffer..ptr_buffer + btt_this]);
+
+            if !buffer.coherent {
+                unsafe {
+                    tlkm_ioctl_dma_buffer_to_dev(
+                        self.tlkm_file.as_raw_fd(),
+                        &mut tlkm_dma_buffer_op {
+                            buffer_id: buffer.id,
+                        },
+                    )
+                        .context(DMABufferAllocateSnafu)?;
+                };
+            }
+
+            let addr = buffer.addr;
+            highest_used = Some(self.schedule_write(buffer, addr, ptr_device, btt_this, stream)?);
+        }
+
+        Ok(highest_used)
+    }
+
+    /// Transfer `len` bytes at `offset` of a pinned region directly to the device.
+    ///
+    /// A write bounce buffer is taken for every transfer but stays unused. This keeps the
+    /// number of outstanding transfers in the engine bounded.
+    fn direct_copy_to(
+        &self,
+        region: &PinnedRegion,
+        offset: usize,
+        len: usize,
+        ptr: DeviceAddress,
+        stream: bool,
+    ) -> Result<()> {
+        region.sync(true)?;
+
+        let mut ptr_device = ptr;
+        let mut highest_used = None;
+        for (addr, n) in split_segments(&region.segments, offset, len, self.write_buf_size) {
+            let slot = self.take_write_buffer(stream)?;
+            highest_used = Some(self.schedule_write(slot, addr, ptr_device, n, stream)?);
             if !stream {
-                ptr_device += btt_this as u64;
+                ptr_device += n as u64;
             }
         }
 
-        self.wait_for_write(false, highest_used, stream)?;
+        match highest_used {
+            Some(h) => self.wait_for_write(false, h, stream),
+            None => Ok(()),
+        }
+    }
+
+    fn take_read_buffer(
+        &self,
+        used_buffers: &mut Vec<(u64, Option<DMABuffer>, usize, usize, bool)>,
+        data: &mut [u8],
+        stream: bool,
+    ) -> Result<DMABuffer> {
+        loop {
+            self.update_interrupts(stream, Duration::ZERO)?;
+            self.release_buffer(used_buffers, data, stream)?;
+
+            match self.from_dev_buffer.steal() {
+                Steal::Success(buffer) => return Ok(buffer),
+                Steal::Empty => {
+                    if self.update_interrupts(stream, DMA_INTERRUPT_WAIT)? == 0 {
+                        thread::yield_now();
+                    }
+                }
+                Steal::Retry => (),
+            }
+        }
+    }
+
+    /// Start a transfer from the device to `addr_host`. Returns the transfer counter.
+    fn schedule_read(
+        &self,
+        addr_host: u64,
+        ptr_device: DeviceAddress,
+        len: usize,
+        stream: bool,
+    ) -> Result<u64> {
+        let dma_engine_memory = self.memory.lock()?;
+        self.schedule_dma_transfer(
+            &dma_engine_memory,
+            addr_host,
+            ptr_device,
+            len as u64,
+            true,
+            stream,
+        );
+        Ok(if stream {
+            self.c2h_cntr.fetch_add(1, Ordering::Relaxed)
+        } else {
+            self.read_cntr.fetch_add(1, Ordering::Relaxed)
+        })
+    }
 
+    fn wait_for_reads(
+        &self,
+        used_buffers: &mut Vec<(u64, Option<DMABuffer>, usize, usize, bool)>,
+        data: &mut [u8],
+        stream: bool,
+    ) -> Result<()> {
+        while !used_buffers.is_empty() {
+            self.release_buffer(used_buffers, data, stream)?;
+            if self.update_interrupts(stream, DMA_INTERRUPT_WAIT)? == 0 {
+                thread::yield_now();
+            }
+        }
         Ok(())
     }
 
     fn do_copy_from(&self, ptr: DeviceAddress, data: &mut [u8], stream: bool) -> Result<()> {
+        if let Some((region, offset)) = self.direct_region(data.as_ptr(), data.len())? {
+            return self.direct_copy_from(ptr, &region, offset, data.len(), stream);
+        }
+
         let mut ptr_buffer = 0;
         let mut ptr_device = ptr;
         let mut btt = data.len();
 
-        let mut used_buffers: Vec<(u64, Option<DMABuffer>, usize, usize)> = Vec::new();
+        // (transfer counter, buffer, offset in data, length, copy back)
+        let mut used_buffers: Vec<(u64, Option<DMABuffer>, usize, usize, bool)> = Vec::new();
 
         while btt > 0 {
-            let buffer = loop {
-                self.update_interrupts(stream)?;
-                self.release_buffer(&mut used_buffers, data, stream)?;
-
-                match self.from_dev_buffer.steal() {
-                    Steal::Success(buffer) => break buffer,
-                    Steal::Empty => thread::yield_now(),
-                    Steal::Retry => (),
-                }
-            };
+            let buffer = self.take_read_buffer(&mut used_buffers, data, stream)?;
 
             let btt_this = if btt < buffer.size { btt } else { buffer.size };
 
-            unsafe {
-                tlkm_ioctl_dma_buffer_to_dev(
-                    self.tlkm_file.as_raw_fd(),
-                    &mut tlkm_dma_buffer_op {
-                        buffer_id: buffer.id,
-                    },
-                )
-                    .context(DMABufferAllocateSnafu)?;
-            };
+            if !buffer.coherent {
+                unsafe {
+                    tlkm_ioctl_dma_buffer_to_dev(
+                        self.tlkm_file.as_raw_fd(),
+                        &mut tlkm_dma_buffer_op {
+                            buffer_id: buffer.id,
+                        },
+                    )
+                        .context(DMABufferAllocateSnafu)?;
+                };
+            }
 
-            let cntr = {
-                let dma_engine_memory = self.memory.lock()?;
-                self.schedule_dma_transfer(
-                    &dma_engine_memory,
-                    buffer.addr,
-                    ptr_device,
-                    btt_this as u64,
-                    true,
-                    stream
-                );
-                if stream {
-                    self.c2h_cntr.fetch_add(1, Ordering::Relaxed)
-                } else {
-                    self.read_cntr.fetch_add(1, Ordering::Relaxed)
-                }
-            };
+            let cntr = self.schedule_read(buffer.addr, ptr_device, btt_this, stream)?;
 
-            used_buffers.push((cntr, Some(buffer), ptr_buffer, btt_this));
+            used_buffers.push((cntr, Some(buffer), ptr_buffer, btt_this, true));
 
             btt -= btt_this;
             ptr_buffer += btt_this;
@@ -519,13 +902,35 @@ impl UserSpaceDMA {
             }
         }
 
-        while !used_buffers.is_empty() {
-            self.release_buffer(&mut used_buffers, data, stream)?;
-            self.update_interrupts(stream)?;
-            thread::yield_now();
+        self.wait_for_reads(&mut used_buffers, data, stream)
+    }
+
+    /// Transfer `len` bytes from the device directly to `offset` of a pinned region.
+    ///
+    /// As for direct writes, read bounce buffers only serve as transfer slots.
+    fn direct_copy_from(
+        &self,
+        ptr: DeviceAddress,
+        region: &PinnedRegion,
+        offset: usize,
+        len: usize,
+        stream: bool,
+    ) -> Result<()> {
+        region.sync(true)?;
+
+        let mut ptr_device = ptr;
+        let mut used_buffers = Vec::new();
+        for (addr, n) in split_segments(&region.segments, offset, len, self.read_buf_size) {
+            let slot = self.take_read_buffer(&mut used_buffers, &mut [], stream)?;
+            let cntr = self.schedule_read(addr, ptr_device, n, stream)?;
+            used_buffers.push((cntr, Some(slot), 0, n, false));
+            if !stream {
+                ptr_device += n as u64;
+            }
         }
+        self.wait_for_reads(&mut used_buffers, &mut [], stream)?;
 
-        Ok(())
+        region.sync(false)
     }
 }
 
@@ -571,4 +976,49 @@ impl DMAControl for UserSpaceDMA {
 
         self.do_copy_from(0, data, true)
     }
+
+    fn register_host_memory(&self, ptr: *const u8, len: usize) -> Result<()> {
+        trace!("Register Host({:?}) ({} Bytes)", ptr, len);
+        let region = PinnedRegion::pin(&self.tlkm_file, ptr as usize, len)?;
+        self.pinned.lock()?.insert(ptr as usize, Arc::new(region));
+        Ok(())
+    }
+
+    fn unregister_host_memory(&self, ptr: *const u8) -> Result<()> {
+        trace!("Unregister Host({:?})", ptr);
+        // Transfers still using the region keep it pinned until they are done
+        match self.pinned.lock()?.remove(&(ptr as usize)) {
+            Some(_) => Ok(()),
+            None => Err(Error::NotRegistered { ptr: ptr as usize }),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn split_pinned_segments() {
+        let segments = [
+            tlkm_dma_segment {
+                addr: 0x10000,
+                len: 0x3000,
+            },
+            tlkm_dma_segment {
+                addr: 0x80000,
+                len: 0x1000,
+            },
+        ];
+        assert_eq!(
+            split_segments(&segments, 0, 0x4000, 0x2000),
+            vec![(0x10000, 0x2000), (0x12000, 0x1000), (0x80000, 0x1000)]
+        );
+        assert_eq!(
+            split_segments(&segments, 0x2800, 0x1000, 0x2000),
+            vec![(0x12800, 0x800), (0x80000, 0x800)]
+        );
+        assert_eq!(split_segments(&segments, 0x3000, 0x10, 0x2000), vec![(0x80000, 0x10)]);
+        assert!(split_segments(&segments, 0, 0, 0x2000).is_empty());
+    }
 }
@@ -18,29 +18,39 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-use crate::device::{DataTransferAlloc, DataTransferStream};
+use crate::device::{DataTransferAlloc, DataTransferBuffer, DataTransferStream};
 use crate::device::DataTransferLocal;
 use crate::device::DataTransferPrealloc;
 use crate::device::Device;
 use crate::device::DeviceAddress;
 use crate::device::OffchipMemory;
 use crate::device::PEParameter;
-use crate::job::Job;
+use crate::device_buffer::{DeviceBuffer, LocalBuffer};
+use crate::device_pool::DevicePool;
+use crate::host_buffer::HostBuffer;
+use crate::job::{Job, JobBatch};
+use crate::latency::{self, JobLatency, LatencyStage, LatencySummary};
 use crate::pe::PEId;
 use crate::tlkm::tlkm_access;
 use crate::tlkm::DeviceId;
 use crate::tlkm::DeviceInfo;
 use crate::tlkm::TLKM;
 use crate::scheduler::SinglePEHandler;
+use crate::software_device::{PEContext, PEModel, SoftwareDeviceConfig};
+use crate::task_graph::{GraphArg, TaskGraph};
 use core::cell::RefCell;
 use libc::c_char;
 use libc::c_int;
+use libc::c_void;
+use once_cell::sync::Lazy;
 use snafu::ResultExt;
 use std::collections::HashMap;
 use std::ffi::CStr;
 use std::ptr;
 use std::slice;
 use std::sync::Arc;
+use std::sync::Mutex;
+use std::time::Duration;
 use std::u64;
 
 #[derive(Debug, Snafu)]
@@ -77,6 +87,39 @@ pub enum Error {
 
     #[snafu(display("Error in plugin: {}", source))]
     FFIPluginError { source: crate::plugins::plugin::Error },
+
+    #[snafu(display("Error during device buffer operation: {}", source))]
+    DeviceBufferError { source: crate::device_buffer::Error },
+
+    #[snafu(display("Error during host buffer operation: {}", source))]
+    HostBufferError { source: crate::host_buffer::Error },
+
+    #[snafu(display("Pointer {:x} was not returned by tapasco_alloc_host.", ptr))]
+    UnknownHostBuffer { ptr: usize },
+
+    #[snafu(display("Could not start asynchronous completion runtime: {}", message))]
+    AsyncRuntimeError { message: String },
+
+    #[snafu(display("Software PE model needs a callback."))]
+    MissingPEModel {},
+
+    #[snafu(display("Error during task graph operation: {}", source))]
+    TaskGraphError { source: crate::task_graph::Error },
+
+    #[snafu(display("Error during device pool operation: {}", source))]
+    DevicePoolError { source: crate::device_pool::Error },
+
+    #[snafu(display("Error during trace operation: {}", source))]
+    TraceError { source: crate::trace::Error },
+
+    #[snafu(display("Mutex has been poisoned"))]
+    MutexError {},
+}
+
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
 }
 
 //////////////////////
@@ -323,6 +366,192 @@ pub unsafe extern "C" fn tapasco_tlkm_device_destroy(t: *mut Device) {
 // END TLKM
 //////////////
 
+/////////////////////
+// Software Devices
+/////////////////////
+
+/// Behaviour of a software PE.
+///
+/// Called on the worker thread of the PE with the index of the PE on the device, its
+/// argument registers and the device memory, whose first byte is device address 0.
+/// Returns the value of the return register.
+pub type TapascoPEModelFn = Option<
+    unsafe extern "C" fn(
+        user_data: *mut c_void,
+        pe: usize,
+        args: *const u64,
+        num_args: usize,
+        memory: *mut u8,
+        memory_size: u64,
+    ) -> u64,
+>;
+
+/// Called with the user data of a PE model once the model is no longer used.
+pub type TapascoPEModelDestroyFn = Option<unsafe extern "C" fn(user_data: *mut c_void)>;
+
+struct ForeignPEModel {
+    callback: unsafe extern "C" fn(*mut c_void, usize, *const u64, usize, *mut u8, u64) -> u64,
+    destroy: TapascoPEModelDestroyFn,
+    user_data: *mut c_void,
+}
+
+// The user data is handed to the callbacks only, synchronization is up to the model.
+unsafe impl Send for ForeignPEModel {}
+unsafe impl Sync for ForeignPEModel {}
+
+impl PEModel for ForeignPEModel {
+    fn execute(&self, ctx: &PEContext) -> u64 {
+        unsafe {
+            (self.callback)(
+                self.user_data,
+                ctx.id(),
+                ctx.args().as_ptr(),
+                ctx.args().len(),
+                ctx.memory().as_ptr(),
+                ctx.memory().size(),
+            )
+        }
+    }
+}
+
+impl Drop for ForeignPEModel {
+    fn drop(&mut self) {
+        if let Some(destroy) = self.destroy {
+            unsafe { destroy(self.user_data) };
+        }
+    }
+}
+
+/// Create the description of a software device with the default memory and link.
+#[no_mangle]
+pub extern "C" fn tapasco_software_config_new() -> *mut SoftwareDeviceConfig {
+    Box::into_raw(Box::new(SoftwareDeviceConfig::default()))
+}
+
+/// # Safety
+/// The config must have been created by `tapasco_software_config_new` and not be used
+/// afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_software_config_destroy(config: *mut SoftwareDeviceConfig) {
+    if !config.is_null() {
+        let _b: Box<SoftwareDeviceConfig> = Box::from_raw(config);
+    }
+}
+
+/// Set memory size and the modelled DMA link of a software device.
+///
+/// # Arguments
+///  * `memory_size`: Size of the device memory in bytes.
+///  * `h2c_bandwidth`, `c2h_bandwidth`: Bytes per second, '0' for unlimited.
+///  * `latency_ns`: Completion latency of a transfer in nanoseconds.
+/// # Returns
+///  * '-1' if an error occured, '0' otherwise
+/// # Safety
+/// The config must have been created by `tapasco_software_config_new`.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_software_config_set_memory(
+    config: *mut SoftwareDeviceConfig,
+    memory_size: u64,
+    h2c_bandwidth: u64,
+    c2h_bandwidth: u64,
+    latency_ns: u64,
+) -> isize {
+    if config.is_null() {
+        warn!("Null pointer passed into tapasco_software_config_set_memory() as the config");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    let c = &mut *config;
+    c.memory_size = memory_size;
+    c.h2c_bandwidth = h2c_bandwidth;
+    c.c2h_bandwidth = c2h_bandwidth;
+    c.dma_latency = Duration::from_nanos(latency_ns);
+    0
+}
+
+/// Add `count` PEs of type `type_id` to a software device.
+///
+/// On success the config owns `user_data` and calls `destroy` on it once the PEs are
+/// gone. `destroy` may be null.
+///
+/// # Arguments
+///  * `name`: Name of the PE type as found in the status core.
+///  * `latency_ns`: Minimum execution time of the PE in nanoseconds.
+///  * `callback`: Behaviour of the PE.
+/// # Returns
+///  * '-1' if an error occured, '0' otherwise
+/// # Safety
+/// The config must have been created by `tapasco_software_config_new` and `name` must be
+/// a valid C string.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_software_config_add_pe(
+    config: *mut SoftwareDeviceConfig,
+    type_id: PEId,
+    name: *const c_char,
+    count: usize,
+    latency_ns: u64,
+    callback: TapascoPEModelFn,
+    destroy: TapascoPEModelDestroyFn,
+    user_data: *mut c_void,
+) -> isize {
+    if config.is_null() || name.is_null() {
+        warn!("Null pointer passed into tapasco_software_config_add_pe()");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    let callback = match callback {
+        Some(c) => c,
+        None => {
+            update_last_error(Error::MissingPEModel {});
+            return -1;
+        }
+    };
+    let name = CStr::from_ptr(name).to_string_lossy();
+    (*config).add_pe(
+        type_id,
+        &name,
+        count,
+        Duration::from_nanos(latency_ns),
+        Arc::new(ForeignPEModel {
+            callback,
+            destroy,
+            user_data,
+        }),
+    );
+    0
+}
+
+/// Create a software device from `config`, which is consumed.
+///
+/// The device is released with `tapasco_tlkm_device_destroy` like any other device.
+///
+/// # Safety
+/// The config must have been created by `tapasco_software_config_new` and must not be
+/// used afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_software_device_alloc(
+    config: *mut SoftwareDeviceConfig,
+    id: DeviceId,
+) -> *mut Device {
+    if config.is_null() {
+        warn!("Null pointer passed into tapasco_software_device_alloc() as the config");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+    let config: Box<SoftwareDeviceConfig> = Box::from_raw(config);
+    match Device::new_software(id, *config, &HashMap::new()).context(DeviceSnafu) {
+        Ok(x) => std::boxed::Box::<Device>::into_raw(Box::new(x)),
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/////////////////////
+// END Software Devices
+/////////////////////
+
 /////////////////
 // Job Creation
 /////////////////
@@ -541,6 +770,57 @@ pub unsafe extern "C" fn tapasco_job_param_virtualaddress(addr: *const u8, list:
     list
 }
 
+/// Pass a persistent device buffer to the PE. Pending host modifications are
+/// transferred before the PE starts, nothing is transferred back afterwards.
+///
+/// # Arguments
+///  * `from_device`: Set if the PE writes to the buffer.
+///
+/// # Safety
+/// `buf` has to be a valid buffer created by `tapasco_device_buffer_create`. The list
+/// holds its own reference to the buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_job_param_buffer(
+    buf: *mut TapascoDeviceBuffer,
+    from_device: bool,
+    list: *mut JobList,
+) -> *mut JobList {
+    if list.is_null() || buf.is_null() {
+        warn!("Null pointer passed into tapasco_job_param_buffer() as the list or buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let tl = &mut *list;
+    tl.push(PEParameter::DeviceBuffer(DataTransferBuffer {
+        buffer: (*buf).clone(),
+        from_device,
+    }));
+    list
+}
+
+/// Pass a buffer that is kept in the local memory of the PE. It is only transferred if
+/// the local memory of the PE does not hold the current content yet.
+///
+/// # Safety
+/// `buf` has to be a valid buffer created by `tapasco_local_buffer_create`. The list
+/// holds its own reference to the buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_job_param_local_buffer(
+    buf: *mut TapascoLocalBuffer,
+    list: *mut JobList,
+) -> *mut JobList {
+    if list.is_null() || buf.is_null() {
+        warn!("Null pointer passed into tapasco_job_param_local_buffer() as the list or buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let tl = &mut *list;
+    tl.push(PEParameter::LocalBuffer((*buf).clone()));
+    list
+}
+
 /// # Safety
 /// TODO
 #[no_mangle]
@@ -670,6 +950,34 @@ pub unsafe extern "C" fn tapasco_device_acquire_pe(dev: *mut Device, id: PEId) -
     }
 }
 
+/// Acquire a PE for a job with the given parameters, preferring PEs whose local memory
+/// already holds the local buffers in `params`. Falls back to any PE after the
+/// configured affinity wait.
+///
+/// # Safety
+/// `params` has to be a valid list, it is not consumed.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_acquire_pe_for(
+    dev: *mut Device,
+    id: PEId,
+    params: *const JobList,
+) -> *mut Job {
+    if dev.is_null() || params.is_null() {
+        warn!("Null pointer passed into tapasco_device_acquire_pe_for() as the device or list");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let tl = &mut *dev;
+    match tl.acquire_pe_for(id, &*params).context(DeviceSnafu) {
+        Ok(x) => std::boxed::Box::<Job>::into_raw(Box::new(x)),
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
 #[no_mangle]
 /// Acquire PE if available and return job.
 ///
@@ -704,6 +1012,46 @@ pub unsafe extern "C" fn tapasco_device_try_acquire_pe(dev: *mut Device, id: PEI
     }
 }
 
+#[no_mangle]
+/// Acquire PE, waiting at most `timeout_us` microseconds for one to become available.
+///
+/// # Arguments
+///  * `dev`: Device on which the PE should be acquired.
+///  * `id`: PE ID of PE.
+///  * `timeout_us`: Maximum time to wait in microseconds.
+///  * `job`: Double pointer to return job object.
+/// # Returns
+///  * 'false' if an error occurred, 'true' otherwise with `job` pointing to the new job object, or as null pointer if the timeout expired
+pub unsafe extern "C" fn tapasco_device_acquire_pe_timeout(
+    dev: *mut Device,
+    id: PEId,
+    timeout_us: u64,
+    job: *mut *mut Job,
+) -> bool {
+    if dev.is_null() {
+        warn!("Null pointer passed into tapasco_device_acquire_pe_timeout() as the device");
+        update_last_error(Error::NullPointerTLKM {});
+        *job = ptr::null_mut();
+        return false;
+    }
+
+    let tl = &mut *dev;
+    match tl.acquire_pe_timeout(id, Duration::from_micros(timeout_us)) {
+        Ok(x) => {
+            *job = match x {
+                Some(j) => std::boxed::Box::<Job>::into_raw(Box::new(j)),
+                None => ptr::null_mut()
+            };
+            true
+        },
+        Err(e) => {
+            *job = ptr::null_mut();
+            update_last_error(Error::DeviceError { source: e });
+            false
+        }
+    }
+}
+
 /// # Safety
 /// TODO
 #[no_mangle]
@@ -837,25 +1185,59 @@ pub unsafe extern "C" fn tapasco_job_try_release(
     }
 }
 
-///////////////////
-// Memory handling
-///////////////////
-
-type TapascoOffchipMemory = Arc<OffchipMemory>;
-
-/// # Safety
-/// TODO
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_get_default_memory(dev: *mut Device) -> *mut TapascoOffchipMemory {
+/// Launch one job per parameter list on PEs of the same type.
+///
+/// # Arguments
+///  * `dev`: Device on which the PEs should be acquired.
+///  * `id`: PE ID of the PEs.
+///  * `params`: Array of `len` parameter lists. The lists are consumed and their pointers set to null.
+///  * `len`: Number of jobs in the batch.
+/// # Returns
+///  * Batch object to be released with `tapasco_job_batch_release`, or a null pointer if an error occurred
+pub unsafe extern "C" fn tapasco_device_launch_batch(
+    dev: *mut Device,
+    id: PEId,
+    params: *mut *mut JobList,
+    len: usize,
+) -> *mut JobBatch {
     if dev.is_null() {
-        warn!("Null pointer passed into tapasco_get_default_memory() as the device");
+        warn!("Null pointer passed into tapasco_device_launch_batch() as the device");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    if params.is_null() {
+        warn!("Null pointer passed into tapasco_device_launch_batch() as the parameters");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let lists = slice::from_raw_parts_mut(params, len);
+    if lists.iter().any(|l| l.is_null()) {
+        warn!("Null pointer passed into tapasco_device_launch_batch() as a parameter list");
         update_last_error(Error::NullPointerTLKM {});
         return ptr::null_mut();
     }
 
+    let args = lists
+        .iter_mut()
+        .map(|l| {
+            let jl = Box::from_raw(*l);
+            *l = ptr::null_mut();
+            *jl
+        })
+        .collect();
+
     let tl = &mut *dev;
-    match tl.default_memory().context(DeviceSnafu) {
-        Ok(x) => Box::into_raw(Box::new(x)),
+    match tl.launch_batch(id, args).context(DeviceSnafu) {
+        Ok((batch, unused_mem)) => {
+            for d in unused_mem.into_iter().flatten() {
+                // Make sure Rust doesn't release the memory received from C
+                let _p = std::boxed::Box::<[u8]>::into_raw(d);
+            }
+            Box::into_raw(Box::new(batch))
+        }
         Err(e) => {
             update_last_error(e);
             ptr::null_mut()
@@ -863,33 +1245,35 @@ pub unsafe extern "C" fn tapasco_get_default_memory(dev: *mut Device) -> *mut Ta
     }
 }
 
-/// # Safety
-/// TODO
-#[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_destroy(t: *mut TapascoOffchipMemory) {
-    let _b: Box<TapascoOffchipMemory> = Box::from_raw(t);
-}
-
-/// # Safety
-/// TODO
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_copy_to(
-    mem: *mut TapascoOffchipMemory,
-    data: *const u8,
-    addr: DeviceAddress,
-    len: usize,
-) -> isize {
-    if mem.is_null() {
-        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+/// Wait for all jobs of a batch and release the batch object.
+///
+/// # Arguments
+///  * `batch`: Batch returned by `tapasco_device_launch_batch`.
+///  * `return_values`: Array with one entry per job for the return values, or a null pointer.
+/// # Returns
+///  * '-1' in case an error occurred, '0' otherwise
+pub unsafe extern "C" fn tapasco_job_batch_release(batch: *mut JobBatch, return_values: *mut u64) -> isize {
+    if batch.is_null() {
+        warn!("Null pointer passed into tapasco_job_batch_release() as the batch");
         update_last_error(Error::NullPointerTLKM {});
         return -1;
     }
 
-    let s = slice::from_raw_parts(data, len);
-
-    let tl = &mut *mem;
-    match tl.dma().copy_to(s, addr).context(DMASnafu) {
-        Ok(_x) => 0,
+    let b = Box::<JobBatch>::from_raw(batch);
+    match b.release().context(JobSnafu) {
+        Ok(x) => {
+            for (i, (r, v)) in x.into_iter().enumerate() {
+                for d in v {
+                    // Make sure Rust doesn't release the memory received from C
+                    let _p = std::boxed::Box::<[u8]>::into_raw(d);
+                }
+                if !return_values.is_null() {
+                    *return_values.add(i) = r;
+                }
+            }
+            0
+        }
         Err(e) => {
             update_last_error(e);
             -1
@@ -897,112 +1281,1276 @@ pub unsafe extern "C" fn tapasco_memory_copy_to(
     }
 }
 
-/// # Safety
-/// TODO
+/// Callback invoked once an asynchronously released job has finished.
+///
+/// `status` is '0' on success and '-1' if an error occurred. The error message can be
+/// retrieved through `tapasco_last_error_message` from within the callback.
+pub type JobCallback = Option<unsafe extern "C" fn(user_data: *mut c_void, status: isize, return_value: u64)>;
+
+struct CallbackData(*mut c_void);
+unsafe impl Send for CallbackData {}
+
+// Runtime driving jobs released through `tapasco_job_release_async`. Callbacks are
+// executed on its worker thread, copy backs on its blocking thread pool.
+static ASYNC_RUNTIME: Lazy<std::io::Result<tokio::runtime::Runtime>> = Lazy::new(|| {
+    tokio::runtime::Builder::new_multi_thread()
+        .worker_threads(1)
+        .thread_name("tapasco-async")
+        .enable_all()
+        .build()
+});
+
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_copy_from(
-    mem: *mut TapascoOffchipMemory,
-    addr: DeviceAddress,
-    data: *mut u8,
-    len: usize,
+/// Release job asynchronously and call `callback` once it has finished.
+///
+/// Like `tapasco_job_release` the job object is consumed. Data is copied back to the
+/// locations supplied during job creation before the callback is invoked.
+///
+/// # Arguments
+///  * `job`: Job to be released.
+///  * `return_value`: Set if the return value should be read from the PE.
+///  * `release`: Set if the PE should be released after the job has finished.
+///  * `callback`: Function to call after completion. Runs on a runtime thread.
+///  * `user_data`: Pointer passed unmodified to `callback`.
+/// # Returns
+///  * '-1' if the job could not be handed to the runtime, in which case the callback is
+///    not called, '0' otherwise
+pub unsafe extern "C" fn tapasco_job_release_async(
+    job: *mut Job,
+    return_value: bool,
+    release: bool,
+    callback: JobCallback,
+    user_data: *mut c_void,
 ) -> isize {
-    if mem.is_null() {
-        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+    if job.is_null() {
+        warn!("Null pointer passed into tapasco_job_release_async() as the job");
         update_last_error(Error::NullPointerTLKM {});
         return -1;
     }
 
-    let s = slice::from_raw_parts_mut(data, len);
-
-    let tl = &mut *mem;
-    match tl.dma().copy_from(addr, s).context(DMASnafu) {
-        Ok(_x) => 0,
+    let rt = match &*ASYNC_RUNTIME {
+        Ok(rt) => rt,
         Err(e) => {
-            update_last_error(e);
-            -1
+            update_last_error(Error::AsyncRuntimeError { message: e.to_string() });
+            return -1;
         }
-    }
+    };
+
+    let mut job = Box::<Job>::from_raw(job);
+    let data = CallbackData(user_data);
+    rt.spawn(async move {
+        let data = data;
+        let (status, r) = match job.release_async(release, return_value).await.context(JobSnafu) {
+            Ok((r, v)) => {
+                for d in v {
+                    // Make sure Rust doesn't release the memory received from C
+                    let _p = std::boxed::Box::<[u8]>::into_raw(d);
+                }
+                (0, r)
+            }
+            Err(e) => {
+                update_last_error(e);
+                (-1, 0)
+            }
+        };
+        drop(job);
+        if let Some(cb) = callback {
+            cb(data.0, status, r);
+        }
+    });
+    0
 }
 
-/// # Safety
-/// TODO
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_allocate(
-    mem: *mut TapascoOffchipMemory,
-    len: usize,
-) -> DeviceAddress {
-    if mem.is_null() {
-        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+/// Wait for a job, release its PE right away and copy data back in the background.
+///
+/// The PE is available to other jobs as soon as it has finished, while the data is
+/// copied back to the locations supplied during job creation. `callback` is invoked
+/// once the copy back is done. Like `tapasco_job_release` the job object is consumed
+/// on success only; if waiting fails the job stays valid and has to be released again.
+///
+/// # Arguments
+///  * `job`: Job to be released.
+///  * `return_value`: Location for the return value of the PE, may be NULL.
+///  * `release`: Return the PE to the pool once it has finished.
+///  * `callback`: Function to call after the copy back. Runs on a runtime thread and
+///    receives the return value again.
+///  * `user_data`: Pointer passed unmodified to `callback`.
+/// # Returns
+///  * '-1' if waiting for the job failed, in which case the callback is not called,
+///    '0' otherwise
+pub unsafe extern "C" fn tapasco_job_release_deferred(
+    job: *mut Job,
+    return_value: *mut u64,
+    release: bool,
+    callback: JobCallback,
+    user_data: *mut c_void,
+) -> isize {
+    if job.is_null() {
+        warn!("Null pointer passed into tapasco_job_release_deferred() as the job");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let rt = match &*ASYNC_RUNTIME {
+        Ok(rt) => rt,
+        Err(e) => {
+            update_last_error(Error::AsyncRuntimeError { message: e.to_string() });
+            return -1;
+        }
+    };
+
+    let tl = &mut *job;
+    let (r, copyback) = match tl.release_deferred(release, true).context(JobSnafu) {
+        Ok(x) => x,
+        Err(e) => {
+            update_last_error(e);
+            return -1;
+        }
+    };
+    // free job object
+    let _j = Box::<Job>::from_raw(job);
+    if !return_value.is_null() {
+        *return_value = r;
+    }
+
+    let data = CallbackData(user_data);
+    rt.spawn(async move {
+        let data = data;
+        let status = match copyback.await.context(JobSnafu) {
+            Ok(v) => {
+                for d in v {
+                    // Make sure Rust doesn't release the memory received from C
+                    let _p = std::boxed::Box::<[u8]>::into_raw(d);
+                }
+                0
+            }
+            Err(e) => {
+                update_last_error(e);
+                -1
+            }
+        };
+        if let Some(cb) = callback {
+            cb(data.0, status, r);
+        }
+    });
+    0
+}
+
+///////////////////
+// Task Graphs
+///////////////////
+
+#[no_mangle]
+/// Create an empty task graph. Tasks are declared in program order, see `TaskGraph`.
+pub extern "C" fn tapasco_graph_new() -> *mut TaskGraph {
+    Box::into_raw(Box::new(TaskGraph::new()))
+}
+
+/// # Safety
+/// Only destroy graphs that have not been passed to `tapasco_graph_run`.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_graph_destroy(g: *mut TaskGraph) {
+    if !g.is_null() {
+        let _b: Box<TaskGraph> = Box::from_raw(g);
+    }
+}
+
+#[no_mangle]
+/// Declare an intermediate buffer of `len` bytes that stays in device memory.
+///
+/// # Returns
+///  * The ID of the buffer or '-1' in case of an error
+pub unsafe extern "C" fn tapasco_graph_add_buffer(g: *mut TaskGraph, len: usize) -> isize {
+    if g.is_null() {
+        warn!("Null pointer passed into tapasco_graph_add_buffer() as the graph");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    (*g).add_buffer(len) as isize
+}
+
+#[no_mangle]
+/// Declare a task on a PE of type `id` without arguments.
+///
+/// Arguments are appended in order with `tapasco_graph_task_params`,
+/// `tapasco_graph_task_read` and `tapasco_graph_task_write`.
+///
+/// # Returns
+///  * The ID of the task or '-1' in case of an error
+pub unsafe extern "C" fn tapasco_graph_add_task(g: *mut TaskGraph, id: PEId) -> isize {
+    if g.is_null() {
+        warn!("Null pointer passed into tapasco_graph_add_task() as the graph");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    match (*g).add_task(id, Vec::new()).context(TaskGraphSnafu) {
+        Ok(t) => t as isize,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+unsafe fn graph_push_args(g: *mut TaskGraph, task: usize, args: Vec<GraphArg>) -> isize {
+    if g.is_null() {
+        warn!("Null pointer passed into tapasco_graph_task_*() as the graph");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    for arg in args {
+        if let Err(e) = (*g).push_arg(task, arg).context(TaskGraphSnafu) {
+            update_last_error(e);
+            return -1;
+        }
+    }
+    0
+}
+
+#[no_mangle]
+/// Append the parameters of `params` to the arguments of `task`. The list is consumed.
+pub unsafe extern "C" fn tapasco_graph_task_params(
+    g: *mut TaskGraph,
+    task: usize,
+    params: *mut *mut JobList,
+) -> isize {
+    if params.is_null() || (*params).is_null() {
+        warn!("Null pointer passed into tapasco_graph_task_params() as the parameters");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    let jl = *Box::from_raw(*params);
+    *params = ptr::null_mut();
+    graph_push_args(g, task, jl.into_iter().map(GraphArg::Param).collect())
+}
+
+#[no_mangle]
+/// Append the device address of intermediate `buffer` read by `task`.
+pub unsafe extern "C" fn tapasco_graph_task_read(
+    g: *mut TaskGraph,
+    task: usize,
+    buffer: usize,
+) -> isize {
+    graph_push_args(g, task, vec![GraphArg::Read(buffer)])
+}
+
+#[no_mangle]
+/// Append the device address of intermediate `buffer` written by `task`.
+pub unsafe extern "C" fn tapasco_graph_task_write(
+    g: *mut TaskGraph,
+    task: usize,
+    buffer: usize,
+) -> isize {
+    graph_push_args(g, task, vec![GraphArg::Write(buffer)])
+}
+
+#[no_mangle]
+/// Run task `after` only once task `before` has finished.
+pub unsafe extern "C" fn tapasco_graph_add_dependency(
+    g: *mut TaskGraph,
+    before: usize,
+    after: usize,
+) -> isize {
+    if g.is_null() {
+        warn!("Null pointer passed into tapasco_graph_add_dependency() as the graph");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    match (*g).add_dependency(before, after).context(TaskGraphSnafu) {
+        Ok(_) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+#[no_mangle]
+/// Execute all tasks of the graph and wait for them. The graph is consumed.
+///
+/// Data is copied back to the locations supplied in the task parameters.
+///
+/// # Arguments
+///  * `dev`: Device to run the tasks on.
+///  * `g`: Graph to execute.
+///  * `return_values`: Array of one entry per task for the PE return values, may be NULL.
+/// # Returns
+///  * '-1' in case an error occurred, '0' otherwise
+pub unsafe extern "C" fn tapasco_graph_run(
+    dev: *mut Device,
+    g: *mut TaskGraph,
+    return_values: *mut u64,
+) -> isize {
+    if dev.is_null() || g.is_null() {
+        warn!("Null pointer passed into tapasco_graph_run()");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let graph = *Box::from_raw(g);
+    match graph.run(&*dev).context(TaskGraphSnafu) {
+        Ok(results) => {
+            for (i, r) in results.into_iter().enumerate() {
+                for d in r.memories {
+                    // Make sure Rust doesn't release the memory received from C
+                    let _p = std::boxed::Box::<[u8]>::into_raw(d);
+                }
+                if !return_values.is_null() {
+                    *return_values.add(i) = r.return_value;
+                }
+            }
+            0
+        }
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+///////////////////
+// Device Pools
+///////////////////
+
+/// Allocate all devices known to the driver as one pool and request `access` to them.
+///
+/// # Safety
+/// `t` has to be a valid driver handle. The pool can be used after the handle has
+/// been destroyed.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_new(t: *const TLKM, access: tlkm_access) -> *mut DevicePool {
+    if t.is_null() {
+        warn!("Null pointer passed into tapasco_pool_new() as the driver");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    match DevicePool::open(&*t, access, &HashMap::new()).context(DevicePoolSnafu) {
+        Ok(x) => Box::into_raw(Box::new(x)),
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// # Safety
+/// `pool` has to be a valid pool without unreleased jobs and must not be used afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_destroy(pool: *mut DevicePool) {
+    if !pool.is_null() {
+        let _b: Box<DevicePool> = Box::from_raw(pool);
+    }
+}
+
+/// # Safety
+/// `pool` has to be a valid pool.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_len(pool: *const DevicePool) -> usize {
+    if pool.is_null() {
+        warn!("Null pointer passed into tapasco_pool_len() as the pool");
+        update_last_error(Error::NullPointerTLKM {});
+        return 0;
+    }
+    (*pool).len()
+}
+
+/// Device `device` of the pool. The device is owned by the pool, it must not be
+/// destroyed and its access mode must not be changed.
+///
+/// # Safety
+/// `pool` has to be a valid pool. The device is valid as long as the pool exists.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_device(pool: *const DevicePool, device: usize) -> *mut Device {
+    if pool.is_null() {
+        warn!("Null pointer passed into tapasco_pool_device() as the pool");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    match (*pool).device(device).context(DevicePoolSnafu) {
+        Ok(x) => x as *const Device as *mut Device,
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// Number of PEs of the given type on all devices of the pool.
+///
+/// # Safety
+/// `pool` has to be a valid pool.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_num_pes(pool: *const DevicePool, id: PEId) -> isize {
+    if pool.is_null() {
+        warn!("Null pointer passed into tapasco_pool_num_pes() as the pool");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    (*pool).num_pes(id) as isize
+}
+
+/// # Safety
+/// `pool` has to be a valid pool and `name` a null terminated string.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_get_pe_id(pool: *const DevicePool, name: *const c_char) -> PEId {
+    if pool.is_null() || name.is_null() {
+        warn!("Null pointer passed into tapasco_pool_get_pe_id() as the pool or name");
+        update_last_error(Error::NullPointerTLKM {});
+        return PEId::MAX;
+    }
+
+    let name_r = CStr::from_ptr(name).to_string_lossy();
+    match (*pool).get_pe_id(&name_r).context(DevicePoolSnafu) {
+        Ok(x) => x,
+        Err(e) => {
+            update_last_error(e);
+            PEId::MAX
+        }
+    }
+}
+
+/// Acquire a PE of the given type on the least loaded device of the pool.
+///
+/// # Arguments
+///  * `device`: Receives the index of the chosen device if not null.
+///
+/// # Safety
+/// `pool` has to be a valid pool.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_acquire_pe(
+    pool: *const DevicePool,
+    id: PEId,
+    device: *mut usize,
+) -> *mut Job {
+    if pool.is_null() {
+        warn!("Null pointer passed into tapasco_pool_acquire_pe() as the pool");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    match (*pool).acquire_pe(id).context(DevicePoolSnafu) {
+        Ok(x) => {
+            if !device.is_null() {
+                *device = x.device;
+            }
+            Box::into_raw(Box::new(x.job))
+        }
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// Start a job with the given parameters on the least loaded device of the pool.
+/// Transfers to the memory of another device of the pool are moved to the default
+/// memory of the chosen device. Like `tapasco_job_start`, the list is consumed.
+///
+/// # Arguments
+///  * `device`: Receives the index of the chosen device if not null.
+///
+/// # Returns
+///  * The started job, which is released with `tapasco_job_release`, or null on error.
+///
+/// # Safety
+/// `pool` has to be a valid pool and `params` has to point to a valid list.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_pool_launch(
+    pool: *const DevicePool,
+    id: PEId,
+    params: *mut *mut JobList,
+    device: *mut usize,
+) -> *mut Job {
+    if pool.is_null() || params.is_null() || (*params).is_null() {
+        warn!("Null pointer passed into tapasco_pool_launch() as the pool or parameters");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let jl = *Box::from_raw(*params);
+    *params = ptr::null_mut();
+
+    match (*pool).launch(id, jl).context(DevicePoolSnafu) {
+        Ok((x, unused_mem)) => {
+            for d in unused_mem {
+                // Make sure Rust doesn't release the memory received from C
+                let _p = std::boxed::Box::<[u8]>::into_raw(d);
+            }
+            if !device.is_null() {
+                *device = x.device;
+            }
+            Box::into_raw(Box::new(x.job))
+        }
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+///////////////////
+// Latency statistics
+///////////////////
+
+/// Switch the recording of job latencies on or off for all devices.
+#[no_mangle]
+pub extern "C" fn tapasco_latency_enable(enable: bool) {
+    latency::set_enabled(enable);
+}
+
+#[no_mangle]
+pub extern "C" fn tapasco_latency_is_enabled() -> bool {
+    latency::is_enabled()
+}
+
+/// Discard all recorded latencies.
+#[no_mangle]
+pub extern "C" fn tapasco_latency_reset() {
+    latency::reset();
+}
+
+/// Hand the latencies recorded by all threads to the statistics and the export hook.
+#[no_mangle]
+pub extern "C" fn tapasco_latency_flush() {
+    latency::flush();
+}
+
+/// Number of records lost because a thread recorded faster than they were collected.
+#[no_mangle]
+pub extern "C" fn tapasco_latency_dropped() -> u64 {
+    latency::dropped()
+}
+
+/// Summarize the given stage of all jobs on PEs of type `pe_type` in ns.
+/// The count of the summary is 0 if no such job has been recorded.
+///
+/// # Safety
+/// `summary` has to point to a writable `LatencySummary`.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_latency_summary(
+    pe_type: PEId,
+    stage: LatencyStage,
+    summary: *mut LatencySummary,
+) -> isize {
+    if summary.is_null() {
+        warn!("Null pointer passed into tapasco_latency_summary() as the summary");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+    *summary = latency::summary(pe_type, stage).unwrap_or_default();
+    0
+}
+
+pub type LatencyExportHook =
+    Option<unsafe extern "C" fn(user_data: *mut c_void, latency: *const JobLatency)>;
+
+struct HookData(*mut c_void);
+unsafe impl Send for HookData {}
+unsafe impl Sync for HookData {}
+
+/// Call `hook` with every recorded job when it is collected. Passing no hook removes the
+/// current one.
+///
+/// The hook is called on any thread using TaPaSCo and must not call the latency functions.
+///
+/// # Safety
+/// `user_data` has to stay valid until the hook is removed.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_latency_set_export_hook(
+    hook: LatencyExportHook,
+    user_data: *mut c_void,
+) {
+    let data = HookData(user_data);
+    latency::set_export_hook(hook.map(|f| -> latency::ExportHook {
+        Box::new(move |l: &JobLatency| {
+            // Capture the wrapper, not the raw pointer inside it
+            let data = &data;
+            unsafe { f(data.0, l) }
+        })
+    }));
+}
+
+///////////////////
+// Tracing
+///////////////////
+
+/// Start writing a timeline trace of all devices to the file at `path`.
+///
+/// # Safety
+/// `path` has to be a null terminated string.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_trace_start(path: *const c_char) -> isize {
+    if path.is_null() {
+        warn!("Null pointer passed into tapasco_trace_start() as the path");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let path = CStr::from_ptr(path).to_string_lossy().into_owned();
+    match crate::trace::start(path).context(TraceSnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Complete the current trace. Traces are also completed when the process exits.
+#[no_mangle]
+pub extern "C" fn tapasco_trace_finish() -> isize {
+    match crate::trace::finish().context(TraceSnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn tapasco_trace_is_enabled() -> bool {
+    crate::trace::is_enabled()
+}
+
+///////////////////
+// Memory handling
+///////////////////
+
+type TapascoOffchipMemory = Arc<OffchipMemory>;
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_get_default_memory(dev: *mut Device) -> *mut TapascoOffchipMemory {
+    if dev.is_null() {
+        warn!("Null pointer passed into tapasco_get_default_memory() as the device");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let tl = &mut *dev;
+    match tl.default_memory().context(DeviceSnafu) {
+        Ok(x) => Box::into_raw(Box::new(x)),
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_destroy(t: *mut TapascoOffchipMemory) {
+    let _b: Box<TapascoOffchipMemory> = Box::from_raw(t);
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_copy_to(
+    mem: *mut TapascoOffchipMemory,
+    data: *const u8,
+    addr: DeviceAddress,
+    len: usize,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let s = slice::from_raw_parts(data, len);
+
+    let tl = &mut *mem;
+    match tl.dma().copy_to(s, addr).context(DMASnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_copy_from(
+    mem: *mut TapascoOffchipMemory,
+    addr: DeviceAddress,
+    data: *mut u8,
+    len: usize,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let s = slice::from_raw_parts_mut(data, len);
+
+    let tl = &mut *mem;
+    match tl.dma().copy_from(addr, s).context(DMASnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_allocate(
+    mem: *mut TapascoOffchipMemory,
+    len: usize,
+) -> DeviceAddress {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return DeviceAddress::MAX;
+    }
+
+    let tl = &mut *mem;
+    match tl.allocate(len as u64, None).context(AllocatorSnafu)
+    {
+        Ok(x) => x,
+        Err(e) => {
+            update_last_error(e);
+            DeviceAddress::MAX
+        }
+    }
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_allocate_fixed(
+    mem: *mut TapascoOffchipMemory,
+    len: usize,
+    offset: usize,
+) -> DeviceAddress {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return DeviceAddress::MAX;
+    }
+
+    let tl = &mut *mem;
+    match tl
+        .allocate_fixed(len as u64, offset as u64)
+        .context(AllocatorSnafu)
+    {
+        Ok(x) => x,
+        Err(e) => {
+            update_last_error(e);
+            DeviceAddress::MAX
+        }
+    }
+}
+
+/// # Safety
+/// TODO
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_free(
+    mem: *mut TapascoOffchipMemory,
+    addr: DeviceAddress,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let tl = &mut *mem;
+    match tl.free(addr).context(AllocatorSnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Return buffers cached in the buffer pool of the memory to its allocator until at most
+/// `keep_bytes` remain cached.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_pool_trim(
+    mem: *mut TapascoOffchipMemory,
+    keep_bytes: u64,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_pool_trim() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let tl = &*mem;
+    match tl.trim_pool(keep_bytes).context(AllocatorSnafu) {
+        Ok(x) => x as isize,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Set the high-water mark of the buffer pool of the memory in bytes. 0 disables caching.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_pool_set_limit(
+    mem: *mut TapascoOffchipMemory,
+    max_bytes: u64,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_pool_set_limit() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    let tl = &*mem;
+    match tl.set_pool_limit(max_bytes).context(AllocatorSnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Number of bytes currently cached in the buffer pool of the memory.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_pool_cached_bytes(mem: *mut TapascoOffchipMemory) -> u64 {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_pool_cached_bytes() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return 0;
+    }
+
+    match (*mem).pool() {
+        Some(p) => match p.stats() {
+            Ok(s) => s.cached_bytes,
+            Err(e) => {
+                update_last_error(Error::AllocatorError { source: e.into() });
+                0
+            }
+        },
+        None => 0,
+    }
+}
+
+/// Register `len` bytes of host memory at `data` for repeated transfers with the memory.
+///
+/// On PCIe devices the pages are pinned and transfers from and to the range skip the
+/// DMA bounce buffers. The memory has to stay valid until it is unregistered.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_memory_register_host(
+    mem: *mut TapascoOffchipMemory,
+    data: *const u8,
+    len: usize,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_register_host() as the memory");
         update_last_error(Error::NullPointerTLKM {});
-        return DeviceAddress::MAX;
+        return -1;
     }
 
-    let tl = &mut *mem;
-    match tl
-        .allocator()
-        .lock()
-        .unwrap()
-        .allocate(len as u64, None)
-        .context(AllocatorSnafu)
-    {
-        Ok(x) => x,
+    match (*mem).dma().register_host_memory(data, len).context(DMASnafu) {
+        Ok(_x) => 0,
         Err(e) => {
             update_last_error(e);
-            DeviceAddress::MAX
+            -1
         }
     }
 }
 
+/// Release host memory registered with `tapasco_memory_register_host`.
+///
 /// # Safety
-/// TODO
+/// `mem` has to be a valid memory returned by the runtime.
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_allocate_fixed(
+pub unsafe extern "C" fn tapasco_memory_unregister_host(
+    mem: *mut TapascoOffchipMemory,
+    data: *const u8,
+) -> isize {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_memory_unregister_host() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*mem).dma().unregister_host_memory(data).context(DMASnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+///////////////////
+// Registered host memory
+///////////////////
+
+/// Host buffers handed out by tapasco_alloc_host, keyed by their address.
+static HOST_BUFFERS: Lazy<Mutex<HashMap<usize, HostBuffer>>> =
+    Lazy::new(|| Mutex::new(HashMap::new()));
+
+/// Allocate `len` bytes of host memory prepared for transfers with the given memory.
+///
+/// The buffer is backed by huge pages where possible and registered with the DMA engine.
+/// Passing (parts of) it as job argument or to `tapasco_memory_copy_to/from` avoids the
+/// staging copy through the DMA bounce buffers. Release it with `tapasco_free_host`.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_alloc_host(mem: *mut TapascoOffchipMemory, len: usize) -> *mut u8 {
+    if mem.is_null() {
+        warn!("Null pointer passed into tapasco_alloc_host() as the memory");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let r = HostBuffer::new((*mem).clone(), len)
+        .context(HostBufferSnafu)
+        .and_then(|x| {
+            let p = x.as_ptr();
+            HOST_BUFFERS.lock()?.insert(p as usize, x);
+            Ok(p)
+        });
+    match r {
+        Ok(p) => p,
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// Release a buffer returned by `tapasco_alloc_host`. No job may use the buffer anymore.
+///
+/// # Safety
+/// `ptr` must not be used afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_free_host(ptr: *mut u8) -> isize {
+    let b = match HOST_BUFFERS.lock() {
+        Ok(mut buffers) => buffers.remove(&(ptr as usize)),
+        Err(e) => {
+            update_last_error(e.into());
+            return -1;
+        }
+    };
+    match b {
+        Some(_) => 0,
+        None => {
+            warn!("Unknown pointer passed into tapasco_free_host()");
+            update_last_error(Error::UnknownHostBuffer { ptr: ptr as usize });
+            -1
+        }
+    }
+}
+
+///////////////////
+// Persistent device buffers
+///////////////////
+
+type TapascoDeviceBuffer = Arc<DeviceBuffer>;
+
+/// Allocate a persistent buffer of `len` bytes on the given memory.
+///
+/// # Safety
+/// `mem` has to be a valid memory returned by the runtime.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_create(
     mem: *mut TapascoOffchipMemory,
     len: usize,
-    offset: usize,
-) -> DeviceAddress {
+) -> *mut TapascoDeviceBuffer {
     if mem.is_null() {
-        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+        warn!("Null pointer passed into tapasco_device_buffer_create() as the memory");
         update_last_error(Error::NullPointerTLKM {});
-        return DeviceAddress::MAX;
+        return ptr::null_mut();
     }
 
-    let tl = &mut *mem;
-    match tl
-        .allocator()
-        .lock()
-        .unwrap()
-        .allocate_fixed(len as u64, offset as u64)
-        .context(AllocatorSnafu)
+    match DeviceBuffer::new((*mem).clone(), len).context(DeviceBufferSnafu) {
+        Ok(x) => Box::into_raw(Box::new(Arc::new(x))),
+        Err(e) => {
+            update_last_error(e);
+            ptr::null_mut()
+        }
+    }
+}
+
+/// Drop this reference to the buffer. The device memory is freed once no job uses the
+/// buffer anymore.
+///
+/// # Safety
+/// `buf` has to be a valid buffer and must not be used afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_destroy(buf: *mut TapascoDeviceBuffer) {
+    if !buf.is_null() {
+        let _b: Box<TapascoDeviceBuffer> = Box::from_raw(buf);
+    }
+}
+
+/// Copy `len` bytes from `src` into the buffer at `offset`.
+///
+/// # Safety
+/// `buf` has to be a valid buffer and `src` has to point to `len` readable bytes.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_write(
+    buf: *mut TapascoDeviceBuffer,
+    src: *const u8,
+    len: usize,
+    offset: usize,
+) -> isize {
+    if buf.is_null() || src.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_write()");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*buf)
+        .write(offset, slice::from_raw_parts(src, len))
+        .context(DeviceBufferSnafu)
+    {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Copy `len` bytes at `offset` of the buffer to `dst`. Fetches the device copy first
+/// if a PE may have modified it.
+///
+/// # Safety
+/// `buf` has to be a valid buffer and `dst` has to point to `len` writable bytes.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_read(
+    buf: *mut TapascoDeviceBuffer,
+    dst: *mut u8,
+    len: usize,
+    offset: usize,
+) -> isize {
+    if buf.is_null() || dst.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_read()");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*buf)
+        .read(offset, slice::from_raw_parts_mut(dst, len))
+        .context(DeviceBufferSnafu)
     {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Pointer to the host copy of the buffer. Changes have to be announced with
+/// `tapasco_device_buffer_mark_host_dirty`.
+///
+/// # Safety
+/// `buf` has to be a valid buffer. The pointer is valid as long as the buffer exists.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_host_ptr(buf: *mut TapascoDeviceBuffer) -> *mut u8 {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_host_ptr() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    match (*buf).host_ptr().context(DeviceBufferSnafu) {
         Ok(x) => x,
         Err(e) => {
             update_last_error(e);
-            DeviceAddress::MAX
+            ptr::null_mut()
         }
     }
 }
 
+/// Mark `len` bytes at `offset` of the host copy as modified.
+///
+/// Fails if a job may have written the buffer since the host copy was fetched. Call
+/// `tapasco_device_buffer_host_ptr` again before modifying the host copy in that case.
+///
 /// # Safety
-/// TODO
+/// `buf` has to be a valid buffer.
 #[no_mangle]
-pub unsafe extern "C" fn tapasco_memory_free(
-    mem: *mut TapascoOffchipMemory,
-    addr: DeviceAddress,
+pub unsafe extern "C" fn tapasco_device_buffer_mark_host_dirty(
+    buf: *mut TapascoDeviceBuffer,
+    offset: usize,
+    len: usize,
 ) -> isize {
-    if mem.is_null() {
-        warn!("Null pointer passed into tapasco_memory_copy_to() as the memory");
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_mark_host_dirty() as the buffer");
         update_last_error(Error::NullPointerTLKM {});
         return -1;
     }
 
-    let tl = &mut *mem;
-    match tl
-        .allocator()
-        .lock()
-        .unwrap()
-        .free(addr)
-        .context(AllocatorSnafu)
+    match (*buf).mark_host_dirty(offset, len).context(DeviceBufferSnafu) {
+        Ok(_x) => 0,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Transfer pending host modifications to the device.
+///
+/// # Returns
+///  * Number of bytes transferred or -1 on error.
+///
+/// # Safety
+/// `buf` has to be a valid buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_sync_to_device(buf: *mut TapascoDeviceBuffer) -> isize {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_sync_to_device() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*buf).sync_to_device().context(DeviceBufferSnafu) {
+        Ok(x) => x as isize,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// Transfer the device copy to the host if a PE may have modified it.
+///
+/// # Returns
+///  * Number of bytes transferred or -1 on error.
+///
+/// # Safety
+/// `buf` has to be a valid buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_sync_to_host(buf: *mut TapascoDeviceBuffer) -> isize {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_sync_to_host() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*buf).sync_to_host().context(DeviceBufferSnafu) {
+        Ok(x) => x as isize,
+        Err(e) => {
+            update_last_error(e);
+            -1
+        }
+    }
+}
+
+/// # Safety
+/// `buf` has to be a valid buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_device_address(
+    buf: *mut TapascoDeviceBuffer,
+) -> DeviceAddress {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_device_address() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return DeviceAddress::MAX;
+    }
+    *(*buf).device_address()
+}
+
+/// # Safety
+/// `buf` has to be a valid buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_device_buffer_len(buf: *mut TapascoDeviceBuffer) -> usize {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_device_buffer_len() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return 0;
+    }
+    *(*buf).len()
+}
+
+///////////////////
+// PE-local buffers
+///////////////////
+
+type TapascoLocalBuffer = Arc<LocalBuffer>;
+
+/// Create a buffer from `len` bytes at `data` that is kept in the local memories of the
+/// PEs it is passed to.
+///
+/// # Safety
+/// `data` has to point to `len` readable bytes.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_local_buffer_create(
+    data: *const u8,
+    len: usize,
+) -> *mut TapascoLocalBuffer {
+    if data.is_null() {
+        warn!("Null pointer passed into tapasco_local_buffer_create() as the data");
+        update_last_error(Error::NullPointerTLKM {});
+        return ptr::null_mut();
+    }
+
+    let b = LocalBuffer::new(slice::from_raw_parts(data, len).into());
+    Box::into_raw(Box::new(Arc::new(b)))
+}
+
+/// Drop this reference to the buffer. The copies in local memories are freed once no
+/// job uses the buffer anymore.
+///
+/// # Safety
+/// `buf` has to be a valid buffer and must not be used afterwards.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_local_buffer_destroy(buf: *mut TapascoLocalBuffer) {
+    if !buf.is_null() {
+        let _b: Box<TapascoLocalBuffer> = Box::from_raw(buf);
+    }
+}
+
+/// Copy `len` bytes from `src` into the buffer at `offset`. Copies in local memories
+/// are updated on their next use.
+///
+/// # Safety
+/// `buf` has to be a valid buffer and `src` has to point to `len` readable bytes.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_local_buffer_write(
+    buf: *mut TapascoLocalBuffer,
+    src: *const u8,
+    len: usize,
+    offset: usize,
+) -> isize {
+    if buf.is_null() || src.is_null() {
+        warn!("Null pointer passed into tapasco_local_buffer_write()");
+        update_last_error(Error::NullPointerTLKM {});
+        return -1;
+    }
+
+    match (*buf)
+        .write(offset, slice::from_raw_parts(src, len))
+        .context(DeviceBufferSnafu)
     {
         Ok(_x) => 0,
         Err(e) => {
@@ -1012,6 +2560,17 @@ pub unsafe extern "C" fn tapasco_memory_free(
     }
 }
 
+/// # Safety
+/// `buf` has to be a valid buffer.
+#[no_mangle]
+pub unsafe extern "C" fn tapasco_local_buffer_len(buf: *mut TapascoLocalBuffer) -> usize {
+    if buf.is_null() {
+        warn!("Null pointer passed into tapasco_local_buffer_len() as the buffer");
+        update_last_error(Error::NullPointerTLKM {});
+        return 0;
+    }
+    *(*buf).len()
+}
 
 ///////////////////
 // Manual PE handling
@@ -1162,3 +2721,28 @@ pub unsafe extern "C" fn tapasco_version(buffer: *mut c_char, length: usize) ->
 pub extern "C" fn tapasco_version_len() -> usize {
     VERSION.len() + 1
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn host_buffer_is_freed_once() {
+        let config = SoftwareDeviceConfig {
+            memory_size: 1024 * 1024,
+            ..Default::default()
+        };
+        let d = Device::new_software(0, config, &HashMap::new()).unwrap();
+        let mut mem = d.default_memory().unwrap();
+        unsafe {
+            let p = tapasco_alloc_host(&mut mem, 4096);
+            assert!(!p.is_null());
+            assert_eq!(tapasco_free_host(p), 0);
+            assert_eq!(tapasco_free_host(p), -1);
+            assert!(matches!(
+                take_last_error().map(|e| *e),
+                Some(Error::UnknownHostBuffer { .. })
+            ));
+        }
+    }
+}
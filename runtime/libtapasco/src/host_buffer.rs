@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+use crate::device::OffchipMemory;
+use std::sync::Arc;
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Could not map {} bytes of host memory: {}", len, source))]
+    HostMap { source: std::io::Error, len: usize },
+
+    #[snafu(display("Host buffers need a size larger than 0."))]
+    EmptyHostBuffer {},
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+const PAGE_SIZE: usize = 4096;
+const HUGE_PAGE_SIZE: usize = 2 * 1024 * 1024;
+
+fn round_up(len: usize, to: usize) -> usize {
+    (len + to - 1) / to * to
+}
+
+/// Host memory prepared for DMA transfers with an [`OffchipMemory`].
+///
+/// Buffers of at least one huge page are backed by huge pages if the system provides
+/// them and by transparent huge pages otherwise. The memory is mapped once, populated and
+/// registered with the DMA engine of the memory for the lifetime of the buffer. Transfers
+/// from and to the buffer, e.g. as job arguments, do not need a staging copy on engines
+/// supporting registered memory.
+///
+/// [`OffchipMemory`]: ../device/struct.OffchipMemory.html
+#[derive(Debug, Getters)]
+pub struct HostBuffer {
+    memory: Arc<OffchipMemory>,
+    ptr: *mut u8,
+    #[get = "pub"]
+    len: usize,
+    mapped_len: usize,
+    /// Backed by explicitly allocated huge pages.
+    #[get = "pub"]
+    huge: bool,
+    /// Registered with the DMA engine. Unregistered buffers are transferred through the
+    /// bounce buffers.
+    #[get = "pub"]
+    registered: bool,
+}
+
+// SAFETY: `ptr` is a private anonymous mapping owned by the buffer alone and unmapped only
+// in drop, so moving the buffer to another thread moves the ownership. Shared references
+// only read through `as_slice`, mutation needs `&mut self` or the raw pointer, as for a
+// `Vec<u8>`. Users writing through the pointer, e.g. C code or a running job, have to
+// synchronize with all other accesses themselves.
+unsafe impl Send for HostBuffer {}
+unsafe impl Sync for HostBuffer {}
+
+impl HostBuffer {
+    pub fn new(memory: Arc<OffchipMemory>, len: usize) -> Result<HostBuffer> {
+        if len == 0 {
+            return Err(Error::EmptyHostBuffer {});
+        }
+        let (ptr, mapped_len, huge) = Self::map(len)?;
+
+        let registered = match memory.dma().register_host_memory(ptr, mapped_len) {
+            Ok(_) => true,
+            Err(e) => {
+                warn!(
+                    "Could not register host buffer of {} bytes, transfers will be staged: {}",
+                    len, e
+                );
+                false
+            }
+        };
+
+        trace!(
+            "Allocated host buffer of {} bytes at {:?} (huge pages: {}).",
+            len,
+            ptr,
+            huge
+        );
+
+        Ok(HostBuffer {
+            memory,
+            ptr,
+            len,
+            mapped_len,
+            huge,
+            registered,
+        })
+    }
+
+    fn map(len: usize) -> Result<(*mut u8, usize, bool)> {
+        let prot = libc::PROT_READ | libc::PROT_WRITE;
+        let flags = libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_POPULATE;
+
+        if len >= HUGE_PAGE_SIZE {
+            let mapped_len = round_up(len, HUGE_PAGE_SIZE);
+            let p = unsafe {
+                libc::mmap(
+                    std::ptr::null_mut(),
+                    mapped_len,
+                    prot,
+                    flags | libc::MAP_HUGETLB,
+                    -1,
+                    0,
+                )
+            };
+            if p != libc::MAP_FAILED {
+                return Ok((p as *mut u8, mapped_len, true));
+            }
+            trace!(
+                "No huge pages available for host buffer: {}",
+                std::io::Error::last_os_error()
+            );
+        }
+
+        let mapped_len = round_up(len, PAGE_SIZE);
+        let p = unsafe { libc::mmap(std::ptr::null_mut(), mapped_len, prot, flags, -1, 0) };
+        if p == libc::MAP_FAILED {
+            return Err(Error::HostMap {
+                source: std::io::Error::last_os_error(),
+                len,
+            });
+        }
+        if mapped_len >= HUGE_PAGE_SIZE {
+            // Only a hint, the buffer works without transparent huge pages
+            unsafe {
+                libc::madvise(p, mapped_len, libc::MADV_HUGEPAGE);
+            }
+        }
+        Ok((p as *mut u8, mapped_len, false))
+    }
+
+    pub fn as_ptr(&self) -> *mut u8 {
+        self.ptr
+    }
+
+    pub fn as_slice(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+
+    pub fn as_mut_slice(&mut self) -> &mut [u8] {
+        unsafe { std::slice::from_raw_parts_mut(self.ptr, self.len) }
+    }
+
+    pub fn memory(&self) -> &Arc<OffchipMemory> {
+        &self.memory
+    }
+}
+
+impl Drop for HostBuffer {
+    fn drop(&mut self) {
+        if self.registered {
+            if let Err(e) = self.memory.dma().unregister_host_memory(self.ptr) {
+                warn!("Failed to unregister host buffer at {:?}: {}", self.ptr, e);
+            }
+        }
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.mapped_len);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::Device;
+    use crate::software_device::SoftwareDeviceConfig;
+    use std::collections::HashMap;
+
+    fn memory() -> (Device, Arc<OffchipMemory>) {
+        let config = SoftwareDeviceConfig {
+            memory_size: 1024 * 1024,
+            ..Default::default()
+        };
+        let d = Device::new_software(0, config, &HashMap::new()).unwrap();
+        let m = d.default_memory().unwrap();
+        (d, m)
+    }
+
+    #[test]
+    fn registered_buffer_is_transferred_and_unregistered() {
+        let (_d, m) = memory();
+        let mut src = HostBuffer::new(m.clone(), 4096).unwrap();
+        let mut dst = HostBuffer::new(m.clone(), 4096).unwrap();
+        assert!(*src.registered() && *dst.registered());
+
+        for (i, x) in src.as_mut_slice().iter_mut().enumerate() {
+            *x = i as u8;
+        }
+        m.dma().copy_to(src.as_slice(), 0).unwrap();
+        m.dma().copy_from(0, dst.as_mut_slice()).unwrap();
+        assert_eq!(src.as_slice(), dst.as_slice());
+
+        let ptr = src.as_ptr();
+        drop(src);
+        assert!(m.dma().unregister_host_memory(ptr).is_err());
+    }
+
+    #[test]
+    fn double_unregister_fails() {
+        let (_d, m) = memory();
+        let b = HostBuffer::new(m.clone(), 4096).unwrap();
+        m.dma().unregister_host_memory(b.as_ptr()).unwrap();
+        assert!(matches!(
+            m.dma().unregister_host_memory(b.as_ptr()),
+            Err(crate::dma::Error::NotRegistered { .. })
+        ));
+        // Dropping the buffer only warns about the missing registration
+        drop(b);
+    }
+}
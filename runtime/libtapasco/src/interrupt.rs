@@ -21,18 +21,27 @@
 use std::fmt::Debug;
 use crate::tlkm::tlkm_ioctl_reg_interrupt;
 use crate::tlkm::tlkm_register_interrupt;
+use nix::sys::epoll::{Epoll, EpollCreateFlags, EpollEvent, EpollFlags};
 use nix::sys::eventfd::{EfdFlags, EventFd};
 use nix::unistd::read;
 use snafu::ResultExt;
+use std::collections::HashMap;
 use std::fs::File;
 use std::os::unix::prelude::*;
-use crate::sim_client::SimClient;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::task::Waker;
+use std::thread;
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+use crate::sim_client::{InterruptSlot, SimClient};
 use crate::protos::simcalls::{
     InterruptStatusRequest,
     RegisterInterrupt,
     DeregisterInterrupt,
 };
 use crate::sim_client;
+use crate::trace;
 
 #[derive(Debug, Snafu)]
 pub enum Error {
@@ -47,6 +56,21 @@ pub enum Error {
 
     #[snafu(display("{}", source))]
     SimClientError { source: sim_client::Error },
+
+    #[snafu(display("Error using completion dispatcher epoll: {}", source))]
+    ErrorEpoll { source: nix::Error },
+
+    #[snafu(display("Could not start completion dispatcher thread: {}", source))]
+    ErrorThread { source: std::io::Error },
+
+    #[snafu(display("Mutex has been poisoned"))]
+    MutexError {},
+}
+
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
 }
 
 type Result<T, E = Error> = std::result::Result<T, E>;
@@ -54,30 +78,219 @@ type Result<T, E = Error> = std::result::Result<T, E>;
 #[derive(Debug, Getters, Setters)]
 pub struct SimInterrupt {
     interrupt: EventFd,
-    client: SimClient,
+    client: Arc<SimClient>,
+    slot: Option<Arc<InterruptSlot>>,
+}
+
+/// Interrupt of a PE on a [`SoftwareDevice`]
+///
+/// The eventfd is signalled by the worker thread of the modelled PE.
+///
+/// [`SoftwareDevice`]: ../software_device/struct.SoftwareDevice.html
+#[derive(Debug)]
+pub struct SoftwareInterrupt {
+    interrupt: Arc<EventFd>,
 }
 
 #[derive(Debug, Getters, Setters)]
 pub struct Interrupt {
     interrupt: EventFd,
+    id: usize,
+    completion: Option<(Arc<CompletionShared>, Arc<CompletionSlot>)>,
+}
+
+/// Interrupt count of a single eventfd as collected by the dispatcher thread
+///
+/// Besides threads sleeping on `cond` a single task waiting in a future can register
+/// its waker, which is woken once the next interrupt has been counted.
+#[derive(Debug, Default)]
+struct CompletionSlot {
+    count: Mutex<u64>,
+    cond: Condvar,
+    waker: Mutex<Option<Waker>>,
+}
+
+impl CompletionSlot {
+    fn wake(&self) {
+        if let Ok(mut w) = self.waker.lock() {
+            if let Some(w) = w.take() {
+                w.wake();
+            }
+        }
+    }
+}
+
+/// State shared by the dispatcher thread and the interrupts registered with it
+///
+/// The eventfds are used as epoll tokens. `slots` is locked while an eventfd is read
+/// so an interrupt cannot close its eventfd during the read.
+#[derive(Debug)]
+struct CompletionShared {
+    epoll: Epoll,
+    stop: EventFd,
+    stopped: AtomicBool,
+    slots: Mutex<HashMap<RawFd, Arc<CompletionSlot>>>,
+}
+
+/// Completion dispatcher
+///
+/// A single thread epolls the eventfds of all PE and DMA interrupts of a device and
+/// wakes the thread waiting on the corresponding [`Interrupt`] through a condition
+/// variable. Waiting for a job thus sleeps instead of spinning on the eventfd.
+///
+/// Enabled through the `interrupt.dispatcher` setting. Interrupts outliving the
+/// dispatcher fall back to reading their eventfd directly.
+#[derive(Debug)]
+pub struct CompletionDispatcher {
+    shared: Arc<CompletionShared>,
+    thread: Option<JoinHandle<()>>,
 }
 
 impl Drop for SimInterrupt {
     fn drop(&mut self) {
         trace!("deregistering interrupt: {:?}", self.interrupt);
         let _ = self.client.deregister_interrupt(DeregisterInterrupt { fd: self.interrupt.as_raw_fd() }).context(SimClientSnafu);
+        self.client.unsubscribe_interrupt(self.interrupt.as_raw_fd());
     }
 }
 
 impl Drop for Interrupt {
     fn drop(&mut self) {
         trace!("deregistering interrupt: {:?}", self.interrupt);
+        if let Some((shared, _)) = &self.completion {
+            if let Ok(mut slots) = shared.slots.lock() {
+                let _ = shared.epoll.delete(&self.interrupt);
+                slots.remove(&self.interrupt.as_raw_fd());
+            }
+        }
     }
 }
 
 pub trait TapascoInterrupt: Debug {
     fn wait_for_interrupt(&self) -> Result<u64>;
     fn check_for_interrupt(&self) -> Result<u64>;
+
+    /// Wait at most `timeout` for an interrupt
+    ///
+    /// Returns the number of interrupts that have occured or 0 on timeout.
+    /// Implementations that cannot sleep return immediately like `check_for_interrupt`.
+    fn wait_for_interrupt_timeout(&self, _timeout: Duration) -> Result<u64> {
+        self.check_for_interrupt()
+    }
+
+    /// Register a waker to be woken on the next interrupt
+    ///
+    /// Returns false if the implementation cannot wake tasks. Callers have to poll
+    /// `check_for_interrupt` in this case.
+    fn register_waker(&self, _waker: &Waker) -> Result<bool> {
+        Ok(false)
+    }
+}
+
+impl CompletionDispatcher {
+    pub fn new() -> Result<Self> {
+        let epoll = Epoll::new(EpollCreateFlags::EPOLL_CLOEXEC).context(ErrorEpollSnafu)?;
+        let stop = EventFd::from_value_and_flags(0, EfdFlags::EFD_NONBLOCK).context(ErrorEventFDSnafu)?;
+        epoll
+            .add(&stop, EpollEvent::new(EpollFlags::EPOLLIN, stop.as_raw_fd() as u64))
+            .context(ErrorEpollSnafu)?;
+
+        let shared = Arc::new(CompletionShared {
+            epoll,
+            stop,
+            stopped: AtomicBool::new(false),
+            slots: Mutex::new(HashMap::new()),
+        });
+
+        let s = shared.clone();
+        let thread = thread::Builder::new()
+            .name("tapasco-completion".to_string())
+            .spawn(move || s.run())
+            .context(ErrorThreadSnafu)?;
+
+        trace!("Started completion dispatcher.");
+        Ok(Self {
+            shared,
+            thread: Some(thread),
+        })
+    }
+
+    fn register(&self, fd: &EventFd) -> Result<(Arc<CompletionShared>, Arc<CompletionSlot>)> {
+        let slot = Arc::new(CompletionSlot::default());
+        let mut slots = self.shared.slots.lock()?;
+        slots.insert(fd.as_raw_fd(), slot.clone());
+        if let Err(e) = self
+            .shared
+            .epoll
+            .add(fd, EpollEvent::new(EpollFlags::EPOLLIN, fd.as_raw_fd() as u64))
+        {
+            slots.remove(&fd.as_raw_fd());
+            return Err(Error::ErrorEpoll { source: e });
+        }
+        Ok((self.shared.clone(), slot))
+    }
+}
+
+impl Drop for CompletionDispatcher {
+    fn drop(&mut self) {
+        trace!("Stopping completion dispatcher.");
+        let _ = self.shared.stop.write(1);
+        if let Some(t) = self.thread.take() {
+            let _ = t.join();
+        }
+    }
+}
+
+impl CompletionShared {
+    fn run(&self) {
+        let mut events = [EpollEvent::empty(); 64];
+        'dispatch: loop {
+            let n = match self.epoll.wait(&mut events, -1) {
+                Ok(n) => n,
+                Err(nix::errno::Errno::EINTR) => continue,
+                Err(e) => {
+                    error!("Completion dispatcher failed: {}", e);
+                    break;
+                }
+            };
+            for ev in &events[..n] {
+                let fd = ev.data() as RawFd;
+                if fd == self.stop.as_raw_fd() {
+                    break 'dispatch;
+                }
+                self.dispatch(fd);
+            }
+        }
+
+        // Wake all waiters so they switch to reading their eventfds
+        self.stopped.store(true, Ordering::SeqCst);
+        if let Ok(slots) = self.slots.lock() {
+            for slot in slots.values() {
+                {
+                    let _l = slot.count.lock();
+                    slot.cond.notify_all();
+                }
+                slot.wake();
+            }
+        }
+    }
+
+    fn dispatch(&self, fd: RawFd) {
+        let slots = match self.slots.lock() {
+            Ok(s) => s,
+            Err(_) => return,
+        };
+        if let Some(slot) = slots.get(&fd) {
+            let mut buf = [0u8; 8];
+            if read(fd, &mut buf).is_ok() {
+                if let Ok(mut c) = slot.count.lock() {
+                    *c += u64::from_ne_bytes(buf);
+                    slot.cond.notify_all();
+                }
+                slot.wake();
+            }
+        }
+    }
 }
 
 /// Handles interrupts using TLKM and Eventfd
@@ -85,31 +298,44 @@ pub trait TapascoInterrupt: Debug {
 /// Registers the eventfd with the driver and makes sure to release it after use.
 /// Supports blocking of the wait_for_interrupt method.
 impl SimInterrupt {
-    pub fn new(interrupt_id: usize, blocking: bool) -> Result<Box<dyn TapascoInterrupt + Sync + Send>> {
+    pub fn new(
+        client: Arc<SimClient>,
+        interrupt_id: usize,
+        blocking: bool,
+    ) -> Result<Box<dyn TapascoInterrupt + Sync + Send>> {
         let fd = if blocking {
             EventFd::from_value(0).context(ErrorEventFDSnafu)?
         } else {
             EventFd::from_value_and_flags(0, EfdFlags::EFD_NONBLOCK).context(ErrorEventFDSnafu)?
         };
 
-        let client = SimClient::new().context(SimClientSnafu)?;
-        client.register_interrupt(RegisterInterrupt {
+        let slot = client.subscribe_interrupt(fd.as_raw_fd());
+        if let Err(e) = client.register_interrupt(RegisterInterrupt {
             fd: fd.as_raw_fd(),
             interrupt_id: interrupt_id as i32,
-        }).context(SimClientSnafu)?;
+        }) {
+            client.unsubscribe_interrupt(fd.as_raw_fd());
+            return Err(Error::SimClientError { source: e });
+        }
 
-        Ok(Box::new(Self { interrupt: fd, client }))
+        Ok(Box::new(Self { interrupt: fd, client, slot }))
     }
 }
 
 impl TapascoInterrupt for SimInterrupt {
 
-    /// Wait for an interrupt as indicated by the eventfd
+    /// Wait for an interrupt of the simulated PE
+    ///
+    /// Sleeps until the simulator pushes an interrupt if it supports the interrupt
+    /// subscription and polls the simulator otherwise.
     ///
     /// Returns the number of interrupts that have occured since the last time
     /// calling this function.
     /// Returns at least 1
     fn wait_for_interrupt(&self) -> Result<u64> {
+        if let Some(interrupts) = self.slot.as_ref().and_then(|s| s.wait()) {
+            return Ok(interrupts);
+        }
         loop {
             let interrupts = self.client.get_interrupt_status(InterruptStatusRequest { fd: self.interrupt.as_raw_fd() }).context(SimClientSnafu)?;
             if interrupts > 0 {
@@ -126,24 +352,95 @@ impl TapascoInterrupt for SimInterrupt {
     /// This function behaves like wait_for_interrupt if blocking mode has been selected
     /// as the `read` will block in this case until an interrupt occurs.
     fn check_for_interrupt(&self) -> Result<u64> {
+        if let Some(interrupts) = self.slot.as_ref().and_then(|s| s.take()) {
+            return Ok(interrupts);
+        }
         let interrupts = self.client.get_interrupt_status(InterruptStatusRequest { fd: self.interrupt.as_raw_fd() }).context(SimClientSnafu)?;
         Ok(interrupts)
     }
 }
 
+impl SoftwareInterrupt {
+    pub fn new(interrupt: Arc<EventFd>) -> Box<dyn TapascoInterrupt + Sync + Send> {
+        Box::new(Self { interrupt })
+    }
+
+    /// Sleep until the eventfd becomes readable or `timeout_ms` has passed.
+    fn poll(&self, timeout_ms: i32) {
+        let mut pfd = libc::pollfd {
+            fd: self.interrupt.as_raw_fd(),
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        // Errors such as EINTR show up as a missing interrupt and the caller polls again
+        unsafe {
+            libc::poll(&mut pfd, 1, timeout_ms);
+        }
+    }
+}
+
+impl TapascoInterrupt for SoftwareInterrupt {
+    fn wait_for_interrupt(&self) -> Result<u64> {
+        loop {
+            let interrupts = self.check_for_interrupt()?;
+            if interrupts > 0 {
+                return Ok(interrupts);
+            }
+            self.poll(-1);
+        }
+    }
+
+    fn check_for_interrupt(&self) -> Result<u64> {
+        match self.interrupt.read() {
+            Ok(interrupts) => Ok(interrupts),
+            Err(nix::errno::Errno::EAGAIN) => Ok(0),
+            Err(e) => Err(Error::ErrorEventFDRead { source: e }),
+        }
+    }
+
+    fn wait_for_interrupt_timeout(&self, timeout: Duration) -> Result<u64> {
+        let interrupts = self.check_for_interrupt()?;
+        if interrupts > 0 {
+            return Ok(interrupts);
+        }
+        self.poll(timeout.as_millis().min(i32::MAX as u128) as i32);
+        self.check_for_interrupt()
+    }
+}
+
 /// Handles interrupts using TLKM and Eventfd
 ///
 /// Registers the eventfd with the driver and makes sure to release it after use.
 /// Supports blocking of the wait_for_interrupt method.
+///
+/// If a [`CompletionDispatcher`] is given, the eventfd is read by the dispatcher thread
+/// and wait_for_interrupt sleeps until the dispatcher reports an interrupt.
 impl Interrupt {
-    pub fn new(tlkm_file: &File, interrupt_id: usize, blocking: bool) -> Result<Box<dyn TapascoInterrupt + Sync + Send>> {
-        let fd = if blocking {
+    pub fn new(
+        tlkm_file: &File,
+        interrupt_id: usize,
+        blocking: bool,
+        dispatcher: Option<&CompletionDispatcher>,
+    ) -> Result<Box<dyn TapascoInterrupt + Sync + Send>> {
+        // The dispatcher reads the eventfd itself and must not block on it
+        let fd = if blocking && dispatcher.is_none() {
             EventFd::from_value(0).context(ErrorEventFDSnafu)?
         } else {
             EventFd::from_value_and_flags(0, EfdFlags::EFD_NONBLOCK).context(ErrorEventFDSnafu)?
         };
+        let completion = match dispatcher {
+            Some(d) => Some(d.register(&fd)?),
+            None => None,
+        };
+        // Dropping the interrupt removes the slot from the dispatcher again if the
+        // driver refuses the eventfd
+        let interrupt = Self {
+            interrupt: fd,
+            id: interrupt_id,
+            completion,
+        };
         let mut ioctl_fd = tlkm_register_interrupt {
-            fd: fd.as_raw_fd(),
+            fd: interrupt.interrupt.as_raw_fd(),
             pe_id: interrupt_id as i32,
         };
 
@@ -152,18 +449,16 @@ impl Interrupt {
                 .context(ErrorEventFDRegisterSnafu)?;
         };
 
-        Ok(Box::new(Self { interrupt: fd }))
+        Ok(Box::new(interrupt))
     }
-}
-
-impl TapascoInterrupt for Interrupt {
 
-    /// Wait for an interrupt as indicated by the eventfd
-    ///
-    /// Returns the number of interrupts that have occured since the last time
-    /// calling this function.
-    /// Returns at least 1
-    fn wait_for_interrupt(&self) -> Result<u64> {
+    /// Block until at least one interrupt has occured
+    fn wait(&self) -> Result<u64> {
+        if let Some((shared, slot)) = &self.completion {
+            if let Some(n) = Self::wait_dispatched(shared, slot, None)? {
+                return Ok(n);
+            }
+        }
         let mut buf = [0u8; 8];
         loop {
             let r = read(self.interrupt.as_raw_fd(), &mut buf);
@@ -182,6 +477,52 @@ impl TapascoInterrupt for Interrupt {
         }
     }
 
+    /// Wait on the dispatcher slot until an interrupt has been counted or `deadline` passed
+    ///
+    /// Returns None if the dispatcher has been stopped.
+    fn wait_dispatched(
+        shared: &CompletionShared,
+        slot: &CompletionSlot,
+        deadline: Option<Instant>,
+    ) -> Result<Option<u64>> {
+        let mut c = slot.count.lock()?;
+        while *c == 0 && !shared.stopped.load(Ordering::SeqCst) {
+            match deadline {
+                Some(d) => {
+                    let now = Instant::now();
+                    if now >= d {
+                        return Ok(Some(0));
+                    }
+                    c = slot.cond.wait_timeout(c, d - now)?.0;
+                }
+                None => c = slot.cond.wait(c)?,
+            }
+        }
+        if *c == 0 {
+            return Ok(None);
+        }
+        let n = *c;
+        *c = 0;
+        Ok(Some(n))
+    }
+}
+
+impl TapascoInterrupt for Interrupt {
+
+    /// Wait for an interrupt as indicated by the eventfd
+    ///
+    /// Returns the number of interrupts that have occured since the last time
+    /// calling this function.
+    /// Returns at least 1
+    fn wait_for_interrupt(&self) -> Result<u64> {
+        let begin = trace::timestamp();
+        let n = self.wait()?;
+        if let Some(begin) = begin {
+            trace::interrupt_wait(self.id, begin);
+        }
+        Ok(n)
+    }
+
     /// Check if any interrupts have occured
     ///
     /// Returns the number of interrupts that have occured since the last time
@@ -189,6 +530,14 @@ impl TapascoInterrupt for Interrupt {
     /// This function behaves like wait_for_interrupt if blocking mode has been selected
     /// as the `read` will block in this case until an interrupt occurs.
     fn check_for_interrupt(&self) -> Result<u64> {
+        if let Some((shared, slot)) = &self.completion {
+            let mut c = slot.count.lock()?;
+            if *c > 0 || !shared.stopped.load(Ordering::SeqCst) {
+                let n = *c;
+                *c = 0;
+                return Ok(n);
+            }
+        }
         let mut buf = [0u8; 8];
         loop {
             let r = read(self.interrupt.as_raw_fd(), &mut buf);
@@ -206,4 +555,51 @@ impl TapascoInterrupt for Interrupt {
             }
         }
     }
+
+    /// Wait at most `timeout` for an interrupt
+    ///
+    /// Only sleeps when a completion dispatcher is used, otherwise this function
+    /// behaves like check_for_interrupt.
+    fn wait_for_interrupt_timeout(&self, timeout: Duration) -> Result<u64> {
+        if let Some((shared, slot)) = &self.completion {
+            let begin = trace::timestamp();
+            if let Some(n) = Self::wait_dispatched(shared, slot, Some(Instant::now() + timeout))? {
+                // Only waits that end with an interrupt are traced, DMA polls time out often
+                if let Some(begin) = begin.filter(|_| n > 0) {
+                    trace::interrupt_wait(self.id, begin);
+                }
+                return Ok(n);
+            }
+        }
+        self.check_for_interrupt()
+    }
+
+    /// Register a waker with the completion dispatcher
+    ///
+    /// Only supported when a completion dispatcher is used. The waker is replaced by
+    /// later registrations and woken at most once.
+    fn register_waker(&self, waker: &Waker) -> Result<bool> {
+        match &self.completion {
+            Some((shared, slot)) => {
+                *slot.waker.lock()? = Some(waker.clone());
+                // The dispatcher might have stopped before the waker was stored
+                Ok(!shared.stopped.load(Ordering::SeqCst))
+            }
+            _ => Ok(false),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn refused_eventfd_leaves_the_dispatcher() {
+        let dispatcher = CompletionDispatcher::new().unwrap();
+        // Not a TLKM device, so the driver ioctl fails
+        let file = File::open("/dev/null").unwrap();
+        assert!(Interrupt::new(&file, 0, true, Some(&dispatcher)).is_err());
+        assert!(dispatcher.shared.slots.lock().unwrap().is_empty());
+    }
 }
@@ -18,15 +18,24 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-use crate::device::{DataTransferAlloc, DataTransferStream, DeviceAddress};
+use crate::device::{DataTransferAlloc, DataTransferStream, DeviceAddress, OffchipMemory};
 use crate::device::DataTransferPrealloc;
 use crate::device::PEParameter;
+use crate::latency::JobTiming;
 use crate::pe::CopyBack;
 use crate::pe::PE;
 use crate::scheduler::ReleasePE;
+use crate::tlkm::DeviceId;
+use crossbeam::channel::{unbounded, RecvTimeoutError, Sender};
+use once_cell::sync::Lazy;
 use snafu::ResultExt;
-use std::sync::Arc;
+use std::collections::{BinaryHeap, VecDeque};
+use std::future::Future;
+use std::pin::Pin;
+use std::sync::{Arc, Condvar, Mutex};
+use std::task::{Context, Poll, Waker};
 use std::thread;
+use std::time::{Duration, Instant};
 
 impl<T> From<std::sync::PoisonError<T>> for Error {
     fn from(_error: std::sync::PoisonError<T>) -> Self {
@@ -49,19 +58,19 @@ pub enum Error {
     PEError { source: crate::pe::Error },
 
     #[snafu(display(
-        "Unsupported parameter during register write stage. Unconverted data transfer alloc?: {:?}",
+        "Unsupported parameter during register write stage. Unconverted data transfer alloc?: {}",
         arg
     ))]
-    UnsupportedRegisterParameter { arg: PEParameter },
+    UnsupportedRegisterParameter { arg: String },
 
     #[snafu(display(
-        "Unsupported parameter during during transfer to. Unconverted data transfer alloc?: {:?}",
+        "Unsupported parameter during during transfer to. Unconverted data transfer alloc?: {}",
         arg
     ))]
-    UnsupportedTransferParameter { arg: PEParameter },
+    UnsupportedTransferParameter { arg: String },
 
-    #[snafu(display("Parameter only supported for bitstreams with enabled SVM support: {:?}", arg))]
-    UnsupportedSVMParameter { arg: PEParameter },
+    #[snafu(display("Parameter only supported for bitstreams with enabled SVM support: {}", arg))]
+    UnsupportedSVMParameter { arg: String },
 
     #[snafu(display("Too many streams. Only one input and output stream supported"))]
     TooManyStreams {},
@@ -77,16 +86,420 @@ pub enum Error {
 
     #[snafu(display("This Job does not contain a PE which could be debugged."))]
     NoPEtoDebug {},
+
+    #[snafu(display("This Job does not contain a PE which could be started."))]
+    NoPEtoStart {},
+
+    #[snafu(display("Copy back task failed: {}", source))]
+    CopyBackTask { source: tokio::task::JoinError },
+
+    #[snafu(display("Device buffer Error: {}", source))]
+    DeviceBufferError { source: crate::device_buffer::Error },
+
+    #[snafu(display("Copy back worker stopped before finishing the copy back."))]
+    CopyBackWorkerLost {},
 }
 
 type Result<T, E = Error> = std::result::Result<T, E>;
 
+/// Result of the copy back stage, produced on a tokio blocking thread or a completion worker.
+type CopyBackResult = Result<(u64, Vec<Box<[u8]>>)>;
+
+/// Shortest and longest interval in which [`JobRelease`] polls a PE that cannot wake it.
+const BACKOFF_MIN: Duration = Duration::from_micros(10);
+const BACKOFF_MAX: Duration = Duration::from_millis(1);
+
+struct BackoffWake {
+    at: Instant,
+    waker: Waker,
+}
+
+impl PartialEq for BackoffWake {
+    fn eq(&self, other: &Self) -> bool {
+        self.at == other.at
+    }
+}
+
+impl Eq for BackoffWake {}
+
+impl PartialOrd for BackoffWake {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for BackoffWake {
+    // Earliest first in the max-heap
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        other.at.cmp(&self.at)
+    }
+}
+
+// Wakes tasks waiting for PEs whose interrupts cannot wake them (no completion
+// dispatcher) after their backoff has expired. If the thread cannot be started, such
+// tasks are woken right away.
+static BACKOFF_TIMER: Lazy<Option<Sender<BackoffWake>>> = Lazy::new(|| {
+    let (tx, rx) = unbounded::<BackoffWake>();
+    let r = thread::Builder::new()
+        .name("tapasco-backoff".to_string())
+        .spawn(move || {
+            let mut pending = BinaryHeap::new();
+            loop {
+                let next = match pending.peek() {
+                    Some(BackoffWake { at, .. }) => rx.recv_deadline(*at),
+                    None => rx.recv().map_err(|_| RecvTimeoutError::Disconnected),
+                };
+                match next {
+                    Ok(w) => pending.push(w),
+                    Err(RecvTimeoutError::Timeout) => (),
+                    Err(RecvTimeoutError::Disconnected) => break,
+                }
+                let now = Instant::now();
+                while pending.peek().map_or(false, |w| w.at <= now) {
+                    pending.pop().unwrap().waker.wake();
+                }
+            }
+        });
+    match r {
+        Ok(_) => Some(tx),
+        Err(e) => {
+            warn!("Could not start backoff timer: {}", e);
+            None
+        }
+    }
+});
+
+/// Wake `waker` once `backoff` has passed.
+fn wake_after(waker: &Waker, backoff: Duration) {
+    let w = BackoffWake {
+        at: Instant::now() + backoff,
+        waker: waker.clone(),
+    };
+    match &*BACKOFF_TIMER {
+        Some(tx) => {
+            if let Err(e) = tx.send(w) {
+                e.0.waker.wake();
+            }
+        }
+        None => w.waker.wake(),
+    }
+}
+
+/// Future that resolves once the PE of a [`Job`] has finished and all copy backs are done.
+///
+/// Created by [`Job::release_async`]. The task is woken through the completion dispatcher
+/// (`interrupt.dispatcher`). Without the dispatcher the PE is polled again after a backoff
+/// which doubles from 10 us up to 1 ms while the PE keeps running.
+///
+/// Copy backs that require DMA transfers run on the blocking thread pool of the current
+/// tokio runtime. Outside of a tokio runtime they are executed in `poll` directly.
+pub struct JobRelease<'a> {
+    job: &'a mut Job,
+    release_pe: bool,
+    return_value: bool,
+    backoff: Duration,
+    copyback: Option<tokio::task::JoinHandle<CopyBackResult>>,
+}
+
+impl Future for JobRelease<'_> {
+    type Output = Result<(u64, Vec<Box<[u8]>>)>;
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Self::Output> {
+        let this = &mut *self;
+        if this.copyback.is_none() {
+            let (ret_val, copyback) =
+                match this.job.poll_completion(
+                    cx.waker(),
+                    &mut this.backoff,
+                    this.release_pe,
+                    this.return_value,
+                )? {
+                    Some(x) => x,
+                    None => return Poll::Pending,
+                };
+            let timing = this.job.take_timing();
+
+            let blocking = copyback.as_ref().map_or(false, |c| {
+                c.iter()
+                    .any(|x| matches!(x, CopyBack::Transfer(_) | CopyBack::Stream(_)))
+            });
+            match tokio::runtime::Handle::try_current() {
+                Ok(h) if blocking => {
+                    trace!("Moving copy back to blocking thread.");
+                    this.copyback = Some(h.spawn_blocking(move || {
+                        Job::handle_copyback(ret_val, copyback, timing)
+                    }));
+                }
+                _ => return Poll::Ready(Job::handle_copyback(ret_val, copyback, timing)),
+            }
+        }
+
+        match Pin::new(this.copyback.as_mut().unwrap()).poll(cx) {
+            Poll::Ready(r) => {
+                this.copyback = None;
+                Poll::Ready(r.context(CopyBackTaskSnafu)?)
+            }
+            Poll::Pending => Poll::Pending,
+        }
+    }
+}
+
+/// Number of threads executing deferred copy backs, see [`Job::release_deferred`].
+const COPY_BACK_THREADS: usize = 2;
+
+/// Bytes a memory needs to transfer for a job before it gets a thread of its own, see
+/// [`Job::transfer_concurrently`]. Below this the thread start costs more than the overlap
+/// with the transfers of the other memories saves.
+const CONCURRENT_TRANSFER_MIN: usize = 256 * 1024;
+
+type CopyBackTask = Box<dyn FnOnce() + Send>;
+
+// Completion workers of deferred copy backs, shared by all devices of the process.
+// If no thread can be started, copy backs are executed by the releasing thread.
+static COPY_BACK_WORKER: Lazy<Option<Sender<CopyBackTask>>> = Lazy::new(|| {
+    let (tx, rx) = unbounded::<CopyBackTask>();
+    let mut started = 0;
+    for i in 0..COPY_BACK_THREADS {
+        let rx = rx.clone();
+        match thread::Builder::new()
+            .name(format!("tapasco-copyback-{}", i))
+            .spawn(move || {
+                for task in rx {
+                    // A panicking copy back is reported through its guard, keep the worker
+                    let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(task));
+                }
+            }) {
+            Ok(_) => started += 1,
+            Err(e) => warn!("Could not start copy back worker: {}", e),
+        }
+    }
+    if started > 0 {
+        Some(tx)
+    } else {
+        None
+    }
+});
+
+#[derive(Default)]
+struct CopyBackState {
+    result: Option<CopyBackResult>,
+    waker: Option<Waker>,
+    // Set if the worker dropped the task without a result
+    lost: bool,
+}
+
+#[derive(Default)]
+struct CopyBackShared {
+    state: Mutex<CopyBackState>,
+    cond: Condvar,
+}
+
+impl CopyBackShared {
+    fn finish(&self, result: Option<CopyBackResult>) {
+        let waker = {
+            let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+            match result {
+                Some(r) => state.result = Some(r),
+                None => state.lost = true,
+            }
+            state.waker.take()
+        };
+        self.cond.notify_all();
+        if let Some(w) = waker {
+            w.wake();
+        }
+    }
+}
+
+/// Marks a deferred copy back as lost if the worker drops it without running it.
+struct CopyBackGuard(Option<Arc<CopyBackShared>>);
+
+impl Drop for CopyBackGuard {
+    fn drop(&mut self) {
+        if let Some(shared) = self.0.take() {
+            shared.finish(None);
+        }
+    }
+}
+
+/// Memories of a job whose copy back runs on a completion worker.
+///
+/// Created by [`Job::release_deferred`]. Resolves to the memories used for copy backs in the
+/// order of the original argument list. Can be awaited or waited for with [`wait`].
+///
+/// [`wait`]: #method.wait
+pub struct CopyBackFuture {
+    shared: Arc<CopyBackShared>,
+}
+
+impl CopyBackFuture {
+    fn ready(result: Result<(u64, Vec<Box<[u8]>>)>) -> Self {
+        let shared = Arc::new(CopyBackShared::default());
+        shared.finish(Some(result));
+        Self { shared }
+    }
+
+    fn spawn(copyback: Vec<CopyBack>, timing: Option<JobTiming>) -> Self {
+        let shared = Arc::new(CopyBackShared::default());
+        let mut guard = CopyBackGuard(Some(shared.clone()));
+        let task: CopyBackTask = Box::new(move || {
+            let r = Job::handle_copyback(0, Some(copyback), timing);
+            if let Some(shared) = guard.0.take() {
+                shared.finish(Some(r));
+            }
+        });
+        match &*COPY_BACK_WORKER {
+            Some(tx) => {
+                if let Err(e) = tx.send(task) {
+                    (e.0)();
+                }
+            }
+            None => task(),
+        }
+        Self { shared }
+    }
+
+    /// Has the copy back finished?
+    pub fn is_done(&self) -> bool {
+        let state = self.shared.state.lock().unwrap_or_else(|e| e.into_inner());
+        state.result.is_some() || state.lost
+    }
+
+    /// Block until the copy back has finished.
+    pub fn wait(self) -> Result<Vec<Box<[u8]>>> {
+        let mut state = self.shared.state.lock()?;
+        loop {
+            if let Some(r) = state.result.take() {
+                return r.map(|(_, v)| v);
+            }
+            if state.lost {
+                return Err(Error::CopyBackWorkerLost {});
+            }
+            state = self.shared.cond.wait(state)?;
+        }
+    }
+}
+
+impl Future for CopyBackFuture {
+    type Output = Result<Vec<Box<[u8]>>>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Self::Output> {
+        let mut state = self.shared.state.lock()?;
+        if let Some(r) = state.result.take() {
+            return Poll::Ready(r.map(|(_, v)| v));
+        }
+        if state.lost {
+            return Poll::Ready(Err(Error::CopyBackWorkerLost {}));
+        }
+        state.waker = Some(cx.waker().clone());
+        Poll::Pending
+    }
+}
+
+impl std::fmt::Debug for CopyBackFuture {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("CopyBackFuture")
+            .field("done", &self.is_done())
+            .finish()
+    }
+}
+
+/// Jobs of one PE type launched together through [`launch_batch`].
+///
+/// Keeps the jobs that are still running as well as the results of jobs that had to
+/// be released early because their PE was needed for a later job of the batch.
+///
+/// [`launch_batch`]: ../device/struct.Device.html#method.launch_batch
+#[derive(Debug)]
+pub struct JobBatch {
+    running: VecDeque<(usize, Job)>,
+    results: Vec<Option<(u64, Vec<Box<[u8]>>)>>,
+    started: usize,
+}
+
+impl JobBatch {
+    pub fn new(len: usize) -> Self {
+        Self {
+            running: VecDeque::new(),
+            results: (0..len).map(|_| None).collect(),
+            started: 0,
+        }
+    }
+
+    /// Number of jobs in this batch.
+    pub fn len(&self) -> usize {
+        self.results.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.results.is_empty()
+    }
+
+    /// Are any jobs of this batch still holding a PE?
+    pub fn has_running(&self) -> bool {
+        !self.running.is_empty()
+    }
+
+    /// Start the given jobs with the next parameter lists of the batch.
+    ///
+    /// Returns the memories not marked for copy back for each job.
+    pub fn start(&mut self, mut jobs: Vec<Job>, args: Vec<Vec<PEParameter>>) -> Result<Vec<Vec<Box<[u8]>>>> {
+        let unused_mem = Job::start_batch(&mut jobs, args)?;
+        for job in jobs {
+            self.running.push_back((self.started, job));
+            self.started += 1;
+        }
+        Ok(unused_mem)
+    }
+
+    /// Wait for the oldest running job, release its PE and keep the result.
+    pub fn release_oldest(&mut self) -> Result<()> {
+        if let Some((i, mut job)) = self.running.pop_front() {
+            self.results[i] = Some(job.release(true, true)?);
+        }
+        Ok(())
+    }
+
+    /// Wait for all jobs of the batch.
+    ///
+    /// # Returns
+    ///  * The return value and copied back memories as returned by [`Job::release`] for
+    ///    every job, in the order of the parameter lists given to the batch.
+    pub fn release(mut self) -> Result<Vec<(u64, Vec<Box<[u8]>>)>> {
+        while self.has_running() {
+            self.release_oldest()?;
+        }
+        Ok(self.results.into_iter().flatten().collect())
+    }
+
+    /// Wait for the running jobs of the batch and drop their results.
+    ///
+    /// Used to clean up after a launch failed part way through the batch.
+    pub fn discard(mut self) {
+        while let Some((i, mut job)) = self.running.pop_front() {
+            if let Err(e) = job.release(true, false) {
+                warn!("Could not release job {} of discarded batch: {}", i, e);
+            }
+        }
+    }
+
+    /// Asynchronous version of [`release`](#method.release).
+    pub async fn release_async(mut self) -> Result<Vec<(u64, Vec<Box<[u8]>>)>> {
+        while let Some((i, mut job)) = self.running.pop_front() {
+            self.results[i] = Some(job.release_async(true, true).await?);
+        }
+        Ok(self.results.into_iter().flatten().collect())
+    }
+}
+
 /// Helper structure to start and release PEs.
 /// Deals with data transfer parameter handling.
 #[derive(Debug)]
 pub struct Job {
     pe: Option<PE>,
     scheduler: Arc<dyn ReleasePE>,
+    // Stage timestamps if latency recording or tracing is enabled, see `crate::latency`
+    timing: Option<JobTiming>,
 }
 
 /// Release the PE if it's no longer needed.
@@ -108,134 +521,288 @@ impl Job {
     ///
     /// [`acquire_pe`]: ../device/struct.Device.html#method.acquire_pe
     pub fn new(pe: PE, scheduler: &Arc<impl ReleasePE + 'static>) -> Self {
+        let timing = if crate::latency::is_enabled() || crate::trace::is_enabled() {
+            Some(JobTiming::new(*pe.type_id(), *pe.id()))
+        } else {
+            None
+        };
         Self {
             pe: Some(pe),
             scheduler: scheduler.clone(),
+            timing,
+        }
+    }
+
+    /// Account the time since `since` to the acquisition of the PE on `device`.
+    pub(crate) fn acquired_since(mut self, device: DeviceId, since: Option<Instant>) -> Self {
+        if let Some(t) = self.timing.as_mut() {
+            t.acquired_on(device, since);
         }
+        self
+    }
+
+    /// Timestamps of the finished run. The next run on the same PE starts a new record.
+    fn take_timing(&mut self) -> Option<JobTiming> {
+        let mut t = self.timing.take()?;
+        t.completed();
+        if self.pe.is_some() {
+            self.timing = Some(t.rerun());
+        }
+        Some(t)
     }
 
     /// Fetches the correct local memory and changes `DataTransferLocal` into `DataTransferAlloc`.
-    fn handle_local_memories(&self, args: Vec<PEParameter>) -> Result<Vec<PEParameter>> {
+    fn handle_local_memories(&self, args: &mut [PEParameter]) -> Result<()> {
         trace!("Handling local memory parameters.");
-        let new_params = args
-            .into_iter()
-            .map(|arg| match arg {
-                PEParameter::DataTransferLocal(x) => {
-                    let m = match self.pe.as_ref().unwrap().local_memory() {
-                        Some(m) => m,
-                        None => return Err(Error::NoLocalMemory {}),
-                    };
-                    Ok(PEParameter::DataTransferAlloc(DataTransferAlloc {
+        for arg in args.iter_mut() {
+            if let PEParameter::DataTransferLocal(_) = arg {
+                let m = match self.pe.as_ref().unwrap().local_memory() {
+                    Some(m) => m,
+                    None => return Err(Error::NoLocalMemory {}),
+                };
+                if let PEParameter::DataTransferLocal(x) = std::mem::replace(arg, PEParameter::Single64(0)) {
+                    *arg = PEParameter::DataTransferAlloc(DataTransferAlloc {
                         data: x.data,
                         from_device: x.from_device,
                         to_device: x.to_device,
                         memory: m.clone(),
                         free: x.free,
                         fixed: x.fixed,
-                    }))
+                    });
                 }
-                _ => Ok(arg),
-            })
-            .collect();
+            }
+        }
         trace!("All local memory parameters handled.");
-        new_params
+        Ok(())
     }
 
-    //TODO: Check performance as this does not happen inplace but creates a new Vec
     /// Allocates memory area on the provided memories which transforms `DataTransferAlloc` into `DataTransferPrealloc`.
-    fn handle_allocates(&self, args: Vec<PEParameter>) -> Result<Vec<PEParameter>> {
+    ///
+    /// Works on the parameter lists of one or more jobs. Buffers cached in the buffer pool of
+    /// a memory are taken first. Each allocator is locked only once for all remaining
+    /// allocations. Allocators are locked in a fixed order so concurrent batches cannot deadlock.
+    ///
+    /// If an allocation fails, all allocations made so far are freed again.
+    ///
+    /// # Returns
+    ///  * The positions (parameter list, parameter) of the allocations made, see
+    ///    [`free_unused_allocations`](#method.free_unused_allocations).
+    fn handle_allocates(
+        args: &mut [Vec<PEParameter>],
+        svm_in_use: bool,
+    ) -> Result<Vec<(usize, usize)>> {
         trace!("Handling allocate parameters.");
-        let new_params = args
-            .into_iter()
-            .map(|arg| match arg {
-                PEParameter::DataTransferAlloc(x) => {
-                    let a = if *self.pe.as_ref().unwrap().svm_in_use() {
-                        x.data.as_ptr() as DeviceAddress
-                    } else {
+        let mut memories: Vec<Arc<OffchipMemory>> = Vec::new();
+        let mut allocated = Vec::new();
+        let r = Self::allocate_cached(args, svm_in_use, &mut memories, &mut allocated)
+            .and_then(|_| {
+                memories.sort_by_key(|m| Arc::as_ptr(m) as usize);
+                Self::allocate_remaining(args, &memories, &mut allocated)
+            });
+        if let Err(e) = r {
+            trace!("Allocation failed, freeing {} allocations.", allocated.len());
+            Self::free_unused_allocations(args, &allocated);
+            return Err(e);
+        }
+        trace!("All allocate parameters handled.");
+        Ok(allocated)
+    }
+
+    /// Take buffers for `DataTransferAlloc` parameters from the buffer pools. Collects
+    /// the memories of all other parameters in `memories` and records the position of
+    /// every allocation in `allocated`.
+    fn allocate_cached(
+        args: &mut [Vec<PEParameter>],
+        svm_in_use: bool,
+        memories: &mut Vec<Arc<OffchipMemory>>,
+        allocated: &mut Vec<(usize, usize)>,
+    ) -> Result<()> {
+        for (i, list) in args.iter_mut().enumerate() {
+            for (j, arg) in list.iter_mut().enumerate() {
+                let cached = match arg {
+                    PEParameter::DataTransferAlloc(x) if svm_in_use => {
+                        Some(x.data.as_ptr() as DeviceAddress)
+                    }
+                    PEParameter::DataTransferAlloc(x) => {
+                        let cached = match x.fixed {
+                            Some(_) => None,
+                            None => x
+                                .memory
+                                .allocate_cached(x.data.len() as u64)
+                                .context(AllocatorSnafu)?,
+                        };
+                        if cached.is_some() {
+                            allocated.push((i, j));
+                        } else if !memories.iter().any(|m| Arc::ptr_eq(m, &x.memory)) {
+                            memories.push(x.memory.clone());
+                        }
+                        cached
+                    }
+                    _ => None,
+                };
+                if let Some(a) = cached {
+                    Self::to_prealloc(arg, a);
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// Allocate all remaining `DataTransferAlloc` parameters with one lock of each of
+    /// `memories`. Records the position of every allocation in `allocated`.
+    fn allocate_remaining(
+        args: &mut [Vec<PEParameter>],
+        memories: &[Arc<OffchipMemory>],
+        allocated: &mut Vec<(usize, usize)>,
+    ) -> Result<()> {
+        let mut allocators = memories
+            .iter()
+            .map(|m| m.allocator().lock())
+            .collect::<std::result::Result<Vec<_>, _>>()?;
+
+        for (i, list) in args.iter_mut().enumerate() {
+            for (j, arg) in list.iter_mut().enumerate() {
+                let a = match arg {
+                    PEParameter::DataTransferAlloc(x) => {
+                        let k = memories
+                            .iter()
+                            .position(|m| Arc::ptr_eq(m, &x.memory))
+                            .unwrap();
                         match x.fixed {
                             Some(offset) => x
                                 .memory
-                                .allocator()
-                                .lock()?
-                                .allocate_fixed(x.data.len() as u64, offset)
+                                .allocate_fixed_with(&mut **allocators[k], x.data.len() as u64, offset)
                                 .context(AllocatorSnafu)?,
                             None => x
                                 .memory
-                                .allocator()
-                                .lock()?
-                                .allocate(x.data.len() as u64, Some(x.data.as_ptr() as u64))
+                                .allocate_with(
+                                    &mut **allocators[k],
+                                    x.data.len() as u64,
+                                    Some(x.data.as_ptr() as u64),
+                                )
                                 .context(AllocatorSnafu)?,
                         }
-                    };
+                    }
+                    _ => continue,
+                };
+                Self::to_prealloc(arg, a);
+                allocated.push((i, j));
+            }
+        }
+        Ok(())
+    }
 
-                    Ok(PEParameter::DataTransferPrealloc(DataTransferPrealloc {
-                        data: x.data,
-                        device_address: a,
-                        from_device: x.from_device,
-                        to_device: x.to_device,
-                        memory: x.memory,
-                        free: x.free,
-                    }))
+    /// Free the allocations made by [`handle_allocates`] at the positions `allocated` which
+    /// have not been handed to a started job yet. Used to roll back if jobs cannot be
+    /// started, cached buffers go back to the buffer pool.
+    ///
+    /// [`handle_allocates`]: #method.handle_allocates
+    fn free_unused_allocations(args: &[Vec<PEParameter>], allocated: &[(usize, usize)]) {
+        for (i, j) in allocated {
+            if let Some(PEParameter::DataTransferPrealloc(x)) = args.get(*i).and_then(|a| a.get(*j)) {
+                if let Err(e) = x.memory.free_sized(x.device_address, x.data.len() as u64) {
+                    warn!("Could not free unused allocation 0x{:x}: {}", x.device_address, e);
                 }
-                _ => Ok(arg),
-            })
-            .collect();
+            }
+        }
+    }
 
-        trace!("All allocate parameters handled.");
-        new_params
+    /// Replace a `DataTransferAlloc` by a `DataTransferPrealloc` using the allocation at `device_address`.
+    fn to_prealloc(arg: &mut PEParameter, device_address: DeviceAddress) {
+        if let PEParameter::DataTransferAlloc(x) = std::mem::replace(arg, PEParameter::Single64(0)) {
+            *arg = PEParameter::DataTransferPrealloc(DataTransferPrealloc {
+                data: x.data,
+                device_address,
+                from_device: x.from_device,
+                to_device: x.to_device,
+                memory: x.memory,
+                free: x.free,
+            });
+        }
     }
 
     /// Move data in `DataTransferPrealloc` to the device if necessary and prepare the copy back operations
     /// to be used after job execution. Converts the `DataTransferPrealloc` into `DeviceAddress`.
-    fn handle_transfers_to_device(
-        &mut self,
-        args: Vec<PEParameter>,
-    ) -> Result<(Vec<PEParameter>, Vec<Box<[u8]>>)> {
+    fn handle_transfers_to_device(&mut self, args: &mut [PEParameter]) -> Result<Vec<Box<[u8]>>> {
         trace!("Handling allocate parameters.");
+        let transfers = args
+            .iter()
+            .filter_map(|arg| match arg {
+                PEParameter::DataTransferPrealloc(x) if x.to_device => {
+                    Some((&x.memory, x.data.len(), (&x.data[..], x.device_address)))
+                }
+                _ => None,
+            })
+            .collect();
+        Self::transfer_concurrently(transfers, |memory, (data, addr)| {
+            memory.dma().copy_to(data, addr)
+        })?;
+
         let mut unused_mem = Vec::new();
-        let new_params = args
-            .into_iter()
-            .try_fold(Vec::new(), |mut xs, arg| match arg {
-                PEParameter::DataTransferPrealloc(x) => {
-                    if x.to_device {
-                        x.memory
-                            .dma()
-                            .copy_to(&x.data[..], x.device_address)
-                            .context(DMASnafu)?;
-                    }
+        for arg in args.iter_mut() {
+            if let PEParameter::DataTransferPrealloc(_) = arg {
+                let x = match std::mem::replace(arg, PEParameter::Single64(0)) {
+                    PEParameter::DataTransferPrealloc(x) => x,
+                    _ => unreachable!(),
+                };
 
-                    xs.push(PEParameter::DeviceAddress(x.device_address));
-                    if *self.pe.as_ref().unwrap().svm_in_use() && !x.from_device {
-                        // return the buffer always if SVM is enabled to let the user
-                        // program regain ownership
-                        self.pe.as_mut().unwrap().add_copyback(CopyBack::Return(x));
-                    } else if x.from_device {
+                *arg = PEParameter::DeviceAddress(x.device_address);
+                if *self.pe.as_ref().unwrap().svm_in_use() && !x.from_device {
+                    // return the buffer always if SVM is enabled to let the user
+                    // program regain ownership
+                    self.pe.as_mut().unwrap().add_copyback(CopyBack::Return(x));
+                } else if x.from_device {
+                    self.pe
+                        .as_mut()
+                        .unwrap()
+                        .add_copyback(CopyBack::Transfer(x));
+                } else {
+                    if x.free {
                         self.pe
                             .as_mut()
                             .unwrap()
-                            .add_copyback(CopyBack::Transfer(x));
-                    } else {
-                        if x.free {
-                            self.pe
-                                .as_mut()
-                                .unwrap()
-                                .add_copyback(CopyBack::Free(x.device_address, x.memory.clone()));
-                        }
-                        unused_mem.push(x.data);
+                            .add_copyback(CopyBack::Free(
+                                x.device_address,
+                                x.data.len() as u64,
+                                x.memory.clone(),
+                            ));
                     }
-
-                    Ok(xs)
+                    unused_mem.push(x.data);
                 }
-                _ => {
-                    xs.push(arg);
-                    Ok(xs)
-                }
-            });
-        trace!("All transfer to parameters handled.");
-        match new_params {
-            Ok(x) => Ok((x, unused_mem)),
-            Err(e) => Err(e),
+            }
+            if let PEParameter::DeviceBuffer(_) = arg {
+                let x = match std::mem::replace(arg, PEParameter::Single64(0)) {
+                    PEParameter::DeviceBuffer(x) => x,
+                    _ => unreachable!(),
+                };
+                *arg = PEParameter::DeviceAddress(
+                    x.buffer
+                        .prepare_launch(x.from_device)
+                        .context(DeviceBufferSnafu)?,
+                );
+                self.pe
+                    .as_mut()
+                    .unwrap()
+                    .add_copyback(CopyBack::Buffer(x.buffer));
+            }
+            if let PEParameter::LocalBuffer(_) = arg {
+                let b = match std::mem::replace(arg, PEParameter::Single64(0)) {
+                    PEParameter::LocalBuffer(b) => b,
+                    _ => unreachable!(),
+                };
+                let pe = self.pe.as_mut().unwrap();
+                let m = match pe.local_memory() {
+                    Some(m) => m.clone(),
+                    None => return Err(Error::NoLocalMemory {}),
+                };
+                *arg = PEParameter::DeviceAddress(
+                    b.prepare_launch(&m).context(DeviceBufferSnafu)?,
+                );
+                pe.add_copyback(CopyBack::LocalBuffer(b));
+            }
         }
+        trace!("All transfer to parameters handled.");
+        Ok(unused_mem)
     }
 
     /// Launch threads to move data from/to device constantly during PE execution using the
@@ -289,48 +856,118 @@ impl Job {
     /// # Returns
     ///  * A list of memories contained in the parameter list that is not marked for copy back. Otherwise, those memories would be dropped.
     ///    The order of returned memories is the same as they occured in the argument list.
-    pub fn start(&mut self, args: Vec<PEParameter>) -> Result<Vec<Box<[u8]>>> {
+    pub fn start(&mut self, mut args: Vec<PEParameter>) -> Result<Vec<Box<[u8]>>> {
         trace!(
             "Starting execution of {:?} with Arguments {:?}.",
             self.pe,
             args
         );
-        let alloc_args = self.handle_local_memories(args)?;
-        trace!("Handled local parameters => {:?}.", alloc_args);
-        let local_args = self.handle_allocates(alloc_args)?;
-        trace!("Handled allocates => {:?}.", local_args);
-        let (trans_args, unused_mem) = self.handle_transfers_to_device(local_args)?;
-        trace!("Handled transfers => {:?}.", trans_args);
-        let trans_args = self.handle_stream_transfers(trans_args)?;
+        if let Some(t) = self.timing.as_mut() {
+            t.started();
+        }
+        self.handle_local_memories(&mut args)?;
+        trace!("Handled local parameters => {:?}.", args);
+        let svm_in_use = *self.pe.as_ref().unwrap().svm_in_use();
+        let allocated = Self::handle_allocates(std::slice::from_mut(&mut args), svm_in_use)?;
+        trace!("Handled allocates => {:?}.", args);
+        if let Some(t) = self.timing.as_mut() {
+            t.allocated();
+        }
+        self.start_allocated(&mut args).map_err(|e| {
+            Self::free_unused_allocations(std::slice::from_ref(&args), &allocated);
+            e
+        })
+    }
+
+    /// Start the given jobs with one parameter list each.
+    ///
+    /// Allocations of all jobs are done with a single lock of each allocator involved.
+    /// Jobs are started in order as soon as their own transfers are done.
+    ///
+    /// If job k cannot be started, jobs 0..k keep running. The allocations of job k not
+    /// taken over by it yet and all allocations of the later jobs are freed, their PEs are
+    /// released when the jobs are dropped.
+    ///
+    /// # Returns
+    ///  * The memories not marked for copy back as returned by [`start`] for each job.
+    ///
+    /// [`start`]: #method.start
+    pub fn start_batch(
+        jobs: &mut [Job],
+        mut args: Vec<Vec<PEParameter>>,
+    ) -> Result<Vec<Vec<Box<[u8]>>>> {
+        trace!("Starting batch of {} jobs.", jobs.len());
+        let mut svm_in_use = false;
+        for (job, a) in jobs.iter_mut().zip(args.iter_mut()) {
+            let pe = match job.pe.as_ref() {
+                Some(pe) => pe,
+                None => return Err(Error::NoPEtoStart {}),
+            };
+            svm_in_use |= *pe.svm_in_use();
+            if let Some(t) = job.timing.as_mut() {
+                t.started();
+            }
+            job.handle_local_memories(a)?;
+        }
+        let allocated = Self::handle_allocates(&mut args, svm_in_use)?;
+        for t in jobs.iter_mut().filter_map(|j| j.timing.as_mut()) {
+            t.allocated();
+        }
+        let mut unused_mem = Vec::with_capacity(jobs.len());
+        for (k, job) in jobs.iter_mut().enumerate() {
+            match job.start_allocated(&mut args[k]) {
+                Ok(m) => unused_mem.push(m),
+                Err(e) => {
+                    // Started jobs have taken over their allocations
+                    Self::free_unused_allocations(&args, &allocated);
+                    return Err(e);
+                }
+            }
+        }
+        Ok(unused_mem)
+    }
+
+    /// Transfer data, set the arguments and start the PE after all allocations are done.
+    ///
+    /// Parameters in `args` are replaced once the job has taken them over, on error the
+    /// remaining `DataTransferPrealloc` parameters are left to the caller.
+    fn start_allocated(&mut self, args: &mut Vec<PEParameter>) -> Result<Vec<Box<[u8]>>> {
+        let unused_mem = self.handle_transfers_to_device(args)?;
+        trace!("Handled transfers => {:?}.", args);
+        let trans_args = self.handle_stream_transfers(std::mem::take(args))?;
         trace!("Setting arguments.");
+        let svm_in_use = *self.pe.as_ref().unwrap().svm_in_use();
+        let mut reg_args = Vec::with_capacity(trans_args.len());
         for (i, arg) in trans_args.into_iter().enumerate() {
             trace!("Setting argument {} => {:?}.", i, arg);
-            match arg {
-                PEParameter::Single32(_) => {
-                    self.pe.as_ref().unwrap().set_arg(i, arg).context(PESnafu)?;
-                }
-                PEParameter::Single64(_) => {
-                    self.pe.as_ref().unwrap().set_arg(i, arg).context(PESnafu)?;
-                }
-                PEParameter::DeviceAddress(x) => self
-                    .pe
-                    .as_ref()
-                    .unwrap()
-                    .set_arg(i, PEParameter::Single64(x))
-                    .context(PESnafu)?,
+            reg_args.push(match arg {
+                PEParameter::Single32(_) | PEParameter::Single64(_) => arg,
+                PEParameter::DeviceAddress(x) => PEParameter::Single64(x),
                 PEParameter::VirtualAddress(p) => {
-                    if *self.pe.as_ref().unwrap().svm_in_use() {
-                        self.pe.as_ref().unwrap().set_arg(i, PEParameter::Single64(p as u64)).context(PESnafu)?;
+                    if svm_in_use {
+                        PEParameter::Single64(p as u64)
                     } else {
-                        return Err(Error::UnsupportedSVMParameter { arg })
+                        return Err(Error::UnsupportedSVMParameter {
+                            arg: format!("{:?}", arg),
+                        })
                     }
                 }
-                _ => return Err(Error::UnsupportedRegisterParameter { arg }),
-            };
+                _ => {
+                    return Err(Error::UnsupportedRegisterParameter {
+                        arg: format!("{:?}", arg),
+                    })
+                }
+            });
         }
-        trace!("Arguments set.");
         trace!("Starting PE {} execution.", self.pe.as_ref().unwrap().id());
-        self.pe.as_mut().unwrap().start().context(PESnafu)?;
+        self.pe
+            .as_mut()
+            .unwrap()
+            .start_with_args(reg_args)
+            .context(PESnafu)?;
+        if let Some(t) = self.timing.as_mut() {
+            t.transferred();
+        }
         trace!("PE {} started.", self.pe.as_ref().unwrap().id());
         Ok(unused_mem)
     }
@@ -375,37 +1012,177 @@ impl Job {
                     .context(SchedulerSnafu)?;
             }
             trace!("Release successful.");
-            Self::handle_copyback(return_value, copyback)
+            let timing = self.take_timing();
+            Self::handle_copyback(return_value, copyback, timing)
         } else {
             Err(Error::NoPEtoRelease {})
         }
     }
 
-    fn handle_copyback(return_value: u64, copyback: Option<Vec<CopyBack>>) -> Result<(u64, Vec<Box<[u8]>>)> {
+    /// Wait for job completion and hand the copy back to a completion worker.
+    ///
+    /// Unlike [`release`] this function returns as soon as the PE has finished. With
+    /// `release_pe` the PE is immediately available to the next job, otherwise it can be
+    /// started again by this job while the results of the previous run are transferred.
+    /// Copy backs without DMA transfers are finished before returning.
+    ///
+    /// # Arguments
+    ///  * `release_pe`: Release the PE so it can be used by another Job.
+    ///  * `return_value`: Read back the return value from the device?
+    /// # Returns
+    ///  * Tuple of
+    ///    a: The return value if requested through the argument `return_value`,
+    ///    b: A [`CopyBackFuture`] resolving to the memories [`release`] would return.
+    ///
+    /// [`release`]: #method.release
+    pub fn release_deferred(
+        &mut self,
+        release_pe: bool,
+        return_value: bool,
+    ) -> Result<(u64, CopyBackFuture)> {
+        let pe = match self.pe.as_mut() {
+            Some(pe) => pe,
+            None => return Err(Error::NoPEtoRelease {}),
+        };
+        trace!("Trying to release PE {:?} with deferred copy back.", pe.id());
+        let (return_value, copyback) = pe.release(return_value).context(PESnafu)?;
+        trace!("PE is idle.");
+
+        if release_pe {
+            self.scheduler
+                .release_pe(self.pe.take().unwrap())
+                .context(SchedulerSnafu)?;
+        }
+        trace!("Release successful.");
+
+        let transfers = copyback.as_ref().map_or(false, |c| {
+            c.iter()
+                .any(|x| matches!(x, CopyBack::Transfer(_) | CopyBack::Stream(_)))
+        });
+        let timing = self.take_timing();
+        let future = match copyback {
+            Some(c) if transfers => CopyBackFuture::spawn(c, timing),
+            c => CopyBackFuture::ready(Self::handle_copyback(return_value, c, timing)),
+        };
+        Ok((return_value, future))
+    }
+
+    /// Run `transfer` for all `transfers`, transfers of different memories concurrently.
+    ///
+    /// Each transfer comes with its length in bytes. Transfers of one memory share its DMA
+    /// engine and are issued in order by a single thread. The calling thread handles the
+    /// first memory and all memories transferring less than [`CONCURRENT_TRANSFER_MIN`]
+    /// bytes, each further memory gets a thread of its own that is joined before returning.
+    fn transfer_concurrently<T, F>(
+        transfers: Vec<(&Arc<OffchipMemory>, usize, T)>,
+        transfer: F,
+    ) -> Result<()>
+    where
+        T: Send,
+        F: Fn(&OffchipMemory, T) -> crate::dma::Result<()> + Sync,
+    {
+        let mut groups: Vec<(&Arc<OffchipMemory>, usize, Vec<T>)> = Vec::new();
+        for (memory, len, t) in transfers {
+            match groups.iter_mut().find(|(m, _, _)| Arc::ptr_eq(m, memory)) {
+                Some((_, bytes, g)) => {
+                    *bytes += len;
+                    g.push(t);
+                }
+                None => groups.push((memory, len, vec![t])),
+            }
+        }
+        // The first memory stays on the calling thread in any case
+        let (concurrent, sequential): (Vec<_>, Vec<_>) = groups
+            .into_iter()
+            .enumerate()
+            .partition(|(i, (_, bytes, _))| *i > 0 && *bytes >= CONCURRENT_TRANSFER_MIN);
+        let sequential = sequential.into_iter().map(|(_, (m, _, g))| (m, g));
+        let concurrent = concurrent.into_iter().map(|(_, (m, _, g))| (m, g));
+
+        let run = |memory: &OffchipMemory, group: Vec<T>| -> crate::dma::Result<()> {
+            for t in group {
+                transfer(memory, t)?;
+            }
+            Ok(())
+        };
+        let run = &run;
+        let run_sequential = move || -> crate::dma::Result<()> {
+            for (memory, group) in sequential {
+                run(memory, group)?;
+            }
+            Ok(())
+        };
+
+        if concurrent.len() == 0 {
+            return run_sequential().context(DMASnafu);
+        }
+
+        trace!("Transferring arguments of {} memories concurrently.", concurrent.len() + 1);
+        thread::scope(|s| {
+            let handles: Vec<_> = concurrent
+                .map(|(memory, group)| s.spawn(move || run(memory, group)))
+                .collect();
+            let mut r = run_sequential();
+            for h in handles {
+                let hr = match h.join() {
+                    Ok(hr) => hr,
+                    Err(e) => std::panic::resume_unwind(e),
+                };
+                if r.is_ok() {
+                    r = hr;
+                }
+            }
+            r
+        })
+        .context(DMASnafu)
+    }
+
+    fn handle_copyback(
+        return_value: u64,
+        copyback: Option<Vec<CopyBack>>,
+        timing: Option<JobTiming>,
+    ) -> Result<(u64, Vec<Box<[u8]>>)> {
+        let r = Self::copy_back(return_value, copyback);
+        if let (Ok(_), Some(t)) = (&r, timing) {
+            t.finish();
+        }
+        r
+    }
+
+    fn copy_back(return_value: u64, copyback: Option<Vec<CopyBack>>) -> Result<(u64, Vec<Box<[u8]>>)> {
         match copyback {
-            Some(copybacks) => {
-                let mut res = Vec::new();
+            Some(mut copybacks) => {
+                let transfers = copybacks
+                    .iter_mut()
+                    .filter_map(|param| match param {
+                        CopyBack::Transfer(t) => {
+                            let len = t.data.len();
+                            Some((&t.memory, len, (t.device_address, &mut t.data[..])))
+                        }
+                        _ => None,
+                    })
+                    .collect();
+                Self::transfer_concurrently(transfers, |memory, (addr, data)| {
+                    memory.dma().copy_from(addr, data)
+                })?;
 
+                let mut res = Vec::new();
                 for param in copybacks {
                     match param {
-                        CopyBack::Transfer(mut transfer) => {
-                            transfer
-                                .memory
-                                .dma()
-                                .copy_from(transfer.device_address, &mut transfer.data[..])
-                                .context(DMASnafu)?;
+                        CopyBack::Transfer(transfer) => {
                             if transfer.free {
                                 transfer
                                     .memory
-                                    .allocator()
-                                    .lock()?
-                                    .free(transfer.device_address)
+                                    .free_sized(
+                                        transfer.device_address,
+                                        transfer.data.len() as u64,
+                                    )
                                     .context(AllocatorSnafu)?;
                             }
                             res.push(transfer.data);
                         }
-                        CopyBack::Free(addr, mem) => {
-                            mem.allocator().lock()?.free(addr).context(AllocatorSnafu)?;
+                        CopyBack::Free(addr, size, mem) => {
+                            mem.free_sized(addr, size).context(AllocatorSnafu)?;
                         }
                         CopyBack::Stream(handle) => {
                             let h = handle.join().unwrap().context(DMASnafu )?;
@@ -417,6 +1194,7 @@ impl Job {
                         CopyBack::Return(transfer) => {
                             res.push(transfer.data);
                         }
+                        CopyBack::Buffer(_) | CopyBack::LocalBuffer(_) => {}
                     }
                 }
 
@@ -449,7 +1227,8 @@ impl Job {
                             .context(SchedulerSnafu)?;
                     }
                     trace!("Release successful.");
-                    let r = Self::handle_copyback(ret_val, copyback)?;
+                    let timing = self.take_timing();
+                    let r = Self::handle_copyback(ret_val, copyback, timing)?;
                     Ok(Some(r))
                 },
                 None => Ok(None)
@@ -459,6 +1238,60 @@ impl Job {
         }
     }
 
+    /// Asynchronous version of [`release`].
+    ///
+    /// # Arguments
+    ///  * `release_pe`: Release the PE so it can be used by another Job.
+    ///  * `return_value`: Read back the return value from the device?
+    /// # Returns
+    ///  * A [`JobRelease`] future resolving to the same tuple as [`release`].
+    ///
+    /// [`release`]: #method.release
+    pub fn release_async(&mut self, release_pe: bool, return_value: bool) -> JobRelease<'_> {
+        JobRelease {
+            job: self,
+            release_pe,
+            return_value,
+            backoff: BACKOFF_MIN,
+            copyback: None,
+        }
+    }
+
+    /// Check for completion and register `waker` if the PE is still running.
+    ///
+    /// The PE is checked again after registering so an interrupt arriving in between
+    /// is not lost. If the interrupt can not wake tasks, the waker is woken after
+    /// `backoff`, which is doubled for the next poll.
+    fn poll_completion(
+        &mut self,
+        waker: &Waker,
+        backoff: &mut Duration,
+        release_pe: bool,
+        return_value: bool,
+    ) -> Result<Option<(u64, Option<Vec<CopyBack>>)>> {
+        let pe = match self.pe.as_mut() {
+            Some(pe) => pe,
+            None => return Err(Error::NoPEtoRelease {}),
+        };
+        let mut res = pe.try_release(return_value).context(PESnafu)?;
+        if res.is_none() {
+            if pe.register_waker(waker).context(PESnafu)? {
+                res = pe.try_release(return_value).context(PESnafu)?;
+            } else {
+                wake_after(waker, *backoff);
+                *backoff = (*backoff * 2).min(BACKOFF_MAX);
+            }
+        }
+
+        if res.is_some() && release_pe {
+            self.scheduler
+                .release_pe(self.pe.take().unwrap())
+                .context(SchedulerSnafu)?;
+            trace!("Release successful.");
+        }
+        Ok(res)
+    }
+
     pub fn enable_debug(&mut self) -> Result<()> {
         match &mut self.pe {
             Some(x) => x.enable_debug().context(PESnafu)?,
@@ -467,3 +1300,95 @@ impl Job {
         Ok(())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use crate::device::{DataTransferAlloc, Device, PEParameter};
+    use crate::software_device::{sum_config, SUM};
+    use crate::tlkm::tlkm_access;
+    use std::collections::HashMap;
+    use std::future::Future;
+    use std::pin::Pin;
+    use std::time::Duration;
+
+    // Device memory of sum_config
+    const MEMORY_SIZE: u64 = 1024 * 1024;
+
+    fn device(latency: Duration) -> Device {
+        let config = sum_config(3, latency);
+        let mut d = Device::new_software(0, config, &HashMap::new()).unwrap();
+        d.change_access(tlkm_access::TlkmAccessExclusive).unwrap();
+        d
+    }
+
+    fn input(d: &Device, len: usize) -> PEParameter {
+        PEParameter::DataTransferAlloc(DataTransferAlloc {
+            data: vec![1u8; len].into_boxed_slice(),
+            from_device: false,
+            to_device: true,
+            free: true,
+            memory: d.default_memory().unwrap(),
+            fixed: None,
+        })
+    }
+
+    /// Nothing may be left allocated, neither in the allocator nor in the buffer pool.
+    fn assert_released(d: &Device) {
+        let memory = d.default_memory().unwrap();
+        let a = memory.allocate_fixed(MEMORY_SIZE, 0).unwrap();
+        memory.allocator().lock().unwrap().free(a).unwrap();
+        let jobs: Vec<_> = (0..3)
+            .map(|_| d.acquire_pe_timeout(SUM, Duration::from_secs(1)).unwrap())
+            .collect();
+        assert!(jobs.iter().all(|j| j.is_some()));
+    }
+
+    #[test]
+    fn batch_allocation_failure_is_rolled_back() {
+        let d = device(Duration::ZERO);
+        let args = vec![
+            vec![input(&d, 4), PEParameter::Single64(4)],
+            vec![input(&d, 8), PEParameter::Single64(8)],
+            vec![input(&d, 2 * MEMORY_SIZE as usize), PEParameter::Single64(0)],
+        ];
+        assert!(d.launch_batch(SUM, args).is_err());
+        assert_released(&d);
+    }
+
+    #[test]
+    fn batch_start_failure_frees_later_jobs() {
+        let d = device(Duration::ZERO);
+        let args = vec![
+            vec![input(&d, 4), PEParameter::Single64(4)],
+            // Not a register parameter without SVM
+            vec![input(&d, 4), PEParameter::VirtualAddress(std::ptr::null())],
+            vec![input(&d, 4), PEParameter::Single64(4)],
+        ];
+        assert!(d.launch_batch(SUM, args).is_err());
+        assert_released(&d);
+
+        let args = (0..5)
+            .map(|_| vec![input(&d, 4), PEParameter::Single64(4)])
+            .collect();
+        let (batch, _) = d.launch_batch(SUM, args).unwrap();
+        assert!(batch.release().unwrap().iter().all(|r| r.0 == 4));
+    }
+
+    #[test]
+    fn release_async_backs_off_without_dispatcher() {
+        let d = device(Duration::from_millis(20));
+        let mut job = d.acquire_pe(SUM).unwrap();
+        job.start(vec![input(&d, 4), PEParameter::Single64(4)])
+            .unwrap();
+        let mut release = job.release_async(true, true);
+        let mut polls = 0;
+        let (rv, _) = futures::executor::block_on(futures::future::poll_fn(|cx| {
+            polls += 1;
+            Pin::new(&mut release).poll(cx)
+        }))
+        .unwrap();
+        assert_eq!(rv, 4);
+        // About 30 polls with the backoff, waking right away polls thousands of times
+        assert!(polls < 200, "{} polls", polls);
+    }
+}
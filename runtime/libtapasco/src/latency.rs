@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//! Latency breakdown of jobs.
+//!
+//! If enabled (`latency.enabled` setting or [`set_enabled`]), every job records a
+//! timestamp when it enters each of its stages. Once the copy back of a job is done, the
+//! durations of the stages are pushed as a [`JobLatency`] into a ring buffer of the
+//! current thread without taking a lock. The records are collected into one
+//! [`Histogram`] per PE type and stage when the statistics are queried or a ring fills
+//! up. An export hook receives every collected record.
+//!
+//! A disabled recorder costs one relaxed atomic load per acquired job.
+
+use crate::pe::PEId;
+use crate::tlkm::DeviceId;
+use crate::trace::{self, FlowPhase, Track};
+use once_cell::sync::Lazy;
+use std::cell::UnsafeCell;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard};
+use std::time::Instant;
+
+/// Stages of a job. Stages not passed by a job, e.g., the acquisition of a PE that is
+/// started again, are recorded as 0.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LatencyStage {
+    /// Waiting for a PE in the scheduler.
+    Acquire = 0,
+    /// Allocation of device memory for the arguments.
+    Allocate,
+    /// Transfer of the arguments to the device and start of the PE.
+    TransferToDevice,
+    /// From the start of the PE until its completion is noticed by the host.
+    Execute,
+    /// Transfer of the results to the host and release of the memories.
+    CopyBack,
+    /// Sum of all stages including the time between them.
+    Total,
+}
+
+pub const LATENCY_STAGES: usize = 6;
+
+impl LatencyStage {
+    pub const ALL: [LatencyStage; LATENCY_STAGES] = [
+        LatencyStage::Acquire,
+        LatencyStage::Allocate,
+        LatencyStage::TransferToDevice,
+        LatencyStage::Execute,
+        LatencyStage::CopyBack,
+        LatencyStage::Total,
+    ];
+
+    pub fn name(&self) -> &'static str {
+        match self {
+            LatencyStage::Acquire => "acquire",
+            LatencyStage::Allocate => "allocate",
+            LatencyStage::TransferToDevice => "transfer_to_device",
+            LatencyStage::Execute => "execute",
+            LatencyStage::CopyBack => "copy_back",
+            LatencyStage::Total => "total",
+        }
+    }
+}
+
+/// Stage durations of a single job in ns.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct JobLatency {
+    pub pe_type: PEId,
+    /// Index of the PE on its device.
+    pub pe_id: usize,
+    /// Indexed by [`LatencyStage`].
+    pub stages: [u64; 6],
+}
+
+impl JobLatency {
+    pub fn stage(&self, stage: LatencyStage) -> u64 {
+        self.stages[stage as usize]
+    }
+}
+
+/// Summary of a histogram in ns.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct LatencySummary {
+    pub count: u64,
+    pub min: u64,
+    pub mean: u64,
+    pub p50: u64,
+    pub p90: u64,
+    pub p99: u64,
+    pub p999: u64,
+    pub max: u64,
+}
+
+// Sub-buckets per power of two. Values are kept with a relative error below 1/16.
+const SUB_BITS: u32 = 4;
+const SUB_BUCKETS: usize = 1 << SUB_BITS;
+const BUCKETS: usize = (64 - SUB_BITS as usize + 1) * SUB_BUCKETS;
+
+/// Log-linear histogram in the style of HDR histograms.
+///
+/// Values below 16 are counted exactly, larger values in 16 buckets per power of two.
+#[derive(Debug, Clone)]
+pub struct Histogram {
+    counts: Vec<u64>,
+    count: u64,
+    sum: u128,
+    min: u64,
+    max: u64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Histogram::new()
+    }
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        Histogram {
+            counts: vec![0; BUCKETS],
+            count: 0,
+            sum: 0,
+            min: u64::MAX,
+            max: 0,
+        }
+    }
+
+    fn index(v: u64) -> usize {
+        if v < SUB_BUCKETS as u64 {
+            return v as usize;
+        }
+        let exp = 63 - v.leading_zeros();
+        let sub = (v >> (exp - SUB_BITS)) as usize & (SUB_BUCKETS - 1);
+        ((exp - SUB_BITS + 1) as usize) * SUB_BUCKETS + sub
+    }
+
+    /// Largest value counted in bucket `i`.
+    fn highest_equivalent(i: usize) -> u64 {
+        if i < SUB_BUCKETS {
+            return i as u64;
+        }
+        let shift = (i / SUB_BUCKETS - 1) as u32;
+        let lower = ((SUB_BUCKETS + i % SUB_BUCKETS) as u64) << shift;
+        lower + ((1u64 << shift) - 1)
+    }
+
+    pub fn record(&mut self, v: u64) {
+        self.counts[Self::index(v)] += 1;
+        self.count += 1;
+        self.sum += v as u128;
+        self.min = self.min.min(v);
+        self.max = self.max.max(v);
+    }
+
+    pub fn merge(&mut self, other: &Histogram) {
+        for (c, o) in self.counts.iter_mut().zip(other.counts.iter()) {
+            *c += o;
+        }
+        self.count += other.count;
+        self.sum += other.sum;
+        self.min = self.min.min(other.min);
+        self.max = self.max.max(other.max);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    pub fn min(&self) -> u64 {
+        if self.count == 0 {
+            0
+        } else {
+            self.min
+        }
+    }
+
+    pub fn max(&self) -> u64 {
+        self.max
+    }
+
+    pub fn mean(&self) -> u64 {
+        if self.count == 0 {
+            0
+        } else {
+            (self.sum / self.count as u128) as u64
+        }
+    }
+
+    /// Value below or at which `percentile` percent of the recorded values lie.
+    pub fn value_at_percentile(&self, percentile: f64) -> u64 {
+        if self.count == 0 {
+            return 0;
+        }
+        let rank = ((percentile.clamp(0.0, 100.0) / 100.0 * self.count as f64).ceil() as u64)
+            .max(1);
+        let mut seen = 0;
+        for (i, c) in self.counts.iter().enumerate() {
+            seen += c;
+            if seen >= rank {
+                return Self::highest_equivalent(i).clamp(self.min, self.max);
+            }
+        }
+        self.max
+    }
+
+    pub fn summary(&self) -> LatencySummary {
+        LatencySummary {
+            count: self.count,
+            min: self.min(),
+            mean: self.mean(),
+            p50: self.value_at_percentile(50.0),
+            p90: self.value_at_percentile(90.0),
+            p99: self.value_at_percentile(99.0),
+            p999: self.value_at_percentile(99.9),
+            max: self.max,
+        }
+    }
+}
+
+const RING_SIZE: usize = 1024;
+
+/// Single producer, single consumer ring of records.
+///
+/// Only the owning thread pushes. Records are popped while holding the collector lock,
+/// so there is only one consumer at a time.
+struct Ring {
+    slots: Box<[UnsafeCell<JobLatency>]>,
+    head: AtomicUsize,
+    tail: AtomicUsize,
+}
+
+unsafe impl Sync for Ring {}
+unsafe impl Send for Ring {}
+
+impl Ring {
+    fn new() -> Ring {
+        Ring {
+            slots: (0..RING_SIZE)
+                .map(|_| UnsafeCell::new(JobLatency::default()))
+                .collect(),
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    /// Returns the number of records in the ring or `None` if the ring is full.
+    fn push(&self, r: JobLatency) -> Option<usize> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        if tail.wrapping_sub(head) == RING_SIZE {
+            return None;
+        }
+        unsafe {
+            *self.slots[tail % RING_SIZE].get() = r;
+        }
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+        Some(tail.wrapping_sub(head) + 1)
+    }
+
+    fn drain(&self, mut f: impl FnMut(&JobLatency)) {
+        let tail = self.tail.load(Ordering::Acquire);
+        let mut head = self.head.load(Ordering::Relaxed);
+        while head != tail {
+            f(unsafe { &*self.slots[head % RING_SIZE].get() });
+            head = head.wrapping_add(1);
+        }
+        self.head.store(head, Ordering::Release);
+    }
+}
+
+pub type ExportHook = Box<dyn Fn(&JobLatency) + Send + Sync>;
+
+#[derive(Default)]
+struct Collector {
+    histograms: HashMap<PEId, Vec<Histogram>>,
+    hook: Option<ExportHook>,
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static DROPPED: AtomicU64 = AtomicU64::new(0);
+static RINGS: Lazy<Mutex<Vec<Arc<Ring>>>> = Lazy::new(|| Mutex::new(Vec::new()));
+static COLLECTOR: Lazy<Mutex<Collector>> = Lazy::new(|| Mutex::new(Collector::default()));
+
+thread_local! {
+    static RING: Arc<Ring> = {
+        let r = Arc::new(Ring::new());
+        lock(&RINGS).push(r.clone());
+        r
+    };
+}
+
+/// Statistics are still meaningful after a panic in a hook, ignore the poisoning.
+fn lock<T>(m: &Mutex<T>) -> MutexGuard<'_, T> {
+    match m.lock() {
+        Ok(g) => g,
+        Err(e) => e.into_inner(),
+    }
+}
+
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Current time if the recording or tracing is enabled.
+#[inline]
+pub(crate) fn timestamp() -> Option<Instant> {
+    if is_enabled() || trace::is_enabled() {
+        Some(Instant::now())
+    } else {
+        None
+    }
+}
+
+/// Number of records lost because the ring of their thread was full.
+pub fn dropped() -> u64 {
+    DROPPED.load(Ordering::Relaxed)
+}
+
+/// Install a hook receiving every record when it is collected, or remove it with `None`.
+///
+/// The hook is called with the statistics locked and must not use the functions of this
+/// module.
+pub fn set_export_hook(hook: Option<ExportHook>) {
+    let mut c = lock(&COLLECTOR);
+    collect(&mut c);
+    c.hook = hook;
+}
+
+fn collect(c: &mut Collector) {
+    let rings: Vec<Arc<Ring>> = {
+        let mut rings = lock(&RINGS);
+        // Forget the rings of finished threads once they are empty
+        rings.retain(|r| {
+            Arc::strong_count(r) > 1
+                || r.head.load(Ordering::Relaxed) != r.tail.load(Ordering::Acquire)
+        });
+        rings.clone()
+    };
+    let Collector { histograms, hook } = c;
+    for r in rings {
+        r.drain(|l| {
+            let h = histograms
+                .entry(l.pe_type)
+                .or_insert_with(|| vec![Histogram::new(); LATENCY_STAGES]);
+            for (h, v) in h.iter_mut().zip(l.stages.iter()) {
+                h.record(*v);
+            }
+            if let Some(hook) = hook {
+                hook(l);
+            }
+        });
+    }
+}
+
+/// Collect the records of all threads into the histograms and the export hook.
+pub fn flush() {
+    collect(&mut lock(&COLLECTOR));
+}
+
+/// Histogram of the given stage for jobs on PEs of type `pe_type`.
+pub fn histogram(pe_type: PEId, stage: LatencyStage) -> Option<Histogram> {
+    let mut c = lock(&COLLECTOR);
+    collect(&mut c);
+    c.histograms.get(&pe_type).map(|h| h[stage as usize].clone())
+}
+
+pub fn summary(pe_type: PEId, stage: LatencyStage) -> Option<LatencySummary> {
+    histogram(pe_type, stage).map(|h| h.summary())
+}
+
+/// PE types with recorded jobs.
+pub fn pe_types() -> Vec<PEId> {
+    let mut c = lock(&COLLECTOR);
+    collect(&mut c);
+    let mut v: Vec<PEId> = c.histograms.keys().copied().collect();
+    v.sort_unstable();
+    v
+}
+
+/// Discard all records and histograms.
+pub fn reset() {
+    let mut c = lock(&COLLECTOR);
+    let hook = c.hook.take();
+    collect(&mut c);
+    c.histograms.clear();
+    c.hook = hook;
+    DROPPED.store(0, Ordering::Relaxed);
+}
+
+fn submit(r: JobLatency) {
+    // The ring is gone if a thread local destructor releases a job
+    let len = match RING.try_with(|ring| ring.push(r)) {
+        Ok(len) => len,
+        Err(_) => None,
+    };
+    match len {
+        Some(n) if n < RING_SIZE / 2 => (),
+        Some(_) => {
+            // Collect early if nobody else does, but never wait for the lock
+            if let Ok(mut c) = COLLECTOR.try_lock() {
+                collect(&mut c);
+            }
+        }
+        None => {
+            DROPPED.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Timestamps of the stages of a job, see [`LatencyStage`].
+///
+/// The time between the acquisition of the PE and the start of the job is spent by the
+/// application and only counts towards the total.
+#[derive(Debug, Clone, Copy)]
+pub(crate) struct JobTiming {
+    device: DeviceId,
+    pe_type: PEId,
+    pe_id: usize,
+    // Trace identifier of the thread starting the job
+    start_thread: u64,
+    acquire_start: Instant,
+    acquired: Instant,
+    // Not acquired again, the job is started on the PE of its previous run
+    rerun: bool,
+    started: Option<Instant>,
+    allocated: Option<Instant>,
+    transferred: Option<Instant>,
+    completed: Option<Instant>,
+}
+
+impl JobTiming {
+    /// Timing of a job whose PE has just been acquired.
+    pub(crate) fn new(pe_type: PEId, pe_id: usize) -> JobTiming {
+        let now = Instant::now();
+        JobTiming {
+            device: 0,
+            pe_type,
+            pe_id,
+            start_thread: 0,
+            acquire_start: now,
+            acquired: now,
+            rerun: false,
+            started: None,
+            allocated: None,
+            transferred: None,
+            completed: None,
+        }
+    }
+
+    /// The PE was acquired on `device` after being requested at `since`.
+    pub(crate) fn acquired_on(&mut self, device: DeviceId, since: Option<Instant>) {
+        self.device = device;
+        if let Some(since) = since {
+            self.acquire_start = since.min(self.acquired);
+        }
+    }
+
+    pub(crate) fn started(&mut self) {
+        let now = Instant::now();
+        if self.rerun {
+            self.acquire_start = now;
+            self.acquired = now;
+        }
+        self.started = Some(now);
+        if trace::is_enabled() {
+            self.start_thread = trace::thread_id();
+        }
+    }
+
+    pub(crate) fn allocated(&mut self) {
+        self.allocated = Some(Instant::now());
+    }
+
+    pub(crate) fn transferred(&mut self) {
+        self.transferred = Some(Instant::now());
+    }
+
+    pub(crate) fn completed(&mut self) {
+        self.completed = Some(Instant::now());
+    }
+
+    /// Timing for the next run of the job on the same PE.
+    pub(crate) fn rerun(&self) -> JobTiming {
+        JobTiming {
+            rerun: true,
+            device: self.device,
+            ..JobTiming::new(self.pe_type, self.pe_id)
+        }
+    }
+
+    /// Record the job after its copy back has finished and add it to the trace. Jobs that
+    /// were never started are not recorded.
+    pub(crate) fn finish(self) {
+        let started = match self.started {
+            Some(s) => s,
+            None => return,
+        };
+        let done = Instant::now();
+        let allocated = self.allocated.unwrap_or(started);
+        let transferred = self.transferred.unwrap_or(allocated);
+        let completed = self.completed.unwrap_or(transferred);
+        if is_enabled() {
+            let ns = |a: Instant, b: Instant| b.saturating_duration_since(a).as_nanos() as u64;
+            submit(JobLatency {
+                pe_type: self.pe_type,
+                pe_id: self.pe_id,
+                stages: [
+                    ns(self.acquire_start, self.acquired),
+                    ns(started, allocated),
+                    ns(allocated, transferred),
+                    ns(transferred, completed),
+                    ns(completed, done),
+                    ns(self.acquire_start, done),
+                ],
+            });
+        }
+        if trace::is_enabled() {
+            self.trace([started, allocated, transferred, completed, done]);
+        }
+    }
+
+    /// Add the stages to the thread starting the job, the PE and the releasing thread.
+    /// A flow connects the start of the job to its execution and release.
+    fn trace(&self, [started, allocated, transferred, completed, done]: [Instant; 5]) {
+        let host = Track::Thread(self.start_thread);
+        let release = Track::Thread(trace::thread_id());
+        let pe = Track::Pe {
+            device: self.device,
+            pe: self.pe_id,
+            pe_type: self.pe_type,
+        };
+        let args = format!("\"pe_type\":{},\"pe\":{}", self.pe_type, self.pe_id);
+        let flow = trace::flow_id();
+        if !self.rerun {
+            trace::slice(host, "acquire", self.acquire_start, self.acquired, &args);
+        }
+        trace::slice(host, "start", started, transferred, &args);
+        trace::slice(host, "allocate", started, allocated, &args);
+        trace::slice(host, "transfer to device", allocated, transferred, &args);
+        trace::flow(host, "job", flow, FlowPhase::Start, started);
+        trace::slice(pe, "execute", transferred, completed, &args);
+        trace::flow(pe, "job", flow, FlowPhase::Step, transferred);
+        trace::slice(release, "copy back", completed, done, &args);
+        trace::flow(release, "job", flow, FlowPhase::End, completed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn histogram_buckets_are_contiguous() {
+        for i in 0..BUCKETS - 1 {
+            let h = Histogram::highest_equivalent(i);
+            assert_eq!(Histogram::index(h), i);
+            assert_eq!(Histogram::index(h + 1), i + 1);
+        }
+        assert_eq!(Histogram::index(u64::MAX), BUCKETS - 1);
+    }
+
+    #[test]
+    fn histogram_percentiles() {
+        let mut h = Histogram::new();
+        assert_eq!(h.value_at_percentile(99.0), 0);
+        for v in 1..=1000 {
+            h.record(v * 1000);
+        }
+        assert_eq!(h.count(), 1000);
+        assert_eq!(h.min(), 1000);
+        assert_eq!(h.max(), 1_000_000);
+        assert_eq!(h.mean(), 500_500);
+        for (p, exact) in [(50.0, 500_000f64), (99.0, 990_000f64), (100.0, 1_000_000f64)] {
+            let v = h.value_at_percentile(p) as f64;
+            assert!(v >= exact && v <= exact * 1.0625, "p{} = {}", p, v);
+        }
+    }
+
+    #[test]
+    fn ring_drops_when_full() {
+        let r = Ring::new();
+        for i in 0..RING_SIZE {
+            assert_eq!(
+                r.push(JobLatency {
+                    pe_id: i,
+                    ..Default::default()
+                }),
+                Some(i + 1)
+            );
+        }
+        assert!(r.push(JobLatency::default()).is_none());
+        let mut ids = Vec::new();
+        r.drain(|l| ids.push(l.pe_id));
+        assert_eq!(ids, (0..RING_SIZE).collect::<Vec<_>>());
+        assert_eq!(r.push(JobLatency::default()), Some(1));
+    }
+}
@@ -35,18 +35,26 @@ extern crate env_logger;
 extern crate lockfree;
 
 pub mod allocator;
+pub mod buffer_pool;
 pub mod debug;
 pub mod device;
+pub mod device_buffer;
+pub mod device_pool;
 pub mod dma;
 pub mod dma_user_space;
 pub mod ffi;
+pub mod host_buffer;
 pub mod interrupt;
 pub mod job;
+pub mod latency;
 pub mod pe;
 pub mod scheduler;
 pub mod vfio;
 pub mod tlkm;
+pub mod trace;
 pub mod sim_client;
+pub mod software_device;
+pub mod task_graph;
 pub mod protos;
 pub mod mmap_mut;
 pub mod plugins;
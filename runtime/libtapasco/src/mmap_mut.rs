@@ -22,6 +22,7 @@ use std::ptr::write_volatile;
 use std::sync::Arc;
 use memmap::MmapMut;
 use crate::sim_client::SimClient;
+use crate::software_device::SoftwareDevice;
 use crate::protos::simcalls::{
     Data32,
     Data64,
@@ -34,9 +35,10 @@ use crate::protos::simcalls::{
 pub enum MemoryType {
     Sim(Arc<SimClient>),
     Mmap(Arc<MmapMut>),
+    Software(Arc<SoftwareDevice>),
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum ValType {
     U32(u32), U64(u64),
 }
@@ -45,6 +47,7 @@ pub enum ValType {
  * Wrapper to write a single word (either 32 or 64 bit) to the provided memory.
  * In case of a hardware target this essentially wraps the write_volatile function and
  * for access to simulation targets it corresponds to a platform memory access.
+ * Software devices apply the write to their PE register model.
  * Arguments:
  * memory: Reference to the memory that is being accessed
  * offset: Address offset into the memory area
@@ -65,13 +68,59 @@ pub unsafe fn tapasco_write_volatile(memory: &MemoryType, offset: isize, value:
                 ValType::U64(u_64) => write_volatile(ptr as *mut u64, u_64),
             };
         }
+        MemoryType::Software(device) => {
+            device.write_register(offset as u64, match value {
+                ValType::U32(u_32) => u_32 as u64,
+                ValType::U64(u_64) => u_64,
+            });
+        }
+    };
+}
+
+/*
+ * Writes several words in the given order, dispatching on the memory type only once.
+ * Hardware targets issue the writes back to back, simulation targets send all of them
+ * with a single request if the simulator supports batches.
+ * Arguments:
+ * memory: Reference to the memory that is being accessed
+ * writes: Address offsets into the memory area and the values to write there
+ * Returns the error of the simulator if a simulation target rejects the writes.
+ */
+pub unsafe fn tapasco_write_volatile_batch(memory: &MemoryType, writes: &[(isize, ValType)]) -> Result<(), crate::sim_client::Error> {
+    match memory {
+        MemoryType::Sim(client) => {client.write_platform_batch(writes.iter().map(|(offset, value)| WritePlatform{addr: *offset as u64, data: Some(
+            match *value {
+                ValType::U32(u_32) => Data::U32(Data32 {value: vec![u_32]}),
+                ValType::U64(u_64) => Data::U64(Data64 {value: vec![u_64]})
+            }
+        )}).collect())?;},
+        MemoryType::Mmap(mmap) => {
+            let base = mmap.as_ptr();
+            for (offset, value) in writes {
+                let ptr = base.offset(*offset);
+                match *value {
+                    ValType::U32(u_32) => write_volatile(ptr as *mut u32, u_32),
+                    ValType::U64(u_64) => write_volatile(ptr as *mut u64, u_64),
+                };
+            }
+        }
+        MemoryType::Software(device) => {
+            for (offset, value) in writes {
+                device.write_register(*offset as u64, match *value {
+                    ValType::U32(u_32) => u_32 as u64,
+                    ValType::U64(u_64) => u_64,
+                });
+            }
+        }
     };
+    Ok(())
 }
 
 /*
  * Wrapper to read a single word (either 32 or 64 bit) to the provided memory.
  * In case of a hardware target this essentially wraps the read_volatile function and
  * for access to simulation targets it corresponds to a platform memory access.
+ * Software devices read from their PE register model.
  * Arguments:
  * memory: Reference to the memory that is being accessed
  * offset: Address offset into the memory area
@@ -97,5 +146,6 @@ pub unsafe fn tapasco_read_volatile(memory: &MemoryType, offset: isize, u_32: bo
                 ptr.cast::<u64>().read_volatile().into()
             }
         }
+        MemoryType::Software(device) => device.read_register(offset as u64, u_32),
     }
 }
\ No newline at end of file
@@ -21,25 +21,27 @@
 use std::borrow::Borrow;
 use crate::debug::DebugControl;
 use crate::device::{DataTransferPrealloc, DataTransferStream};
-use crate::device::DeviceAddress;
+use crate::device::{DeviceAddress, DeviceSize};
 use crate::device::OffchipMemory;
 use crate::device::PEParameter;
-use crate::interrupt::{Interrupt, SimInterrupt, TapascoInterrupt};
+use crate::device_buffer::{DeviceBuffer, LocalBuffer};
+use crate::interrupt::{CompletionDispatcher, Interrupt, SimInterrupt, SoftwareInterrupt, TapascoInterrupt};
 use snafu::ResultExt;
 use std::fs::File;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex, MutexGuard};
+use std::task::Waker;
 use std::thread::JoinHandle;
-use crate::mmap_mut::{MemoryType, tapasco_read_volatile, tapasco_write_volatile, ValType};
+use crate::mmap_mut::{MemoryType, tapasco_read_volatile, tapasco_write_volatile, tapasco_write_volatile_batch, ValType};
 
 use crate::sim_client;
 
 #[derive(Debug, Snafu)]
 pub enum Error {
     #[snafu(display(
-        "Param {:?} is unsupported. Only 32 and 64 Bit value can interact with device registers.",
+        "Param {} is unsupported. Only 32 and 64 Bit value can interact with device registers.",
         param
     ))]
-    UnsupportedParameter { param: PEParameter },
+    UnsupportedParameter { param: String },
 
     #[snafu(display(
         "Transfer width {} Bit is unsupported. Only 32 and 64 Bit value can interact with device registers.",
@@ -76,6 +78,12 @@ pub enum Error {
 
     #[snafu(display("Error during gRPC communictaion {}", source))]
     SimClientError { source: sim_client::Error },
+
+    #[snafu(display("Interrupt of software PE unavailable: {}", source))]
+    SoftwareInterruptError { source: crate::software_device::Error },
+
+    #[snafu(display("PE interrupts of memory mapped devices need the TLKM device file."))]
+    MissingCompletionFile {},
 }
 
 type Result<T, E = Error> = std::result::Result<T, E>;
@@ -83,9 +91,11 @@ type Result<T, E = Error> = std::result::Result<T, E>;
 #[derive(Debug)]
 pub enum CopyBack {
     Transfer(DataTransferPrealloc),
-    Free(DeviceAddress, Arc<OffchipMemory>),
+    Free(DeviceAddress, DeviceSize, Arc<OffchipMemory>),
     Stream(JoinHandle<crate::dma::Result<DataTransferStream>>),
     Return(DataTransferPrealloc),               // used to return ownership only when using SVM
+    Buffer(Arc<DeviceBuffer>),                  // keeps the buffer allocated until the job is released
+    LocalBuffer(Arc<LocalBuffer>),              // same for buffers kept in PE-local memory
 }
 
 pub type PEId = usize;
@@ -123,6 +133,16 @@ pub struct PE {
 
     #[get = "pub"]
     svm_in_use: bool,
+
+    /// Last value written to each argument register, None if unknown.
+    shadow_args: Mutex<Vec<Option<ValType>>>,
+
+    /// Whether the argument registers of this PE type keep their values between runs,
+    /// so unchanged arguments need not be written again. Off by default, as PEs may use
+    /// their argument registers as scratch space or for return values.
+    #[set = "pub"]
+    #[get = "pub"]
+    retains_args: bool,
 }
 
 impl PE {
@@ -131,14 +151,20 @@ impl PE {
         type_id: PEId,
         offset: DeviceAddress,
         memory: Arc<MemoryType>,
-        completion: &File,
+        completion: Option<&File>,
         interrupt_id: usize,
         debug: Box<dyn DebugControl + Sync + Send>,
         svm_in_use: bool,
+        dispatcher: Option<&CompletionDispatcher>,
     ) -> Result<Self> {
-        let interrupt = match memory.borrow() {
-            MemoryType::Sim(_) => SimInterrupt::new(interrupt_id, false).context(ErrorInterruptSnafu)?,
-            _ => Interrupt::new(completion, interrupt_id, false).context(ErrorInterruptSnafu)?
+        let m: &MemoryType = memory.borrow();
+        let interrupt = match (m, completion) {
+            (MemoryType::Sim(client), _) => SimInterrupt::new(client.clone(), interrupt_id, false).context(ErrorInterruptSnafu)?,
+            (MemoryType::Software(device), _) => SoftwareInterrupt::new(
+                device.interrupt(interrupt_id).context(SoftwareInterruptSnafu)?,
+            ),
+            (_, Some(completion)) => Interrupt::new(completion, interrupt_id, false, dispatcher).context(ErrorInterruptSnafu)?,
+            (_, None) => return Err(Error::MissingCompletionFile {}),
         };
         Ok(Self {
             id,
@@ -151,6 +177,8 @@ impl PE {
             interrupt,
             debug,
             svm_in_use,
+            shadow_args: Mutex::new(Vec::new()),
+            retains_args: false,
         })
     }
 
@@ -166,6 +194,58 @@ impl PE {
         Ok(())
     }
 
+    /// Sets the arguments and starts the PE.
+    ///
+    /// All register writes are issued as one batch, a single request on simulation
+    /// targets. If the PE retains its arguments (see `pe.retained_args`), arguments still
+    /// holding the value of the previous launch are not written again.
+    pub fn start_with_args(&mut self, args: Vec<PEParameter>) -> Result<()> {
+        ensure!(!self.active, PEAlreadyActiveSnafu { id: self.id });
+        let values = args
+            .into_iter()
+            .map(Self::arg_value)
+            .collect::<Result<Vec<ValType>>>()?;
+        let num_args = values.len();
+        let mut writes = Vec::with_capacity(num_args + 1);
+        {
+            let shadow = self.shadow_args();
+            for (argn, value) in values.iter().enumerate() {
+                if self.retains_args && shadow.get(argn) == Some(&Some(*value)) {
+                    trace!("Argument {} of PE {} is unchanged.", argn, self.id);
+                    continue;
+                }
+                writes.push((self.arg_offset(argn), *value));
+            }
+        }
+        writes.push((self.offset as isize, ValType::U32(1_u32)));
+        trace!(
+            "Starting PE {} with {} of {} arguments written.",
+            self.id,
+            writes.len() - 1,
+            num_args
+        );
+        let written = unsafe { tapasco_write_volatile_batch(&self.memory, &writes) };
+        if written.is_err() {
+            // Unknown which of the writes took effect
+            self.invalidate_args();
+        }
+        written.context(SimClientSnafu)?;
+
+        // Only values known to be in the registers enter the shadow
+        {
+            let mut shadow = self.shadow_args();
+            if shadow.len() < num_args {
+                shadow.resize(num_args, None);
+            }
+            for (argn, value) in values.into_iter().enumerate() {
+                shadow[argn] = Some(value);
+            }
+        }
+
+        self.active = true;
+        Ok(())
+    }
+
     pub fn release(&mut self, return_value: bool) -> Result<(u64, Option<Vec<CopyBack>>)> {
         trace!(
             "Waiting for PE {} to complete processing (interrupt signal).",
@@ -223,6 +303,15 @@ impl PE {
         Ok(true)
     }
 
+    /// Wake `waker` on the next PE interrupt
+    ///
+    /// Returns false if the interrupt implementation cannot wake tasks.
+    pub fn register_waker(&self, waker: &Waker) -> Result<bool> {
+        self.interrupt
+            .register_waker(waker)
+            .context(ErrorInterruptSnafu)
+    }
+
     pub fn interrupt_set(&self) -> Result<bool> {
         let offset = (self.offset as usize + 0x0c) as isize;
         let r = unsafe {
@@ -277,21 +366,56 @@ impl PE {
         Ok(())
     }
 
+    fn arg_offset(&self, argn: usize) -> isize {
+        (self.offset as usize + 0x20 + argn * 0x10) as isize
+    }
+
+    fn arg_value(arg: PEParameter) -> Result<ValType> {
+        match arg {
+            PEParameter::Single32(x) => Ok(ValType::U32(x)),
+            PEParameter::Single64(x) => Ok(ValType::U64(x)),
+            _ => Err(Error::UnsupportedParameter {
+                param: format!("{:?}", arg),
+            }),
+        }
+    }
+
+    fn shadow_args(&self) -> MutexGuard<'_, Vec<Option<ValType>>> {
+        // The shadow is only a cache, a poisoned one is still usable
+        self.shadow_args.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    /// Forget the argument values written so far, so the next start writes all of them.
+    ///
+    /// Needed if the argument registers were changed without this PE, e.g. by a reset.
+    pub fn invalidate_args(&self) {
+        self.shadow_args().clear();
+    }
+
     pub fn set_arg(&self, argn: usize, arg: PEParameter) -> Result<()> {
-        let offset = (self.offset as usize + 0x20 + argn * 0x10) as isize;
+        let offset = self.arg_offset(argn);
         trace!("Writing argument: 0x{:x} ({}) -> {:?}", offset, argn, arg);
+        let value = Self::arg_value(arg)?;
         unsafe {
-            match arg {
-                PEParameter::Single32(x) => tapasco_write_volatile(&self.memory, offset, ValType::U32(x)),
-                PEParameter::Single64(x) => tapasco_write_volatile(&self.memory, offset, ValType::U64(x)),
-                _ => return Err(Error::UnsupportedParameter { param: arg }),
-            };
+            tapasco_write_volatile(&self.memory, offset, value);
         }
+        let mut shadow = self.shadow_args();
+        if shadow.len() <= argn {
+            shadow.resize(argn + 1, None);
+        }
+        shadow[argn] = Some(value);
         Ok(())
     }
 
+    /// Reads an argument register.
+    ///
+    /// Reading marks the argument as changed, as PEs returning values through their
+    /// argument registers overwrite them.
     pub fn read_arg(&self, argn: usize, bytes: usize) -> Result<PEParameter> {
-        let offset = (self.offset as usize + 0x20 + argn * 0x10) as isize;
+        let offset = self.arg_offset(argn);
+        if let Some(v) = self.shadow_args().get_mut(argn) {
+            *v = None;
+        }
         let r = unsafe {
             match bytes {
                 4 => Ok(PEParameter::Single32(
@@ -336,3 +460,94 @@ impl PE {
             .context(DebugSnafu { id: self.id })
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::Device;
+    use crate::software_device::{PEContext, SoftwareDeviceConfig};
+    use crate::tlkm::tlkm_access;
+    use std::collections::HashMap;
+    use std::time::Duration;
+
+    const ECHO: PEId = 3;
+
+    fn device() -> Device {
+        let mut config = SoftwareDeviceConfig {
+            memory_size: 4096,
+            ..Default::default()
+        };
+        // Returns its first argument
+        config.add_pe(
+            ECHO,
+            "echo",
+            1,
+            Duration::ZERO,
+            Arc::new(|ctx: &PEContext| ctx.arg(0)),
+        );
+        let mut d = Device::new_software(0, config, &HashMap::new()).unwrap();
+        d.change_access(tlkm_access::TlkmAccessExclusive).unwrap();
+        d
+    }
+
+    fn run(pe: &mut PE, arg: u64) -> u64 {
+        pe.start_with_args(vec![PEParameter::Single64(arg)]).unwrap();
+        pe.release(true).unwrap().0
+    }
+
+    /// Overwrites the first argument register without the PE noticing, like a PE using
+    /// it as scratch space.
+    fn clobber_arg(pe: &PE) {
+        unsafe { tapasco_write_volatile(&pe.memory, pe.arg_offset(0), ValType::U64(0)) }
+    }
+
+    #[test]
+    fn unchanged_args_are_written_by_default() {
+        let d = device();
+        let mut pe = d.acquire_pe_without_job(ECHO).unwrap();
+        assert_eq!(run(&mut pe, 42), 42);
+        clobber_arg(&pe);
+        assert_eq!(run(&mut pe, 42), 42);
+    }
+
+    #[test]
+    fn retained_args_skip_unchanged_writes() {
+        let d = device();
+        let mut pe = d.acquire_pe_without_job(ECHO).unwrap();
+        pe.set_retains_args(true);
+        assert_eq!(run(&mut pe, 42), 42);
+        clobber_arg(&pe);
+        assert_eq!(run(&mut pe, 42), 0);
+        // Changed arguments are still written
+        assert_eq!(run(&mut pe, 7), 7);
+    }
+
+    #[test]
+    fn invalidated_args_are_written_again() {
+        let d = device();
+        let mut pe = d.acquire_pe_without_job(ECHO).unwrap();
+        pe.set_retains_args(true);
+        assert_eq!(run(&mut pe, 42), 42);
+        clobber_arg(&pe);
+        pe.invalidate_args();
+        assert_eq!(run(&mut pe, 42), 42);
+
+        clobber_arg(&pe);
+        pe.read_arg(0, 8).unwrap();
+        assert_eq!(run(&mut pe, 42), 42);
+    }
+
+    #[test]
+    fn failed_start_keeps_the_shadow() {
+        let d = device();
+        let mut pe = d.acquire_pe_without_job(ECHO).unwrap();
+        pe.set_retains_args(true);
+        assert_eq!(run(&mut pe, 42), 42);
+        // Rejected before anything is written
+        assert!(pe
+            .start_with_args(vec![PEParameter::Single64(7), PEParameter::DeviceAddress(0)])
+            .is_err());
+        assert!(!pe.active());
+        assert_eq!(run(&mut pe, 7), 7);
+    }
+}
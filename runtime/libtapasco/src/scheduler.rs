@@ -19,17 +19,18 @@
  */
 
 use crate::device::OffchipMemory;
+use crate::interrupt::CompletionDispatcher;
 use crate::pe::PEId;
 use crate::pe::PE;
 use crate::job::Job;
-use crossbeam::deque::{Injector, Steal};
 use lockfree::map::Map;
 use snafu::ResultExt;
 use std::collections::HashMap;
 use std::collections::VecDeque;
 use std::fs::File;
-use std::sync::Arc;
+use std::sync::{Arc, Condvar, Mutex};
 use std::thread;
+use std::time::{Duration, Instant};
 use crate::debug::{DebugGenerator, NonDebugGenerator, UnsupportedDebugGenerator};
 use crate::mmap_mut::MemoryType;
 use crate::protos::status;
@@ -61,23 +62,259 @@ pub enum Error {
 
     #[snafu(display("Local memory requested on PE without local memory"))]
     NoLocalMemory {},
+
+    #[snafu(display("Mutex has been poisoned"))]
+    MutexError {},
 }
 
 type Result<T, E = Error> = std::result::Result<T, E>;
 
-pub trait ReleasePE: Debug {
+impl<T> From<std::sync::PoisonError<T>> for Error {
+    fn from(_error: std::sync::PoisonError<T>) -> Self {
+        Self::MutexError {}
+    }
+}
+
+pub trait ReleasePE: Debug + Send + Sync {
     fn release_pe(&self, pe: PE) -> Result<()>;
 }
 
+/// Utilization of the PEs of one type.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct PELoad {
+    /// Number of PEs of the type.
+    pub total: usize,
+    /// PEs that are not acquired by a job.
+    pub idle: usize,
+    /// Threads waiting for a PE of the type.
+    pub waiting: usize,
+}
+
+impl PELoad {
+    /// Acquired PEs and waiting threads.
+    pub fn demand(&self) -> usize {
+        self.total - self.idle + self.waiting
+    }
+}
+
+/// Slot a waiting thread parks on until a PE is handed to it.
+///
+/// A waiter with a non-empty `affinity` only accepts PEs attached to one of these memories.
+#[derive(Debug)]
+struct PEWaiter {
+    pe: Mutex<Option<PE>>,
+    cond: Condvar,
+    affinity: Vec<Arc<OffchipMemory>>,
+}
+
+impl PEWaiter {
+    fn accepts(&self, pe: &PE) -> bool {
+        self.affinity.is_empty() || attached_to(pe, &self.affinity).is_some()
+    }
+}
+
+/// Position of the first memory in `memories` that is the local memory of `pe`.
+fn attached_to(pe: &PE, memories: &[Arc<OffchipMemory>]) -> Option<usize> {
+    let l = pe.local_memory().as_ref()?;
+    memories.iter().position(|m| Arc::ptr_eq(m, l))
+}
+
+#[derive(Debug)]
+struct PEQueueInner {
+    idle: VecDeque<PE>,
+    waiters: VecDeque<Arc<PEWaiter>>,
+}
+
+/// Queue of idle PEs of a single type.
+///
+/// In blocking mode threads that find no idle PE park on a [`PEWaiter`] and are served in
+/// arrival order: a released PE is handed directly to the oldest waiter accepting it and
+/// never becomes visible to other threads in between. Idle PEs therefore only coexist with
+/// waiters restricted to PEs of certain local memories.
+/// In spinning mode waiting threads poll the idle list and yield in between.
+#[derive(Debug)]
+struct PEQueue {
+    inner: Mutex<PEQueueInner>,
+    blocking: bool,
+}
+
+impl PEQueue {
+    fn new(blocking: bool) -> Self {
+        Self {
+            inner: Mutex::new(PEQueueInner {
+                idle: VecDeque::new(),
+                waiters: VecDeque::new(),
+            }),
+            blocking,
+        }
+    }
+
+    fn push(&self, pe: PE) -> Result<()> {
+        let mut q = self.inner.lock()?;
+        let w = match q.waiters.iter().position(|w| w.accepts(&pe)) {
+            Some(i) => q.waiters.remove(i),
+            None => None,
+        };
+        match w {
+            Some(w) => {
+                // Fill the slot while still holding the queue lock so a waiter that
+                // times out concurrently finds the PE once it has withdrawn from the queue.
+                *w.pe.lock()? = Some(pe);
+                w.cond.notify_one();
+            }
+            None => q.idle.push_back(pe),
+        }
+        Ok(())
+    }
+
+    /// Retrieve up to `max` idle PEs with a single lock of the queue.
+    ///
+    /// If no PE is idle and `block` is set, waits for one PE like `pop`.
+    fn pop_many(&self, max: usize, block: bool) -> Result<Vec<PE>> {
+        let mut pes: Vec<PE> = {
+            let mut q = self.inner.lock()?;
+            let n = max.min(q.idle.len());
+            q.idle.drain(..n).collect()
+        };
+        if pes.is_empty() && block && max > 0 {
+            if let Some(pe) = self.pop(true, None)? {
+                pes.push(pe);
+            }
+        }
+        Ok(pes)
+    }
+
+    /// Take the idle PE attached to the earliest possible memory of `affinity`, or the
+    /// oldest idle PE if `affinity` is empty.
+    fn take_idle(q: &mut PEQueueInner, affinity: &[Arc<OffchipMemory>]) -> Option<PE> {
+        if affinity.is_empty() {
+            return q.idle.pop_front();
+        }
+        let i = q
+            .idle
+            .iter()
+            .enumerate()
+            .filter_map(|(i, pe)| attached_to(pe, affinity).map(|rank| (rank, i)))
+            .min()?
+            .1;
+        q.idle.remove(i)
+    }
+
+    fn try_pop(&self, affinity: &[Arc<OffchipMemory>]) -> Result<Option<PE>> {
+        Ok(Self::take_idle(&mut *self.inner.lock()?, affinity))
+    }
+
+    /// Retrieve an idle PE.
+    ///
+    /// Returns immediately if `block` is false. Otherwise waits until a PE becomes available
+    /// or the optional timeout expires, returning `None` in the latter case.
+    fn pop(&self, block: bool, timeout: Option<Duration>) -> Result<Option<PE>> {
+        self.pop_attached(&[], block, timeout.map(|t| Instant::now() + t))
+    }
+
+    /// Retrieve a PE, preferring PEs attached to `affinity` for at most `wait`.
+    ///
+    /// The memories are ordered by preference. After the wait any PE is taken.
+    fn pop_preferring(&self, affinity: &[Arc<OffchipMemory>], wait: Duration) -> Result<PE> {
+        if !affinity.is_empty() {
+            if let Some(pe) =
+                self.pop_attached(affinity, !wait.is_zero(), Some(Instant::now() + wait))?
+            {
+                return Ok(pe);
+            }
+            trace!("No PE with preferred local memory within {:?}.", wait);
+        }
+        Ok(self.pop_attached(&[], true, None)?.unwrap())
+    }
+
+    /// Retrieve an idle PE attached to one of the memories in `affinity`, or any PE if
+    /// `affinity` is empty. Waits until `deadline` if `block` is set.
+    fn pop_attached(
+        &self,
+        affinity: &[Arc<OffchipMemory>],
+        block: bool,
+        deadline: Option<Instant>,
+    ) -> Result<Option<PE>> {
+        if !self.blocking {
+            loop {
+                if let Some(pe) = self.try_pop(affinity)? {
+                    return Ok(Some(pe));
+                }
+                trace!("Failed to acquire PE");
+                if !block || deadline.map_or(false, |d| Instant::now() >= d) {
+                    return Ok(None);
+                }
+                thread::yield_now();
+            }
+        }
+
+        let waiter = {
+            let mut q = self.inner.lock()?;
+            if let Some(pe) = Self::take_idle(&mut q, affinity) {
+                return Ok(Some(pe));
+            }
+            if !block {
+                return Ok(None);
+            }
+            let w = Arc::new(PEWaiter {
+                pe: Mutex::new(None),
+                cond: Condvar::new(),
+                affinity: affinity.to_vec(),
+            });
+            q.waiters.push_back(w.clone());
+            w
+        };
+
+        trace!("No idle PE, waiting in queue.");
+        {
+            let mut slot = waiter.pe.lock()?;
+            loop {
+                if let Some(pe) = slot.take() {
+                    return Ok(Some(pe));
+                }
+                slot = match deadline {
+                    Some(d) => {
+                        let now = Instant::now();
+                        if now >= d {
+                            break;
+                        }
+                        waiter.cond.wait_timeout(slot, d - now)?.0
+                    }
+                    None => waiter.cond.wait(slot)?,
+                };
+            }
+        }
+
+        trace!("Timed out waiting for PE.");
+        self.inner
+            .lock()?
+            .waiters
+            .retain(|w| !Arc::ptr_eq(w, &waiter));
+        // A release might have picked this waiter right before it withdrew.
+        let pe = waiter.pe.lock()?.take();
+        Ok(pe)
+    }
+}
+
 /// Main method to retrieve a PE for execution
 ///
-/// Uses an unblocking Injector primitive usually used for job stealing.
-/// Retrieves PEs based on a first-come-first-serve basis.
+/// Keeps one [`PEQueue`] per PE type. Depending on the `scheduler.blocking` setting
+/// waiting threads either sleep and are served first-come-first-serve or spin on the
+/// queue as long as no PE is available.
+///
+/// [`acquire_pe_preferring`] waits up to `scheduler.affinity_wait_us` for a PE attached
+/// to a preferred local memory before it takes any PE.
+///
+/// PEs whose type ID is listed in `pe.retained_args` skip rewriting arguments that are
+/// unchanged since their previous start.
+///
+/// [`acquire_pe_preferring`]: #method.acquire_pe_preferring
 #[derive(Debug)]
 pub struct Scheduler {
-    pes: Map<PEId, Injector<PE>>,
+    pes: Map<PEId, PEQueue>,
     pes_overview: HashMap<PEId, usize>,
     pes_name: HashMap<PEId, String>,
+    affinity_wait: Duration,
 }
 
 impl Scheduler {
@@ -85,12 +322,16 @@ impl Scheduler {
         pes: &[status::Pe],
         arch: &Arc<MemoryType>,
         mut local_memories: VecDeque<Arc<OffchipMemory>>,
-        completion: &File,
+        completion: Option<&File>,
         debug_impls: &HashMap<String, Box<dyn DebugGenerator + Sync + Send>>,
         is_pcie: bool,
         svm_in_use: bool,
+        dispatcher: Option<&CompletionDispatcher>,
+        blocking: bool,
+        affinity_wait: Duration,
+        retained_args: &[PEId],
     ) -> Result<Self> {
-        let pe_hashed: Map<PEId, Injector<PE>> = Map::new();
+        let pe_hashed: Map<PEId, PEQueue> = Map::new();
         let mut pes_overview: HashMap<PEId, usize> = HashMap::new();
         let mut pes_name: HashMap<PEId, String> = HashMap::new();
 
@@ -138,8 +379,10 @@ impl Scheduler {
                 interrupt_id,
                 debug,
                 svm_in_use,
+                dispatcher,
             )
             .context(PESnafu)?;
+            the_pe.set_retains_args(retained_args.contains(&(pe.id as PEId)));
 
             interrupt_id += 1;
 
@@ -150,11 +393,11 @@ impl Scheduler {
             }
 
             match pe_hashed.get(&(pe.id as PEId)) {
-                Some(l) => l.val().push(the_pe),
+                Some(l) => l.val().push(the_pe)?,
                 None => {
                     trace!("New PE type found: {} ({}).", pe.name, pe.id);
-                    let v = Injector::new();
-                    v.push(the_pe);
+                    let v = PEQueue::new(blocking);
+                    v.push(the_pe)?;
                     pe_hashed.insert(pe.id as PEId, v);
                     pes_name.insert(pe.id as PEId, pe.name.clone());
                 }
@@ -172,34 +415,66 @@ impl Scheduler {
             pes: pe_hashed,
             pes_overview,
             pes_name,
+            affinity_wait,
         })
     }
 
-    fn do_acquire_pe(&self, id: PEId, block: bool) -> Result<Option<PE>> {
+    fn do_acquire_pe(&self, id: PEId, block: bool, timeout: Option<Duration>) -> Result<Option<PE>> {
         match self.pes.get(&id) {
-            Some(l) => loop {
-                match l.val().steal() {
-                    Steal::Success(pe) => return Ok(Some(pe)),
-                    Steal::Empty => (),
-                    Steal::Retry => (),
-                }
-                trace!("Failed to steal PE");
-                if !block {
-                    return Ok(None);
-                }
-                thread::yield_now();
-            },
+            Some(l) => l.val().pop(block, timeout),
             None => Err(Error::NoSuchPE { id }),
         }
     }
 
     pub fn acquire_pe(&self, id: PEId) -> Result<PE> {
-        let pe = self.do_acquire_pe(id, true)?;
+        let pe = self.do_acquire_pe(id, true, None)?;
         Ok(pe.unwrap())
     }
 
     pub fn try_acpuire_pe(&self, id: PEId) -> Result<Option<PE>> {
-        self.do_acquire_pe(id, false)
+        self.do_acquire_pe(id, false, None)
+    }
+
+    /// Wait at most `timeout` for a PE of the given type.
+    pub fn acquire_pe_timeout(&self, id: PEId, timeout: Duration) -> Result<Option<PE>> {
+        self.do_acquire_pe(id, true, Some(timeout))
+    }
+
+    /// Acquire a PE of the given type, preferring PEs whose local memory is in `memories`.
+    ///
+    /// Earlier memories are preferred over later ones. If no such PE is idle, waits for one
+    /// at most for the configured affinity wait and falls back to any PE afterwards.
+    pub fn acquire_pe_preferring(&self, id: PEId, memories: &[Arc<OffchipMemory>]) -> Result<PE> {
+        match self.pes.get(&id) {
+            Some(l) => l.val().pop_preferring(memories, self.affinity_wait),
+            None => Err(Error::NoSuchPE { id }),
+        }
+    }
+
+    /// Current utilization of the PEs of the given type.
+    pub fn load(&self, id: PEId) -> Result<PELoad> {
+        match self.pes.get(&id) {
+            Some(l) => {
+                let q = l.val().inner.lock()?;
+                Ok(PELoad {
+                    total: self.num_pes(id),
+                    idle: q.idle.len(),
+                    waiting: q.waiters.len(),
+                })
+            }
+            None => Err(Error::NoSuchPE { id }),
+        }
+    }
+
+    /// Acquire up to `max` PEs of the given type at once.
+    ///
+    /// Returns all PEs that are idle right now. If none is idle and `block` is set,
+    /// waits until at least one PE is available.
+    pub fn acquire_pes(&self, id: PEId, max: usize, block: bool) -> Result<Vec<PE>> {
+        match self.pes.get(&id) {
+            Some(l) => l.val().pop_many(max, block),
+            None => Err(Error::NoSuchPE { id }),
+        }
     }
 
     pub fn release_pe(&self, pe: PE) -> Result<()> {
@@ -207,27 +482,18 @@ impl Scheduler {
 
         match self.pes.get(pe.type_id()) {
             Some(l) => l.val().push(pe),
-            None => return Err(Error::NoSuchPE { id: *pe.type_id() }),
+            None => Err(Error::NoSuchPE { id: *pe.type_id() }),
         }
-        Ok(())
     }
 
     pub fn reset_interrupts(&self) -> Result<()> {
         for v in self.pes.iter() {
-            let mut remove_pes = Vec::new();
-            let mut maybe_pe = v.val().steal();
-
-            while let Steal::Success(pe) = maybe_pe {
+            let q = v.val().inner.lock()?;
+            for pe in q.idle.iter() {
                 pe.enable_interrupt().context(PESnafu)?;
                 if pe.interrupt_set().context(PESnafu)? {
                     pe.reset_interrupt(true).context(PESnafu)?;
                 }
-                remove_pes.push(pe);
-                maybe_pe = v.val().steal();
-            }
-
-            for pe in remove_pes {
-                v.val().push(pe);
             }
         }
 
@@ -256,13 +522,7 @@ impl Scheduler {
 
 impl ReleasePE for Scheduler {
     fn release_pe(&self, pe: PE) -> Result<()> {
-        ensure!(!pe.active(), PEStillActiveSnafu { pe });
-
-        match self.pes.get(pe.type_id()) {
-            Some(l) => l.val().push(pe),
-            None => return Err(Error::NoSuchPE { id: *pe.type_id() }),
-        }
-        Ok(())
+        Scheduler::release_pe(self, pe)
     }
 }
 
@@ -276,7 +536,7 @@ pub struct SinglePEHandler {
 
 #[derive(Debug)]
 pub struct SinglePEScheduler {
-    pe: Injector<PE>,
+    pe: PEQueue,
     local_memory: Option<Arc<OffchipMemory>>,
 }
 
@@ -296,7 +556,7 @@ impl SinglePEHandler {
         if self.released {
             Err(Error::PEUnavailable {id: 0 })
         } else {
-            Ok(Job::new(self.scheduler.acquire_pe(), &self.scheduler))
+            Ok(Job::new(self.scheduler.acquire_pe()?, &self.scheduler))
         }
     }
 
@@ -307,7 +567,7 @@ impl SinglePEHandler {
     pub fn release_pe(&mut self) -> Result<()> {
         if !self.released {
             self.released = true;
-            self.release.release_pe(self.scheduler.acquire_pe())
+            self.release.release_pe(self.scheduler.acquire_pe()?)
         } else {
             Ok(())
         }
@@ -318,24 +578,17 @@ impl SinglePEScheduler {
     pub fn new(
         pe: PE,
     ) -> Self {
-        let v = Injector::new();
+        let mut v = PEQueue::new(true);
         let memory = pe.local_memory().clone();
-        v.push(pe);
+        v.inner.get_mut().unwrap().idle.push_back(pe);
         SinglePEScheduler {
             pe: v,
             local_memory: memory,
         }
     }
 
-    pub fn acquire_pe(&self) -> PE {
-        loop {
-            match self.pe.steal() {
-                Steal::Success(pe) => return pe,
-                Steal::Empty => (),
-                Steal::Retry => (),
-            }
-            thread::yield_now();
-        }
+    pub fn acquire_pe(&self) -> Result<PE> {
+        Ok(self.pe.pop(true, None)?.unwrap())
     }
 
     pub fn get_local_memory(&self) -> Result<&Arc<OffchipMemory>, Error> {
@@ -349,8 +602,130 @@ impl SinglePEScheduler {
 impl ReleasePE for SinglePEScheduler {
 
     fn release_pe(&self, pe: PE) -> Result<()> {
-        self.pe.push(pe);
-        Ok(())
+        self.pe.push(pe)
+    }
+
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::Device;
+    use crate::software_device::{sum_config, SUM};
+
+    fn device(id: u32, count: usize) -> Device {
+        Device::new_software(id, sum_config(count, Duration::ZERO), &HashMap::new()).unwrap()
+    }
+
+    /// PEs of `d`, the i-th one attached to `memories[i]`.
+    fn pes(d: &Device, memories: Vec<Option<Arc<OffchipMemory>>>) -> Vec<PE> {
+        memories
+            .into_iter()
+            .map(|m| {
+                let mut pe = d.acquire_pe_without_job(SUM).unwrap();
+                pe.set_local_memory(m);
+                pe
+            })
+            .collect()
     }
 
+    fn wait_for_waiters(q: &PEQueue, n: usize) {
+        while q.inner.lock().unwrap().waiters.len() != n {
+            thread::yield_now();
+        }
+    }
+
+    #[test]
+    fn preferred_pe_is_taken_when_idle() {
+        let d = device(0, 3);
+        let (m0, m1) = (device(1, 1).default_memory().unwrap(), d.default_memory().unwrap());
+        let q = PEQueue::new(true);
+        let ids: Vec<usize> = pes(&d, vec![None, Some(m1.clone()), Some(m0.clone())])
+            .into_iter()
+            .map(|pe| {
+                let id = *pe.id();
+                q.push(pe).unwrap();
+                id
+            })
+            .collect();
+
+        let preferred = [m0, m1];
+        let wait = Duration::from_secs(10);
+        assert_eq!(*q.pop_preferring(&preferred, wait).unwrap().id(), ids[2]);
+        assert_eq!(*q.pop_preferring(&preferred, wait).unwrap().id(), ids[1]);
+        // No preferred PE left, falls back without waiting
+        assert_eq!(*q.pop_preferring(&preferred, Duration::ZERO).unwrap().id(), ids[0]);
+    }
+
+    #[test]
+    fn any_pe_is_taken_after_the_wait() {
+        let d = device(0, 1);
+        let m = d.default_memory().unwrap();
+        let q = PEQueue::new(true);
+        let pe = pes(&d, vec![None]).pop().unwrap();
+        let id = *pe.id();
+        q.push(pe).unwrap();
+
+        let wait = Duration::from_millis(20);
+        let start = Instant::now();
+        assert_eq!(*q.pop_preferring(&[m], wait).unwrap().id(), id);
+        assert!(start.elapsed() >= wait);
+        assert!(q.inner.lock().unwrap().waiters.is_empty());
+    }
+
+    #[test]
+    fn released_pe_is_handed_to_matching_waiter() {
+        let d = device(0, 2);
+        let m = d.default_memory().unwrap();
+        let q = Arc::new(PEQueue::new(true));
+        let mut p = pes(&d, vec![Some(m.clone()), None]);
+        let (other, attached) = (p.pop().unwrap(), p.pop().unwrap());
+        let attached_id = *attached.id();
+
+        let waiter = {
+            let q = q.clone();
+            thread::spawn(move || *q.pop_preferring(&[m], Duration::from_secs(10)).unwrap().id())
+        };
+        wait_for_waiters(&q, 1);
+
+        // Not attached to the preferred memory, stays idle
+        q.push(other).unwrap();
+        {
+            let inner = q.inner.lock().unwrap();
+            assert_eq!(inner.idle.len(), 1);
+            assert_eq!(inner.waiters.len(), 1);
+        }
+
+        q.push(attached).unwrap();
+        assert_eq!(waiter.join().unwrap(), attached_id);
+        assert_eq!(q.inner.lock().unwrap().idle.len(), 1);
+    }
+
+    #[test]
+    fn blocked_acquirers_are_served_in_arrival_order() {
+        let d = device(0, 3);
+        let q = Arc::new(PEQueue::new(true));
+        let (done, order) = std::sync::mpsc::channel();
+        let waiters: Vec<_> = (0..3)
+            .map(|i| {
+                let (q, done) = (q.clone(), done.clone());
+                let t = thread::spawn(move || {
+                    let pe = q.pop(true, None).unwrap().unwrap();
+                    done.send((i, *pe.id())).unwrap();
+                });
+                wait_for_waiters(&q, i + 1);
+                t
+            })
+            .collect();
+
+        for (i, pe) in pes(&d, vec![None; 3]).into_iter().enumerate() {
+            let id = *pe.id();
+            q.push(pe).unwrap();
+            assert_eq!(order.recv_timeout(Duration::from_secs(10)).unwrap(), (i, id));
+        }
+        for t in waiters {
+            t.join().unwrap();
+        }
+        assert!(q.inner.lock().unwrap().idle.is_empty());
+    }
 }
@@ -18,11 +18,15 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-use std::cmp::min;
+use std::collections::HashMap;
 use std::io;
-use std::sync::Mutex;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use once_cell::sync::OnceCell;
 use snafu::ResultExt;
 use tokio::runtime::{Builder, Runtime};
+use tokio::task::JoinHandle;
+use tonic::transport::{Channel, Endpoint};
 use crate::protos::simcalls::{
     InterruptStatusRequest,
     Void,
@@ -32,7 +36,12 @@ use crate::protos::simcalls::{
     WriteMemory,
     ReadMemory,
     WritePlatform,
+    WritePlatformBatch,
     ReadPlatform,
+    ReadMemoryResponse,
+    Capabilities,
+    InterruptEvent,
+    SimResponse,
     sim_request_client::SimRequestClient,
     sim_response::ResponsePayload
 };
@@ -47,9 +56,6 @@ pub enum Error {
     #[snafu(display("Failed to build tokio runtime: {}", source))]
     TonicRuntimeBuild { source: io::Error },
 
-    #[snafu(display("Failed to acquire lock on client mutex"))]
-    ClientLockError { },
-
     #[snafu(display("Failed to connect to gRPC server: {}", source))]
     Connect { source: tonic::transport::Error },
 
@@ -82,31 +88,250 @@ pub enum Error {
 }
 type Result<T, E = Error> = std::result::Result<T, E>;
 
+/// Largest payload of a single memory request or stream message in bytes.
+const MAX_CHUNK_SIZE: usize = 2097152;
+
+/// Number of connections to the simulation server, requests are spread round robin.
+const NUM_CONNECTIONS: usize = 4;
+
+/// Worker threads of the runtime driving all simulator connections.
+const RUNTIME_THREADS: usize = 2;
+
+static RUNTIME: OnceCell<Runtime> = OnceCell::new();
+
+/// Runtime shared by all clients of the process, created on first use.
+///
+/// Requests are issued from the calling thread with `block_on`, the workers only
+/// drive the connections in the background.
+fn runtime() -> Result<&'static Runtime> {
+    RUNTIME.get_or_try_init(|| {
+        Builder::new_multi_thread()
+            .worker_threads(RUNTIME_THREADS)
+            .thread_name("tapasco-sim")
+            .enable_all()
+            .build()
+            .context(TonicRuntimeBuildSnafu)
+    })
+}
+
+fn void_response(inner: SimResponse) -> Result<Void> {
+    match SimResponseType::try_from(inner.r#type).context(ResponseParseSnafu)? {
+        SimResponseType::Okay => match inner.response_payload {
+            Some(ResponsePayload::Void(void)) => Ok(void),
+            Some(r) => Err(WrongResponsePayload {payload: r, expected: "Void".to_string()}),
+            None => Err(ResponseNone {expected: "Void".to_string()}),
+        },
+        SimResponseType::Error => match inner.response_payload {
+            Some(ResponsePayload::ErrorReason(reason)) => Err(ServerError {message: reason}),
+            Some(r) => Err(WrongResponsePayload {payload: r, expected: "ErrorReason".to_string()}),
+            _ => Err(ResponseNone {expected: "ErrorReason".to_string()}),
+        },
+    }
+}
+
+#[derive(Debug, Default)]
+struct SlotState {
+    count: u64,
+    closed: bool,
+}
+
+/// Interrupts of a single registered interrupt as pushed by the simulation server
+///
+/// Filled by the subscription task of the [`SimClient`]. Once the subscription has ended
+/// the slot is closed and the interrupt has to be polled with `get_interrupt_status`.
+#[derive(Debug, Default)]
+pub struct InterruptSlot {
+    state: Mutex<SlotState>,
+    cond: Condvar,
+}
+
+impl InterruptSlot {
+    fn add(&self, interrupts: u64) {
+        if let Ok(mut s) = self.state.lock() {
+            s.count += interrupts;
+            self.cond.notify_all();
+        }
+    }
+
+    fn close(&self) {
+        if let Ok(mut s) = self.state.lock() {
+            s.closed = true;
+            self.cond.notify_all();
+        }
+    }
+
+    /// Sleep until at least one interrupt has been pushed and return the number of
+    /// interrupts since the last call. Returns None if the subscription has ended.
+    pub fn wait(&self) -> Option<u64> {
+        let mut s = self.state.lock().ok()?;
+        loop {
+            if s.count > 0 {
+                return Some(std::mem::take(&mut s.count));
+            }
+            if s.closed {
+                return None;
+            }
+            s = self.cond.wait(s).ok()?;
+        }
+    }
+
+    /// Number of interrupts since the last call, possibly 0. Returns None if the
+    /// subscription has ended and no interrupts are left.
+    pub fn take(&self) -> Option<u64> {
+        let mut s = self.state.lock().ok()?;
+        if s.count == 0 && s.closed {
+            None
+        } else {
+            Some(std::mem::take(&mut s.count))
+        }
+    }
+}
+
+/// Waiters of the interrupt subscription, keyed by the fd used during registration
+#[derive(Debug, Default)]
+struct Subscription {
+    active: AtomicBool,
+    slots: Mutex<HashMap<i32, Arc<InterruptSlot>>>,
+}
+
+impl Subscription {
+    async fn run(self: Arc<Self>, mut client: SimRequestClient<Channel>) {
+        match client.subscribe_interrupts(tonic::Request::new(Void {})).await {
+            Ok(response) => {
+                let mut stream = response.into_inner();
+                loop {
+                    match stream.message().await {
+                        Ok(Some(InterruptEvent { fd, interrupts })) => {
+                            let slot = self.slots.lock().ok().and_then(|s| s.get(&fd).cloned());
+                            match slot {
+                                Some(slot) => slot.add(interrupts),
+                                None => trace!("Dropping {} interrupts of unknown fd {}", interrupts, fd),
+                            }
+                        }
+                        Ok(None) => {
+                            warn!("Simulator closed the interrupt subscription.");
+                            break;
+                        }
+                        Err(e) => {
+                            warn!("Interrupt subscription failed: {}", e);
+                            break;
+                        }
+                    }
+                }
+            }
+            Err(e) => warn!("Could not subscribe to interrupts: {}", e),
+        }
+        self.close();
+    }
+
+    /// Wake all waiters, they fall back to polling.
+    fn close(&self) {
+        if let Ok(slots) = self.slots.lock() {
+            self.active.store(false, Ordering::Release);
+            for slot in slots.values() {
+                slot.close();
+            }
+        }
+    }
+}
+
+/// gRPC client of the simulation server.
+///
+/// A device creates a single client which is shared by its DMA engines, PEs and
+/// interrupts. The client holds a small pool of connections so concurrent requests do
+/// not serialize on one another, all of them driven by one process wide runtime.
+///
+/// Memory transfers use the most compact encoding the server supports. The features are
+/// negotiated on connect, servers predating the negotiation get one `uint32` per byte.
+///
+/// If the server supports it, interrupts are received through a single
+/// `subscribe_interrupts` stream and handed to the [`InterruptSlot`] of the
+/// respective interrupt. Otherwise interrupts are polled.
 #[derive(Debug)]
 pub struct SimClient {
-    client: Mutex<SimRequestClient<tonic::transport::Channel>>,
-    rt: Runtime,
+    clients: Vec<SimRequestClient<Channel>>,
+    next: AtomicUsize,
+    rt: &'static Runtime,
+    capabilities: Capabilities,
+    subscription: Arc<Subscription>,
+    subscription_task: Option<JoinHandle<()>>,
 }
 
 impl SimClient {
     pub fn new() -> Result<Self> {
-        let rt = Builder::new_multi_thread().enable_all().build().context(TonicRuntimeBuildSnafu)?;
+        let rt = runtime()?;
         let port = match env::var("SIM_PORT") {
             Ok(p) => p.parse::<u32>().context(PortParseSnafu {})?,
             Err(_) => 4040,
         };
-        let client = rt.block_on(SimRequestClient::connect(format!("http://[::1]:{}", port))).context(ConnectSnafu)?;
+        let endpoint = Endpoint::from_shared(format!("http://[::1]:{}", port)).context(ConnectSnafu)?;
+        let clients = (0..NUM_CONNECTIONS)
+            .map(|_| {
+                rt.block_on(endpoint.connect())
+                    .map(SimRequestClient::new)
+                    .context(ConnectSnafu)
+            })
+            .collect::<Result<Vec<_>>>()?;
+
+        let mut client = clients[0].clone();
+        let capabilities = match rt.block_on(client.get_capabilities(tonic::Request::new(Void {}))) {
+            Ok(response) => match response.into_inner().response_payload {
+                Some(ResponsePayload::Capabilities(c)) => c,
+                _ => Capabilities::default(),
+            },
+            // Older simulators do not implement the call
+            Err(s) if s.code() == tonic::Code::Unimplemented => Capabilities::default(),
+            Err(s) => return Err(Request { source: s }),
+        };
+        trace!("Simulator capabilities: {capabilities:?}");
+
+        let subscription = Arc::new(Subscription::default());
+        let subscription_task = if capabilities.interrupt_subscription {
+            subscription.active.store(true, Ordering::Release);
+            Some(rt.spawn(subscription.clone().run(clients[NUM_CONNECTIONS - 1].clone())))
+        } else {
+            None
+        };
 
         Ok(Self {
-            client: Mutex::new(client),
+            clients,
+            next: AtomicUsize::new(0),
             rt,
+            capabilities,
+            subscription,
+            subscription_task,
         })
     }
 
+    /// Slot receiving the pushed interrupts of `fd`, None if the interrupt has to be polled.
+    ///
+    /// Has to be called before the interrupt is registered so no event gets lost.
+    pub fn subscribe_interrupt(&self, fd: i32) -> Option<Arc<InterruptSlot>> {
+        let mut slots = self.subscription.slots.lock().ok()?;
+        if !self.subscription.active.load(Ordering::Acquire) {
+            return None;
+        }
+        let slot = Arc::new(InterruptSlot::default());
+        slots.insert(fd, slot.clone());
+        Some(slot)
+    }
+
+    pub fn unsubscribe_interrupt(&self, fd: i32) {
+        if let Ok(mut slots) = self.subscription.slots.lock() {
+            slots.remove(&fd);
+        }
+    }
+
+    /// Next connection of the pool. Clones of a client share the underlying connection.
+    fn client(&self) -> SimRequestClient<Channel> {
+        let idx = self.next.fetch_add(1, Ordering::Relaxed) % self.clients.len();
+        self.clients[idx].clone()
+    }
+
     pub fn write_platform(&self, write_platform: WritePlatform) -> Result<Void> {
         trace!("write platform: {write_platform:?}");
         let request = tonic::Request::new(write_platform);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.write_platform(request)).context(RequestSnafu)?;
 
         let inner = response.into_inner();
@@ -124,11 +349,26 @@ impl SimClient {
         }
     }
 
+    /// Applies `writes` in order with a single request if the server supports it and one
+    /// request per write otherwise.
+    pub fn write_platform_batch(&self, writes: Vec<WritePlatform>) -> Result<Void> {
+        if !self.capabilities.platform_batch {
+            for w in writes {
+                self.write_platform(w)?;
+            }
+            return Ok(Void {});
+        }
+        trace!("write platform batch of {} writes", writes.len());
+        let request = tonic::Request::new(WritePlatformBatch { writes });
+        let mut client = self.client();
+        let response = self.rt.block_on(client.write_platform_batch(request)).context(RequestSnafu)?;
+        void_response(response.into_inner())
+    }
 
     pub fn read_platform(&self, read_platform: ReadPlatform) -> Result<Vec<u32>> {
         let num_bytes = read_platform.num_bytes;
         let request = tonic::Request::new(read_platform);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.read_platform(request)).context(RequestSnafu)?;
 
         let inner = response.into_inner();
@@ -151,37 +391,69 @@ impl SimClient {
         }
     }
 
-    pub fn read_memory(&self, read_memory: ReadMemory) -> Result<Vec<u32>> {
-        let max_chunk_size = 2097152_u64;
-        let mut read_mem: Vec<u32> = Vec::with_capacity(read_memory.length as usize);
-
-        let mut bytes_left = read_memory.length;
-        let mut curr_offset = 0;
-
-        while bytes_left > 0 {
-            let bytes_to_read = min(bytes_left, max_chunk_size);
-            let _read_memory = ReadMemory {
-                addr: read_memory.addr + (curr_offset * max_chunk_size) as u64,
-                length: bytes_to_read,
+    /// Read `data.len()` bytes of simulated memory at `addr` into `data`.
+    pub fn read_memory(&self, addr: u64, data: &mut [u8]) -> Result<()> {
+        if self.capabilities.memory_streams && data.len() > MAX_CHUNK_SIZE {
+            trace!("read memory stream len: {}", data.len());
+            let request = ReadMemory {
+                addr,
+                length: data.len() as u64,
+                bytes_response: true,
             };
-            read_mem.extend(self._read_memory(_read_memory)?);
-            bytes_left -= bytes_to_read;
-            curr_offset += 1;
+            let mut client = self.client();
+            return self.rt.block_on(async {
+                let mut stream = client.read_memory_stream(request).await.context(RequestSnafu)?.into_inner();
+                let mut offset = 0;
+                while let Some(chunk) = stream.message().await.context(RequestSnafu)? {
+                    let end = offset + chunk.payload.len();
+                    if end > data.len() {
+                        return Err(WrongResponseLength {});
+                    }
+                    data[offset..end].copy_from_slice(&chunk.payload);
+                    offset = end;
+                }
+                if offset != data.len() {
+                    Err(WrongResponseLength {})
+                } else {
+                    Ok(())
+                }
+            });
         }
 
-        Ok(read_mem)
+        for (idx, chunk) in data.chunks_mut(MAX_CHUNK_SIZE).enumerate() {
+            let response = self._read_memory(ReadMemory {
+                addr: addr + (idx * MAX_CHUNK_SIZE) as u64,
+                length: chunk.len() as u64,
+                bytes_response: self.capabilities.bytes_payload,
+            })?;
+            if self.capabilities.bytes_payload {
+                if response.payload.len() != chunk.len() {
+                    return Err(WrongResponseLength {});
+                }
+                chunk.copy_from_slice(&response.payload);
+            } else {
+                if response.value.len() != chunk.len() {
+                    return Err(WrongResponseLength {});
+                }
+                for (d, v) in chunk.iter_mut().zip(response.value) {
+                    *d = v as u8;
+                }
+            }
+        }
+
+        Ok(())
     }
 
-    fn _read_memory(&self, read_memory: ReadMemory) -> Result<Vec<u32>> {
+    fn _read_memory(&self, read_memory: ReadMemory) -> Result<ReadMemoryResponse> {
         trace!("read memory len: {}", read_memory.length);
         let request = tonic::Request::new(read_memory);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.read_memory(request)).context(RequestSnafu)?;
 
         let inner = response.into_inner();
         match SimResponseType::try_from(inner.r#type).context(ResponseParseSnafu)? {
             SimResponseType::Okay => match inner.response_payload {
-                Some(ResponsePayload::ReadMemoryResponse(response)) => Ok(response.value),
+                Some(ResponsePayload::ReadMemoryResponse(response)) => Ok(response),
                 Some(r) => Err(WrongResponsePayload {payload: r, expected: "ReadMemoryResponse".to_string()}),
                 None => Err(ResponseNone {expected: "ReadMemoryResponse".to_string()}),
             },
@@ -193,43 +465,54 @@ impl SimClient {
         }
     }
 
-    pub fn write_memory(&self, write_memory: WriteMemory) -> Result<Void> {
-        let max_chunk_size = 2097152;
-        let chunks: Vec<&[u32]> = write_memory.data.chunks(max_chunk_size).collect();
-        chunks.iter().enumerate().try_for_each(|(idx, chunk)| -> Result<()> {
-            let _write_memory = WriteMemory {
-                addr: write_memory.addr + (idx * max_chunk_size) as u64,
-                data: chunk.to_vec(),
+    /// Write `data` to simulated memory at `addr`.
+    pub fn write_memory(&self, addr: u64, data: &[u8]) -> Result<Void> {
+        if self.capabilities.memory_streams && data.len() > MAX_CHUNK_SIZE {
+            trace!("write memory stream len: {}", data.len());
+            let chunks: Vec<WriteMemory> = data
+                .chunks(MAX_CHUNK_SIZE)
+                .enumerate()
+                .map(|(idx, chunk)| WriteMemory {
+                    addr: addr + (idx * MAX_CHUNK_SIZE) as u64,
+                    data: Vec::new(),
+                    payload: chunk.to_vec(),
+                })
+                .collect();
+            let mut client = self.client();
+            let response = self
+                .rt
+                .block_on(client.write_memory_stream(futures::stream::iter(chunks)))
+                .context(RequestSnafu)?;
+            return void_response(response.into_inner());
+        }
+
+        data.chunks(MAX_CHUNK_SIZE).enumerate().try_for_each(|(idx, chunk)| -> Result<()> {
+            let (data, payload) = if self.capabilities.bytes_payload {
+                (Vec::new(), chunk.to_vec())
+            } else {
+                (chunk.iter().map(|b| *b as u32).collect(), Vec::new())
             };
-            self._write_memory(_write_memory).unwrap();
+            self._write_memory(WriteMemory {
+                addr: addr + (idx * MAX_CHUNK_SIZE) as u64,
+                data,
+                payload,
+            })?;
             Ok(())
         }).map(|_| Void{})
     }
 
     fn _write_memory(&self, write_memory: WriteMemory) -> Result<Void> {
-        trace!("write memory len: {}", write_memory.data.len());
+        trace!("write memory len: {}", write_memory.data.len() + write_memory.payload.len());
         let request = tonic::Request::new(write_memory);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.write_memory(request)).context(RequestSnafu)?;
 
-        let inner = response.into_inner();
-        match SimResponseType::try_from(inner.r#type).context(ResponseParseSnafu)? {
-            SimResponseType::Okay => match inner.response_payload {
-                Some(ResponsePayload::Void(void)) => Ok(void),
-                Some(r) => Err(WrongResponsePayload {payload: r, expected: "Void".to_string()}),
-                None => Err(ResponseNone {expected: "Void".to_string()}),
-            },
-            SimResponseType::Error => match inner.response_payload {
-                Some(ResponsePayload::ErrorReason(reason)) => Err(ServerError {message: reason}),
-                Some(r) => Err(WrongResponsePayload {payload: r, expected: "ErrorReason".to_string()}),
-                _ => Err(ResponseNone {expected: "ErrorReason".to_string()}),
-            },
-        }
+        void_response(response.into_inner())
     }
 
     pub fn register_interrupt(&self, register_interrupt: RegisterInterrupt) -> Result<Void> {
         let request = tonic::Request::new(register_interrupt);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.register_interrupt(request)).context(RequestSnafu)?;
 
         let inner = response.into_inner();
@@ -249,7 +532,7 @@ impl SimClient {
 
     pub fn deregister_interrupt(&self, register_interrupt: DeregisterInterrupt) -> Result<Void> {
         let request = tonic::Request::new(register_interrupt);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.deregister_interrupt(request)).context(RequestSnafu)?;
 
         let inner = response.into_inner();
@@ -269,7 +552,7 @@ impl SimClient {
 
     pub fn get_status(&self) -> Result<status::Status> {
         let request = tonic::Request::new(Void{});
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.get_status(request)).context(RequestSnafu)?;
         let inner = response.into_inner();
 
@@ -289,7 +572,7 @@ impl SimClient {
 
     pub fn get_interrupt_status(&self, interrupt_status_request: InterruptStatusRequest) -> Result<u64> {
         let request = tonic::Request::new(interrupt_status_request);
-        let mut client = self.client.lock().map_err(|_| ClientLockError {})?;
+        let mut client = self.client();
         let response = self.rt.block_on(client.get_interrupt_status(request)).context(RequestSnafu)?;
         let inner = response.into_inner();
 
@@ -307,3 +590,12 @@ impl SimClient {
         }
     }
 }
+
+impl Drop for SimClient {
+    fn drop(&mut self) {
+        // The runtime outlives the client, the stream would keep its connection open
+        if let Some(task) = self.subscription_task.take() {
+            task.abort();
+        }
+    }
+}
@@ -0,0 +1,733 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//! In-process model of a TaPaSCo device.
+//!
+//! Provides the status core, the PE register interface with interrupts and a device
+//! memory behind a modelled DMA link without any hardware, driver or simulator. The
+//! behaviour of the PEs is supplied by the user as [`PEModel`]. Used through
+//! [`Device::new_software`] to measure and profile the host side of the runtime.
+//!
+//! [`Device::new_software`]: ../device/struct.Device.html#method.new_software
+
+use crate::device::{DeviceAddress, DeviceSize};
+use crate::pe::PEId;
+use crate::protos::status;
+use memmap::MmapMut;
+use nix::sys::eventfd::{EfdFlags, EventFd};
+use snafu::ResultExt;
+use std::fmt;
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::sync::mpsc::{channel, Receiver, Sender};
+use std::sync::{Arc, Mutex, MutexGuard};
+use std::thread;
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Could not map {} bytes of device memory: {}", size, source))]
+    MapMemory {
+        source: std::io::Error,
+        size: DeviceSize,
+    },
+
+    #[snafu(display(
+        "Access 0x{:x} - 0x{:x} outside of device memory 0x{:x}.",
+        ptr,
+        end,
+        size
+    ))]
+    OutOfRange {
+        ptr: DeviceAddress,
+        end: DeviceAddress,
+        size: DeviceSize,
+    },
+
+    #[snafu(display("Error creating interrupt eventfd: {}", source))]
+    ErrorEventFD { source: nix::Error },
+
+    #[snafu(display("Could not start worker thread of PE {}: {}", id, source))]
+    ErrorThread { source: std::io::Error, id: usize },
+
+    #[snafu(display("There is no PE with interrupt {}.", id))]
+    UnknownInterrupt { id: usize },
+
+    #[snafu(display("A software device needs at least one PE."))]
+    NoPEs {},
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+/// Number of argument registers of a modelled PE.
+pub const NUM_ARGS: usize = 16;
+
+// Register layout of a PE as used in `pe.rs`
+const PE_STRIDE: u64 = 0x1000;
+const PE_CONTROL: u64 = 0x00;
+const PE_IER: u64 = 0x04;
+const PE_GIER: u64 = 0x08;
+const PE_ISR: u64 = 0x0c;
+const PE_RETURN: u64 = 0x10;
+const PE_ARGS: u64 = 0x20;
+const PE_ARG_STRIDE: u64 = 0x10;
+
+const PLATFORM_SIZE: u64 = 0x10000;
+
+/// Behaviour of a modelled PE
+///
+/// `execute` is called on the worker thread of the PE each time the PE is started. The
+/// returned value ends up in the return register. The PE signals completion once
+/// `execute` has returned and the configured latency has passed.
+///
+/// Implemented by all closures taking a [`PEContext`].
+pub trait PEModel: Send + Sync {
+    fn execute(&self, ctx: &PEContext) -> u64;
+}
+
+impl<F> PEModel for F
+where
+    F: Fn(&PEContext) -> u64 + Send + Sync,
+{
+    fn execute(&self, ctx: &PEContext) -> u64 {
+        self(ctx)
+    }
+}
+
+/// Arguments and device memory of a single PE execution
+#[derive(Debug)]
+pub struct PEContext<'a> {
+    id: usize,
+    args: [u64; NUM_ARGS],
+    memory: &'a SoftwareMemory,
+}
+
+impl<'a> PEContext<'a> {
+    /// Index of the executing PE on the device.
+    pub fn id(&self) -> usize {
+        self.id
+    }
+
+    pub fn arg(&self, n: usize) -> u64 {
+        self.args[n]
+    }
+
+    pub fn args(&self) -> &[u64] {
+        &self.args
+    }
+
+    pub fn memory(&self) -> &SoftwareMemory {
+        self.memory
+    }
+}
+
+/// Memory of a software device
+///
+/// Backed by an anonymous mapping, so only touched pages use host memory. Like on real
+/// hardware, accesses of PEs and DMA transfers are not synchronized with each other.
+#[derive(Debug)]
+pub struct SoftwareMemory {
+    map: MmapMut,
+}
+
+// Accesses go through raw pointers, overlapping accesses are the user's responsibility.
+unsafe impl Sync for SoftwareMemory {}
+
+impl SoftwareMemory {
+    fn new(size: DeviceSize) -> Result<Self> {
+        Ok(Self {
+            map: MmapMut::map_anon(size as usize).context(MapMemorySnafu { size })?,
+        })
+    }
+
+    pub fn size(&self) -> DeviceSize {
+        self.map.len() as DeviceSize
+    }
+
+    fn check(&self, ptr: DeviceAddress, len: usize) -> Result<()> {
+        match ptr.checked_add(len as u64) {
+            Some(end) if end <= self.size() => Ok(()),
+            end => Err(Error::OutOfRange {
+                ptr,
+                end: end.unwrap_or(DeviceAddress::MAX),
+                size: self.size(),
+            }),
+        }
+    }
+
+    pub fn read(&self, ptr: DeviceAddress, data: &mut [u8]) -> Result<()> {
+        self.check(ptr, data.len())?;
+        unsafe {
+            std::ptr::copy_nonoverlapping(
+                self.as_ptr().offset(ptr as isize),
+                data.as_mut_ptr(),
+                data.len(),
+            );
+        }
+        Ok(())
+    }
+
+    pub fn write(&self, ptr: DeviceAddress, data: &[u8]) -> Result<()> {
+        self.check(ptr, data.len())?;
+        unsafe {
+            std::ptr::copy_nonoverlapping(
+                data.as_ptr(),
+                self.as_ptr().offset(ptr as isize),
+                data.len(),
+            );
+        }
+        Ok(())
+    }
+
+    /// Base of the memory, device address 0.
+    pub fn as_ptr(&self) -> *mut u8 {
+        self.map.as_ptr() as *mut u8
+    }
+}
+
+/// One direction of the modelled host-device link
+///
+/// Transfers occupy the link for `len / bandwidth` one after another and complete
+/// `latency` after leaving it. Concurrent transfers thus share the bandwidth and
+/// pipelined transfers hide the latency like on a DMA engine.
+#[derive(Debug)]
+struct Link {
+    /// Bytes per second, 0 for unlimited.
+    bandwidth: u64,
+    latency: Duration,
+    free_at: Mutex<Instant>,
+}
+
+impl Link {
+    fn new(bandwidth: u64, latency: Duration) -> Self {
+        Self {
+            bandwidth,
+            latency,
+            free_at: Mutex::new(Instant::now()),
+        }
+    }
+
+    /// Point in time at which a transfer of `len` bytes issued now is complete.
+    fn reserve(&self, len: usize) -> Instant {
+        let now = Instant::now();
+        let occupied = if self.bandwidth == 0 {
+            Duration::ZERO
+        } else {
+            Duration::from_nanos((len as u128 * 1_000_000_000 / self.bandwidth as u128) as u64)
+        };
+        let mut free_at = lock(&self.free_at);
+        let start = (*free_at).max(now);
+        *free_at = start + occupied;
+        *free_at + self.latency
+    }
+}
+
+fn lock<T>(m: &Mutex<T>) -> MutexGuard<T> {
+    // The state stays consistent even if a PE model panicked while holding a lock
+    m.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+fn sleep_until(t: Instant) {
+    let now = Instant::now();
+    if t > now {
+        thread::sleep(t - now);
+    }
+}
+
+/// A group of identical PEs of a [`SoftwareDeviceConfig`]
+#[derive(Clone)]
+struct SoftwarePEConfig {
+    type_id: PEId,
+    name: String,
+    count: usize,
+    latency: Duration,
+    model: Arc<dyn PEModel>,
+}
+
+impl fmt::Debug for SoftwarePEConfig {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("SoftwarePEConfig")
+            .field("type_id", &self.type_id)
+            .field("name", &self.name)
+            .field("count", &self.count)
+            .field("latency", &self.latency)
+            .finish()
+    }
+}
+
+/// Description of a software device
+///
+/// The defaults resemble a PCIe Gen3 x16 card with 1 GiB of memory.
+#[derive(Debug, Clone)]
+pub struct SoftwareDeviceConfig {
+    /// Size of the device memory in bytes.
+    pub memory_size: DeviceSize,
+    /// Host to device bandwidth in bytes per second, 0 for unlimited.
+    pub h2c_bandwidth: u64,
+    /// Device to host bandwidth in bytes per second, 0 for unlimited.
+    pub c2h_bandwidth: u64,
+    /// Time between a transfer leaving the link and its completion.
+    pub dma_latency: Duration,
+    pub design_frequency_mhz: u32,
+    pes: Vec<SoftwarePEConfig>,
+}
+
+impl Default for SoftwareDeviceConfig {
+    fn default() -> Self {
+        Self {
+            memory_size: 1024 * 1024 * 1024,
+            h2c_bandwidth: 12_000_000_000,
+            c2h_bandwidth: 12_000_000_000,
+            dma_latency: Duration::from_micros(2),
+            design_frequency_mhz: 250,
+            pes: Vec::new(),
+        }
+    }
+}
+
+impl SoftwareDeviceConfig {
+    /// Add `count` PEs of type `type_id` behaving as `model`.
+    ///
+    /// An execution takes at least `latency`, measured from the start of the PE.
+    pub fn add_pe(
+        &mut self,
+        type_id: PEId,
+        name: &str,
+        count: usize,
+        latency: Duration,
+        model: Arc<dyn PEModel>,
+    ) -> &mut Self {
+        self.pes.push(SoftwarePEConfig {
+            type_id,
+            name: name.to_string(),
+            count,
+            latency,
+            model,
+        });
+        self
+    }
+}
+
+#[derive(Debug, Default)]
+struct PERegisters {
+    args: [u64; NUM_ARGS],
+    ret: u64,
+    ier: bool,
+    gier: bool,
+    isr: bool,
+    running: bool,
+}
+
+struct PEState {
+    id: usize,
+    regs: Mutex<PERegisters>,
+    interrupt: Arc<EventFd>,
+    latency: Duration,
+    model: Arc<dyn PEModel>,
+}
+
+impl fmt::Debug for PEState {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("PEState")
+            .field("id", &self.id)
+            .field("regs", &self.regs)
+            .field("latency", &self.latency)
+            .finish()
+    }
+}
+
+impl PEState {
+    fn run(&self, memory: &SoftwareMemory, jobs: Receiver<(Instant, [u64; NUM_ARGS])>) {
+        while let Ok((started, args)) = jobs.recv() {
+            let ctx = PEContext {
+                id: self.id,
+                args,
+                memory,
+            };
+            let ret = match catch_unwind(AssertUnwindSafe(|| self.model.execute(&ctx))) {
+                Ok(r) => r,
+                Err(_) => {
+                    error!("Model of PE {} panicked, completing with return value 0.", self.id);
+                    0
+                }
+            };
+            sleep_until(started + self.latency);
+
+            let signal = {
+                let mut regs = lock(&self.regs);
+                regs.ret = ret;
+                regs.running = false;
+                regs.isr = true;
+                regs.ier && regs.gier
+            };
+            if signal {
+                if let Err(e) = self.interrupt.write(1) {
+                    error!("Could not signal interrupt of PE {}: {}", self.id, e);
+                }
+            }
+        }
+        trace!("Worker of PE {} stopped.", self.id);
+    }
+}
+
+#[derive(Debug)]
+struct SoftwarePE {
+    state: Arc<PEState>,
+    start: Mutex<Option<Sender<(Instant, [u64; NUM_ARGS])>>>,
+    worker: Option<JoinHandle<()>>,
+}
+
+impl SoftwarePE {
+    fn write(&self, reg: u64, value: u64) {
+        let mut regs = lock(&self.state.regs);
+        match reg {
+            PE_CONTROL => {
+                if value & 1 == 0 {
+                    return;
+                }
+                if regs.running {
+                    warn!("PE {} started while running, ignoring.", self.state.id);
+                    return;
+                }
+                regs.running = true;
+                let args = regs.args;
+                drop(regs);
+                if let Some(start) = lock(&self.start).as_ref() {
+                    let _ = start.send((Instant::now(), args));
+                }
+            }
+            PE_IER => regs.ier = value & 1 == 1,
+            PE_GIER => regs.gier = value & 1 == 1,
+            // toggle on write
+            PE_ISR => {
+                if value & 1 == 1 {
+                    regs.isr = false;
+                }
+            }
+            r if r >= PE_ARGS && r < PE_ARGS + NUM_ARGS as u64 * PE_ARG_STRIDE => {
+                let n = ((r - PE_ARGS) / PE_ARG_STRIDE) as usize;
+                match (r - PE_ARGS) % PE_ARG_STRIDE {
+                    0 => regs.args[n] = value,
+                    4 => regs.args[n] = (regs.args[n] & 0xffff_ffff) | (value << 32),
+                    _ => trace!("Ignoring write to PE {} register 0x{:x}.", self.state.id, r),
+                }
+            }
+            r => trace!("Ignoring write to PE {} register 0x{:x}.", self.state.id, r),
+        }
+    }
+
+    fn read(&self, reg: u64) -> u64 {
+        let regs = lock(&self.state.regs);
+        match reg {
+            PE_CONTROL => regs.running as u64,
+            PE_IER => regs.ier as u64,
+            PE_GIER => regs.gier as u64,
+            PE_ISR => regs.isr as u64,
+            PE_RETURN => regs.ret,
+            r if r == PE_RETURN + 4 => regs.ret >> 32,
+            r if r >= PE_ARGS && r < PE_ARGS + NUM_ARGS as u64 * PE_ARG_STRIDE => {
+                let n = ((r - PE_ARGS) / PE_ARG_STRIDE) as usize;
+                match (r - PE_ARGS) % PE_ARG_STRIDE {
+                    0 => regs.args[n],
+                    4 => regs.args[n] >> 32,
+                    _ => 0,
+                }
+            }
+            _ => 0,
+        }
+    }
+}
+
+/// In-process TaPaSCo device
+///
+/// Each PE occupies 4 KiB of the architecture register space and has a worker thread
+/// executing its [`PEModel`]. Interrupts are delivered through one eventfd per PE, the
+/// interrupt ID of a PE is its index on the device.
+#[derive(Debug, Getters)]
+pub struct SoftwareDevice {
+    #[get = "pub"]
+    status: status::Status,
+    #[get = "pub"]
+    memory: Arc<SoftwareMemory>,
+    pes: Vec<SoftwarePE>,
+    h2c: Link,
+    c2h: Link,
+}
+
+impl SoftwareDevice {
+    pub fn new(config: SoftwareDeviceConfig) -> Result<Self> {
+        ensure!(config.pes.iter().any(|p| p.count > 0), NoPEsSnafu);
+        let memory = Arc::new(SoftwareMemory::new(config.memory_size)?);
+
+        let mut pes = Vec::new();
+        let mut status_pes = Vec::new();
+        for p in &config.pes {
+            for _ in 0..p.count {
+                let id = pes.len();
+                let state = Arc::new(PEState {
+                    id,
+                    regs: Mutex::new(PERegisters::default()),
+                    interrupt: Arc::new(
+                        EventFd::from_value_and_flags(0, EfdFlags::EFD_NONBLOCK)
+                            .context(ErrorEventFDSnafu)?,
+                    ),
+                    latency: p.latency,
+                    model: p.model.clone(),
+                });
+                let (start, jobs) = channel();
+                let worker = {
+                    let state = state.clone();
+                    let memory = memory.clone();
+                    thread::Builder::new()
+                        .name(format!("tapasco-pe-{}", id))
+                        .spawn(move || state.run(&memory, jobs))
+                        .context(ErrorThreadSnafu { id })?
+                };
+                pes.push(SoftwarePE {
+                    state,
+                    start: Mutex::new(Some(start)),
+                    worker: Some(worker),
+                });
+                status_pes.push(status::Pe {
+                    name: p.name.clone(),
+                    id: p.type_id as u32,
+                    offset: id as u64 * PE_STRIDE,
+                    size: PE_STRIDE,
+                    local_memory: None,
+                    debug: None,
+                    interrupts: vec![status::Interrupt {
+                        mapping: id as u64,
+                        name: "".to_string(),
+                    }],
+                });
+            }
+        }
+
+        let clock = |name: &str| status::Clock {
+            name: name.to_string(),
+            frequency_mhz: config.design_frequency_mhz,
+        };
+        let status = status::Status {
+            timestamp: 0,
+            arch_base: Some(status::MemoryArea {
+                base: 0,
+                size: pes.len() as u64 * PE_STRIDE,
+            }),
+            platform_base: Some(status::MemoryArea {
+                base: 0,
+                size: PLATFORM_SIZE,
+            }),
+            pe: status_pes,
+            platform: Vec::new(),
+            clocks: vec![clock("Design"), clock("Memory"), clock("Host")],
+            versions: vec![status::Version {
+                software: "Software Device".to_string(),
+                ..Default::default()
+            }],
+        };
+
+        trace!("Created software device with {} PEs.", pes.len());
+
+        Ok(Self {
+            status,
+            memory,
+            pes,
+            h2c: Link::new(config.h2c_bandwidth, config.dma_latency),
+            c2h: Link::new(config.c2h_bandwidth, config.dma_latency),
+        })
+    }
+
+    fn pe(&self, offset: u64) -> Option<&SoftwarePE> {
+        self.pes.get((offset / PE_STRIDE) as usize)
+    }
+
+    /// Write a PE register in the architecture address space.
+    pub fn write_register(&self, offset: u64, value: u64) {
+        match self.pe(offset) {
+            Some(pe) => pe.write(offset % PE_STRIDE, value),
+            None => warn!("Write to 0x{:x} outside of the PE address space.", offset),
+        }
+    }
+
+    /// Read a PE register in the architecture address space.
+    pub fn read_register(&self, offset: u64, u_32: bool) -> u64 {
+        let v = match self.pe(offset) {
+            Some(pe) => pe.read(offset % PE_STRIDE),
+            None => {
+                warn!("Read from 0x{:x} outside of the PE address space.", offset);
+                0
+            }
+        };
+        if u_32 {
+            v & 0xffff_ffff
+        } else {
+            v
+        }
+    }
+
+    /// Eventfd signalled on completion of the PE with the given interrupt ID.
+    pub fn interrupt(&self, id: usize) -> Result<Arc<EventFd>> {
+        self.pes
+            .get(id)
+            .map(|pe| pe.state.interrupt.clone())
+            .ok_or(Error::UnknownInterrupt { id })
+    }
+
+    /// Transfer `data` to device memory at `ptr`, taking the modelled link time.
+    pub fn copy_to(&self, data: &[u8], ptr: DeviceAddress) -> Result<()> {
+        self.memory.check(ptr, data.len())?;
+        let done = self.h2c.reserve(data.len());
+        self.memory.write(ptr, data)?;
+        sleep_until(done);
+        Ok(())
+    }
+
+    /// Transfer device memory at `ptr` into `data`, taking the modelled link time.
+    pub fn copy_from(&self, ptr: DeviceAddress, data: &mut [u8]) -> Result<()> {
+        self.memory.check(ptr, data.len())?;
+        let done = self.c2h.reserve(data.len());
+        self.memory.read(ptr, data)?;
+        sleep_until(done);
+        Ok(())
+    }
+}
+
+impl Drop for SoftwareDevice {
+    fn drop(&mut self) {
+        // Closing the channels ends the workers after their current execution
+        for pe in &self.pes {
+            lock(&pe.start).take();
+        }
+        for pe in &mut self.pes {
+            if let Some(worker) = pe.worker.take() {
+                let _ = worker.join();
+            }
+        }
+    }
+}
+
+/// PE type ID of the PEs added by [`sum_config`].
+#[cfg(test)]
+pub(crate) const SUM: PEId = 14;
+
+/// Test fixture: 1 MiB of memory and `count` PEs of type [`SUM`], which sum up arg(1)
+/// bytes at arg(0) and take at least `latency`.
+#[cfg(test)]
+pub(crate) fn sum_config(count: usize, latency: Duration) -> SoftwareDeviceConfig {
+    let mut config = SoftwareDeviceConfig {
+        memory_size: 1024 * 1024,
+        ..Default::default()
+    };
+    config.add_pe(
+        SUM,
+        "sum",
+        count,
+        latency,
+        Arc::new(|ctx: &PEContext| {
+            let mut data = vec![0u8; ctx.arg(1) as usize];
+            ctx.memory().read(ctx.arg(0), &mut data).unwrap();
+            data.iter().map(|x| *x as u64).sum()
+        }),
+    );
+    config
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn device(latency: Duration) -> SoftwareDevice {
+        SoftwareDevice::new(sum_config(2, latency)).unwrap()
+    }
+
+    fn wait(fd: &EventFd) -> u64 {
+        loop {
+            match fd.read() {
+                Ok(n) => return n,
+                Err(nix::errno::Errno::EAGAIN) => thread::yield_now(),
+                Err(e) => panic!("{}", e),
+            }
+        }
+    }
+
+    #[test]
+    fn status_describes_pes() {
+        let d = device(Duration::ZERO);
+        assert_eq!(d.status().pe.len(), 2);
+        assert_eq!(d.status().pe[1].offset, PE_STRIDE);
+        assert_eq!(d.status().pe[1].interrupts[0].mapping, 1);
+    }
+
+    #[test]
+    fn execute_and_interrupt() {
+        let d = device(Duration::ZERO);
+        d.copy_to(&[1, 2, 3, 4], 64).unwrap();
+        let pe = PE_STRIDE;
+        d.write_register(pe + PE_IER, 1);
+        d.write_register(pe + PE_GIER, 1);
+        d.write_register(pe + PE_ARGS, 64);
+        d.write_register(pe + PE_ARGS + PE_ARG_STRIDE, 4);
+        d.write_register(pe + PE_CONTROL, 1);
+
+        assert_eq!(wait(&d.interrupt(1).unwrap()), 1);
+        assert_eq!(d.read_register(pe + PE_RETURN, false), 10);
+        assert_eq!(d.read_register(pe + PE_ISR, true), 1);
+        d.write_register(pe + PE_ISR, 1);
+        assert_eq!(d.read_register(pe + PE_ISR, true), 0);
+    }
+
+    #[test]
+    fn accesses_are_bounds_checked() {
+        let d = device(Duration::ZERO);
+        let size = d.memory().size();
+        assert!(d.copy_to(&[1, 2, 3, 4], size - 4).is_ok());
+        assert!(d.copy_to(&[1, 2, 3, 4], size - 3).is_err());
+        // The end of the access overflows
+        let mut data = [0u8; 4];
+        assert!(d.copy_from(DeviceAddress::MAX - 1, &mut data).is_err());
+    }
+
+    #[test]
+    fn latency_is_modelled() {
+        let d = device(Duration::from_millis(20));
+        d.write_register(PE_IER, 1);
+        d.write_register(PE_GIER, 1);
+        let start = Instant::now();
+        d.write_register(PE_CONTROL, 1);
+        wait(&d.interrupt(0).unwrap());
+        assert!(start.elapsed() >= Duration::from_millis(20));
+    }
+
+    #[test]
+    fn link_shares_bandwidth() {
+        let link = Link::new(1_000_000, Duration::ZERO);
+        let start = Instant::now();
+        link.reserve(1000);
+        let second = link.reserve(1000);
+        assert!(second >= start + Duration::from_millis(2));
+    }
+
+    #[test]
+    fn transfers_out_of_range() {
+        let d = device(Duration::ZERO);
+        let mut data = [0u8; 16];
+        assert!(d.copy_from(1024 * 1024 - 8, &mut data).is_err());
+    }
+}
@@ -38,11 +38,20 @@
 #endif
 #endif
 
+#include <exception>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#define TAPASCO_HAS_COROUTINES 1
+#endif
 
 #include <tapasco_inner.hpp>
 
@@ -188,6 +197,28 @@ template <typename T> OutputStream<T> makeOutputStream(T *t, size_t sz) {
   return OutputStream<T>(t, sz);
 }
 
+/**
+ * Intermediate buffer of a TapascoGraph. Stays in device memory and is passed
+ * to the tasks of the graph as device address.
+ **/
+struct GraphBuffer final {
+  uintptr_t id;
+};
+
+/** Graph buffer read by a task. **/
+struct GraphRead final {
+  GraphBuffer buffer;
+};
+
+/** Graph buffer written by a task. **/
+struct GraphWrite final {
+  GraphBuffer buffer;
+};
+
+inline GraphRead makeGraphRead(GraphBuffer b) { return GraphRead{b}; }
+
+inline GraphWrite makeGraphWrite(GraphBuffer b) { return GraphWrite{b}; }
+
 /** A TAPASCO runtime error. **/
 class tapasco_error : public std::runtime_error {
 public:
@@ -205,6 +236,115 @@ static void handle_error() {
   throw tapasco_error(err_msg);
 }
 
+static std::string last_error_message() {
+  int l = tapasco_last_error_length();
+  if (l <= 0) {
+    return "Unknown error.";
+  }
+  std::string buf(l, '\0');
+  tapasco_last_error_message(&buf[0], l);
+  return std::string(buf.c_str());
+}
+
+/**
+ * Completion handler of an asynchronously released job. Receives the return
+ * value of the PE or an exception if the release failed. It is executed on a
+ * runtime thread and must not block for long.
+ */
+using JobCompletionHandler =
+    std::function<void(uint64_t, std::exception_ptr)>;
+
+/**
+ * Hand a started job to the runtime and call handler once it has finished.
+ * The job object is consumed.
+ */
+static void release_async(Job *j, bool return_value,
+                          JobCompletionHandler handler) {
+  auto h = new JobCompletionHandler(std::move(handler));
+  auto cb = [](void *user_data, intptr_t status, uint64_t ret_val) {
+    auto h = static_cast<JobCompletionHandler *>(user_data);
+    if (status < 0) {
+      (*h)(0, std::make_exception_ptr(tapasco_error(last_error_message())));
+    } else {
+      (*h)(ret_val, nullptr);
+    }
+    delete h;
+  };
+  if (tapasco_job_release_async(j, return_value, true, cb, h) < 0) {
+    delete h;
+    handle_error();
+  }
+}
+
+/**
+ * Wait for a started job and return the return value of its PE. With release
+ * the PE is released right away, the data is copied back in the background and
+ * handler is called once the copy back is done. The job object is consumed on
+ * success, on error it stays valid.
+ */
+static uint64_t release_deferred(Job *j, bool release,
+                                 JobCompletionHandler handler) {
+  auto h = new JobCompletionHandler(std::move(handler));
+  auto cb = [](void *user_data, intptr_t status, uint64_t ret_val) {
+    auto h = static_cast<JobCompletionHandler *>(user_data);
+    if (status < 0) {
+      (*h)(0, std::make_exception_ptr(tapasco_error(last_error_message())));
+    } else {
+      (*h)(ret_val, nullptr);
+    }
+    delete h;
+  };
+  uint64_t ret_val = 0;
+  if (tapasco_job_release_deferred(j, &ret_val, release, cb, h) < 0) {
+    delete h;
+    handle_error();
+  }
+  return ret_val;
+}
+
+#ifdef TAPASCO_HAS_COROUTINES
+/**
+ * C++20 awaitable for a started job. Awaiting yields the return value of the
+ * PE. The awaiting coroutine is resumed on a runtime thread.
+ */
+class JobAwaitable {
+public:
+  explicit JobAwaitable(Job *j) : job(j) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> h) {
+    this->handle = h;
+    auto cb = [](void *user_data, intptr_t status, uint64_t ret_val) {
+      auto a = static_cast<JobAwaitable *>(user_data);
+      if (status < 0) {
+        a->error = std::make_exception_ptr(tapasco_error(last_error_message()));
+      }
+      a->ret_val = ret_val;
+      a->handle.resume();
+    };
+    if (tapasco_job_release_async(this->job, true, true, cb, this) < 0) {
+      this->error = std::make_exception_ptr(tapasco_error(last_error_message()));
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t await_resume() {
+    if (this->error) {
+      std::rethrow_exception(this->error);
+    }
+    return this->ret_val;
+  }
+
+private:
+  Job *job;
+  std::coroutine_handle<> handle;
+  uint64_t ret_val{0};
+  std::exception_ptr error;
+};
+#endif
+
 /**
  * Wrapping class for release-callback of jobs.
  */
@@ -239,6 +379,108 @@ private:
 };
 using job_future = JobFuture;
 
+/**
+ * Persistent buffer in device memory with a host copy. Passed to jobs as an
+ * argument, only host side changes are transferred before the PE starts and
+ * nothing is copied back after the job. Data written by PEs is fetched on
+ * read() or sync_to_host(). Wrap the buffer in InOnly if the PE only reads
+ * it. Copies refer to the same buffer.
+ **/
+class TapascoBuffer {
+public:
+  TapascoBuffer(TapascoDeviceBuffer *b)
+      : buf(b, tapasco_device_buffer_destroy) {}
+
+  size_t size() const { return tapasco_device_buffer_len(buf.get()); }
+
+  DeviceAddress device_address() const {
+    return tapasco_device_buffer_device_address(buf.get());
+  }
+
+  void write(const void *src, size_t len, size_t offset = 0) {
+    if (tapasco_device_buffer_write(buf.get(), (const uint8_t *)src, len,
+                                    offset) == -1) {
+      handle_error();
+    }
+  }
+
+  void read(void *dst, size_t len, size_t offset = 0) {
+    if (tapasco_device_buffer_read(buf.get(), (uint8_t *)dst, len, offset) ==
+        -1) {
+      handle_error();
+    }
+  }
+
+  /**
+   * Host copy of the buffer. Changes have to be announced with
+   * mark_host_dirty(). Call again after a job wrote the buffer.
+   **/
+  uint8_t *host_ptr() {
+    uint8_t *p = tapasco_device_buffer_host_ptr(buf.get());
+    if (p == 0) {
+      handle_error();
+    }
+    return p;
+  }
+
+  void mark_host_dirty(size_t offset, size_t len) {
+    if (tapasco_device_buffer_mark_host_dirty(buf.get(), offset, len) == -1) {
+      handle_error();
+    }
+  }
+
+  void mark_host_dirty() { mark_host_dirty(0, size()); }
+
+  /** @return Number of bytes transferred. **/
+  size_t sync_to_device() {
+    intptr_t r = tapasco_device_buffer_sync_to_device(buf.get());
+    if (r == -1) {
+      handle_error();
+    }
+    return r;
+  }
+
+  /** @return Number of bytes transferred. **/
+  size_t sync_to_host() {
+    intptr_t r = tapasco_device_buffer_sync_to_host(buf.get());
+    if (r == -1) {
+      handle_error();
+    }
+    return r;
+  }
+
+  TapascoDeviceBuffer *get() const { return buf.get(); }
+
+private:
+  std::shared_ptr<TapascoDeviceBuffer> buf;
+};
+
+/**
+ * Job input kept in the local memories of the PEs it is passed to. The data is
+ * only transferred if the local memory of the PE running the job does not hold
+ * the current content yet. PEs must not write to the buffer. Copies refer to
+ * the same buffer.
+ **/
+class PELocalBuffer {
+public:
+  PELocalBuffer(TapascoLocalBuffer *b) : buf(b, tapasco_local_buffer_destroy) {}
+
+  size_t size() const { return tapasco_local_buffer_len(buf.get()); }
+
+  /** Updates the buffer, copies in local memories are refreshed on next use. **/
+  void write(const void *src, size_t len, size_t offset = 0) {
+    if (tapasco_local_buffer_write(buf.get(), (const uint8_t *)src, len,
+                                   offset) == -1) {
+      handle_error();
+    }
+  }
+
+  TapascoLocalBuffer *get() const { return buf.get(); }
+
+private:
+  std::shared_ptr<TapascoLocalBuffer> buf;
+};
+
 class JobArgumentList {
 public:
   JobArgumentList(Device *d) : device(d) { new_list(); }
@@ -299,6 +541,16 @@ public:
     this->reset_state();
   }
 
+  void bufferop(TapascoDeviceBuffer *b) {
+    tapasco_job_param_buffer(b, this->from_device, this->list_inner);
+    this->reset_state();
+  }
+
+  void localbufferop(TapascoLocalBuffer *b) {
+    tapasco_job_param_local_buffer(b, this->list_inner);
+    this->reset_state();
+  }
+
   void virtaddr(uint8_t *ptr) {
 	  tapasco_job_param_virtualaddress(ptr, this->list_inner);
   }
@@ -392,6 +644,12 @@ private:
     this->memop((uint8_t *)t.value, t.sz);
   }
 
+  /** Sets a persistent device buffer argument (transfer only if modified). **/
+  void set_arg(TapascoBuffer t) { this->bufferop(t.get()); }
+
+  /** Sets a buffer kept in PE-local memory (transfer only if not resident). **/
+  void set_arg(PELocalBuffer t) { this->localbufferop(t.get()); }
+
   /** Sets a virtual address argument used for virtual pointers in SVM feature **/
   template <typename T> void set_arg(VirtualAddress<T> t) {
     this->virtaddr((uint8_t *)t.addr);
@@ -408,6 +666,190 @@ private:
   }
 };
 
+/**
+ * Argument lists for a batch of jobs started with Tapasco::launch_batch.
+ **/
+class JobBatchArguments {
+public:
+  JobBatchArguments(Device *d) : device(d) {}
+
+  /** Adds the arguments of one job to the batch. **/
+  template <typename... Targs> void add(Targs... args) {
+    std::unique_ptr<JobArgumentList> a(new JobArgumentList(this->device));
+    a->set_args(args...);
+    this->lists.push_back(std::move(a));
+  }
+
+  size_t size() const { return this->lists.size(); }
+
+  /**
+   * Launches the batch. The argument lists are consumed by the runtime.
+   * @return Batch object or nullptr in case of an error.
+   **/
+  JobBatch *launch(PEId pe_id) {
+    std::vector<JobList *> l;
+    for (auto &a : this->lists) {
+      l.push_back(*a->list());
+    }
+    JobBatch *b =
+        tapasco_device_launch_batch(this->device, pe_id, l.data(), l.size());
+    for (size_t i = 0; i < l.size(); ++i) {
+      *this->lists[i]->list() = l[i];
+    }
+    return b;
+  }
+
+private:
+  Device *device{0};
+  std::vector<std::unique_ptr<JobArgumentList>> lists;
+};
+
+/**
+ * Future for a batch of jobs. Waits for all jobs of the batch when called
+ * and returns their return values in the order the jobs were added.
+ **/
+class JobBatchFuture {
+public:
+  JobBatchFuture(JobBatch *b, size_t len) : batch(b), len(len) {}
+  JobBatchFuture(const JobBatchFuture &) = delete;
+  JobBatchFuture(JobBatchFuture &&other) : batch(other.batch), len(other.len) {
+    other.batch = 0;
+  }
+
+  virtual ~JobBatchFuture() {
+    if (this->batch != 0) {
+      tapasco_job_batch_release(this->batch, nullptr);
+      this->batch = 0;
+    }
+  }
+
+  std::vector<uint64_t> operator()() {
+    if (this->batch == 0) {
+      throw tapasco_error("Job batch already released.");
+    }
+    std::vector<uint64_t> ret_vals(this->len);
+    JobBatch *b = this->batch;
+    this->batch = 0;
+    if (tapasco_job_batch_release(b, ret_vals.data()) < 0) {
+      handle_error();
+    }
+    return ret_vals;
+  }
+
+private:
+  JobBatch *batch{0};
+  size_t len{0};
+};
+
+/**
+ * Tasks connected through intermediate buffers in device memory. Tasks are
+ * declared in program order, a task reading a buffer runs after the task
+ * writing it. Only the regular arguments of the tasks are transferred between
+ * host and device.
+ **/
+class TapascoGraph {
+public:
+  TapascoGraph(Device *d) : device(d), graph(tapasco_graph_new()) {}
+  TapascoGraph(const TapascoGraph &) = delete;
+  TapascoGraph(TapascoGraph &&other)
+      : device(other.device), graph(other.graph), tasks(other.tasks) {
+    other.graph = 0;
+  }
+
+  virtual ~TapascoGraph() {
+    if (this->graph != 0) {
+      tapasco_graph_destroy(this->graph);
+      this->graph = 0;
+    }
+  }
+
+  /** Declares an intermediate buffer of len bytes. **/
+  GraphBuffer buffer(uintptr_t len) {
+    intptr_t b = tapasco_graph_add_buffer(check_graph(), len);
+    if (b < 0) {
+      handle_error();
+    }
+    return GraphBuffer{static_cast<uintptr_t>(b)};
+  }
+
+  /**
+   * Declares a task on a PE of type pe_id. Arguments are the same as for
+   * Tapasco::launch, graph buffers are passed with makeGraphRead and
+   * makeGraphWrite.
+   * @return ID of the task
+   **/
+  template <typename... Targs> uintptr_t task(PEId pe_id, Targs... args) {
+    intptr_t t = tapasco_graph_add_task(check_graph(), pe_id);
+    if (t < 0) {
+      handle_error();
+    }
+    add_args(static_cast<uintptr_t>(t), args...);
+    ++this->tasks;
+    return static_cast<uintptr_t>(t);
+  }
+
+  /** Runs task after only once task before has finished. **/
+  void depends(uintptr_t before, uintptr_t after) {
+    if (tapasco_graph_add_dependency(check_graph(), before, after) < 0) {
+      handle_error();
+    }
+  }
+
+  /**
+   * Executes all tasks and waits for them. The graph can only be run once.
+   * @return Return values of the tasks in the order they were declared
+   **/
+  std::vector<uint64_t> run() {
+    TaskGraph *g = check_graph();
+    this->graph = 0;
+    std::vector<uint64_t> ret_vals(this->tasks);
+    if (tapasco_graph_run(this->device, g, ret_vals.data()) < 0) {
+      handle_error();
+    }
+    return ret_vals;
+  }
+
+private:
+  TaskGraph *check_graph() {
+    if (this->graph == 0) {
+      throw tapasco_error("Task graph already executed.");
+    }
+    return this->graph;
+  }
+
+  void add_args(uintptr_t) {}
+
+  template <typename T, typename... Targs>
+  void add_args(uintptr_t task, T arg, Targs... args) {
+    add_arg(task, arg);
+    add_args(task, args...);
+  }
+
+  void add_arg(uintptr_t task, GraphRead r) {
+    if (tapasco_graph_task_read(this->graph, task, r.buffer.id) < 0) {
+      handle_error();
+    }
+  }
+
+  void add_arg(uintptr_t task, GraphWrite w) {
+    if (tapasco_graph_task_write(this->graph, task, w.buffer.id) < 0) {
+      handle_error();
+    }
+  }
+
+  template <typename T> void add_arg(uintptr_t task, T arg) {
+    JobArgumentList a(this->device);
+    a.set_args(arg);
+    if (tapasco_graph_task_params(this->graph, task, a.list()) < 0) {
+      handle_error();
+    }
+  }
+
+  Device *device{0};
+  TaskGraph *graph{0};
+  uintptr_t tasks{0};
+};
+
 class TapascoMemory {
 public:
   TapascoMemory(TapascoOffchipMemory *m) : mem(m) {}
@@ -427,6 +869,33 @@ public:
     return a;
   }
 
+  TapascoBuffer alloc_buffer(size_t len) {
+    TapascoDeviceBuffer *b = tapasco_device_buffer_create(mem, len);
+    if (b == 0) {
+      handle_error();
+    }
+    return TapascoBuffer(b);
+  }
+
+  /**
+   * Allocates host memory registered for DMA with this memory. Transfers from
+   * and to the memory, e.g. with makeWrappedPointer, need no staging copy.
+   * Release it with free_host.
+   */
+  void *alloc_host(size_t len) {
+    uint8_t *p = tapasco_alloc_host(mem, len);
+    if (p == 0) {
+      handle_error();
+    }
+    return p;
+  }
+
+  void free_host(void *ptr) {
+    if (tapasco_free_host((uint8_t *)ptr) == -1) {
+      handle_error();
+    }
+  }
+
   DeviceAddress alloc_fixed(uint64_t len, uint64_t offset) {
     DeviceAddress a = tapasco_memory_allocate_fixed(mem, len, offset);
     if (a == (uint64_t)(int64_t)-1) {
@@ -448,6 +917,50 @@ public:
     this->free(handle);
   }
 
+  /**
+   * Return buffers cached in the buffer pool of this memory to the allocator
+   * until at most keep_bytes remain cached.
+   * @return Number of buffers released.
+   */
+  size_t trim_pool(uint64_t keep_bytes = 0) {
+    intptr_t r = tapasco_memory_pool_trim(mem, keep_bytes);
+    if (r == -1) {
+      handle_error();
+    }
+    return r;
+  }
+
+  /**
+   * Set the high-water mark of the buffer pool of this memory in bytes.
+   * 0 disables caching of freed buffers.
+   */
+  void set_pool_limit(uint64_t max_bytes) {
+    if (tapasco_memory_pool_set_limit(mem, max_bytes) == -1) {
+      handle_error();
+    }
+  }
+
+  uint64_t pool_cached_bytes() {
+    return tapasco_memory_pool_cached_bytes(mem);
+  }
+
+  /**
+   * Register host memory for repeated transfers. On PCIe devices the pages are
+   * pinned and transferred without the DMA bounce buffers. The memory has to
+   * stay valid until unregister_host is called.
+   */
+  void register_host(const void *ptr, size_t len) {
+    if (tapasco_memory_register_host(mem, (const uint8_t *)ptr, len) == -1) {
+      handle_error();
+    }
+  }
+
+  void unregister_host(const void *ptr) {
+    if (tapasco_memory_unregister_host(mem, (const uint8_t *)ptr) == -1) {
+      handle_error();
+    }
+  }
+
   int copy_to(uint8_t *d, DeviceAddress a, uint64_t len) {
     if (tapasco_memory_copy_to(mem, d, a, len) == -1) {
       handle_error();
@@ -604,6 +1117,18 @@ public:
     return j;
   }
 
+  /**
+   * Acquire a PE of the given type for the arguments in list, preferring PEs
+   * whose local memory already holds the PELocalBuffer arguments.
+   */
+  Job *acquire_pe_for(PEId pe_id, JobArgumentList &list) {
+    Job *j = tapasco_device_acquire_pe_for(this->device, pe_id, *list.list());
+    if (j == 0) {
+      handle_error();
+    }
+    return j;
+  }
+
   Job *try_acquire_pe(PEId pe_id) {
     Job *j = nullptr;
     if (!tapasco_device_try_acquire_pe(this->device, pe_id, &j)) {
@@ -612,6 +1137,19 @@ public:
     return j;
   }
 
+  /**
+   * Acquire a PE of the given type, waiting at most timeout_us microseconds.
+   * @return Job object or nullptr if no PE became available in time.
+   */
+  Job *acquire_pe_timeout(PEId pe_id, uint64_t timeout_us) {
+    Job *j = nullptr;
+    if (!tapasco_device_acquire_pe_timeout(this->device, pe_id, timeout_us,
+                                           &j)) {
+      handle_error();
+    }
+    return j;
+  }
+
   float design_frequency() {
     return tapasco_device_design_frequency(this->device);
   }
@@ -669,6 +1207,18 @@ public:
     return TapascoDevice(device);
   }
 
+  /**
+   * Allocates all devices as one pool with the given access mode.
+   * @return pool owned by the caller, release it with tapasco_pool_destroy
+   **/
+  DevicePool *allocate_pool(tlkm_access const access) {
+    DevicePool *pool = tapasco_pool_new(this->tlkm, access);
+    if (pool == 0) {
+      handle_error();
+    }
+    return pool;
+  }
+
   int num_devices() {
     // Retrieve the number of devices from the runtime
     int num_devices = 0;
@@ -682,6 +1232,113 @@ private:
   TLKM *tlkm{0};
 };
 
+/**
+ * Description of an in-process software device. Exercises the runtime without
+ * hardware, driver or simulator, e.g. to measure the host overhead of jobs.
+ * PEs are modelled by callables receiving the PE index, the argument registers
+ * and the device memory and returning the PE return value. Models run on a
+ * worker thread per PE. If a model throws, the exception is logged and the PE
+ * completes with return value 0.
+ **/
+class TapascoSoftwareDevice {
+public:
+  typedef std::function<uint64_t(uintptr_t pe, const uint64_t *args,
+                                 uintptr_t num_args, uint8_t *memory,
+                                 uint64_t memory_size)>
+      Model;
+
+  TapascoSoftwareDevice() {
+    tapasco_init_logging();
+    this->config = tapasco_software_config_new();
+  }
+
+  virtual ~TapascoSoftwareDevice() {
+    if (this->config != 0) {
+      tapasco_software_config_destroy(this->config);
+      this->config = 0;
+    }
+  }
+
+  TapascoSoftwareDevice(const TapascoSoftwareDevice &) = delete;
+  TapascoSoftwareDevice &operator=(const TapascoSoftwareDevice &) = delete;
+
+  /**
+   * Set the device memory size and the modelled DMA link.
+   * @param memory_size Size of the device memory in bytes
+   * @param h2c_bandwidth Host to device bandwidth in bytes/s, 0 for unlimited
+   * @param c2h_bandwidth Device to host bandwidth in bytes/s, 0 for unlimited
+   * @param latency_ns Completion latency of a transfer
+   **/
+  void set_memory(uint64_t memory_size, uint64_t h2c_bandwidth,
+                  uint64_t c2h_bandwidth, uint64_t latency_ns) {
+    check_config();
+    if (tapasco_software_config_set_memory(this->config, memory_size,
+                                           h2c_bandwidth, c2h_bandwidth,
+                                           latency_ns) < 0) {
+      handle_error();
+    }
+  }
+
+  /**
+   * Add count PEs of type type_id, each execution taking at least latency_ns.
+   **/
+  void add_pe(PEId type_id, std::string name, uintptr_t count,
+              uint64_t latency_ns, Model model) {
+    check_config();
+    Model *m = new Model(std::move(model));
+    if (tapasco_software_config_add_pe(this->config, type_id, name.c_str(),
+                                       count, latency_ns,
+                                       &TapascoSoftwareDevice::execute,
+                                       &TapascoSoftwareDevice::destroy, m) < 0) {
+      delete m;
+      handle_error();
+    }
+  }
+
+  /**
+   * Create the device. The description is consumed and cannot be used
+   * afterwards.
+   **/
+  TapascoDevice allocate(DeviceId dev_id = 0) {
+    check_config();
+    Device *device = tapasco_software_device_alloc(this->config, dev_id);
+    this->config = 0;
+    if (device == 0) {
+      handle_error();
+    }
+    return TapascoDevice(device);
+  }
+
+private:
+  void check_config() {
+    if (this->config == 0) {
+      throw tapasco_error("Software device has already been allocated.");
+    }
+  }
+
+  static uint64_t execute(void *user_data, uintptr_t pe, const uint64_t *args,
+                          uintptr_t num_args, uint8_t *memory,
+                          uint64_t memory_size) {
+    // exceptions must not unwind into the runtime calling this
+    try {
+      return (*static_cast<Model *>(user_data))(pe, args, num_args, memory,
+                                                memory_size);
+    } catch (std::exception const &e) {
+      std::cerr << "Model of software PE " << pe
+                << " threw, completing with return value 0: " << e.what()
+                << std::endl;
+    } catch (...) {
+      std::cerr << "Model of software PE " << pe
+                << " threw, completing with return value 0." << std::endl;
+    }
+    return 0;
+  }
+
+  static void destroy(void *user_data) { delete static_cast<Model *>(user_data); }
+
+  SoftwareDeviceConfig *config{0};
+};
+
 /**
  * C++ Wrapper class for TaPaSCo API. Currently wraps a single device.
  **/
@@ -717,7 +1374,7 @@ struct Tapasco {
     JobArgumentList a(this->device_internal.get_device());
     a.set_args(args...);
 
-    Job *j = this->device_internal.acquire_pe(pe_id);
+    Job *j = this->device_internal.acquire_pe_for(pe_id, a);
     if (j == 0) {
       handle_error();
     }
@@ -733,7 +1390,7 @@ struct Tapasco {
     JobArgumentList a(this->device_internal.get_device());
     a.set_args(args...);
 
-    Job *j = this->device_internal.acquire_pe(pe_id);
+    Job *j = this->device_internal.acquire_pe_for(pe_id, a);
     if (j == 0) {
       handle_error();
     }
@@ -745,6 +1402,83 @@ struct Tapasco {
     return JobFuture(getCallback(j));
   }
 
+  /**
+   * Create an empty argument list for launch_batch.
+   */
+  JobBatchArguments batch_arguments() {
+    return JobBatchArguments(this->device_internal.get_device());
+  }
+
+  /**
+   * Create an empty task graph for this device.
+   */
+  TapascoGraph graph() {
+    return TapascoGraph(this->device_internal.get_device());
+  }
+
+  /**
+   * Launch one task per argument list in args on PEs of type pe_id. PEs are
+   * acquired and started together, which saves host overhead for short
+   * running tasks.
+   *
+   * @param pe_id PE-ID of the tasks
+   * @param args Argument lists, consumed by this call
+   * @return Future returning the return values of all tasks
+   */
+  JobBatchFuture launch_batch(PEId pe_id, JobBatchArguments &args) {
+    JobBatch *b = args.launch(pe_id);
+    if (b == 0) {
+      handle_error();
+    }
+    return JobBatchFuture(b, args.size());
+  }
+
+  /**
+   * Launch a task and call handler once it has finished instead of returning
+   * a JobFuture. No thread is blocked while the PE is running if the
+   * completion dispatcher is enabled (interrupt.dispatcher).
+   *
+   * @param pe_id PE-ID of this task
+   * @param handler Completion handler receiving the PE return value
+   * @param args PE arguments
+   */
+  template <typename... Targs>
+  void launch_async(PEId pe_id, JobCompletionHandler handler, Targs... args) {
+    JobArgumentList a(this->device_internal.get_device());
+    a.set_args(args...);
+
+    Job *j = this->device_internal.acquire_pe_for(pe_id, a);
+
+    if (tapasco_job_start(j, a.list()) < 0) {
+      handle_error();
+    }
+
+    release_async(j, true, std::move(handler));
+  }
+
+#ifdef TAPASCO_HAS_COROUTINES
+  /**
+   * Launch a task and return an awaitable for use in C++20 coroutines.
+   * co_await yields the PE return value.
+   *
+   * @param pe_id PE-ID of this task
+   * @param args PE arguments
+   */
+  template <typename... Targs>
+  JobAwaitable launch_awaitable(PEId pe_id, Targs... args) {
+    JobArgumentList a(this->device_internal.get_device());
+    a.set_args(args...);
+
+    Job *j = this->device_internal.acquire_pe_for(pe_id, a);
+
+    if (tapasco_job_start(j, a.list()) < 0) {
+      handle_error();
+    }
+
+    return JobAwaitable(j);
+  }
+#endif
+
   /**
    * Launch a task on a PE if a matching PE is available at the moment.
    * An uninitialized JobFuture must be passed by reference and the
@@ -873,6 +1607,43 @@ struct Tapasco {
     return this->default_memory_internal.copy_from(src, dst, len);
   }
 
+  /**
+   * Allocates a persistent buffer in the default memory. The buffer keeps its
+   * device allocation across jobs and is only transferred when modified.
+   * @param len size in bytes
+   * @return buffer handle, freed when the last copy is destroyed
+   **/
+  TapascoBuffer alloc_buffer(size_t len) {
+    return this->default_memory_internal.alloc_buffer(len);
+  }
+
+  /**
+   * Creates a buffer that is kept in the local memories of the PEs it is passed
+   * to. Jobs started with launch prefer PEs that already hold the buffer.
+   * @param data initial content of len bytes
+   **/
+  PELocalBuffer local_buffer(const void *data, size_t len) {
+    TapascoLocalBuffer *b =
+        tapasco_local_buffer_create((const uint8_t *)data, len);
+    if (b == 0) {
+      handle_error();
+    }
+    return PELocalBuffer(b);
+  }
+
+  /**
+   * Allocates host memory backed by huge pages where possible and registered
+   * for DMA with the default memory. Job arguments in this memory are
+   * transferred without staging copies.
+   * @param len size in bytes
+   * @return pointer to the memory, release it with free_host
+   **/
+  void *alloc_host(size_t len) {
+    return this->default_memory_internal.alloc_host(len);
+  }
+
+  void free_host(void *ptr) { this->default_memory_internal.free_host(ptr); }
+
   /**
    * Returns the number of PEs of kernel k_id in the currently loaded
    *bitstream.
@@ -1002,6 +1773,186 @@ private:
   TapascoMemory default_memory_internal;
 };
 
+/**
+ * C++ Wrapper class for all TaPaSCo devices of the system. The PEs of the
+ * devices are merged by type; each job is started on the device with the
+ * lowest load for its PE type. Buffer arguments are placed in the default
+ * memory of that device. Persistent buffers are bound to a single device and
+ * cannot be passed to pool jobs.
+ **/
+class TapascoPool {
+public:
+  TapascoPool(tlkm_access const access = tlkm_access::TlkmAccessExclusive)
+      : driver_internal(), pool(driver_internal.allocate_pool(access)) {}
+
+  virtual ~TapascoPool() {
+    if (this->pool != 0) {
+      tapasco_pool_destroy(this->pool);
+      this->pool = 0;
+    }
+  }
+
+  TapascoPool(const TapascoPool &) = delete;
+  TapascoPool &operator=(const TapascoPool &) = delete;
+
+  size_t num_devices() const { return tapasco_pool_len(this->pool); }
+
+  /** Device of the pool, owned by the pool. **/
+  Device *device(size_t idx) const {
+    Device *d = tapasco_pool_device(this->pool, idx);
+    if (d == 0) {
+      handle_error();
+    }
+    return d;
+  }
+
+  /** Returns the number of PEs of the given kernel on all devices. **/
+  int kernel_pe_count(PEId k_id) {
+    intptr_t cnt = tapasco_pool_num_pes(this->pool, k_id);
+    if (cnt < 0) {
+      handle_error();
+    }
+    return cnt;
+  }
+
+  PEId get_pe_id(std::string name) {
+    PEId peid = tapasco_pool_get_pe_id(this->pool, name.c_str());
+    if (peid == (PEId)-1) {
+      handle_error();
+    }
+    return peid;
+  }
+
+  template <typename R, typename... Targs>
+  JobFuture launch(PEId pe_id, RetVal<R> &ret, Targs... args) {
+    Job *j = start(pe_id, args...);
+    R *value = ret.value;
+    return JobFuture([j, value](bool block) {
+      uint64_t ret_val;
+      int r = release(j, &ret_val, block);
+      if (r == 0) {
+        *value = (R)ret_val;
+      }
+      return r;
+    });
+  }
+
+  template <typename... Targs> JobFuture launch(PEId pe_id, Targs... args) {
+    Job *j = start(pe_id, args...);
+    return JobFuture(
+        [j](bool block) { return release(j, nullptr, block); });
+  }
+
+private:
+  template <typename... Targs> Job *start(PEId pe_id, Targs... args) {
+    // Transfers are moved to the memory of the chosen device on launch
+    JobArgumentList a(this->device(0));
+    a.set_args(args...);
+    Job *j = tapasco_pool_launch(this->pool, pe_id, a.list(), nullptr);
+    if (j == 0) {
+      handle_error();
+    }
+    return j;
+  }
+
+  /** @return 0 if the job has been released, 1 if it is still running. **/
+  static int release(Job *j, uint64_t *ret_val, bool block) {
+    if (block) {
+      if (tapasco_job_release(j, ret_val, true) < 0) {
+        handle_error();
+      }
+      return 0;
+    }
+    int r = tapasco_job_try_release(j, ret_val, true);
+    if (r < 0) {
+      handle_error();
+    }
+    return r;
+  }
+
+  TapascoDriver driver_internal;
+  DevicePool *pool{0};
+};
+
+/**
+ * Latency breakdown of the jobs of all devices. Recording is switched on with
+ * enable() or the `latency.enabled` setting. Durations are given in ns.
+ **/
+class Latency {
+public:
+  using ExportHook = std::function<void(const JobLatency &)>;
+
+  static void enable(bool const on = true) { tapasco_latency_enable(on); }
+  static bool enabled() { return tapasco_latency_is_enabled(); }
+
+  /** Discard all recorded latencies. **/
+  static void reset() { tapasco_latency_reset(); }
+
+  /** Hand the latencies recorded so far to the statistics and export hook. **/
+  static void flush() { tapasco_latency_flush(); }
+
+  /** Number of records lost because they were not collected in time. **/
+  static uint64_t dropped() { return tapasco_latency_dropped(); }
+
+  /** Summary of the given stage for all jobs on PEs of the given kernel. **/
+  static LatencySummary summary(PEId k_id,
+                                LatencyStage const stage = LatencyStage::Total) {
+    LatencySummary s;
+    if (tapasco_latency_summary(k_id, stage, &s) < 0) {
+      handle_error();
+    }
+    return s;
+  }
+
+  /**
+   * Call hook with every recorded job. It runs on the threads using TaPaSCo
+   * and must not use this class. An empty hook removes the current one.
+   **/
+  static void set_export_hook(ExportHook hook) {
+    std::unique_ptr<ExportHook> h;
+    if (hook) {
+      h.reset(new ExportHook(std::move(hook)));
+      auto cb = [](void *user_data, const JobLatency *l) {
+        (*static_cast<ExportHook *>(user_data))(*l);
+      };
+      tapasco_latency_set_export_hook(cb, h.get());
+    } else {
+      tapasco_latency_set_export_hook(nullptr, nullptr);
+    }
+    // The previous hook is no longer called once it has been replaced
+    installed_hook() = std::move(h);
+  }
+
+private:
+  static std::unique_ptr<ExportHook> &installed_hook() {
+    static std::unique_ptr<ExportHook> h;
+    return h;
+  }
+};
+
+/**
+ * Timeline trace of the jobs, DMA transfers and interrupt waits of all
+ * devices in the Chrome trace event format, e.g. for https://ui.perfetto.dev.
+ * Tracing can also be started with the `trace.file` setting.
+ **/
+class Trace {
+public:
+  static void start(std::string const &path) {
+    if (tapasco_trace_start(path.c_str()) < 0) {
+      handle_error();
+    }
+  }
+
+  /** Complete the trace file. Done automatically when the process exits. **/
+  static void finish() {
+    if (tapasco_trace_finish() < 0) {
+      handle_error();
+    }
+  }
+
+  static bool enabled() { return tapasco_trace_is_enabled(); }
+};
+
 } /* namespace tapasco */
 
 #endif /* TAPASCO_HPP__ */
@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+use crate::device::{Device, PEParameter};
+use crate::device_buffer::DeviceBuffer;
+use crate::job::Job;
+use crate::pe::PEId;
+use futures::stream::{FuturesUnordered, StreamExt};
+use snafu::ResultExt;
+use std::collections::VecDeque;
+use std::future::Future;
+use std::pin::Pin;
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Device Error: {}", source))]
+    DeviceError { source: crate::device::Error },
+
+    #[snafu(display("Task {} failed: {}", task, source))]
+    TaskFailed {
+        source: crate::job::Error,
+        task: TaskId,
+    },
+
+    #[snafu(display("Could not allocate intermediate buffer {}: {}", buffer, source))]
+    BufferAllocation {
+        source: crate::device_buffer::Error,
+        buffer: BufferId,
+    },
+
+    #[snafu(display("Task {} does not exist in this graph.", task))]
+    UnknownTask { task: TaskId },
+
+    #[snafu(display("Buffer {} does not exist in this graph.", buffer))]
+    UnknownBuffer { buffer: BufferId },
+
+    #[snafu(display(
+        "Task {} has to be declared before task {} to run before it.",
+        before,
+        after
+    ))]
+    DependencyOrder { before: TaskId, after: TaskId },
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+pub type TaskId = usize;
+pub type BufferId = usize;
+
+/// Argument of a task in a [`TaskGraph`].
+#[derive(Debug)]
+pub enum GraphArg {
+    /// Regular job parameter, e.g. a value or a transfer from or to host memory.
+    Param(PEParameter),
+    /// Device address of an intermediate buffer the task reads.
+    Read(BufferId),
+    /// Device address of an intermediate buffer the task writes.
+    Write(BufferId),
+}
+
+/// Result of a task after the graph has been executed.
+#[derive(Debug)]
+pub struct TaskResult {
+    pub return_value: u64,
+    /// Memories returned by [`Job::start`] followed by the ones returned by
+    /// [`Job::release`], in the order of the task arguments.
+    ///
+    /// [`Job::start`]: ../job/struct.Job.html#method.start
+    /// [`Job::release`]: ../job/struct.Job.html#method.release
+    pub memories: Vec<Box<[u8]>>,
+}
+
+#[derive(Debug)]
+struct Task {
+    pe_id: PEId,
+    args: Vec<GraphArg>,
+    after: Vec<TaskId>,
+}
+
+type TaskOutput = (TaskId, crate::job::Result<(u64, Vec<Box<[u8]>>)>);
+
+// Release of a launched task, owns the job of the task
+type Release = Pin<Box<dyn Future<Output = TaskOutput>>>;
+
+/// Launched tasks of a graph.
+///
+/// With the completion dispatcher the jobs are awaited through their interrupts and
+/// finish in any order. Without it a PE cannot wake the waiting task, so the oldest job
+/// is released with a blocking wait for its interrupt instead.
+enum Running {
+    Async(FuturesUnordered<Release>),
+    Blocking(VecDeque<(TaskId, Job)>),
+}
+
+impl Running {
+    fn new(dispatcher: bool) -> Self {
+        if dispatcher {
+            Running::Async(FuturesUnordered::new())
+        } else {
+            Running::Blocking(VecDeque::new())
+        }
+    }
+
+    fn is_empty(&self) -> bool {
+        match self {
+            Running::Async(r) => r.is_empty(),
+            Running::Blocking(r) => r.is_empty(),
+        }
+    }
+
+    fn push(&mut self, id: TaskId, mut job: Job) {
+        match self {
+            Running::Async(r) => r.push(Box::pin(async move {
+                let r = job.release_async(true, true).await;
+                (id, r)
+            })),
+            Running::Blocking(r) => r.push_back((id, job)),
+        }
+    }
+
+    /// Wait for the next task to finish, None if no task is running.
+    async fn next(&mut self) -> Option<TaskOutput> {
+        match self {
+            Running::Async(r) => r.next().await,
+            Running::Blocking(r) => r
+                .pop_front()
+                .map(|(id, mut job)| (id, job.release(true, true))),
+        }
+    }
+}
+
+/// Jobs connected through buffers that stay in device memory.
+///
+/// Tasks are declared in program order. A task reading a buffer runs after the last task
+/// declared before it that writes the buffer, a task writing a buffer also waits for the
+/// tasks reading the previous content. Further ordering can be added with
+/// [`add_dependency`].
+///
+/// Intermediate buffers are allocated in the default memory of the device when their
+/// first task is launched and freed as soon as their last task has finished. Only
+/// [`GraphArg::Param`] arguments are transferred between host and device, so a pipeline
+/// of PEs pays for PCIe transfers only at its inputs and outputs.
+///
+/// [`add_dependency`]: #method.add_dependency
+/// [`GraphArg::Param`]: enum.GraphArg.html#variant.Param
+#[derive(Debug, Default)]
+pub struct TaskGraph {
+    tasks: Vec<Task>,
+    buffers: Vec<usize>,
+}
+
+impl TaskGraph {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of tasks in the graph.
+    pub fn len(&self) -> usize {
+        self.tasks.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.tasks.is_empty()
+    }
+
+    /// Declare an intermediate buffer of `len` bytes.
+    pub fn add_buffer(&mut self, len: usize) -> BufferId {
+        self.buffers.push(len);
+        self.buffers.len() - 1
+    }
+
+    /// Declare a task running on a PE of type `pe_id` with the given arguments.
+    pub fn add_task(&mut self, pe_id: PEId, args: Vec<GraphArg>) -> Result<TaskId> {
+        for arg in args.iter() {
+            self.check_arg(arg)?;
+        }
+        self.tasks.push(Task {
+            pe_id,
+            args,
+            after: Vec::new(),
+        });
+        Ok(self.tasks.len() - 1)
+    }
+
+    /// Append an argument to an already declared task.
+    pub fn push_arg(&mut self, task: TaskId, arg: GraphArg) -> Result<()> {
+        self.check_arg(&arg)?;
+        match self.tasks.get_mut(task) {
+            Some(t) => {
+                t.args.push(arg);
+                Ok(())
+            }
+            None => Err(Error::UnknownTask { task }),
+        }
+    }
+
+    /// Run `after` only once `before` has finished.
+    pub fn add_dependency(&mut self, before: TaskId, after: TaskId) -> Result<()> {
+        ensure!(before < self.tasks.len(), UnknownTaskSnafu { task: before });
+        ensure!(after < self.tasks.len(), UnknownTaskSnafu { task: after });
+        ensure!(before < after, DependencyOrderSnafu { before, after });
+        self.tasks[after].after.push(before);
+        Ok(())
+    }
+
+    fn check_arg(&self, arg: &GraphArg) -> Result<()> {
+        match *arg {
+            GraphArg::Read(buffer) | GraphArg::Write(buffer) => {
+                ensure!(buffer < self.buffers.len(), UnknownBufferSnafu { buffer });
+                Ok(())
+            }
+            GraphArg::Param(_) => Ok(()),
+        }
+    }
+
+    /// Predecessors of every task, derived from the buffer accesses and the explicit
+    /// dependencies.
+    fn predecessors(&self) -> Vec<Vec<TaskId>> {
+        let mut last_writer: Vec<Option<TaskId>> = vec![None; self.buffers.len()];
+        let mut readers: Vec<Vec<TaskId>> = vec![Vec::new(); self.buffers.len()];
+        let mut preds = Vec::with_capacity(self.tasks.len());
+        for (id, task) in self.tasks.iter().enumerate() {
+            let mut p = task.after.clone();
+            for arg in task.args.iter() {
+                match *arg {
+                    GraphArg::Read(b) => {
+                        p.extend(last_writer[b]);
+                        readers[b].push(id);
+                    }
+                    GraphArg::Write(b) => {
+                        p.extend(last_writer[b]);
+                        p.append(&mut readers[b]);
+                        last_writer[b] = Some(id);
+                    }
+                    GraphArg::Param(_) => (),
+                }
+            }
+            p.sort_unstable();
+            p.dedup();
+            p.retain(|x| *x != id);
+            preds.push(p);
+        }
+        preds
+    }
+
+    /// Execute all tasks on `device` and wait for them.
+    ///
+    /// A task is launched as soon as its predecessors have finished and a PE is idle.
+    /// Completions are awaited through the PE interrupts, the calling thread sleeps while
+    /// no task can make progress. With the completion dispatcher (`interrupt.dispatcher`)
+    /// tasks are handled in the order they finish, otherwise in the order they were
+    /// launched.
+    ///
+    /// Returns the results in the order the tasks were declared. On error no further
+    /// tasks are launched, the tasks already running are waited for and all intermediate
+    /// buffers are freed before returning.
+    pub fn run(self, device: &Device) -> Result<Vec<TaskResult>> {
+        let num_tasks = self.tasks.len();
+        trace!(
+            "Running task graph of {} tasks and {} buffers.",
+            num_tasks,
+            self.buffers.len()
+        );
+        let memory = device.default_memory().context(DeviceSnafu)?;
+
+        let preds = self.predecessors();
+        let mut missing: Vec<usize> = preds.iter().map(|p| p.len()).collect();
+        let mut successors: Vec<Vec<TaskId>> = vec![Vec::new(); num_tasks];
+        for (id, p) in preds.iter().enumerate() {
+            for b in p {
+                successors[*b].push(id);
+            }
+        }
+
+        // Number of unfinished tasks using each buffer, it is freed once this drops to 0
+        let task_buffers: Vec<Vec<BufferId>> = self
+            .tasks
+            .iter()
+            .map(|task| {
+                let mut used: Vec<BufferId> = task
+                    .args
+                    .iter()
+                    .filter_map(|a| match *a {
+                        GraphArg::Read(b) | GraphArg::Write(b) => Some(b),
+                        GraphArg::Param(_) => None,
+                    })
+                    .collect();
+                used.sort_unstable();
+                used.dedup();
+                used
+            })
+            .collect();
+        let mut users = vec![0usize; self.buffers.len()];
+        for b in task_buffers.iter().flatten() {
+            users[*b] += 1;
+        }
+
+        let lens = self.buffers;
+        let mut buffers: Vec<Option<DeviceBuffer>> = (0..lens.len()).map(|_| None).collect();
+        let mut tasks: Vec<Option<Task>> = self.tasks.into_iter().map(Some).collect();
+        let mut results: Vec<Option<TaskResult>> = (0..num_tasks).map(|_| None).collect();
+        let mut ready: VecDeque<TaskId> = (0..num_tasks).filter(|t| missing[*t] == 0).collect();
+        let mut running = Running::new(device.has_completion_dispatcher());
+
+        futures::executor::block_on(async {
+            let r = async {
+                loop {
+                    let mut blocked = VecDeque::new();
+                    while let Some(id) = ready.pop_front() {
+                        let pe_id = tasks[id].as_ref().unwrap().pe_id;
+                        let mut job = match device.try_acquire_pe(pe_id).context(DeviceSnafu)? {
+                            Some(job) => job,
+                            // No task of this graph will free a PE, wait for other users
+                            None if running.is_empty() => {
+                                device.acquire_pe(pe_id).context(DeviceSnafu)?
+                            }
+                            None => {
+                                blocked.push_back(id);
+                                continue;
+                            }
+                        };
+
+                        let mut params = Vec::new();
+                        for arg in tasks[id].take().unwrap().args {
+                            let b = match arg {
+                                GraphArg::Param(p) => {
+                                    params.push(p);
+                                    continue;
+                                }
+                                GraphArg::Read(b) | GraphArg::Write(b) => b,
+                            };
+                            if buffers[b].is_none() {
+                                trace!("Allocating intermediate buffer {} of {} bytes.", b, lens[b]);
+                                buffers[b] = Some(
+                                    DeviceBuffer::new(memory.clone(), lens[b])
+                                        .context(BufferAllocationSnafu { buffer: b })?,
+                                );
+                            }
+                            let addr = *buffers[b].as_ref().unwrap().device_address();
+                            params.push(PEParameter::DeviceAddress(addr));
+                        }
+
+                        trace!("Launching task {} of graph on PE type {}.", id, pe_id);
+                        let unused = job.start(params).context(TaskFailedSnafu { task: id })?;
+                        results[id] = Some(TaskResult {
+                            return_value: 0,
+                            memories: unused,
+                        });
+                        running.push(id, job);
+                    }
+                    ready = blocked;
+
+                    let (id, r) = match running.next().await {
+                        Some(x) => x,
+                        None => break,
+                    };
+                    let (return_value, memories) = r.context(TaskFailedSnafu { task: id })?;
+                    trace!("Task {} of graph finished.", id);
+                    let result = results[id].as_mut().unwrap();
+                    result.return_value = return_value;
+                    result.memories.extend(memories);
+
+                    for b in task_buffers[id].iter() {
+                        users[*b] -= 1;
+                        if users[*b] == 0 {
+                            trace!("Freeing intermediate buffer {}.", b);
+                            buffers[*b] = None;
+                        }
+                    }
+                    for s in successors[id].iter() {
+                        missing[*s] -= 1;
+                        if missing[*s] == 0 {
+                            ready.push_back(*s);
+                        }
+                    }
+                }
+                Ok::<(), Error>(())
+            }
+            .await;
+            if r.is_err() {
+                // Running tasks still use the intermediate buffers
+                while let Some((id, r)) = running.next().await {
+                    if let Err(e) = r {
+                        warn!("Task {} of failed task graph: {}", id, e);
+                    }
+                }
+            }
+            r
+        })?;
+
+        Ok(results.into_iter().map(|r| r.unwrap()).collect())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device::DataTransferAlloc;
+    use crate::software_device::{sum_config, PEContext, SUM};
+    use crate::tlkm::tlkm_access;
+    use std::collections::HashMap;
+    use std::sync::Arc;
+    use std::time::Duration;
+
+    const FILL: PEId = 1;
+
+    #[test]
+    fn dependencies_follow_buffers() {
+        let mut g = TaskGraph::new();
+        let b = g.add_buffer(16);
+        let c = g.add_buffer(16);
+        let w = g.add_task(FILL, vec![GraphArg::Write(b)]).unwrap();
+        let r1 = g.add_task(SUM, vec![GraphArg::Read(b), GraphArg::Write(c)]).unwrap();
+        let r2 = g.add_task(SUM, vec![GraphArg::Read(b)]).unwrap();
+        let w2 = g.add_task(FILL, vec![GraphArg::Write(b)]).unwrap();
+        let last = g.add_task(SUM, vec![GraphArg::Read(c)]).unwrap();
+        g.add_dependency(r2, last).unwrap();
+
+        let p = g.predecessors();
+        assert!(p[w].is_empty());
+        assert_eq!(p[r1], vec![w]);
+        assert_eq!(p[r2], vec![w]);
+        assert_eq!(p[w2], vec![w, r1, r2]);
+        assert_eq!(p[last], vec![r1, r2]);
+    }
+
+    #[test]
+    fn invalid_references() {
+        let mut g = TaskGraph::new();
+        assert!(g.add_task(FILL, vec![GraphArg::Read(0)]).is_err());
+        let a = g.add_task(FILL, Vec::new()).unwrap();
+        let b = g.add_task(FILL, Vec::new()).unwrap();
+        assert!(g.add_dependency(b, a).is_err());
+        assert!(g.push_arg(5, GraphArg::Param(PEParameter::Single64(0))).is_err());
+    }
+
+    fn device(latency: Duration) -> Device {
+        let mut config = sum_config(1, Duration::ZERO);
+        // Fills arg(2) bytes at arg(1) with arg(0)
+        config.add_pe(
+            FILL,
+            "fill",
+            1,
+            latency,
+            Arc::new(|ctx: &PEContext| {
+                let data = vec![ctx.arg(0) as u8; ctx.arg(2) as usize];
+                ctx.memory().write(ctx.arg(1), &data).unwrap();
+                0
+            }),
+        );
+        let mut device = Device::new_software(0, config, &HashMap::new()).unwrap();
+        device
+            .change_access(tlkm_access::TlkmAccessExclusive)
+            .unwrap();
+        device
+    }
+
+    #[test]
+    fn pipeline_on_software_device() {
+        let device = device(Duration::ZERO);
+        let memory = device.default_memory().unwrap();
+
+        let mut g = TaskGraph::new();
+        let b = g.add_buffer(64);
+        g.add_task(
+            FILL,
+            vec![
+                GraphArg::Param(PEParameter::Single64(3)),
+                GraphArg::Write(b),
+                GraphArg::Param(PEParameter::Single64(64)),
+            ],
+        )
+        .unwrap();
+        g.add_task(
+            SUM,
+            vec![GraphArg::Read(b), GraphArg::Param(PEParameter::Single64(64))],
+        )
+        .unwrap();
+        // Host input next to the intermediate
+        g.add_task(
+            SUM,
+            vec![
+                GraphArg::Param(PEParameter::DataTransferAlloc(DataTransferAlloc {
+                    data: vec![2u8; 8].into_boxed_slice(),
+                    from_device: false,
+                    to_device: true,
+                    free: true,
+                    memory,
+                    fixed: None,
+                })),
+                GraphArg::Param(PEParameter::Single64(8)),
+            ],
+        )
+        .unwrap();
+
+        let r = g.run(&device).unwrap();
+        assert_eq!(r.len(), 3);
+        assert_eq!(r[1].return_value, 3 * 64);
+        assert_eq!(r[2].return_value, 2 * 8);
+        assert_eq!(r[2].memories.len(), 1);
+    }
+
+    #[test]
+    fn failed_task_waits_for_running_tasks() {
+        let device = device(Duration::from_millis(20));
+        let memory = device.default_memory().unwrap();
+
+        let mut g = TaskGraph::new();
+        let b = g.add_buffer(64);
+        g.add_task(
+            FILL,
+            vec![
+                GraphArg::Param(PEParameter::Single64(3)),
+                GraphArg::Write(b),
+                GraphArg::Param(PEParameter::Single64(64)),
+            ],
+        )
+        .unwrap();
+        // Independent of the first task, fails to start without SVM
+        g.add_task(
+            SUM,
+            vec![GraphArg::Param(PEParameter::VirtualAddress(std::ptr::null()))],
+        )
+        .unwrap();
+        g.add_task(
+            SUM,
+            vec![GraphArg::Read(b), GraphArg::Param(PEParameter::Single64(64))],
+        )
+        .unwrap();
+
+        match g.run(&device) {
+            Err(Error::TaskFailed { task, .. }) => assert_eq!(task, 1),
+            r => panic!("unexpected result {:?}", r),
+        }
+        // The fill task has finished and the intermediate buffer is freed
+        assert!(device.try_acquire_pe(FILL).unwrap().is_some());
+        let a = memory.allocate_fixed(1024 * 1024, 0).unwrap();
+        memory.allocator().lock().unwrap().free(a).unwrap();
+    }
+}
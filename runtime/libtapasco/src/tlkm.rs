@@ -235,6 +235,7 @@ pub struct tlkm_dma_buffer_allocate {
     pub from_device: bool,
     pub buffer_id: usize,
     pub addr: u64,
+    pub coherent: bool,
 }
 
 #[repr(C)]
@@ -243,6 +244,25 @@ pub struct tlkm_dma_buffer_op {
     pub buffer_id: usize,
 }
 
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct tlkm_dma_segment {
+    pub addr: u64,
+    pub len: u64,
+}
+
+#[repr(C)]
+#[derive(Debug, PartialEq)]
+pub struct tlkm_dma_pin_cmd {
+    pub user_addr: u64,
+    pub len: u64,
+    pub segments: u64,
+    pub max_segments: usize,
+    pub num_segments: usize,
+    pub buffer_id: usize,
+    pub coherent: bool,
+}
+
 #[repr(C)]
 #[derive(Debug, PartialEq)]
 pub struct tlkm_gp_buffer_allocate_cmd {
@@ -272,6 +292,10 @@ const TLKM_IOCTL_KERNEL_BUFFER_ALLOCATE: u8 = 0x44;
 const TLKM_IOCTL_KERNEL_BUFFER_FREE: u8 = 0x45;
 const TLKM_IOCTL_KERNEL_BUFFER_MAP: u8 = 0x46;
 const TLKM_IOCTL_KERNEL_BUFFER_UNMAP: u8 = 0x47;
+const TLKM_IOCTL_DMA_BUFFER_PIN: u8 = 0x48;
+const TLKM_IOCTL_DMA_BUFFER_UNPIN: u8 = 0x49;
+const TLKM_IOCTL_DMA_PINNED_TO_DEV: u8 = 0x4A;
+const TLKM_IOCTL_DMA_PINNED_FROM_DEV: u8 = 0x4B;
 const TLKM_IOCTL_PCIE_BAR_ADDR: u8 = 0x4F;
 
 ioctl_readwrite!(
@@ -330,6 +354,34 @@ ioctl_readwrite!(
     tlkm_dma_buffer_op
 );
 
+ioctl_readwrite!(
+    tlkm_ioctl_dma_buffer_pin,
+    TLKM_DEVICE_IOC_MAGIC,
+    TLKM_IOCTL_DMA_BUFFER_PIN,
+    tlkm_dma_pin_cmd
+);
+
+ioctl_readwrite!(
+    tlkm_ioctl_dma_buffer_unpin,
+    TLKM_DEVICE_IOC_MAGIC,
+    TLKM_IOCTL_DMA_BUFFER_UNPIN,
+    tlkm_dma_buffer_op
+);
+
+ioctl_readwrite!(
+    tlkm_ioctl_dma_pinned_to_dev,
+    TLKM_DEVICE_IOC_MAGIC,
+    TLKM_IOCTL_DMA_PINNED_TO_DEV,
+    tlkm_dma_buffer_op
+);
+
+ioctl_readwrite!(
+    tlkm_ioctl_dma_pinned_from_dev,
+    TLKM_DEVICE_IOC_MAGIC,
+    TLKM_IOCTL_DMA_PINNED_FROM_DEV,
+    tlkm_dma_buffer_op
+);
+
 ioctl_readwrite!(
     tlkm_ioctl_bar_addr,
     TLKM_DEVICE_IOC_MAGIC,
@@ -407,20 +459,26 @@ impl Drop for TLKM {
     }
 }
 
+/// Load the runtime configuration
+///
+/// The built-in defaults are overridden by the configuration files and the environment.
+pub(crate) fn load_settings() -> std::result::Result<Config, config::ConfigError> {
+    let default_config = include_str!("../config/default.toml");
+    Config::builder()
+        .add_source(config::File::from_str(
+            default_config,
+            config::FileFormat::Toml,
+        ))
+        .add_source(config::File::with_name("/etc/tapasco/TapascoConfig").required(false))
+        .add_source(config::File::with_name("TapascoConfig").required(false))
+        .add_source(config::Environment::with_prefix("tapasco").separator("__"))
+        .build()
+}
+
 impl TLKM {
     /// Open the driver chardev.
     pub fn new() -> Result<Self> {
-        let default_config = include_str!("../config/default.toml");
-        let settings = Config::builder()
-            .add_source(config::File::from_str(
-                default_config,
-                config::FileFormat::Toml,
-            ))
-            .add_source(config::File::with_name("/etc/tapasco/TapascoConfig").required(false))
-            .add_source(config::File::with_name("TapascoConfig").required(false))
-            .add_source(config::Environment::with_prefix("tapasco").separator("__"))
-            .build()
-            .context(ConfigSnafu)?;
+        let settings = load_settings().context(ConfigSnafu)?;
 
         trace!("Using config: {:?}", settings);
 
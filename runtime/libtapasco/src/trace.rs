@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2014-2024 Embedded Systems and Applications, TU Darmstadt.
+ *
+ * This file is part of TaPaSCo
+ * (see https://github.com/esa-tu-darmstadt/tapasco).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//! Timeline traces of jobs, DMA transfers and interrupt waits.
+//!
+//! Traces are written in the JSON array flavour of the Chrome trace event format, which
+//! is read by Perfetto (<https://ui.perfetto.dev>) and `chrome://tracing`. Tracing is
+//! started by setting `trace.file` or through [`start`]. The file is completed by
+//! [`finish`] or when the process exits.
+//!
+//! Each device is shown as a process with one track per PE and per DMA direction. Host
+//! threads are grouped in a process of their own. Flow arrows lead from the start of a
+//! job through its execution on the PE to its release.
+//!
+//! A disabled tracer costs one relaxed atomic load per traced operation.
+
+use crate::device::DeviceAddress;
+use crate::dma::DMAControl;
+use crate::pe::PEId;
+use crate::tlkm::DeviceId;
+use once_cell::sync::Lazy;
+use snafu::ResultExt;
+use std::collections::{HashMap, HashSet};
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Mutex, MutexGuard};
+use std::time::Instant;
+
+#[derive(Debug, Snafu)]
+pub enum Error {
+    #[snafu(display("Could not write trace file {}: {}", path, source))]
+    TraceFile {
+        path: String,
+        source: std::io::Error,
+    },
+
+    #[snafu(display("A trace is written to {} already.", path))]
+    AlreadyTracing { path: String },
+}
+
+type Result<T, E = Error> = std::result::Result<T, E>;
+
+// Host threads are shown in process 0, device `d` in process `d + 1`
+const HOST_PID: u64 = 0;
+const DMA_TO_DEVICE_TID: u64 = 1 << 20;
+const DMA_FROM_DEVICE_TID: u64 = DMA_TO_DEVICE_TID + 1;
+
+/// Track of a trace event.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) enum Track {
+    /// Host thread as returned by [`thread_id`].
+    Thread(u64),
+    Pe {
+        device: DeviceId,
+        pe: usize,
+        pe_type: PEId,
+    },
+    Dma {
+        device: DeviceId,
+        to_device: bool,
+    },
+}
+
+impl Track {
+    fn pid(&self) -> u64 {
+        match self {
+            Track::Thread(_) => HOST_PID,
+            Track::Pe { device, .. } | Track::Dma { device, .. } => *device as u64 + 1,
+        }
+    }
+
+    fn tid(&self) -> u64 {
+        match self {
+            Track::Thread(t) => *t,
+            Track::Pe { pe, .. } => *pe as u64,
+            Track::Dma { to_device: true, .. } => DMA_TO_DEVICE_TID,
+            Track::Dma { to_device: false, .. } => DMA_FROM_DEVICE_TID,
+        }
+    }
+
+    fn process_name(&self) -> String {
+        match self {
+            Track::Thread(_) => "Host".to_string(),
+            Track::Pe { device, .. } | Track::Dma { device, .. } => format!("Device {}", device),
+        }
+    }
+}
+
+struct Tracer {
+    path: String,
+    out: BufWriter<File>,
+    events: usize,
+    processes: HashSet<u64>,
+    tracks: HashSet<Track>,
+    thread_names: HashMap<u64, String>,
+}
+
+impl Tracer {
+    fn write(&mut self, event: &str) {
+        let sep = if self.events == 0 { "" } else { ",\n" };
+        self.events += 1;
+        if let Err(e) = write!(self.out, "{}{}", sep, event) {
+            warn!("Could not write trace event to {}: {}", self.path, e);
+        }
+    }
+
+    fn metadata(&mut self, pid: u64, tid: Option<u64>, name: &str, value: &str) {
+        let tid = tid.map_or(String::new(), |t| format!(",\"tid\":{}", t));
+        self.write(&format!(
+            "{{\"name\":\"{}\",\"ph\":\"M\",\"pid\":{}{},\"args\":{{\"name\":{}}}}}",
+            name,
+            pid,
+            tid,
+            json_string(value)
+        ));
+    }
+
+    /// Name the track and its process when it is used for the first time.
+    fn announce(&mut self, track: Track) {
+        if !self.tracks.insert(track) {
+            return;
+        }
+        let pid = track.pid();
+        if self.processes.insert(pid) {
+            self.metadata(pid, None, "process_name", &track.process_name());
+        }
+        let name = match track {
+            Track::Thread(t) => self
+                .thread_names
+                .get(&t)
+                .cloned()
+                .unwrap_or_else(|| format!("Thread {}", t)),
+            Track::Pe { pe, pe_type, .. } => format!("PE {} (type {})", pe, pe_type),
+            Track::Dma { to_device: true, .. } => "DMA to device".to_string(),
+            Track::Dma { to_device: false, .. } => "DMA from device".to_string(),
+        };
+        self.metadata(pid, Some(track.tid()), "thread_name", &name);
+    }
+
+    fn event(&mut self, track: Track, fields: &str) {
+        self.announce(track);
+        self.write(&format!(
+            "{{\"pid\":{},\"tid\":{},{}}}",
+            track.pid(),
+            track.tid(),
+            fields
+        ));
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static EPOCH: Lazy<Instant> = Lazy::new(Instant::now);
+static TRACER: Lazy<Mutex<Option<Tracer>>> = Lazy::new(|| Mutex::new(None));
+static NEXT_THREAD: AtomicU64 = AtomicU64::new(1);
+static NEXT_FLOW: AtomicU64 = AtomicU64::new(1);
+
+thread_local! {
+    static THREAD_ID: u64 = {
+        let id = NEXT_THREAD.fetch_add(1, Ordering::Relaxed);
+        let name = match std::thread::current().name() {
+            Some(n) => format!("{} ({})", n, id),
+            None => format!("Thread {}", id),
+        };
+        if let Some(t) = lock().as_mut() {
+            t.thread_names.insert(id, name);
+        }
+        id
+    };
+}
+
+/// A panic while writing leaves a usable tracer, ignore the poisoning.
+fn lock() -> MutexGuard<'static, Option<Tracer>> {
+    match TRACER.lock() {
+        Ok(g) => g,
+        Err(e) => e.into_inner(),
+    }
+}
+
+fn json_string(s: &str) -> String {
+    let mut r = String::with_capacity(s.len() + 2);
+    r.push('"');
+    for c in s.chars() {
+        match c {
+            '"' => r.push_str("\\\""),
+            '\\' => r.push_str("\\\\"),
+            c if (c as u32) < 0x20 => r.push_str(&format!("\\u{:04x}", c as u32)),
+            c => r.push(c),
+        }
+    }
+    r.push('"');
+    r
+}
+
+/// Timestamp in µs since the start of the trace as used by the trace event format.
+fn ts(t: Instant) -> String {
+    format!("{:.3}", t.saturating_duration_since(*EPOCH).as_nanos() as f64 / 1000.0)
+}
+
+extern "C" fn finish_at_exit() {
+    if let Err(e) = finish() {
+        warn!("{}", e);
+    }
+}
+
+/// Start writing a trace to `path`. Only one trace can be written at a time.
+pub fn start<P: AsRef<Path>>(path: P) -> Result<()> {
+    let path = path.as_ref().display().to_string();
+    let mut tracer = lock();
+    if let Some(t) = tracer.as_ref() {
+        return Err(Error::AlreadyTracing {
+            path: t.path.clone(),
+        });
+    }
+    let mut out = BufWriter::new(File::create(&path).context(TraceFileSnafu { path: &path })?);
+    out.write_all(b"[\n").context(TraceFileSnafu { path: &path })?;
+    Lazy::force(&EPOCH);
+
+    static AT_EXIT: std::sync::Once = std::sync::Once::new();
+    AT_EXIT.call_once(|| unsafe {
+        libc::atexit(finish_at_exit);
+    });
+
+    trace!("Writing trace to {}.", path);
+    *tracer = Some(Tracer {
+        path,
+        out,
+        events: 0,
+        processes: HashSet::new(),
+        tracks: HashSet::new(),
+        thread_names: HashMap::new(),
+    });
+    ENABLED.store(true, Ordering::Relaxed);
+    Ok(())
+}
+
+/// Start the trace configured by the `trace.file` setting unless a trace is written
+/// already. An empty setting disables tracing.
+pub(crate) fn start_configured(file: &str) -> Result<()> {
+    if file.is_empty() || lock().is_some() {
+        return Ok(());
+    }
+    start(file)
+}
+
+/// Complete and close the current trace. Does nothing if no trace is written.
+pub fn finish() -> Result<()> {
+    ENABLED.store(false, Ordering::Relaxed);
+    let tracer = lock().take();
+    if let Some(mut t) = tracer {
+        trace!("Finishing trace {} of {} events.", t.path, t.events);
+        t.out.write_all(b"\n]\n").context(TraceFileSnafu { path: &t.path })?;
+        t.out.flush().context(TraceFileSnafu { path: &t.path })?;
+    }
+    Ok(())
+}
+
+/// Write all buffered events to the trace file.
+pub fn flush() -> Result<()> {
+    if let Some(t) = lock().as_mut() {
+        t.out.flush().context(TraceFileSnafu { path: &t.path })?;
+    }
+    Ok(())
+}
+
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Current time if tracing is enabled.
+#[inline]
+pub(crate) fn timestamp() -> Option<Instant> {
+    if is_enabled() {
+        Some(Instant::now())
+    } else {
+        None
+    }
+}
+
+/// Identifier of the current thread in the trace.
+pub(crate) fn thread_id() -> u64 {
+    THREAD_ID.try_with(|t| *t).unwrap_or(0)
+}
+
+/// Identifier connecting the events of a flow.
+pub(crate) fn flow_id() -> u64 {
+    NEXT_FLOW.fetch_add(1, Ordering::Relaxed)
+}
+
+/// Record a slice from `begin` to `end` on `track`. `args` are the members of the JSON
+/// object shown with the slice.
+pub(crate) fn slice(track: Track, name: &str, begin: Instant, end: Instant, args: &str) {
+    let dur = end.saturating_duration_since(begin).as_nanos() as f64 / 1000.0;
+    if let Some(t) = lock().as_mut() {
+        t.event(
+            track,
+            &format!(
+                "\"ph\":\"X\",\"name\":\"{}\",\"ts\":{},\"dur\":{:.3},\"args\":{{{}}}",
+                name,
+                ts(begin),
+                dur,
+                args
+            ),
+        );
+    }
+}
+
+/// Step of a flow.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum FlowPhase {
+    Start,
+    Step,
+    End,
+}
+
+/// Connect the slice enclosing `at` on `track` to the flow `id`.
+pub(crate) fn flow(track: Track, name: &str, id: u64, phase: FlowPhase, at: Instant) {
+    let ph = match phase {
+        FlowPhase::Start => "\"ph\":\"s\"",
+        FlowPhase::Step => "\"ph\":\"t\"",
+        FlowPhase::End => "\"ph\":\"f\",\"bp\":\"e\"",
+    };
+    if let Some(t) = lock().as_mut() {
+        t.event(
+            track,
+            &format!(
+                "{},\"name\":\"{}\",\"cat\":\"job\",\"id\":{},\"ts\":{}",
+                ph,
+                name,
+                id,
+                ts(at)
+            ),
+        );
+    }
+}
+
+/// Record the wait for interrupt `id` on the track of the current thread.
+pub(crate) fn interrupt_wait(id: usize, begin: Instant) {
+    slice(
+        Track::Thread(thread_id()),
+        "wait for interrupt",
+        begin,
+        Instant::now(),
+        &format!("\"interrupt\":{}", id),
+    );
+}
+
+/// DMA engine recording its transfers on the DMA tracks of `device`.
+#[derive(Debug)]
+pub(crate) struct TracedDMA {
+    device: DeviceId,
+    dma: Box<dyn DMAControl + Sync + Send>,
+}
+
+impl TracedDMA {
+    pub(crate) fn new(
+        device: DeviceId,
+        dma: Box<dyn DMAControl + Sync + Send>,
+    ) -> Box<dyn DMAControl + Sync + Send> {
+        Box::new(TracedDMA { device, dma })
+    }
+
+    fn record(&self, to_device: bool, name: &str, len: usize, ptr: DeviceAddress, begin: Option<Instant>) {
+        if let Some(begin) = begin {
+            let track = Track::Dma {
+                device: self.device,
+                to_device,
+            };
+            let args = format!(
+                "\"bytes\":{},\"device_address\":\"0x{:x}\",\"thread\":{}",
+                len,
+                ptr,
+                thread_id()
+            );
+            slice(track, name, begin, Instant::now(), &args);
+        }
+    }
+}
+
+impl DMAControl for TracedDMA {
+    fn copy_to(&self, data: &[u8], ptr: DeviceAddress) -> crate::dma::Result<()> {
+        let begin = timestamp();
+        let r = self.dma.copy_to(data, ptr);
+        self.record(true, "copy to device", data.len(), ptr, begin);
+        r
+    }
+
+    fn copy_from(&self, ptr: DeviceAddress, data: &mut [u8]) -> crate::dma::Result<()> {
+        let begin = timestamp();
+        let r = self.dma.copy_from(ptr, data);
+        self.record(false, "copy from device", data.len(), ptr, begin);
+        r
+    }
+
+    fn h2c_stream(&self, data: &[u8]) -> crate::dma::Result<()> {
+        let begin = timestamp();
+        let r = self.dma.h2c_stream(data);
+        self.record(true, "stream to device", data.len(), 0, begin);
+        r
+    }
+
+    fn c2h_stream(&self, data: &mut [u8]) -> crate::dma::Result<()> {
+        let begin = timestamp();
+        let r = self.dma.c2h_stream(data);
+        self.record(false, "stream from device", data.len(), 0, begin);
+        r
+    }
+
+    fn register_host_memory(&self, ptr: *const u8, len: usize) -> crate::dma::Result<()> {
+        self.dma.register_host_memory(ptr, len)
+    }
+
+    fn unregister_host_memory(&self, ptr: *const u8) -> crate::dma::Result<()> {
+        self.dma.unregister_host_memory(ptr)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn strings_are_escaped() {
+        assert_eq!(json_string("a\"b\\c\n"), "\"a\\\"b\\\\c\\u000a\"");
+    }
+
+    #[test]
+    fn tracks_are_separated() {
+        let pe = Track::Pe {
+            device: 1,
+            pe: 3,
+            pe_type: 14,
+        };
+        let dma = Track::Dma {
+            device: 1,
+            to_device: false,
+        };
+        assert_eq!(pe.pid(), 2);
+        assert_eq!(dma.pid(), 2);
+        assert_ne!(pe.tid(), dma.tid());
+        assert_eq!(Track::Thread(3).pid(), HOST_PID);
+    }
+}
@@ -26,7 +26,7 @@ class SimInterrupt:
     """Represents the Interrupt coming from a specific PE
     """
 
-    def __init__(self, dut, interrupt_handle):
+    def __init__(self, dut, interrupt_handle, on_interrupt=None):
         """
         Parameters
         ----------
@@ -35,6 +35,8 @@ class SimInterrupt:
         interrup_handle: str
             Name of the interrupt port of the TaPaSCo design this
             instance represents
+        on_interrupt: callable, optional
+            Called without arguments after each counted interrupt
         """
         self._counter_lock = Lock()
         self._counter = 0
@@ -44,6 +46,7 @@ class SimInterrupt:
         self.should_exit = False
         self.exit_event = Event()
         self._interrupt_task = None
+        self._on_interrupt = on_interrupt
 
     def __del__(self):
         self.should_exit = True
@@ -72,12 +75,21 @@ class SimInterrupt:
         self._counter_lock.acquire()
         self._counter += 1
         self._counter_lock.release()
+        if self._on_interrupt is not None:
+            self._on_interrupt()
 
     def clear_interrupt(self):
         self._counter_lock.acquire()
         self._counter = 0
         self._counter_lock.release()
 
+    def take_interrupt_count(self):
+        self._counter_lock.acquire()
+        tmp = self._counter
+        self._counter = 0
+        self._counter_lock.release()
+        return tmp
+
     def get_interrupt_count(self):
         self._counter_lock.acquire()
         tmp = self._counter
@@ -18,10 +18,10 @@
 
 import itertools
 from sys import byteorder
-from threading import Event
+from threading import Event, Lock
 import SimInterrupt
 from io import BytesIO
-from grpc_gen import sim_calls_pb2_grpc as sc_grpc, sim_calls_pb2 as sc, status_core_pb2 as status_core
+from grpc_gen import sim_calls_pb2_grpc as sc_grpc, sim_calls_pb2 as sc, status_core_pb2 as status_core, read_write_pb2 as rw
 from SimInterrupt import SimInterrupt
 import cocotb
 import leb128
@@ -30,6 +30,10 @@ import queue
 from math import ceil
 import os
 
+# payload size of the chunks sent by read_memory_stream
+MEMORY_STREAM_CHUNK = 2 * 1024 * 1024
+
+
 def partition(l, size):
     it = iter(l)
     return iter(lambda: list(itertools.islice(it, size)), [])
@@ -54,6 +58,9 @@ class SimServer(sc_grpc.SimRequestServicer):
     """
     def __init__(self, dut, axim, memory):
         self.interrupts: dict[int, SimInterrupt] = dict()
+        # queues of the fds with new interrupts, one per subscribe_interrupts stream
+        self.subscribers: list[queue.Queue] = []
+        self.subscribers_lock = Lock()
 
         self.dut = dut
         self.request_queue = queue.Queue()
@@ -69,6 +76,11 @@ class SimServer(sc_grpc.SimRequestServicer):
         self.status_read_event = Event()
         self.request_queue.put((cocotb.create_task(self._get_status_init()), lambda: self.status_read_event.set()))
 
+    def _notify_interrupt(self, fd):
+        with self.subscribers_lock:
+            for subscriber in self.subscribers:
+                subscriber.put(fd)
+
     def _request_coroutine(self, func) -> Event:
         event = Event()
         self.request_queue.put((cocotb.create_task(func), lambda: event.set()))
@@ -111,10 +123,20 @@ class SimServer(sc_grpc.SimRequestServicer):
         await cocotb.triggers.ReadOnly()
         values.extend(self.memory[addr:addr+length])
 
+    async def _read_memory_bytes(self, addr, length, result):
+        await cocotb.triggers.ReadOnly()
+        result.append(bytes(self.memory[addr:addr+length]))
+
     async def _write_memory(self, addr, data):
         await cocotb.triggers.ReadOnly()
-        for i, value in enumerate(data):
-            self.memory[addr+i] = value.to_bytes(4, byteorder="little")[0]
+        self.memory[addr:addr+len(data)] = data
+
+    @staticmethod
+    def _write_memory_data(request):
+        """Returns the data of a WriteMemory request as bytes, independent of the encoding used by the client"""
+        if len(request.payload) > 0:
+            return request.payload
+        return bytes(value & 0xff for value in request.data)
 
     async def _read_platform(self, addr, read_platform_response, num_bytes):
         _bytes_left = num_bytes
@@ -176,11 +198,35 @@ class SimServer(sc_grpc.SimRequestServicer):
         event = Event()
         resp.void.SetInParent()
         self.request_queue.put(
-                (cocotb.create_task(self._write_memory(request.addr, request.data)), lambda: event.set()))
+                (cocotb.create_task(self._write_memory(request.addr, self._write_memory_data(request))), lambda: event.set()))
         if (not self.unsafe):
             event.wait()
         return resp
 
+    def write_memory_stream(self, request_iterator, context):
+        """Services a stream of write requests to the memory connected to the TaPaSCo design.
+        Used by the runtime for large transfers.
+
+        Parameters
+        ----------
+        request_iterator: iterator of grpc_gen.read_write_pb2.WriteMemory
+        context: ignored
+
+        Returns
+        -------
+        grpc_gen.sim_calls_pb2.SimResponse:
+            Response type Okay and response_payload grpc_gen.sim_calls_pb2.Void
+        """
+        resp = sc.SimResponse(type=sc.SimResponseType.Okay)
+        resp.void.SetInParent()
+        for request in request_iterator:
+            event = Event()
+            self.request_queue.put(
+                    (cocotb.create_task(self._write_memory(request.addr, self._write_memory_data(request))), lambda e=event: e.set()))
+            if (not self.unsafe):
+                event.wait()
+        return resp
+
     def read_memory(self, request, context):
         """Services a read request to the memory connected to the TaPaSCo design
 
@@ -198,10 +244,64 @@ class SimServer(sc_grpc.SimRequestServicer):
         resp = sc.SimResponse(type=sc.SimResponseType.Okay)
         resp.read_memory_response.SetInParent()
         event = Event()
-        self.request_queue.put(
-            (cocotb.create_task(self._read_memory(request.addr, request.length, resp.read_memory_response.value)), lambda: event.set())
-        )
-        event.wait()
+        if request.bytes_response:
+            result = []
+            self.request_queue.put(
+                (cocotb.create_task(self._read_memory_bytes(request.addr, request.length, result)), lambda: event.set())
+            )
+            event.wait()
+            resp.read_memory_response.payload = result[0]
+        else:
+            self.request_queue.put(
+                (cocotb.create_task(self._read_memory(request.addr, request.length, resp.read_memory_response.value)), lambda: event.set())
+            )
+            event.wait()
+        return resp
+
+    def read_memory_stream(self, request, context):
+        """Services a large read request to the memory connected to the TaPaSCo design
+        by streaming the data in chunks
+
+        Parameters
+        ----------
+        request: grpc_gen.read_write_pb2.ReadMemory
+        context: ignored
+
+        Yields
+        ------
+        grpc_gen.read_write_pb2.ReadMemoryResponse:
+            Consecutive chunks of the requested data in payload
+        """
+        offset = 0
+        while offset < request.length:
+            length = min(MEMORY_STREAM_CHUNK, request.length - offset)
+            result = []
+            event = Event()
+            self.request_queue.put(
+                (cocotb.create_task(self._read_memory_bytes(request.addr + offset, length, result)), lambda: event.set())
+            )
+            event.wait()
+            yield rw.ReadMemoryResponse(payload=result[0])
+            offset += length
+
+    def get_capabilities(self, request, context):
+        """Announces the optional features of this server to the runtime
+
+        Parameters
+        ----------
+        request: grpc_gen.sim_calls_pb2.Void
+        context: ignored
+
+        Returns
+        -------
+        grpc_gen.sim_calls_pb2.SimResponse:
+            Response type Okay and response_payload grpc_gen.sim_calls_pb2.Capabilities
+        """
+        resp = sc.SimResponse(type=sc.SimResponseType.Okay)
+        resp.capabilities.bytes_payload = True
+        resp.capabilities.memory_streams = True
+        resp.capabilities.interrupt_subscription = True
+        resp.capabilities.platform_batch = True
         return resp
 
     def read_platform(self, request, context):
@@ -248,6 +348,33 @@ class SimServer(sc_grpc.SimRequestServicer):
             event.wait()
         return resp
 
+    async def _write_platform_batch(self, writes):
+        for write in writes:
+            whichoneof = write.WhichOneof("data")
+            await self._write_platform(write.addr, getattr(write, whichoneof).value, whichoneof == "u_32")
+
+    def write_platform_batch(self, request, context):
+        """Services several writes to the platform memory with a single request. The writes
+        are applied in order, e.g. all arguments of a PE followed by its start.
+
+        Parameters
+        ----------
+        request: grpc_gen.read_write_pb2.WritePlatformBatch
+        context: ignored
+
+        Returns
+        -------
+        grpc_gen.sim_calls_pb2.SimResponse:
+            Response type Okay and response_payload grpc_gen.sim_calls_pb2.Void
+        """
+        resp = sc.SimResponse(type=sc.SimResponseType.Okay)
+        resp.void.SetInParent()
+        event = Event()
+        self.request_queue.put((cocotb.create_task(self._write_platform_batch(list(request.writes))), lambda: event.set()))
+        if (not self.unsafe):
+            event.wait()
+        return resp
+
     def register_interrupt(self, request, context):
         """Enalbes a specific interrupt to be tracked. The interrupt is identified by the number
         specified in the tapasco-status. The SimInterrupt instance corresponding to
@@ -266,7 +393,8 @@ class SimServer(sc_grpc.SimRequestServicer):
         if request.fd in self.interrupts.keys():
             self.interrupts[request.fd].deregister_interrupt()
 
-        self.interrupts[request.fd] = SimInterrupt(self.dut, f'ext_intr_PE_{request.interrupt_id}_0')
+        self.interrupts[request.fd] = SimInterrupt(self.dut, f'ext_intr_PE_{request.interrupt_id}_0',
+                                                   lambda fd=request.fd: self._notify_interrupt(fd))
         self.request_queue.put(
             (self.interrupts[request.fd].get_cocotb_task(), lambda: None))
 
@@ -326,8 +454,7 @@ class SimServer(sc_grpc.SimRequestServicer):
         resp = sc.SimResponse()
 
         if request.fd in self.interrupts.keys():
-            ints = self.interrupts[request.fd].get_interrupt_count()
-            self.interrupts[request.fd].clear_interrupt()
+            ints = self.interrupts[request.fd].take_interrupt_count()
             resp.type = sc.SimResponseType.Okay
             resp.interrupt_status.interrupts = ints
         else:
@@ -336,3 +463,41 @@ class SimServer(sc_grpc.SimRequestServicer):
 
         return resp
 
+    def subscribe_interrupts(self, request, context):
+        """Pushes the interrupts of all registered interrupts to the runtime as they occur.
+        Interrupts are taken from the same counters as in get_interrupt_status, so every
+        interrupt is reported exactly once by either of them. The stream ends when the
+        runtime cancels it.
+
+        Parameters
+        ----------
+        request: grpc_gen.sim_calls_pb2.Void
+        context: grpc.ServicerContext
+
+        Yields
+        ------
+        grpc_gen.sim_calls_pb2.InterruptEvent:
+            fd of the interrupt and the number of interrupts since its last report
+        """
+        events = queue.Queue()
+        context.add_callback(lambda: events.put(None))
+        with self.subscribers_lock:
+            self.subscribers.append(events)
+            # report interrupts counted before the subscription
+            for fd in list(self.interrupts.keys()):
+                events.put(fd)
+
+        try:
+            while True:
+                fd = events.get()
+                if fd is None:
+                    break
+                interrupt = self.interrupts.get(fd)
+                if interrupt is None:
+                    continue
+                ints = interrupt.take_interrupt_count()
+                if ints > 0:
+                    yield sc.InterruptEvent(fd=fd, interrupts=ints)
+        finally:
+            with self.subscribers_lock:
+                self.subscribers.remove(events)